@@ -3,7 +3,13 @@
 #include <QLoggingCategory>
 #include <QApplication>
 #include <QtGlobal>
+#include <QDebug>
+#include <QTimer>
 #include "mainwindow.h"
+#include "cantsmetrics.h"
+#include "cantsmetricsserver.h"
+#include "cantstrace.h"
+#include "cantstraceexport.h"
 
 int main(int argc, char *argv[])
 {
@@ -19,8 +25,44 @@ int main(int argc, char *argv[])
     QApplication a(argc, argv);
     a.setStyle("fusion");
 
+    // Binary trace is enabled with CANTS_TRACE=<dump file> and written on exit (as Chrome trace if file name ends with .json).
+    QByteArray trace_path = qgetenv("CANTS_TRACE");
+    sky::Trace::SetEnabled(!trace_path.isEmpty());
+
+    // Metrics are written to CANTS_METRICS=<file> every 10 s and served on CANTS_METRICS_SOCKET=<name>.
+    QString metrics_path = QString::fromLocal8Bit(qgetenv("CANTS_METRICS"));
+    QTimer metrics_timer;
+
+    if (!metrics_path.isEmpty()) {
+        QObject::connect(&metrics_timer, &QTimer::timeout, [&metrics_path]() {
+            sky::Metrics::Instance().WritePrometheus(metrics_path);
+        });
+        metrics_timer.start(10000);
+    }
+
+    sky::MetricsServer metrics_server;
+    QString metrics_socket = QString::fromLocal8Bit(qgetenv("CANTS_METRICS_SOCKET"));
+
+    if (!metrics_socket.isEmpty())
+        metrics_server.Listen(metrics_socket);
+
     MainWindow w;
     w.show();
 
-    return a.exec();
+    int ret = a.exec();
+
+    if (!metrics_path.isEmpty())
+        sky::Metrics::Instance().WritePrometheus(metrics_path);
+
+    if (trace_path.endsWith(".json")) {
+        std::vector<sky::TraceThread> threads;
+        sky::Trace::Snapshot(threads);
+
+        if (!sky::ChromeTraceExport::Write(threads, trace_path.toStdString()))
+            qCritical() << "Failed writing trace to" << trace_path;
+    } else if (!trace_path.isEmpty() && !sky::Trace::Dump(trace_path.toStdString())) {
+        qCritical() << "Failed writing trace to" << trace_path;
+    }
+
+    return ret;
 }
@@ -14,50 +14,62 @@ MainWindow::MainWindow(QWidget *parent) :
 {
     ui_->setupUi(this);
 
-    connect(&cants_, &sky::CAN_TS::SendTCCompleted, this, &MainWindow::cants_SendTCCompleted, Qt::QueuedConnection);
-    connect(&cants_, &sky::CAN_TS::ReceiveTMCompleted, this, &MainWindow::cants_ReceiveTMCompleted, Qt::QueuedConnection);
     connect(&cants_, &sky::CAN_TS::SendBlockCompleted, this, &MainWindow::cants_SendBlockCompleted, Qt::QueuedConnection);
     connect(&cants_, &sky::CAN_TS::ReceiveBlockCompleted, this, &MainWindow::cants_ReceiveBlockCompleted, Qt::QueuedConnection);
-    connect(&cants_, &sky::CAN_TS::SendTCFailed, this, &MainWindow::cants_SendTCFailed, Qt::QueuedConnection);
-    connect(&cants_, &sky::CAN_TS::ReceiveTMFailed, this, &MainWindow::cants_ReceiveTMFailed, Qt::QueuedConnection);
     connect(&cants_, &sky::CAN_TS::SendBlockFailed, this, &MainWindow::cants_SendBlockFailed, Qt::QueuedConnection);
     connect(&cants_, &sky::CAN_TS::ReceiveBlockFailed, this, &MainWindow::cants_ReceiveBlockFailed, Qt::QueuedConnection);
     connect(&cants_, &sky::CAN_TS::SendUnsolicitedFailed, this, &MainWindow::cants_SendUnsolicitedFailed, Qt::QueuedConnection);
     connect(&cants_, &sky::CAN_TS::SendTimeSyncFailed, this, &MainWindow::cants_SendTimeSyncFailed, Qt::QueuedConnection);
-}
+    connect(&cants_, &sky::CAN_TS::BusSwitched, this, &MainWindow::cants_BusSwitched, Qt::QueuedConnection);
 
-MainWindow::~MainWindow()
-{
-    delete ui_;
-}
+    // Automatic bus failover on keep alive silence is enabled with CANTS_FAILOVER=1 (buses are switched manually otherwise).
+    if (qgetenv("CANTS_FAILOVER") == "1") {
+        sky::CAN_TS::RedundancySettings redundancy;
+        redundancy.enabled = true;
+        cants_.SetRedundancy(redundancy);
+    }
 
-void MainWindow::cants_SendTCCompleted(uint8_t address, uint8_t channel)
-{
-    if ((address == nodeid_) && (channel == kLedTcTmCh)) {
-        if (!cants_.ReceiveTM(nodeid_, 0x00)) {
-            ledTcTmActive_ = false;
-            ui_->lblLedStatus->setText("Unknown");
-            QMessageBox::critical(this, "Error", "Can't receive CAN-TS telemetry.");
+    // Bus traffic (also between other nodes) is recorded with CANTS_CAPTURE=<capture path> (segments of 1M frames, last 64 kept).
+    QString capture_path = QString::fromLocal8Bit(qgetenv("CANTS_CAPTURE"));
+
+    if (!capture_path.isEmpty()) {
+        sky::CaptureWriter::Settings settings;
+        settings.max_segments = 64;
+
+        if (capture_.Open(capture_path, settings)) {
+            recorder_.Attach(cants_.GetTransport(sky::CAN_TS::CanBus::CAN0), 0);
+            recorder_.Attach(cants_.GetTransport(sky::CAN_TS::CanBus::CAN1), 1);
         }
     }
 }
 
-void MainWindow::cants_ReceiveTMCompleted(uint8_t address, uint8_t channel, const std::vector<uint8_t> &data)
+MainWindow::~MainWindow()
 {
-    if ((address == nodeid_) && (channel == kLedTcTmCh)) {
-        ledTcTmActive_ = false;
+    delete ui_;
+}
 
-        if (data.size() != 1) {
-            ui_->lblLedStatus->setText("Unknown");
-            QMessageBox::critical(this, "Error", "Invalid CAN-TS telemetry received. Check your firmware!");
-            return;
-        }
+void MainWindow::ledTcTm_finished(bool success, const std::vector<uint8_t>& data, sky::CAN_TS::ReceiveTMError error)
+{
+    if (!success) {
+        ui_->lblLedStatus->setText("Unknown");
 
-        if (data[0] & 0x01)
-            ui_->lblLedStatus->setText("LED On");
+        if (error == sky::CAN_TS::ReceiveTMError::kSendTCFailed)
+            QMessageBox::critical(this, "Error", "Failed sending CAN-TS telecommand.");
         else
-            ui_->lblLedStatus->setText("LED Off");
+            QMessageBox::critical(this, "Error", QString("Failed receiving CAN-TS telemetry (error code: %1)").arg(static_cast<int>(error)));
+        return;
     }
+
+    if (data.size() != 1) {
+        ui_->lblLedStatus->setText("Unknown");
+        QMessageBox::critical(this, "Error", "Invalid CAN-TS telemetry received. Check your firmware!");
+        return;
+    }
+
+    if (data[0] & 0x01)
+        ui_->lblLedStatus->setText("LED On");
+    else
+        ui_->lblLedStatus->setText("LED Off");
 }
 
 void MainWindow::cants_SendBlockCompleted(uint8_t address)
@@ -76,23 +88,6 @@ void MainWindow::cants_ReceiveBlockCompleted(uint8_t address, std::vector<uint8_
     }
 }
 
-void MainWindow::cants_SendTCFailed(uint8_t address, uint8_t channel, sky::CAN_TS::SendTCError error)
-{
-    if ((address == nodeid_) && (channel == kLedTcTmCh)) {
-        ledTcTmActive_ = false;
-        QMessageBox::critical(this, "Error", QString("Failed sending CAN-TS telecommand (error code: %1).").arg(static_cast<int>(error)));
-    }
-}
-
-void MainWindow::cants_ReceiveTMFailed(uint8_t address, uint8_t channel, sky::CAN_TS::ReceiveTMError error)
-{
-    if ((address == nodeid_) && (channel == kLedTcTmCh)) {
-        ledTcTmActive_ = false;
-        ui_->lblLedStatus->setText("Unknown");
-        QMessageBox::critical(this, "Error", QString("Failed receiving CAN-TS telemetry (error code: %1)").arg(static_cast<int>(error)));
-    }
-}
-
 void MainWindow::cants_SendBlockFailed(uint8_t address, sky::CAN_TS::SendBlockError error)
 {
     if (address == nodeid_) {
@@ -186,22 +181,28 @@ void MainWindow::on_btnClosePort_clicked()
 
 void MainWindow::on_btnLedOn_clicked()
 {
-    if (!ledTcTmActive_ && portOpened_) {
-
-        if (!cants_.SendTC(nodeid_, kLedTcTmCh, std::vector<uint8_t>({0x01}))) {
-            QMessageBox::critical(this, "Error", "Can't send CAN-TS telecommand.");
-            return;
-        }
-
-        ledTcTmActive_ = true;
-    }
+    SendLedTcTm(0x01);
 }
 
 void MainWindow::on_btnLedOff_clicked()
+{
+    SendLedTcTm(0x00);
+}
+
+void MainWindow::SendLedTcTm(uint8_t state)
 {
     if (!ledTcTmActive_ && portOpened_) {
 
-        if (!cants_.SendTC(nodeid_, kLedTcTmCh, std::vector<uint8_t>({0x00}))) {
+        // LED status is read back as soon as telecommand is acknowledged. Handler is invoked
+        // once however the transaction ends, result is shown from the event loop.
+        auto handler = [this] (bool success, const std::vector<uint8_t>& data, sky::CAN_TS::ReceiveTMError error) {
+            ledTcTmActive_ = false;
+            QMetaObject::invokeMethod(this, [this, success, data, error] () {
+                ledTcTm_finished(success, data, error);
+            }, Qt::QueuedConnection);
+        };
+
+        if (!cants_.SendTCReceiveTM(nodeid_, kLedTcTmCh, std::vector<uint8_t>({state}), handler)) {
             QMessageBox::critical(this, "Error", "Can't send CAN-TS telecommand.");
             return;
         }
@@ -311,8 +312,14 @@ void MainWindow::on_btnKeepAliveStop_clicked()
 void MainWindow::on_btnSwitchBus_clicked()
 {
     cants_.CanBusSwitch();
+}
+
+void MainWindow::cants_BusSwitched(sky::CAN_TS::CanBus bus)
+{
+    if (!portOpened_)
+        return;
 
-    if (cants_.GetActiveBus() == sky::CAN_TS::CanBus::CAN0) {
+    if (bus == sky::CAN_TS::CanBus::CAN0) {
         ui_->lblActiveBus->setText("Bus 0 (N)");
     } else {
         ui_->lblActiveBus->setText("Bus 1 (R)");
@@ -5,10 +5,12 @@
 
 #include <QMainWindow>
 #include <QDateTime>
+#include <QTimer>
 #include <cstdint>
 #include <vector>
 #include "commdriver.h"
 #include "can_ts.h"
+#include "cantscapture.h"
 
 namespace Ui
 {
@@ -26,19 +28,17 @@ public:
 
 private slots:
 
-    void cants_SendTCCompleted(uint8_t address, uint8_t channel);
-    void cants_ReceiveTMCompleted(uint8_t address, uint8_t channel, const std::vector<uint8_t>& data);
     void cants_SendBlockCompleted(uint8_t address);
     void cants_ReceiveBlockCompleted(uint8_t address, std::vector<uint8_t> data);
 
-    void cants_SendTCFailed(uint8_t address, uint8_t channel, sky::CAN_TS::SendTCError error);
-    void cants_ReceiveTMFailed(uint8_t address, uint8_t channel, sky::CAN_TS::ReceiveTMError error);
     void cants_SendBlockFailed(uint8_t address, sky::CAN_TS::SendBlockError error);
     void cants_ReceiveBlockFailed(uint8_t address, sky::CAN_TS::ReceiveBlockError error);
     void cants_SendUnsolicitedFailed(uint8_t address, uint8_t channel);
     void cants_SendTimeSyncFailed();
+    void cants_BusSwitched(sky::CAN_TS::CanBus bus);
 
     void keepAliveTmr_timeout();
+    void ledTcTm_finished(bool success, const std::vector<uint8_t>& data, sky::CAN_TS::ReceiveTMError error);
 
     void on_btnOpenPort_clicked();
     void on_btnClosePort_clicked();
@@ -56,8 +56,13 @@ private:
     static constexpr uint8_t kLedTcTmCh   = 0;
     static constexpr uint8_t kKeepAliveCh = 0;
 
+    //! Sets LED to \a state and reads it back (TC-TM transaction).
+    void SendLedTcTm(uint8_t state);
+
     Ui::MainWindow *ui_;
     sky::CAN_TS cants_;
+    sky::CaptureWriter capture_;
+    sky::CaptureRecorder recorder_{capture_};
     uint8_t nodeid_ = 0x00;
     QTimer keepAliveTmr_;
     bool portOpened_ = false;
@@ -0,0 +1,96 @@
+/* See the file "LICENSE.txt" for the full license governing this code. */
+
+#include "benchmark.h"
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+
+namespace
+{
+
+std::atomic<uint64_t> allocation_count{0};
+
+constexpr double kMinTime = 0.2; //!< Minimum measured time of a benchmark in seconds.
+constexpr uint64_t kMaxIterations = 1000000000; //!< Upper bound of iterations.
+
+std::vector<benchmark::Benchmark>& Registry()
+{
+    static std::vector<benchmark::Benchmark> benchmarks;
+    return benchmarks;
+}
+
+} // namespace
+
+void* operator new(std::size_t size)
+{
+    allocation_count.fetch_add(1, std::memory_order_relaxed);
+
+    if (void* p = std::malloc(size ? size : 1))
+        return p;
+
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept
+{
+    std::free(p);
+}
+
+namespace benchmark
+{
+
+uint64_t AllocationCount()
+{
+    return allocation_count.load(std::memory_order_relaxed);
+}
+
+int Register(const char* name, void (*function)(State&))
+{
+    Registry().push_back({name, function});
+    return static_cast<int>(Registry().size());
+}
+
+int RunBenchmarks(const std::string& filter)
+{
+    int count = 0;
+
+    std::printf("%-40s %14s %12s %14s\n", "Benchmark", "Time", "Iterations", "Allocs/op");
+    std::printf("%s\n", std::string(83, '-').c_str());
+
+    for (const auto& benchmark : Registry()) {
+        if (!filter.empty() && std::string(benchmark.name).find(filter) == std::string::npos)
+            continue;
+
+        uint64_t iterations = 1;
+
+        for (;;) {
+            State state(iterations);
+            benchmark.function(state);
+            state.Stop();
+
+            // Scale iterations to reach minimum time, like Google Benchmark.
+            if ((state.seconds() >= kMinTime) || (iterations >= kMaxIterations)) {
+                std::printf("%-40s %11.1f ns %12llu %14.2f\n", benchmark.name,
+                            state.seconds() * 1e9 / static_cast<double>(iterations),
+                            static_cast<unsigned long long>(iterations),
+                            static_cast<double>(state.allocations()) / static_cast<double>(iterations));
+                break;
+            }
+
+            double factor = (state.seconds() > 0) ? (kMinTime * 1.4 / state.seconds()) : 100.0;
+            factor = (factor > 100.0) ? 100.0 : ((factor < 2.0) ? 2.0 : factor);
+            iterations = static_cast<uint64_t>(static_cast<double>(iterations) * factor);
+        }
+
+        count++;
+    }
+
+    return count;
+}
+
+} // namespace benchmark
@@ -0,0 +1,114 @@
+/* See the file "LICENSE.txt" for the full license governing this code. */
+
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+// Minimal benchmark harness with Google Benchmark style interface:
+//
+//     static void BM_Name(benchmark::State& state) {
+//         for (auto _ : state)
+//             benchmark::DoNotOptimize(Work());
+//     }
+//     BENCHMARK(BM_Name);
+//
+// Each benchmark is run with growing iteration count until it runs for at
+// least kMinTime, then time and heap allocations per iteration are reported.
+// Allocations are counted by replacement of global operator new (benchmark.cpp).
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace benchmark
+{
+
+//! Number of heap allocations made by the process so far.
+uint64_t AllocationCount();
+
+//! Prevents compiler from optimizing away computation of \a value.
+template <typename T>
+inline void DoNotOptimize(const T& value)
+{
+#if defined(__GNUC__)
+    asm volatile("" : : "r,m"(value) : "memory");
+#else
+    static volatile const void* sink;
+    sink = &value;
+#endif
+}
+
+//! Iteration state of one benchmark run, iterated with range-based for loop.
+class State {
+public:
+    //! Loop variable of benchmark loop, non-trivial so that unused variable is not reported.
+    struct Value {
+        Value() {}
+        ~Value() {}
+    };
+
+    //! Iterator counting remaining iterations.
+    class Iterator {
+    public:
+        explicit Iterator(uint64_t remaining) : remaining_(remaining) {}
+        bool operator!=(const Iterator&) const { return remaining_ != 0; }
+        void operator++() { remaining_--; }
+        Value operator*() const { return Value(); }
+
+    private:
+        uint64_t remaining_;
+    };
+
+    explicit State(uint64_t iterations) : iterations_(iterations) {}
+
+    Iterator begin() {
+        start_allocations_ = AllocationCount();
+        start_ = std::chrono::steady_clock::now();
+        return Iterator(iterations_);
+    }
+
+    Iterator end() {
+        return Iterator(0);
+    }
+
+    //! Stops time measurement, called by harness after loop.
+    void Stop() {
+        elapsed_ = std::chrono::steady_clock::now() - start_;
+        allocations_ = AllocationCount() - start_allocations_;
+    }
+
+    uint64_t iterations() const { return iterations_; }
+    double seconds() const { return std::chrono::duration<double>(elapsed_).count(); }
+    uint64_t allocations() const { return allocations_; }
+
+private:
+    uint64_t iterations_;
+    uint64_t start_allocations_ = 0;
+    uint64_t allocations_ = 0;
+    std::chrono::steady_clock::time_point start_;
+    std::chrono::steady_clock::duration elapsed_ {};
+};
+
+//! Registered benchmark.
+struct Benchmark {
+    const char* name;
+    void (*function)(State&);
+};
+
+//! Registers \a function under \a name, returns registration index.
+int Register(const char* name, void (*function)(State&));
+
+//! Runs benchmarks whose name contains \a filter and prints results. Returns number of benchmarks run.
+int RunBenchmarks(const std::string& filter);
+
+} // namespace benchmark
+
+#define BENCHMARK_CONCAT_(a, b) a##b
+#define BENCHMARK_CONCAT(a, b) BENCHMARK_CONCAT_(a, b)
+
+//! Registers benchmark \a function.
+#define BENCHMARK(function) \
+    static int BENCHMARK_CONCAT(benchmark_registration_, __LINE__) = benchmark::Register(#function, function)
+
+#endif // BENCHMARK_H
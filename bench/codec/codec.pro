@@ -0,0 +1,28 @@
+# See the file "LICENSE.txt" for the full license governing this code.
+#
+# Microbenchmarks of per-frame code paths. Build in release mode:
+#
+#     qmake CONFIG+=release bench/codec/codec.pro && make && ./codecbench [filter]
+
+QT += core serialport network
+QT -= gui
+
+TARGET = codecbench
+TEMPLATE = app
+
+DEFINES += QT_DEPRECATED_WARNINGS
+DEFINES += QT_USE_QSTRINGBUILDER
+DEFINES += QT_NO_DEBUG_OUTPUT
+DEFINES += QT_NO_INFO_OUTPUT
+
+CONFIG += c++14 strict_c++ warn_on console
+CONFIG -= app_bundle
+
+include(../../cants.pri)
+
+SOURCES += \
+        main.cpp \
+        benchmark.cpp
+
+HEADERS += \
+        benchmark.h
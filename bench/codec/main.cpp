@@ -0,0 +1,283 @@
+/* See the file "LICENSE.txt" for the full license governing this code. */
+
+// Microbenchmarks of code running per CAN frame.
+//
+// Usage: codecbench [filter]
+//
+// Only benchmarks whose name contains filter are run.
+
+#include <algorithm>
+#include <cstdio>
+#include "benchmark.h"
+#include "can_ts.h"
+#include "canframe.h"
+#include "cantsanalyzer.h"
+#include "cantsframe.h"
+#include "cantsutils.h"
+#include "skyslip.h"
+
+namespace
+{
+
+//! CAN TS frame with full 8 byte payload without SLIP special bytes.
+sky::CanFrame RealisticFrame()
+{
+    sky::CanTsFrame frame = sky::CanTsFrame::CreateSetBlockTransfer(0x12, 0x01, 5, {0x10, 0x32, 0x54, 0x76, 0x98, 0xBA, 0x0E, 0xF0});
+    return sky::CAN_TS::ToCanFrame(frame);
+}
+
+//! Frame whose serialized bytes are all SLIP_END or SLIP_ESC, so every byte is escaped.
+std::vector<uint8_t> EscapeHeavyPayload()
+{
+    return std::vector<uint8_t>(13, 0xC0);
+}
+
+const std::vector<uint8_t> kData8 = {0x10, 0x32, 0x54, 0x76, 0x98, 0xBA, 0x0E, 0xF0};
+const std::vector<uint8_t> kAddress = {0x00, 0x10, 0x00, 0x20};
+
+void BM_SlipEncode(benchmark::State& state)
+{
+    sky::SkySlip slip;
+    std::vector<uint8_t> payload = RealisticFrame().ToStdVector();
+
+    for (auto _ : state)
+        benchmark::DoNotOptimize(slip.Encode(sky::SkySlip::SendCan0, payload));
+}
+BENCHMARK(BM_SlipEncode);
+
+void BM_SlipEncodeEscapeHeavy(benchmark::State& state)
+{
+    sky::SkySlip slip;
+    std::vector<uint8_t> payload = EscapeHeavyPayload();
+
+    for (auto _ : state)
+        benchmark::DoNotOptimize(slip.Encode(sky::SkySlip::SendCan0, payload));
+}
+BENCHMARK(BM_SlipEncodeEscapeHeavy);
+
+void BM_SlipDecode(benchmark::State& state)
+{
+    sky::SkySlip slip;
+    std::vector<uint8_t> encoded = slip.Encode(sky::SkySlip::SendCan0, RealisticFrame().ToStdVector());
+    uint64_t frames = 0;
+
+    QObject::connect(&slip, &sky::SkySlip::FrameReceived, [&frames](const sky::SkySlip::Frame&) { frames++; });
+
+    for (auto _ : state)
+        slip.Decode(encoded);
+
+    benchmark::DoNotOptimize(frames);
+}
+BENCHMARK(BM_SlipDecode);
+
+void BM_SlipDecodeEscapeHeavy(benchmark::State& state)
+{
+    sky::SkySlip slip;
+    std::vector<uint8_t> encoded = slip.Encode(sky::SkySlip::SendCan0, EscapeHeavyPayload());
+    uint64_t frames = 0;
+
+    QObject::connect(&slip, &sky::SkySlip::FrameReceived, [&frames](const sky::SkySlip::Frame&) { frames++; });
+
+    for (auto _ : state)
+        slip.Decode(encoded);
+
+    benchmark::DoNotOptimize(frames);
+}
+BENCHMARK(BM_SlipDecodeEscapeHeavy);
+
+void BM_CanFrameToStdVector(benchmark::State& state)
+{
+    sky::CanFrame frame = RealisticFrame();
+
+    for (auto _ : state)
+        benchmark::DoNotOptimize(frame.ToStdVector());
+}
+BENCHMARK(BM_CanFrameToStdVector);
+
+void BM_CanFrameFromStdVector(benchmark::State& state)
+{
+    std::vector<uint8_t> bytes = RealisticFrame().ToStdVector();
+
+    for (auto _ : state)
+        benchmark::DoNotOptimize(sky::CanFrame::FromStdVector(bytes));
+}
+BENCHMARK(BM_CanFrameFromStdVector);
+
+void BM_ToCanFrame(benchmark::State& state)
+{
+    sky::CanTsFrame frame = sky::CanTsFrame::CreateSetBlockTransfer(0x12, 0x01, 5, kData8);
+
+    for (auto _ : state)
+        benchmark::DoNotOptimize(sky::CAN_TS::ToCanFrame(frame));
+}
+BENCHMARK(BM_ToCanFrame);
+
+void BM_FromCanFrame(benchmark::State& state)
+{
+    sky::CanFrame frame = RealisticFrame();
+
+    for (auto _ : state)
+        benchmark::DoNotOptimize(sky::CAN_TS::FromCanFrame(frame));
+}
+BENCHMARK(BM_FromCanFrame);
+
+void BM_CreateTelecommand(benchmark::State& state)
+{
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(sky::CanTsFrame::CreateTelecommandRequest(0x12, 0x01, 3, kData8));
+        benchmark::DoNotOptimize(sky::CanTsFrame::CreateTelecommandAck(0x01, 0x12, 3));
+        benchmark::DoNotOptimize(sky::CanTsFrame::CreateTelecommandNack(0x01, 0x12, 3));
+    }
+}
+BENCHMARK(BM_CreateTelecommand);
+
+void BM_CreateTelemetry(benchmark::State& state)
+{
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(sky::CanTsFrame::CreateTelemetryRequest(0x12, 0x01, 3));
+        benchmark::DoNotOptimize(sky::CanTsFrame::CreateTelemetryAck(0x01, 0x12, 3, kData8));
+        benchmark::DoNotOptimize(sky::CanTsFrame::CreateTelemetryNack(0x01, 0x12, 3));
+    }
+}
+BENCHMARK(BM_CreateTelemetry);
+
+void BM_CreateSetBlock(benchmark::State& state)
+{
+    std::vector<uint8_t> bitmap = {0xFF, 0x0F};
+
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(sky::CanTsFrame::CreateSetBlockRequest(0x12, 0x01, 12, kAddress));
+        benchmark::DoNotOptimize(sky::CanTsFrame::CreateSetBlockAck(0x01, 0x12, 12, kAddress));
+        benchmark::DoNotOptimize(sky::CanTsFrame::CreateSetBlockNack(0x01, 0x12));
+        benchmark::DoNotOptimize(sky::CanTsFrame::CreateSetBlockTransfer(0x12, 0x01, 5, kData8));
+        benchmark::DoNotOptimize(sky::CanTsFrame::CreateSetBlockAbort(0x12, 0x01));
+        benchmark::DoNotOptimize(sky::CanTsFrame::CreateSetBlockStatus(0x12, 0x01));
+        benchmark::DoNotOptimize(sky::CanTsFrame::CreateSetBlockReport(0x01, 0x12, false, bitmap));
+    }
+}
+BENCHMARK(BM_CreateSetBlock);
+
+void BM_CreateGetBlock(benchmark::State& state)
+{
+    std::vector<uint8_t> bitmap = {0xFF, 0x0F};
+
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(sky::CanTsFrame::CreateGetBlockRequest(0x12, 0x01, 12, kAddress));
+        benchmark::DoNotOptimize(sky::CanTsFrame::CreateGetBlockAck(0x01, 0x12, 12, kAddress));
+        benchmark::DoNotOptimize(sky::CanTsFrame::CreateGetBlockNack(0x01, 0x12));
+        benchmark::DoNotOptimize(sky::CanTsFrame::CreateGetBlockStart(0x12, 0x01, bitmap));
+        benchmark::DoNotOptimize(sky::CanTsFrame::CreateGetBlockTransfer(0x01, 0x12, 5, kData8));
+        benchmark::DoNotOptimize(sky::CanTsFrame::CreateGetBlockAbort(0x12, 0x01));
+    }
+}
+BENCHMARK(BM_CreateGetBlock);
+
+void BM_CreateUnsolicitedTimeSync(benchmark::State& state)
+{
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(sky::CanTsFrame::CreateUnsolicited(0x01, 0x12, 3, kData8));
+        benchmark::DoNotOptimize(sky::CanTsFrame::CreateTimeSync(0x01, {0, 0, 0, 1, 0, 0}));
+    }
+}
+BENCHMARK(BM_CreateUnsolicitedTimeSync);
+
+void BM_BitmapSetAndCheck(benchmark::State& state)
+{
+    const uint8_t blocks = 200;
+    std::vector<uint8_t> bitmap(sky::CanTsUtils::GetBitmapNumBytes(blocks));
+
+    for (auto _ : state) {
+        std::fill(bitmap.begin(), bitmap.end(), 0);
+
+        for (uint8_t i = 0; i < blocks; i++)
+            sky::CanTsUtils::SetBitmapBit(bitmap, i);
+
+        benchmark::DoNotOptimize(sky::CanTsUtils::IsBitmapSet(bitmap, blocks));
+    }
+}
+BENCHMARK(BM_BitmapSetAndCheck);
+
+void BM_BitmapQueries(benchmark::State& state)
+{
+    const uint8_t blocks = 200;
+    std::vector<uint8_t> bitmap(sky::CanTsUtils::GetBitmapNumBytes(blocks));
+    sky::CanTsUtils::SetBitmap(bitmap, blocks);
+    sky::CanTsUtils::ClearBitmapBit(bitmap, 150);
+
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(sky::CanTsUtils::IsBitmapValid(bitmap, blocks));
+        benchmark::DoNotOptimize(sky::CanTsUtils::IsBitmapSet(bitmap, blocks));
+        benchmark::DoNotOptimize(sky::CanTsUtils::IsBitmapCleared(bitmap, blocks));
+        benchmark::DoNotOptimize(sky::CanTsUtils::IsBitmapBitSet(bitmap, 150));
+    }
+}
+BENCHMARK(BM_BitmapQueries);
+
+//! Frames of complete TC, TM, set block and get block transfers (4 blocks each) between \a nodes node pairs.
+std::vector<sky::CanTsFrame> AnalyzerTraffic(uint8_t nodes)
+{
+    using sky::CanTsFrame;
+    std::vector<CanTsFrame> frames;
+    std::vector<uint8_t> bitmap = {0x0F};
+
+    for (uint8_t i = 0; i < nodes; i++) {
+        uint8_t client = 0x01;
+        uint8_t node = static_cast<uint8_t>(0x10 + i);
+
+        frames.push_back(CanTsFrame::CreateTelecommandRequest(node, client, 3, kData8));
+        frames.push_back(CanTsFrame::CreateTelecommandAck(client, node, 3));
+        frames.push_back(CanTsFrame::CreateTelemetryRequest(node, client, 3));
+        frames.push_back(CanTsFrame::CreateTelemetryAck(client, node, 3, kData8));
+
+        frames.push_back(CanTsFrame::CreateSetBlockRequest(node, client, 3, kAddress));
+        frames.push_back(CanTsFrame::CreateSetBlockAck(client, node, 3, kAddress));
+        for (uint8_t sequence = 0; sequence < 4; sequence++)
+            frames.push_back(CanTsFrame::CreateSetBlockTransfer(node, client, sequence, kData8));
+        frames.push_back(CanTsFrame::CreateSetBlockStatus(node, client));
+        frames.push_back(CanTsFrame::CreateSetBlockReport(client, node, true, bitmap));
+        frames.push_back(CanTsFrame::CreateSetBlockAbort(node, client));
+        frames.push_back(CanTsFrame::CreateSetBlockAck(client, node, 0, {}));
+
+        frames.push_back(CanTsFrame::CreateGetBlockRequest(node, client, 3, kAddress));
+        frames.push_back(CanTsFrame::CreateGetBlockAck(client, node, 3, kAddress));
+        frames.push_back(CanTsFrame::CreateGetBlockStart(node, client, bitmap));
+        for (uint8_t sequence = 0; sequence < 4; sequence++)
+            frames.push_back(CanTsFrame::CreateGetBlockTransfer(client, node, sequence, kData8));
+        frames.push_back(CanTsFrame::CreateGetBlockAbort(node, client));
+        frames.push_back(CanTsFrame::CreateGetBlockAck(client, node, 0, {}));
+    }
+
+    return frames;
+}
+
+// Time per analyzed frame, a fully loaded 1 Mbit/s bus carries a frame about every 130 usec.
+void BM_AnalyzerProcess(benchmark::State& state)
+{
+    std::vector<sky::CanTsFrame> frames = AnalyzerTraffic(16);
+    sky::BusAnalyzer analyzer;
+    uint64_t timestamp = 1;
+    size_t index = 0;
+
+    for (auto _ : state) {
+        analyzer.Process(frames[index], timestamp);
+        timestamp += 130000;
+
+        if (++index == frames.size())
+            index = 0;
+    }
+
+    benchmark::DoNotOptimize(analyzer.GetStats());
+}
+BENCHMARK(BM_AnalyzerProcess);
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+    if (argc > 2) {
+        std::fprintf(stderr, "Usage: %s [filter]\n", argv[0]);
+        return 2;
+    }
+
+    return benchmark::RunBenchmarks((argc == 2) ? argv[1] : "") ? 0 : 1;
+}
@@ -0,0 +1,187 @@
+/* See the file "LICENSE.txt" for the full license governing this code. */
+
+#include "workload.h"
+#include <QFile>
+#include <QJsonDocument>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+namespace bench
+{
+
+const char* const kKindNames[kKindCount] = {"telecommand", "telemetry", "set_block", "get_block"};
+const char* const kKindKeys[kKindCount] = {"tc", "tm", "sb", "gb"};
+
+const uint8_t kKindTypes[kKindCount] = {
+    sky::CanTsFrame::TransferType::TELECOMMAND, sky::CanTsFrame::TransferType::TELEMETRY,
+    sky::CanTsFrame::TransferType::SET_BLOCK, sky::CanTsFrame::TransferType::GET_BLOCK
+};
+
+bool ParseMix(const std::string& text, Options& options)
+{
+    std::fill(std::begin(options.weights), std::end(options.weights), 0.0);
+    size_t pos = 0;
+
+    while (pos < text.size()) {
+        size_t end = text.find(',', pos);
+        std::string item = text.substr(pos, (end == std::string::npos) ? std::string::npos : end - pos);
+        size_t eq = item.find('=');
+        int kind = -1;
+
+        for (int i = 0; i < kKindCount; i++) {
+            if (item.compare(0, eq, kKindKeys[i]) == 0)
+                kind = i;
+        }
+
+        if ((eq == std::string::npos) || (kind < 0))
+            return false;
+
+        options.weights[kind] = std::atof(item.c_str() + eq + 1);
+        pos = (end == std::string::npos) ? text.size() : end + 1;
+    }
+
+    options.mix = text;
+    return std::any_of(std::begin(options.weights), std::end(options.weights), [](double w) { return w > 0; });
+}
+
+bool ParseOptions(int argc, char* argv[], Options& options, const OptionParser& parser)
+{
+    for (int i = 1; i < argc; i++) {
+        if (i + 1 >= argc)
+            return false;
+
+        const char* name = argv[i];
+        const char* value = argv[++i];
+
+        if (!std::strcmp(name, "--nodes"))
+            options.nodes = static_cast<uint32_t>(std::strtoul(value, nullptr, 0));
+        else if (!std::strcmp(name, "--mix")) {
+            if (!ParseMix(value, options))
+                return false;
+        } else if (!std::strcmp(name, "--block-size"))
+            options.block_size = static_cast<uint32_t>(std::strtoul(value, nullptr, 0));
+        else if (!std::strcmp(name, "--timeout"))
+            options.timeout_ms = static_cast<uint32_t>(std::strtoul(value, nullptr, 0));
+        else if (!std::strcmp(name, "--report-delay"))
+            options.report_delay_ms = static_cast<uint32_t>(std::strtoul(value, nullptr, 0));
+        else if (!std::strcmp(name, "--seed"))
+            options.seed = static_cast<uint32_t>(std::strtoul(value, nullptr, 0));
+        else if (!std::strcmp(name, "--output"))
+            options.output = value;
+        else if (!parser(name, value))
+            return false;
+    }
+
+    // Block transfers carry 1 to 64 blocks of 8 bytes.
+    return (options.nodes >= 1) && (options.nodes <= 200) &&
+           (options.block_size >= 8) && (options.block_size <= 512) && (options.block_size % 8 == 0);
+}
+
+std::vector<uint8_t> BlockData(const Options& options)
+{
+    std::vector<uint8_t> block(options.block_size);
+
+    for (size_t i = 0; i < block.size(); i++)
+        block[i] = static_cast<uint8_t>(i);
+
+    return block;
+}
+
+bool StartTransfer(sky::CAN_TS& cants, int kind, uint8_t address, const std::vector<uint8_t>& block,
+                   const Options& options, const std::function<void(bool success)>& done)
+{
+    switch (kind) {
+    case kTelecommand:
+        return cants.SendTC(address, 0, {0x01, 0x02, 0x03, 0x04}, 3,
+                            [done](bool success, sky::CAN_TS::SendTCError) { done(success); });
+    case kTelemetry:
+        return cants.ReceiveTM(address, 0, 3, 0,
+                               [done](bool success, const std::vector<uint8_t>&, sky::CAN_TS::ReceiveTMError) { done(success); });
+    case kSetBlock:
+        return cants.SendBlock(address, kBlockAddress, block, 3, options.report_delay_ms, 3,
+                               [done](bool success, sky::CAN_TS::SendBlockError) { done(success); });
+    case kGetBlock:
+        return cants.ReceiveBlock(address, kBlockAddress, static_cast<uint8_t>(options.block_size / 8), 3, 3,
+                                  [done](bool success, const std::vector<uint8_t>&, sky::CAN_TS::ReceiveBlockError) { done(success); });
+    default:
+        return false;
+    }
+}
+
+bool HostNodes(sky::CAN_TS& nodes, const sky::CAN_TS::Transport& transport, const Options& options)
+{
+    if (!nodes.Start(kNodesAddress, options.timeout_ms, transport))
+        return false;
+
+    for (uint32_t i = 0; i < options.nodes; i++) {
+        auto address = static_cast<uint8_t>(kFirstNodeAddress + i);
+        nodes.AddNode(address);
+        nodes.SetTCHandler(address, 0, [](uint8_t, uint8_t, uint8_t, const std::vector<uint8_t>&) { return true; });
+        nodes.SetTMHandler(address, 0, [](uint8_t, uint8_t, uint8_t, std::vector<uint8_t>& data) {
+            data.assign(8, 0x55);
+            return true;
+        });
+    }
+
+    return true;
+}
+
+double Percentile(const std::vector<uint64_t>& values, double q)
+{
+    if (values.empty())
+        return 0.0;
+
+    auto rank = static_cast<size_t>(std::ceil(q * static_cast<double>(values.size())));
+    return static_cast<double>(values[std::min(std::max<size_t>(rank, 1), values.size()) - 1]) / 1000.0;
+}
+
+QJsonObject Config(const Options& options)
+{
+    QJsonObject config;
+    config["nodes"] = static_cast<int>(options.nodes);
+    config["mix"] = QString::fromStdString(options.mix);
+    config["block_size"] = static_cast<int>(options.block_size);
+    config["timeout_ms"] = static_cast<int>(options.timeout_ms);
+    config["report_delay_ms"] = static_cast<int>(options.report_delay_ms);
+    config["seed"] = static_cast<int>(options.seed);
+    return config;
+}
+
+QJsonObject Report(const Stats& stats)
+{
+    std::vector<uint64_t> latency_ns = stats.latency_ns;
+    std::sort(latency_ns.begin(), latency_ns.end());
+
+    QJsonObject latency;
+    latency["p50"] = Percentile(latency_ns, 0.5);
+    latency["p99"] = Percentile(latency_ns, 0.99);
+    latency["p999"] = Percentile(latency_ns, 0.999);
+    latency["max"] = Percentile(latency_ns, 1.0);
+
+    QJsonObject type;
+    type["completed"] = static_cast<double>(latency_ns.size());
+    type["failed"] = static_cast<double>(stats.failed);
+    type["latency_us"] = latency;
+    return type;
+}
+
+bool WriteResult(const QJsonObject& result, const std::string& output)
+{
+    QByteArray json = QJsonDocument(result).toJson(QJsonDocument::Indented);
+
+    if (output.empty())
+        return std::fwrite(json.constData(), 1, static_cast<size_t>(json.size()), stdout) == static_cast<size_t>(json.size());
+
+    QFile file(QString::fromStdString(output));
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate) || (file.write(json) != json.size())) {
+        std::fprintf(stderr, "Cannot write %s\n", output.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+} // namespace bench
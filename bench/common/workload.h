@@ -0,0 +1,91 @@
+/* See the file "LICENSE.txt" for the full license governing this code. */
+
+#ifndef WORKLOAD_H
+#define WORKLOAD_H
+
+// Transfer workload shared by end-to-end benchmarks (bench/loopback, bench/simbus):
+// common options, transfer mix, nodes hosted by second CAN_TS and latency report.
+
+#include <QJsonObject>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+#include "can_ts.h"
+
+namespace bench
+{
+
+enum TransferKind { kTelecommand, kTelemetry, kSetBlock, kGetBlock, kKindCount };
+
+extern const char* const kKindNames[kKindCount]; //!< Transfer kind names in result JSON.
+extern const char* const kKindKeys[kKindCount]; //!< Transfer kind keys of --mix.
+extern const uint8_t kKindTypes[kKindCount]; //!< Bus transfer type of transfer kind.
+
+constexpr uint8_t kClientAddress = 0x02; //!< Address of client stack.
+constexpr uint8_t kNodesAddress = 0x01; //!< Address of stack hosting the nodes.
+constexpr uint8_t kFirstNodeAddress = 0x20; //!< Address of first hosted node.
+constexpr uint64_t kBlockAddress = 0x1000; //!< Memory address of block transfers.
+
+//! Options common to workload benchmarks.
+struct Options {
+    uint32_t nodes = 4;
+    double weights[kKindCount] = {4, 4, 1, 1};
+    std::string mix = "tc=4,tm=4,sb=1,gb=1";
+    uint32_t block_size = 64;
+    uint32_t timeout_ms = 50;
+    uint32_t report_delay_ms = 0;
+    uint32_t seed = 1;
+    std::string output;
+};
+
+//! Results of one transfer kind (counters not measured by a benchmark stay 0).
+struct Stats {
+    std::vector<uint64_t> latency_ns; //!< Latency of completed transfers.
+    uint64_t failed = 0; //!< Failed or rejected transfers.
+    uint64_t overruns = 0; //!< Transfers skipped because previous transfer of the node was active.
+    uint64_t frames = 0; //!< Frames of the transfer type on bus (both directions).
+    uint64_t bytes = 0; //!< Payload bytes of the transfer type on bus.
+};
+
+//! Parses option \a name of benchmark with \a value. Returns false if option is unknown or invalid.
+using OptionParser = std::function<bool(const char* name, const char* value)>;
+
+//! Parses transfer mix \a text ("tc=4,tm=4,sb=1,gb=1") into \a options.
+bool ParseMix(const std::string& text, Options& options);
+
+//! Parses command line into common \a options, other options are passed to \a parser.
+bool ParseOptions(int argc, char* argv[], Options& options, const OptionParser& parser);
+
+//! Returns data of block transfers of \a options.
+std::vector<uint8_t> BlockData(const Options& options);
+
+//! Starts transfer of \a kind to node \a address, \a done is called when it finishes.
+/*!
+    Returns false if transfer was rejected (\a done is not called).
+*/
+bool StartTransfer(sky::CAN_TS& cants, int kind, uint8_t address, const std::vector<uint8_t>& block,
+                   const Options& options, const std::function<void(bool success)>& done);
+
+//! Starts \a nodes stack on \a transport and hosts options.nodes nodes.
+/*!
+    Nodes answer telecommands with ACK and telemetry requests with 8 bytes,
+    block transfers use node memory.
+*/
+bool HostNodes(sky::CAN_TS& nodes, const sky::CAN_TS::Transport& transport, const Options& options);
+
+//! Returns \a q quantile of sorted \a values in microseconds (nearest rank).
+double Percentile(const std::vector<uint64_t>& values, double q);
+
+//! Returns common \a options as result config.
+QJsonObject Config(const Options& options);
+
+//! Returns completed and failed count and latency percentiles of \a stats.
+QJsonObject Report(const Stats& stats);
+
+//! Writes \a result to \a output file (stdout if empty). Returns false on failure.
+bool WriteResult(const QJsonObject& result, const std::string& output);
+
+} // namespace bench
+
+#endif // WORKLOAD_H
@@ -0,0 +1,278 @@
+/* See the file "LICENSE.txt" for the full license governing this code. */
+
+// End-to-end benchmark of CAN_TS against nodes hosted by second CAN_TS on loopback bus.
+//
+// Usage: loopbackbench [--nodes N] [--mix tc=4,tm=4,sb=1,gb=1] [--loss P]
+//                      [--transfers N] [--block-size BYTES] [--timeout MS]
+//                      [--report-delay MS] [--seed N] [--output FILE]
+//                      [--baseline FILE] [--tolerance FRACTION]
+//
+// Every node has one transfer in flight, next transfer type is drawn from
+// the mix when previous transfer finishes. Result is JSON with latency
+// percentiles and bus throughput per transfer type. With --baseline, p50 and
+// p99 latency and frame rate are compared against earlier result and the exit
+// code is 1 if any of them is worse by more than tolerance.
+
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QTimer>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+#include "can_ts.h"
+#include "cantstrace.h"
+#include "loopbackbus.h"
+#include "workload.h"
+
+namespace
+{
+
+struct Options : bench::Options {
+    double loss = 0.0;
+    uint32_t transfers = 10000;
+    std::string baseline;
+    double tolerance = 0.1;
+};
+
+bool ParseOptions(int argc, char* argv[], Options& options)
+{
+    bool ok = bench::ParseOptions(argc, argv, options, [&options](const char* name, const char* value) {
+        if (!std::strcmp(name, "--loss"))
+            options.loss = std::atof(value);
+        else if (!std::strcmp(name, "--transfers"))
+            options.transfers = static_cast<uint32_t>(std::strtoul(value, nullptr, 0));
+        else if (!std::strcmp(name, "--baseline"))
+            options.baseline = value;
+        else if (!std::strcmp(name, "--tolerance"))
+            options.tolerance = std::atof(value);
+        else
+            return false;
+        return true;
+    });
+
+    return ok && (options.transfers >= 1);
+}
+
+//! Runs closed loop workload, one transfer in flight per node.
+class Workload {
+public:
+    Workload(sky::CAN_TS& cants, const Options& options)
+        : cants_(cants), options_(options), random_(options.seed),
+          pick_(std::begin(options.weights), std::end(options.weights)),
+          block_(bench::BlockData(options)) {
+    }
+
+    void Start() {
+        clock_.start();
+
+        for (uint32_t i = 0; i < options_.nodes; i++)
+            Next(static_cast<uint8_t>(bench::kFirstNodeAddress + i));
+    }
+
+    //! Counts \a frame seen on bus.
+    void CountFrame(const sky::CanFrame& frame) {
+        auto type = static_cast<uint8_t>((frame.id >> 18) & 0x07);
+
+        for (int kind = 0; kind < bench::kKindCount; kind++) {
+            if (bench::kKindTypes[kind] == type) {
+                stats_[kind].frames++;
+                stats_[kind].bytes += frame.data.size();
+            }
+        }
+    }
+
+    const bench::Stats& GetStats(int kind) const { return stats_[kind]; }
+    double GetSeconds() const { return seconds_; }
+
+private:
+    sky::CAN_TS& cants_;
+    const Options& options_;
+    std::mt19937 random_;
+    std::discrete_distribution<int> pick_;
+    std::vector<uint8_t> block_;
+    bench::Stats stats_[bench::kKindCount];
+    uint32_t started_ = 0;
+    uint32_t finished_ = 0;
+    QElapsedTimer clock_;
+    double seconds_ = 0;
+
+    void Next(uint8_t address) {
+        if (started_ >= options_.transfers) {
+            if (finished_ == started_) {
+                seconds_ = static_cast<double>(clock_.nsecsElapsed()) / 1e9;
+                QCoreApplication::quit();
+            }
+            return;
+        }
+
+        int kind = pick_(random_);
+        uint64_t start = sky::Trace::Now();
+        started_++;
+
+        bool ok = bench::StartTransfer(cants_, kind, address, block_, options_, [this, kind, address, start](bool success) {
+            Finish(kind, address, start, success);
+        });
+
+        // Rejected transfer, handler is not invoked. Continue from event loop to avoid recursion.
+        if (!ok)
+            QTimer::singleShot(0, [this, kind, address, start]() { Finish(kind, address, start, false); });
+    }
+
+    void Finish(int kind, uint8_t address, uint64_t start, bool success) {
+        finished_++;
+
+        if (success)
+            stats_[kind].latency_ns.push_back(sky::Trace::Now() - start);
+        else
+            stats_[kind].failed++;
+
+        Next(address);
+    }
+};
+
+QJsonObject Report(const Workload& workload, const Options& options, const sky::LoopbackBus& bus)
+{
+    QJsonObject config = bench::Config(options);
+    config["loss"] = options.loss;
+    config["transfers"] = static_cast<int>(options.transfers);
+
+    double seconds = std::max(workload.GetSeconds(), 1e-9);
+    QJsonObject types;
+
+    for (int kind = 0; kind < bench::kKindCount; kind++) {
+        const bench::Stats& stats = workload.GetStats(kind);
+        QJsonObject type = bench::Report(stats);
+        type["transfers_per_s"] = static_cast<double>(stats.latency_ns.size()) / seconds;
+        type["frames_per_s"] = static_cast<double>(stats.frames) / seconds;
+        type["bytes_per_s"] = static_cast<double>(stats.bytes) / seconds;
+        types[bench::kKindNames[kind]] = type;
+    }
+
+    QJsonObject bus_stats;
+    bus_stats["frames"] = static_cast<double>(bus.GetFramesSent());
+    bus_stats["lost"] = static_cast<double>(bus.GetFramesLost());
+    bus_stats["frames_per_s"] = static_cast<double>(bus.GetFramesSent()) / seconds;
+
+    QJsonObject result;
+    result["benchmark"] = "loopback";
+    result["config"] = config;
+    result["duration_s"] = seconds;
+    result["bus"] = bus_stats;
+    result["types"] = types;
+    return result;
+}
+
+//! Compares \a result with \a baseline, prints differences. Returns false if any metric regressed beyond \a tolerance.
+bool Compare(const QJsonObject& result, const QJsonObject& baseline, double tolerance)
+{
+    bool ok = true;
+    QJsonObject types = result["types"].toObject();
+    QJsonObject base_types = baseline["types"].toObject();
+
+    // Metric path and whether higher value is better.
+    struct Metric { const char* group; const char* name; bool higher_better; };
+    const Metric metrics[] = {{"latency_us", "p50", false}, {"latency_us", "p99", false}, {nullptr, "frames_per_s", true}};
+
+    for (int kind = 0; kind < bench::kKindCount; kind++) {
+        QJsonObject type = types[bench::kKindNames[kind]].toObject();
+        QJsonObject base_type = base_types[bench::kKindNames[kind]].toObject();
+
+        for (const auto& metric : metrics) {
+            QJsonObject now_group = metric.group ? type[metric.group].toObject() : type;
+            QJsonObject base_group = metric.group ? base_type[metric.group].toObject() : base_type;
+            double now = now_group[metric.name].toDouble();
+            double base = base_group[metric.name].toDouble();
+
+            if (base <= 0.0)
+                continue;
+
+            double change = (now - base) / base;
+            bool regressed = metric.higher_better ? (change < -tolerance) : (change > tolerance);
+            ok = ok && !regressed;
+
+            std::fprintf(stderr, "%-12s %-14s %12.1f -> %12.1f  %+6.1f%%%s\n", bench::kKindNames[kind], metric.name,
+                         base, now, change * 100.0, regressed ? "  REGRESSION" : "");
+        }
+    }
+
+    return ok;
+}
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+    QCoreApplication app(argc, argv);
+    Options options;
+
+    if (!ParseOptions(argc, argv, options)) {
+        std::fprintf(stderr, "Usage: %s [--nodes N] [--mix tc=4,tm=4,sb=1,gb=1] [--loss P] [--transfers N]\n"
+                             "       [--block-size BYTES] [--timeout MS] [--report-delay MS] [--seed N]\n"
+                             "       [--output FILE] [--baseline FILE] [--tolerance FRACTION]\n", argv[0]);
+        return 2;
+    }
+
+    sky::LoopbackBus bus0(options.loss, options.seed);
+    sky::LoopbackBus bus1;
+    sky::LoopbackTransport client0(bus0);
+    sky::LoopbackTransport client1(bus1);
+    sky::LoopbackTransport node0(bus0);
+    sky::LoopbackTransport node1(bus1);
+    sky::LoopbackTransport monitor(bus0);
+
+    sky::CAN_TS nodes;
+    sky::CAN_TS::Transport node_transport;
+    node_transport.can0 = &node0;
+    node_transport.can1 = &node1;
+
+    if (!bench::HostNodes(nodes, node_transport, options)) {
+        std::fprintf(stderr, "Starting CAN TS nodes failed\n");
+        return 1;
+    }
+
+    sky::CAN_TS cants;
+    sky::CAN_TS::Transport transport;
+    transport.can0 = &client0;
+    transport.can1 = &client1;
+
+    if (!cants.Start(bench::kClientAddress, options.timeout_ms, transport)) {
+        std::fprintf(stderr, "Starting CAN TS failed\n");
+        return 1;
+    }
+
+    Workload workload(cants, options);
+    QObject::connect(&monitor, &sky::CanTransport::CanFrameReceived,
+                     [&workload](const sky::CanFrame& frame) { workload.CountFrame(frame); });
+
+    QTimer::singleShot(0, [&workload]() { workload.Start(); });
+    app.exec();
+    cants.Stop();
+    nodes.Stop();
+
+    QJsonObject result = Report(workload, options, bus0);
+
+    if (!bench::WriteResult(result, options.output))
+        return 1;
+
+    if (!options.baseline.empty()) {
+        QFile file(QString::fromStdString(options.baseline));
+        QJsonDocument baseline = file.open(QIODevice::ReadOnly) ? QJsonDocument::fromJson(file.readAll()) : QJsonDocument();
+
+        if (!baseline.isObject()) {
+            std::fprintf(stderr, "Invalid baseline %s\n", options.baseline.c_str());
+            return 1;
+        }
+
+        if (!Compare(result, baseline.object(), options.tolerance))
+            return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,312 @@
+/* See the file "LICENSE.txt" for the full license governing this code. */
+
+// Scaling benchmark of sky::CanTsNetwork: independent networks served by shard threads.
+//
+// Usage: networkbench [--networks 1,2,4,8] [--nodes N] [--transfers N] [--timeout MS]
+//                     [--output FILE]
+//
+// Every network is a loopback bus pair living in its shard thread, with the
+// shard stack as client and a second stack hosting --nodes nodes (AddNode).
+// Each node has one transfer in flight (telecommand, telemetry, set block and
+// get block in turn) until --transfers per network finished. Transfers are
+// started through the queued CanTsNetwork API. Work per network is fixed, so
+// with perfect scaling throughput grows with the number of networks. Result is
+// JSON with transfers/s, speedup and efficiency against one network for each
+// network count.
+
+#include <QCoreApplication>
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QThread>
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+#include "can_ts.h"
+#include "cantsnetwork.h"
+#include "cantstrace.h"
+#include "loopbackbus.h"
+
+namespace
+{
+
+constexpr uint8_t kClientAddress = 0x02;
+constexpr uint8_t kFirstNodeAddress = 0x20;
+constexpr uint64_t kBlockAddress = 0x1000;
+constexpr uint8_t kBlocks = 8;
+
+struct Options {
+    std::vector<int> networks = {1, 2, 4, 8};
+    uint32_t nodes = 4;
+    uint32_t transfers = 20000;
+    uint32_t timeout_ms = 50;
+    std::string output;
+};
+
+bool ParseNetworks(const char* text, Options& options)
+{
+    options.networks.clear();
+
+    for (const char* item = text; *item;) {
+        char* end = nullptr;
+        long count = std::strtol(item, &end, 0);
+
+        if ((end == item) || (count < 1) || (count > 64))
+            return false;
+
+        options.networks.push_back(static_cast<int>(count));
+        item = (*end == ',') ? end + 1 : end;
+    }
+
+    return !options.networks.empty();
+}
+
+bool ParseOptions(int argc, char* argv[], Options& options)
+{
+    for (int i = 1; i < argc; i++) {
+        if (i + 1 >= argc)
+            return false;
+
+        const char* name = argv[i];
+        const char* value = argv[++i];
+
+        if (!std::strcmp(name, "--networks")) {
+            if (!ParseNetworks(value, options))
+                return false;
+        } else if (!std::strcmp(name, "--nodes"))
+            options.nodes = static_cast<uint32_t>(std::strtoul(value, nullptr, 0));
+        else if (!std::strcmp(name, "--transfers"))
+            options.transfers = static_cast<uint32_t>(std::strtoul(value, nullptr, 0));
+        else if (!std::strcmp(name, "--timeout"))
+            options.timeout_ms = static_cast<uint32_t>(std::strtoul(value, nullptr, 0));
+        else if (!std::strcmp(name, "--output"))
+            options.output = value;
+        else
+            return false;
+    }
+
+    return (options.nodes >= 1) && (options.nodes <= 200) && (options.transfers >= 1);
+}
+
+//! Loopback network and its closed loop workload, created and used in the shard thread.
+class Network {
+public:
+    Network(sky::CanTsNetwork& engine, int index, const Options& options, std::atomic<int>& running)
+        : engine_(engine), index_(index), options_(options), running_(running), block_(kBlocks * 8) {
+        for (size_t i = 0; i < block_.size(); i++)
+            block_[i] = static_cast<uint8_t>(i);
+
+        sky::CAN_TS::Transport transport;
+        transport.can0 = &node0_;
+        transport.can1 = &node1_;
+        nodes_.Start(0x01, options.timeout_ms, transport);
+
+        for (uint32_t i = 0; i < options.nodes; i++) {
+            auto address = static_cast<uint8_t>(kFirstNodeAddress + i);
+            nodes_.AddNode(address);
+            nodes_.SetTCHandler(address, 0, [](uint8_t, uint8_t, uint8_t, const std::vector<uint8_t>&) {
+                return true;
+            });
+            nodes_.SetTMHandler(address, 0, [](uint8_t, uint8_t, uint8_t, std::vector<uint8_t>& data) {
+                data.assign(8, 0x55);
+                return true;
+            });
+        }
+    }
+
+    //! Stops node stack (client stack is the shard stack).
+    void Stop() {
+        nodes_.Stop();
+    }
+
+    //! Returns client transport settings (transports live as long as this object).
+    sky::CAN_TS::Transport GetClientTransport() {
+        sky::CAN_TS::Transport transport;
+        transport.can0 = &client0_;
+        transport.can1 = &client1_;
+        return transport;
+    }
+
+    //! Starts one transfer per node.
+    void Start() {
+        start_ = sky::Trace::Now();
+
+        for (uint32_t i = 0; i < options_.nodes; i++)
+            Next(static_cast<uint8_t>(kFirstNodeAddress + i));
+    }
+
+    uint64_t GetFailed() const { return failed_; }
+    uint64_t GetDuration() const { return end_ - start_; }
+
+private:
+    sky::CanTsNetwork& engine_;
+    int index_;
+    const Options& options_;
+    std::atomic<int>& running_;
+    std::vector<uint8_t> block_;
+    sky::LoopbackBus bus0_;
+    sky::LoopbackBus bus1_;
+    sky::LoopbackTransport client0_{bus0_};
+    sky::LoopbackTransport client1_{bus1_};
+    sky::LoopbackTransport node0_{bus0_};
+    sky::LoopbackTransport node1_{bus1_};
+    sky::CAN_TS nodes_;
+    uint32_t started_ = 0;
+    uint32_t finished_ = 0;
+    uint64_t failed_ = 0;
+    uint64_t start_ = 0;
+    uint64_t end_ = 0;
+
+    void Next(uint8_t address) {
+        if (started_ >= options_.transfers) {
+            if (finished_ == started_) {
+                end_ = sky::Trace::Now();
+
+                if (running_.fetch_sub(1) == 1)
+                    QMetaObject::invokeMethod(QCoreApplication::instance(), "quit", Qt::QueuedConnection);
+            }
+            return;
+        }
+
+        auto done = [this, address](bool success) {
+            finished_++;
+            failed_ += success ? 0 : 1;
+            Next(address);
+        };
+
+        // Called from handlers in the shard thread, so requests are executed directly.
+        switch (started_++ % 4) {
+        case 0:
+            engine_.SendTC(index_, address, 0, {0x01, 0x02, 0x03, 0x04}, 3,
+                           [done](bool success, sky::CAN_TS::SendTCError) { done(success); });
+            break;
+        case 1:
+            engine_.ReceiveTM(index_, address, 0, 3, 0,
+                              [done](bool success, const std::vector<uint8_t>&, sky::CAN_TS::ReceiveTMError) { done(success); });
+            break;
+        case 2:
+            engine_.SendBlock(index_, address, kBlockAddress, block_, 3, 0, 3,
+                              [done](bool success, sky::CAN_TS::SendBlockError) { done(success); });
+            break;
+        default:
+            engine_.ReceiveBlock(index_, address, kBlockAddress, kBlocks, 3, 3,
+                                 [done](bool success, const std::vector<uint8_t>&, sky::CAN_TS::ReceiveBlockError) { done(success); });
+            break;
+        }
+    }
+};
+
+//! Runs workload on \a count networks in parallel. Returns run result.
+QJsonObject Run(int count, const Options& options)
+{
+    // Networks are destroyed after the engine (and its threads), client stacks use their transports until then.
+    std::vector<std::unique_ptr<Network>> networks(static_cast<size_t>(count));
+    std::atomic<int> running(count);
+    sky::CanTsNetwork engine;
+
+    // Networks are created in shard threads, so their buses and stacks belong to them.
+    for (int i = 0; i < count; i++) {
+        int index = engine.AddNetwork();
+        engine.InvokeBlocking(index, [&](sky::CAN_TS&) {
+            networks[static_cast<size_t>(index)].reset(new Network(engine, index, options, running));
+        });
+        engine.Start(index, kClientAddress, options.timeout_ms, networks[static_cast<size_t>(index)]->GetClientTransport());
+    }
+
+    uint64_t start = sky::Trace::Now();
+
+    for (int i = 0; i < count; i++) {
+        Network* network = networks[static_cast<size_t>(i)].get();
+        engine.Invoke(i, [network](sky::CAN_TS&) { network->Start(); });
+    }
+
+    QCoreApplication::exec();
+    double seconds = static_cast<double>(sky::Trace::Now() - start) / 1e9;
+
+    uint64_t failed = 0;
+    double slowest = 0.0;
+
+    for (int i = 0; i < count; i++) {
+        Network* network = networks[static_cast<size_t>(i)].get();
+        engine.InvokeBlocking(i, [network](sky::CAN_TS& cants) {
+            cants.Stop();
+            network->Stop();
+        });
+
+        failed += network->GetFailed();
+        slowest = std::max(slowest, static_cast<double>(network->GetDuration()) / 1e9);
+    }
+
+    QJsonObject run;
+    run["networks"] = count;
+    run["duration_s"] = seconds;
+    run["slowest_network_s"] = slowest;
+    run["transfers"] = static_cast<double>(options.transfers) * count;
+    run["failed"] = static_cast<double>(failed);
+    run["transfers_per_s"] = static_cast<double>(options.transfers) * count / std::max(seconds, 1e-9);
+    return run;
+}
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+    QCoreApplication app(argc, argv);
+    Options options;
+
+    if (!ParseOptions(argc, argv, options)) {
+        std::fprintf(stderr, "Usage: %s [--networks 1,2,4,8] [--nodes N] [--transfers N] [--timeout MS]\n"
+                             "       [--output FILE]\n", argv[0]);
+        return 2;
+    }
+
+    QJsonArray runs;
+    double base = 0.0;
+
+    for (int count : options.networks) {
+        QJsonObject run = Run(count, options);
+        double rate = run["transfers_per_s"].toDouble();
+
+        // Speedup and efficiency are relative to the first (smallest) run per network.
+        if (base <= 0.0)
+            base = rate / options.networks.front();
+
+        run["speedup"] = rate / std::max(base, 1e-9);
+        run["efficiency"] = rate / std::max(base, 1e-9) / count;
+        runs.append(run);
+
+        std::fprintf(stderr, "%3d networks: %10.0f transfers/s  speedup %5.2f  efficiency %5.1f %%\n", count, rate,
+                     run["speedup"].toDouble(), 100.0 * run["efficiency"].toDouble());
+    }
+
+    QJsonObject config;
+    config["nodes"] = static_cast<int>(options.nodes);
+    config["transfers"] = static_cast<int>(options.transfers);
+    config["timeout_ms"] = static_cast<int>(options.timeout_ms);
+
+    QJsonObject result;
+    result["benchmark"] = "network";
+    result["config"] = config;
+    result["hardware_threads"] = QThread::idealThreadCount();
+    result["runs"] = runs;
+
+    QByteArray json = QJsonDocument(result).toJson(QJsonDocument::Indented);
+
+    if (options.output.empty()) {
+        std::fwrite(json.constData(), 1, static_cast<size_t>(json.size()), stdout);
+    } else {
+        QFile file(QString::fromStdString(options.output));
+        if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate) || (file.write(json) != json.size())) {
+            std::fprintf(stderr, "Cannot write %s\n", options.output.c_str());
+            return 1;
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,24 @@
+# See the file "LICENSE.txt" for the full license governing this code.
+#
+# Scaling benchmark of CanTsNetwork shards on loopback buses. Build in release mode:
+#
+#     qmake CONFIG+=release bench/network/network.pro && make && ./networkbench > result.json
+
+QT += core serialport network
+QT -= gui
+
+TARGET = networkbench
+TEMPLATE = app
+
+DEFINES += QT_DEPRECATED_WARNINGS
+DEFINES += QT_USE_QSTRINGBUILDER
+DEFINES += QT_NO_DEBUG_OUTPUT
+DEFINES += QT_NO_INFO_OUTPUT
+
+CONFIG += c++14 strict_c++ warn_on console thread cants_bench
+CONFIG -= app_bundle
+
+include(../../cants.pri)
+
+SOURCES += \
+        main.cpp
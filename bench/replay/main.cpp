@@ -0,0 +1,390 @@
+/* See the file "LICENSE.txt" for the full license governing this code. */
+
+// Replay of recorded bus traffic through CAN_TS.
+//
+// Usage: replaybench <capture> [--bus N] [--speed X] [--mirror] [--address A]
+//                    [--timeout MS] [--record PATH] [--output FILE]
+//
+// Frames received on --bus in the capture are delivered to CAN_TS and frames
+// CAN_TS sends are checked against frames transmitted in the capture. Local
+// address defaults to the recording station (most frequent destination of
+// received frames).
+//
+// With --mirror, frames the station transmitted are delivered instead, to a
+// CAN_TS hosting every node the station addressed: telecommands are
+// acknowledged and telemetry requests are answered with the data recorded
+// from the node, so node responses are reproduced.
+//
+// With --speed 0 (default), frames are replayed as fast as possible and CPU
+// time per processed frame measures protocol cost on the recorded traffic
+// mix. Other speeds replay at scaled original timing in virtual time
+// (CAN_TS timeouts included), so runs are deterministic. --record writes
+// frames sent by CAN_TS into a capture for comparison between runs. Result
+// is JSON; exit code is 1 if any sent frame differs from the recorded one.
+
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <algorithm>
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+#include "can_ts.h"
+#include "cantscapture.h"
+#include "cantstrace.h"
+#include "replaytransport.h"
+
+namespace
+{
+
+constexpr uint64_t kMismatchesPrinted = 10;
+
+struct Options {
+    std::string capture;
+    uint32_t bus = 0;
+    double speed = 0.0;
+    bool mirror = false;
+    int address = -1;
+    uint32_t timeout_ms = 100;
+    std::string record;
+    std::string output;
+};
+
+bool ParseOptions(int argc, char* argv[], Options& options)
+{
+    for (int i = 1; i < argc; i++) {
+        const char* name = argv[i];
+
+        if (!std::strcmp(name, "--mirror")) {
+            options.mirror = true;
+            continue;
+        }
+
+        if (name[0] != '-') {
+            options.capture = name;
+            continue;
+        }
+
+        if (i + 1 >= argc)
+            return false;
+
+        const char* value = argv[++i];
+
+        if (!std::strcmp(name, "--bus"))
+            options.bus = static_cast<uint32_t>(std::strtoul(value, nullptr, 0));
+        else if (!std::strcmp(name, "--speed"))
+            options.speed = std::atof(value);
+        else if (!std::strcmp(name, "--address"))
+            options.address = static_cast<int>(std::strtoul(value, nullptr, 0));
+        else if (!std::strcmp(name, "--timeout"))
+            options.timeout_ms = static_cast<uint32_t>(std::strtoul(value, nullptr, 0));
+        else if (!std::strcmp(name, "--record"))
+            options.record = value;
+        else if (!std::strcmp(name, "--output"))
+            options.output = value;
+        else
+            return false;
+    }
+
+    return !options.capture.empty() && (options.bus < 256) && (options.speed >= 0) && (options.address < 256);
+}
+
+//! Calls \a visit with every record of CAN \a bus in capture \a path stamped with epoch time (as ReplayTransport::Load),
+//! segment by segment (invalid segments are skipped).
+void ScanCapture(const QString& path, uint8_t bus, const std::function<void(const sky::CaptureRecord&)>& visit)
+{
+    for (const auto& file : sky::CaptureReader::SegmentFiles(path)) {
+        sky::CaptureReader reader;
+
+        if (!reader.Open(file))
+            continue;
+
+        const sky::CaptureRecord* records = reader.GetRecords();
+
+        for (uint64_t i = 0; i < reader.GetCount(); i++) {
+            if (records[i].bus != bus)
+                continue;
+
+            sky::CaptureRecord record = records[i];
+            record.timestamp = static_cast<uint64_t>(static_cast<int64_t>(record.timestamp) + reader.GetEpochOffset());
+            visit(record);
+        }
+    }
+}
+
+bool IsDirection(const sky::CaptureRecord& record, sky::CaptureDirection direction)
+{
+    return record.direction == static_cast<uint8_t>(direction);
+}
+
+//! Recorded frames of the replayed bus.
+struct Summary {
+    uint64_t records = 0; //!< Number of records.
+    uint64_t first = UINT64_MAX; //!< Earliest time stamp.
+    uint64_t last = 0; //!< Latest time stamp.
+    uint8_t station = 0x02; //!< Address of recording station: most frequent destination of received frames.
+};
+
+//! Returns summary of records of CAN \a bus in capture \a path.
+Summary Summarize(const QString& path, uint8_t bus)
+{
+    Summary summary;
+    std::map<uint8_t, uint64_t> counts;
+
+    ScanCapture(path, bus, [&summary, &counts](const sky::CaptureRecord& record) {
+        summary.records++;
+        summary.first = std::min(summary.first, record.timestamp);
+        summary.last = std::max(summary.last, record.timestamp);
+
+        sky::CanTsFrame frame = sky::CAN_TS::FromCanFrame(record.ToCanFrame());
+
+        if (IsDirection(record, sky::CaptureDirection::kRx) && !sky::CanTsFrame::IsBroadcastAddress(frame.toAddress_))
+            counts[frame.toAddress_]++;
+    });
+
+    auto it = std::max_element(counts.begin(), counts.end(), [](const std::pair<const uint8_t, uint64_t>& a,
+                                                                 const std::pair<const uint8_t, uint64_t>& b) {
+        return a.second < b.second;
+    });
+
+    if (it != counts.end())
+        summary.station = it->first;
+
+    return summary;
+}
+
+//! Hosts nodes addressed by \a station in \a cants, telemetry is answered with recorded responses.
+class MirrorNodes {
+public:
+    MirrorNodes(sky::CAN_TS& cants, const QString& path, uint8_t bus, uint8_t station) {
+        std::map<uint8_t, std::set<uint8_t>> tc_channels;
+        std::map<uint8_t, std::set<uint8_t>> tm_channels;
+
+        ScanCapture(path, bus, [&](const sky::CaptureRecord& record) {
+            sky::CanTsFrame frame = sky::CAN_TS::FromCanFrame(record.ToCanFrame());
+
+            if (IsDirection(record, sky::CaptureDirection::kTx) && (frame.fromAddress_ == station) &&
+                !sky::CanTsFrame::IsBroadcastAddress(frame.toAddress_)) {
+                nodes_.insert(frame.toAddress_);
+
+                if (frame.type_ == sky::CanTsFrame::TELECOMMAND)
+                    tc_channels[frame.toAddress_].insert(frame.GetChannel());
+                else if (frame.type_ == sky::CanTsFrame::TELEMETRY)
+                    tm_channels[frame.toAddress_].insert(frame.GetChannel());
+            } else if (IsDirection(record, sky::CaptureDirection::kRx) && (frame.toAddress_ == station) &&
+                       (frame.type_ == sky::CanTsFrame::TELEMETRY) &&
+                       (frame.GetFrameType() == sky::CanTsFrame::TelecommandFrameType::ACK)) {
+                responses_[{frame.fromAddress_, frame.GetChannel()}].push_back(frame.GetData());
+            }
+        });
+
+        for (uint8_t node : nodes_)
+            cants.AddNode(node);
+
+        for (const auto& node : tc_channels) {
+            for (uint8_t channel : node.second) {
+                cants.SetTCHandler(node.first, channel, [](uint8_t, uint8_t, uint8_t, const std::vector<uint8_t>&) {
+                    return true;
+                });
+            }
+        }
+
+        for (const auto& node : tm_channels) {
+            for (uint8_t channel : node.second) {
+                cants.SetTMHandler(node.first, channel, [this](uint8_t address, uint8_t, uint8_t channel, std::vector<uint8_t>& data) {
+                    auto& queue = responses_[{address, channel}];
+
+                    if (queue.empty())
+                        return false;
+
+                    data = queue.front();
+                    queue.pop_front();
+                    return true;
+                });
+            }
+        }
+    }
+
+    size_t GetNodeCount() const { return nodes_.size(); }
+
+private:
+    std::set<uint8_t> nodes_;
+    std::map<std::pair<uint8_t, uint8_t>, std::deque<std::vector<uint8_t>>> responses_;
+};
+
+double CpuSeconds()
+{
+    return static_cast<double>(std::clock()) / CLOCKS_PER_SEC;
+}
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+    QCoreApplication app(argc, argv);
+    Options options;
+
+    if (!ParseOptions(argc, argv, options)) {
+        std::fprintf(stderr, "Usage: %s <capture> [--bus N] [--speed X] [--mirror] [--address A] [--timeout MS]\n"
+                             "       [--record PATH] [--output FILE]\n", argv[0]);
+        return 2;
+    }
+
+    auto bus = static_cast<uint8_t>(options.bus);
+    QString path = QString::fromStdString(options.capture);
+
+    // Capture is scanned segment by segment, only the replay transport holds its frames.
+    Summary summary = Summarize(path, bus);
+    auto address = static_cast<uint8_t>((options.address >= 0) ? options.address : summary.station);
+
+    sky::ReplayTransport::Settings settings;
+    settings.speed = options.speed;
+    settings.mirror = options.mirror;
+
+    // Replayed bus is the nominal bus of CAN_TS, redundant bus stays silent.
+    sky::VirtualClock clock;
+    sky::ReplayTransport replay(settings);
+    sky::ReplayTransport idle(settings);
+    sky::CAN_TS cants;
+
+    if (!replay.Load(path, bus)) {
+        std::fprintf(stderr, "Cannot read capture %s\n", options.capture.c_str());
+        return 1;
+    }
+
+    if (options.speed > 0) {
+        replay.SetClock(clock);
+        cants.SetClock(clock);
+    }
+
+    sky::CAN_TS::Transport transport;
+    transport.can0 = &replay;
+    transport.can1 = &idle;
+
+    if (!cants.Start(address, options.timeout_ms, transport)) {
+        std::fprintf(stderr, "Starting CAN TS failed\n");
+        return 1;
+    }
+
+    std::unique_ptr<MirrorNodes> mirror;
+    if (options.mirror)
+        mirror.reset(new MirrorNodes(cants, path, bus, summary.station));
+
+    QObject::connect(&replay, &sky::ReplayTransport::TransmitMismatch,
+                     [](uint64_t index, const sky::CanFrame& expected, const sky::CanFrame& actual) {
+        if (index >= kMismatchesPrinted)
+            return;
+
+        std::fprintf(stderr, "Frame %" PRIu64 ": expected %08x/%zu, sent %08x/%zu\n",
+                     index, expected.id, expected.data.size(), actual.id, actual.data.size());
+    });
+
+    QElapsedTimer wall;
+    double cpu_start = CpuSeconds();
+    wall.start();
+
+    if (options.speed > 0) {
+        replay.Start();
+
+        // Reactions to each delivered frame are processed before virtual time moves to the next deadline.
+        uint64_t deadline = 0;
+        while (!replay.IsFinished() && clock.NextDeadline(deadline)) {
+            QCoreApplication::processEvents();
+            clock.AdvanceTo(deadline);
+        }
+    } else {
+        QObject::connect(&replay, &sky::ReplayTransport::Finished, &app, &QCoreApplication::quit, Qt::QueuedConnection);
+        replay.Start();
+
+        if (!replay.IsFinished())
+            app.exec();
+    }
+
+    // Reactions to the last frame.
+    QCoreApplication::processEvents();
+    QCoreApplication::processEvents();
+
+    double wall_s = static_cast<double>(wall.nsecsElapsed()) / 1e9;
+    double cpu_s = CpuSeconds() - cpu_start;
+    cants.Stop();
+
+    if (!options.record.empty()) {
+        sky::CaptureWriter writer;
+        sky::CaptureWriter::Settings capture_settings;
+        capture_settings.segment_records = std::max<uint64_t>(replay.GetTransmitted().size(), 1);
+
+        if (!writer.Open(QString::fromStdString(options.record), capture_settings)) {
+            std::fprintf(stderr, "Cannot write %s\n", options.record.c_str());
+            return 1;
+        }
+
+        // Replay positions are epoch time, writer stamps segments with offset of trace clock to epoch.
+        auto now = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch());
+        int64_t epoch_offset = static_cast<int64_t>(now.count()) - static_cast<int64_t>(sky::Trace::Now());
+
+        for (sky::CaptureRecord record : replay.GetTransmitted()) {
+            record.timestamp = static_cast<uint64_t>(static_cast<int64_t>(record.timestamp) - epoch_offset);
+            writer.Append(record);
+        }
+    }
+
+    uint64_t sent = replay.GetTransmitted().size();
+    uint64_t processed = std::max<uint64_t>(replay.GetFramesReplayed() + sent, 1);
+    double capture_s = summary.records ? static_cast<double>(summary.last - summary.first) / 1e9 : 0.0;
+
+    QJsonObject config;
+    config["capture"] = QString::fromStdString(options.capture);
+    config["bus"] = static_cast<int>(options.bus);
+    config["speed"] = options.speed;
+    config["mirror"] = options.mirror;
+    config["address"] = static_cast<int>(address);
+    config["timeout_ms"] = static_cast<int>(options.timeout_ms);
+
+    QJsonObject frames;
+    frames["recorded"] = static_cast<double>(summary.records);
+    frames["replayed"] = static_cast<double>(replay.GetFramesReplayed());
+    frames["filtered"] = static_cast<double>(replay.GetFramesFiltered());
+    frames["sent"] = static_cast<double>(sent);
+    frames["matched"] = static_cast<double>(replay.GetFramesMatched());
+    frames["mismatched"] = static_cast<double>(replay.GetFramesMismatched());
+    frames["missing"] = static_cast<double>(replay.GetFramesMissing());
+    frames["unexpected"] = static_cast<double>(replay.GetFramesUnexpected());
+
+    QJsonObject result;
+    result["benchmark"] = "replay";
+    result["config"] = config;
+    result["nodes"] = static_cast<double>(mirror ? mirror->GetNodeCount() : 0);
+    result["frames"] = frames;
+    result["capture_s"] = capture_s;
+    result["wall_s"] = wall_s;
+    result["cpu_s"] = cpu_s;
+    result["cpu_ns_per_frame"] = cpu_s * 1e9 / static_cast<double>(processed);
+    result["wall_ns_per_frame"] = wall_s * 1e9 / static_cast<double>(processed);
+    result["frames_per_s"] = static_cast<double>(processed) / std::max(wall_s, 1e-9);
+
+    QByteArray json = QJsonDocument(result).toJson(QJsonDocument::Indented);
+
+    if (options.output.empty()) {
+        std::fwrite(json.constData(), 1, static_cast<size_t>(json.size()), stdout);
+    } else {
+        QFile file(QString::fromStdString(options.output));
+        if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate) || (file.write(json) != json.size())) {
+            std::fprintf(stderr, "Cannot write %s\n", options.output.c_str());
+            return 1;
+        }
+    }
+
+    return replay.GetFramesMismatched() ? 1 : 0;
+}
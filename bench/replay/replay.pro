@@ -0,0 +1,24 @@
+# See the file "LICENSE.txt" for the full license governing this code.
+#
+# Replay of recorded bus traffic through CAN_TS. Build in release mode:
+#
+#     qmake CONFIG+=release bench/replay/replay.pro && make && ./replaybench capture --speed 0
+
+QT += core serialport network
+QT -= gui
+
+TARGET = replaybench
+TEMPLATE = app
+
+DEFINES += QT_DEPRECATED_WARNINGS
+DEFINES += QT_USE_QSTRINGBUILDER
+DEFINES += QT_NO_DEBUG_OUTPUT
+DEFINES += QT_NO_INFO_OUTPUT
+
+CONFIG += c++14 strict_c++ warn_on console cants_bench
+CONFIG -= app_bundle
+
+include(../../cants.pri)
+
+SOURCES += \
+        main.cpp
@@ -0,0 +1,254 @@
+/* See the file "LICENSE.txt" for the full license governing this code. */
+
+// Capacity planning of CAN_TS workload on simulated bus in virtual time.
+//
+// Usage: simbusbench [--nodes N] [--bitrate BIT/S] [--mix tc=4,tm=4,sb=1,gb=1]
+//                    [--period MS] [--duration S] [--processing-delay US]
+//                    [--error P] [--drop P] [--corrupt P] [--block-size BYTES]
+//                    [--timeout MS] [--report-delay MS] [--seed N]
+//                    [--output FILE]
+//
+// Client polls every node once per period with a transfer drawn from the mix
+// (polls of different nodes are evenly spread over the period). Poll finding
+// previous transfer of the node still active is counted as overrun. Latency
+// and throughput are in virtual time of the bus, also response timeouts of
+// CAN_TS run on the virtual clock advanced by the bus, so hours of traffic
+// take seconds. Result is JSON with latency percentiles per transfer type,
+// bus load and CPU (wall-clock) time per frame.
+
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QJsonObject>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+#include "can_ts.h"
+#include "simulatedbus.h"
+#include "workload.h"
+
+namespace
+{
+
+struct Options : bench::Options {
+    uint32_t bitrate = 1000000;
+    double period_ms = 100;
+    double duration_s = 3600;
+    double processing_delay_us = 50;
+    double error = 0.0;
+    double drop = 0.0;
+    double corrupt = 0.0;
+
+    Options() {
+        nodes = 40;
+    }
+};
+
+bool ParseOptions(int argc, char* argv[], Options& options)
+{
+    bool ok = bench::ParseOptions(argc, argv, options, [&options](const char* name, const char* value) {
+        if (!std::strcmp(name, "--bitrate"))
+            options.bitrate = static_cast<uint32_t>(std::strtoul(value, nullptr, 0));
+        else if (!std::strcmp(name, "--period"))
+            options.period_ms = std::atof(value);
+        else if (!std::strcmp(name, "--duration"))
+            options.duration_s = std::atof(value);
+        else if (!std::strcmp(name, "--processing-delay"))
+            options.processing_delay_us = std::atof(value);
+        else if (!std::strcmp(name, "--error"))
+            options.error = std::atof(value);
+        else if (!std::strcmp(name, "--drop"))
+            options.drop = std::atof(value);
+        else if (!std::strcmp(name, "--corrupt"))
+            options.corrupt = std::atof(value);
+        else
+            return false;
+        return true;
+    });
+
+    return ok && (options.bitrate >= 10000) && (options.period_ms > 0) && (options.duration_s > 0) &&
+           (options.processing_delay_us >= 0);
+}
+
+//! Polls every node periodically in virtual time of the bus.
+class Workload {
+public:
+    Workload(sky::CAN_TS& cants, sky::SimulatedBus& bus, const Options& options)
+        : cants_(cants), bus_(bus), options_(options), random_(options.seed),
+          pick_(std::begin(options.weights), std::end(options.weights)),
+          block_(bench::BlockData(options)), active_(options.nodes, false) {
+    }
+
+    void Start() {
+        uint64_t period = Period();
+
+        for (uint32_t i = 0; i < options_.nodes; i++)
+            bus_.Schedule(bus_.Now() + period * i / options_.nodes, [this, i]() { Poll(i); });
+    }
+
+    const bench::Stats& GetStats(int kind) const { return stats_[kind]; }
+
+private:
+    sky::CAN_TS& cants_;
+    sky::SimulatedBus& bus_;
+    const Options& options_;
+    std::mt19937 random_;
+    std::discrete_distribution<int> pick_;
+    std::vector<uint8_t> block_;
+    std::vector<bool> active_;
+    bench::Stats stats_[bench::kKindCount];
+
+    uint64_t Period() const {
+        return static_cast<uint64_t>(options_.period_ms * 1e6);
+    }
+
+    void Poll(uint32_t node) {
+        bus_.Schedule(bus_.Now() + Period(), [this, node]() { Poll(node); });
+
+        int kind = pick_(random_);
+        if (active_[node]) {
+            stats_[kind].overruns++;
+            return;
+        }
+
+        auto address = static_cast<uint8_t>(bench::kFirstNodeAddress + node);
+        uint64_t start = bus_.Now();
+        active_[node] = true;
+
+        bool ok = bench::StartTransfer(cants_, kind, address, block_, options_, [this, kind, node, start](bool success) {
+            Finish(kind, node, start, success);
+        });
+
+        // Rejected transfer, handler is not invoked.
+        if (!ok)
+            Finish(kind, node, start, false);
+    }
+
+    void Finish(int kind, uint32_t node, uint64_t start, bool success) {
+        active_[node] = false;
+
+        if (success)
+            stats_[kind].latency_ns.push_back(bus_.Now() - start);
+        else
+            stats_[kind].failed++;
+    }
+};
+
+QJsonObject Report(const Workload& workload, const Options& options, const sky::SimulatedBus& bus, double wall_s)
+{
+    QJsonObject config = bench::Config(options);
+    config["bitrate"] = static_cast<double>(options.bitrate);
+    config["period_ms"] = options.period_ms;
+    config["duration_s"] = options.duration_s;
+    config["processing_delay_us"] = options.processing_delay_us;
+    config["error"] = options.error;
+    config["drop"] = options.drop;
+    config["corrupt"] = options.corrupt;
+
+    double seconds = static_cast<double>(bus.Now()) / 1e9;
+    QJsonObject types;
+
+    for (int kind = 0; kind < bench::kKindCount; kind++) {
+        const bench::Stats& stats = workload.GetStats(kind);
+        QJsonObject type = bench::Report(stats);
+        type["overruns"] = static_cast<double>(stats.overruns);
+        type["transfers_per_s"] = static_cast<double>(stats.latency_ns.size()) / seconds;
+        types[bench::kKindNames[kind]] = type;
+    }
+
+    QJsonObject bus_stats;
+    bus_stats["load"] = bus.GetLoad();
+    bus_stats["frames"] = static_cast<double>(bus.GetFramesSent());
+    bus_stats["frames_per_s"] = static_cast<double>(bus.GetFramesSent()) / seconds;
+    bus_stats["error_frames"] = static_cast<double>(bus.GetErrorFrames());
+    bus_stats["dropped"] = static_cast<double>(bus.GetFramesDropped());
+    bus_stats["corrupted"] = static_cast<double>(bus.GetFramesCorrupted());
+    bus_stats["arbitration_losses"] = static_cast<double>(bus.GetArbitrationLosses());
+
+    QJsonObject result;
+    result["benchmark"] = "simbus";
+    result["config"] = config;
+    result["virtual_s"] = seconds;
+    result["wall_s"] = wall_s;
+    result["speedup"] = seconds / std::max(wall_s, 1e-9);
+    result["wall_ns_per_frame"] = wall_s * 1e9 / static_cast<double>(std::max<uint64_t>(bus.GetFramesSent(), 1));
+    result["bus"] = bus_stats;
+    result["types"] = types;
+    return result;
+}
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+    QCoreApplication app(argc, argv);
+    Options options;
+
+    if (!ParseOptions(argc, argv, options)) {
+        std::fprintf(stderr, "Usage: %s [--nodes N] [--bitrate BIT/S] [--mix tc=4,tm=4,sb=1,gb=1] [--period MS]\n"
+                             "       [--duration S] [--processing-delay US] [--error P] [--drop P] [--corrupt P]\n"
+                             "       [--block-size BYTES] [--timeout MS] [--report-delay MS] [--seed N] [--output FILE]\n", argv[0]);
+        return 2;
+    }
+
+    sky::SimulatedBus::Settings settings;
+    settings.bitrate = options.bitrate;
+    settings.error_rate = options.error;
+    settings.drop_rate = options.drop;
+    settings.corrupt_rate = options.corrupt;
+    settings.seed = options.seed;
+
+    sky::VirtualClock clock;
+    sky::SimulatedBus bus0(settings);
+    sky::SimulatedBus bus1(settings);
+    bus0.SetClock(&clock);
+    sky::SimulatedTransport client0(bus0);
+    sky::SimulatedTransport client1(bus1);
+    sky::SimulatedTransport node0(bus0, static_cast<uint64_t>(options.processing_delay_us * 1e3));
+    sky::SimulatedTransport node1(bus1, static_cast<uint64_t>(options.processing_delay_us * 1e3));
+
+    sky::CAN_TS nodes;
+    nodes.SetClock(clock);
+
+    sky::CAN_TS::Transport node_transport;
+    node_transport.can0 = &node0;
+    node_transport.can1 = &node1;
+
+    if (!bench::HostNodes(nodes, node_transport, options)) {
+        std::fprintf(stderr, "Starting CAN TS nodes failed\n");
+        return 1;
+    }
+
+    sky::CAN_TS cants;
+    cants.SetClock(clock);
+
+    sky::CAN_TS::Transport transport;
+    transport.can0 = &client0;
+    transport.can1 = &client1;
+
+    if (!cants.Start(bench::kClientAddress, options.timeout_ms, transport)) {
+        std::fprintf(stderr, "Starting CAN TS failed\n");
+        return 1;
+    }
+
+    Workload workload(cants, bus0, options);
+    workload.Start();
+
+    QElapsedTimer wall;
+    wall.start();
+    bus0.RunUntil(static_cast<uint64_t>(options.duration_s * 1e9));
+    double wall_s = static_cast<double>(wall.nsecsElapsed()) / 1e9;
+
+    cants.Stop();
+    nodes.Stop();
+
+    QJsonObject result = Report(workload, options, bus0, wall_s);
+
+    if (!bench::WriteResult(result, options.output))
+        return 1;
+
+    return 0;
+}
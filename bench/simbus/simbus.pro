@@ -0,0 +1,31 @@
+# See the file "LICENSE.txt" for the full license governing this code.
+#
+# Capacity planning of CAN_TS workload on simulated bus in virtual time. Build in release mode:
+#
+#     qmake CONFIG+=release bench/simbus/simbus.pro && make && ./simbusbench --nodes 40 --bitrate 125000
+
+QT += core serialport network
+QT -= gui
+
+TARGET = simbusbench
+TEMPLATE = app
+
+DEFINES += QT_DEPRECATED_WARNINGS
+DEFINES += QT_USE_QSTRINGBUILDER
+DEFINES += QT_NO_DEBUG_OUTPUT
+DEFINES += QT_NO_INFO_OUTPUT
+
+CONFIG += c++14 strict_c++ warn_on console cants_bench
+CONFIG -= app_bundle
+
+include(../../cants.pri)
+
+INCLUDEPATH += \
+        ../common
+
+SOURCES += \
+        main.cpp \
+        ../common/workload.cpp
+
+HEADERS += \
+        ../common/workload.h
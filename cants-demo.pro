@@ -1,6 +1,6 @@
 # See the file "LICENSE.txt" for the full license governing this code.
 
-QT += core gui serialport widgets
+QT += core gui serialport widgets network
 
 TARGET = cants-demo
 TEMPLATE = app
@@ -16,34 +16,18 @@ CONFIG(release, debug|release) {
 
 CONFIG += c++14 strict_c++ warn_on #console
 
+# CAN TS library (USDT probes of include/cantsprobes.h are enabled with qmake CONFIG+=usdt).
+include(cants.pri)
+
 INCLUDEPATH += \
-        app/ \
-        include
+        app/
 
 SOURCES += \
         app/main.cpp \
-        app/mainwindow.cpp \
-        src/commdriver.cpp \
-        src/canframe.cpp \
-        src/cantsutils.cpp \
-        src/skyslip.cpp \
-        src/can_ts.cpp \
-        src/can_ts_tc.cpp \
-        src/can_ts_tm.cpp \
-        src/can_ts_sb.cpp \
-        src/can_ts_gb.cpp \
-        src/can_ts_ts.cpp \
-        src/can_ts_un.cpp \
-        src/cantsframe.cpp
+        app/mainwindow.cpp
 
 HEADERS += \
-        app/mainwindow.h \
-        include/canframe.h \
-        include/cantsutils.h \
-        include/commdriver.h \
-        include/skyslip.h \
-        include/can_ts.h \
-        include/cantsframe.h
+        app/mainwindow.h
 
 FORMS += \
         gui/mainwindow.ui
@@ -0,0 +1,82 @@
+# See the file "LICENSE.txt" for the full license governing this code.
+#
+# CAN TS library sources shared by the application, benchmarks and tools:
+#
+#     include(../../cants.pri)
+#
+# Options (qmake CONFIG):
+#   cants_capture  only capture, trace and analyzer sources (tools reading captures, no serial port)
+#   cants_bench    adds benchmark transports (loopback bus, simulated bus, capture replay)
+#   usdt           USDT probes (include/cantsprobes.h). Requires sys/sdt.h.
+
+INCLUDEPATH += \
+        $$PWD/include
+
+usdt {
+    DEFINES += SKY_USDT
+}
+
+SOURCES += \
+        $$PWD/src/canframe.cpp \
+        $$PWD/src/cantsanalyzer.cpp \
+        $$PWD/src/cantscapture.cpp \
+        $$PWD/src/cantscaptureexport.cpp \
+        $$PWD/src/cantsframe.cpp \
+        $$PWD/src/cantsmetrics.cpp \
+        $$PWD/src/cantstrace.cpp \
+        $$PWD/src/cantstraceexport.cpp \
+        $$PWD/src/cantsutils.cpp
+
+HEADERS += \
+        $$PWD/include/canframe.h \
+        $$PWD/include/cantransport.h \
+        $$PWD/include/cantsanalyzer.h \
+        $$PWD/include/cantscapture.h \
+        $$PWD/include/cantscaptureexport.h \
+        $$PWD/include/cantsframe.h \
+        $$PWD/include/cantsmetrics.h \
+        $$PWD/include/cantstrace.h \
+        $$PWD/include/cantstraceexport.h \
+        $$PWD/include/cantsutils.h
+
+!cants_capture {
+    QT += serialport network
+
+    SOURCES += \
+            $$PWD/src/can_ts.cpp \
+            $$PWD/src/can_ts_tc.cpp \
+            $$PWD/src/can_ts_tm.cpp \
+            $$PWD/src/can_ts_sb.cpp \
+            $$PWD/src/can_ts_gb.cpp \
+            $$PWD/src/can_ts_ts.cpp \
+            $$PWD/src/can_ts_un.cpp \
+            $$PWD/src/can_ts_cp.cpp \
+            $$PWD/src/can_ts_rd.cpp \
+            $$PWD/src/can_ts_sv.cpp \
+            $$PWD/src/cantsclock.cpp \
+            $$PWD/src/cantsmetricsserver.cpp \
+            $$PWD/src/cantsnetwork.cpp \
+            $$PWD/src/commdriver.cpp \
+            $$PWD/src/skyslip.cpp
+
+    HEADERS += \
+            $$PWD/include/can_ts.h \
+            $$PWD/include/cantsclock.h \
+            $$PWD/include/cantsmetricsserver.h \
+            $$PWD/include/cantsnetwork.h \
+            $$PWD/include/cantsprobes.h \
+            $$PWD/include/commdriver.h \
+            $$PWD/include/skyslip.h
+}
+
+cants_bench {
+    SOURCES += \
+            $$PWD/src/loopbackbus.cpp \
+            $$PWD/src/replaytransport.cpp \
+            $$PWD/src/simulatedbus.cpp
+
+    HEADERS += \
+            $$PWD/include/loopbackbus.h \
+            $$PWD/include/replaytransport.h \
+            $$PWD/include/simulatedbus.h
+}
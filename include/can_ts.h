@@ -4,13 +4,20 @@
 #define CAN_TS_H
 
 #include <QObject>
-#include <QTimer>
 #include <cstdint>
+#include <functional>
+#include <list>
 #include <memory>
+#include <unordered_map>
 #include <unordered_set>
 #include <vector>
 #include "cantsframe.h"
+#include "cantransport.h"
+#include "cantsanalyzer.h"
+#include "cantsclock.h"
 #include "commdriver.h"
+#include "cantsmetrics.h"
+#include "cantstrace.h"
 
 namespace sky
 {
@@ -30,14 +37,17 @@ public:
     //! Provides error status of telecommand transfer.
     enum class SendTCError {
         kSendRequestFailed = 0, //!< Failed to send telecommand transfer request frame.
-        kMaxRetriesReached = 1 //!< Maximum number of request retries reached.
+        kMaxRetriesReached = 1, //!< Maximum number of request retries reached.
+        kNone = 2 //!< No error (transfer completed).
     };
     Q_ENUM(SendTCError)
 
     //! Provides error status of telemetry transfer.
     enum class ReceiveTMError {
         kSendRequestFailed = 0, //!< Failed to send telemetry transfer request frame.
-        kMaxRetriesReached = 1 //!< Maximum number of request retries reached.
+        kMaxRetriesReached = 1, //!< Maximum number of request retries reached.
+        kSendTCFailed = 2, //!< Telecommand preceding telemetry request failed (compound transaction only).
+        kNone = 3 //!< No error (transfer completed).
     };
     Q_ENUM(ReceiveTMError)
 
@@ -51,7 +61,8 @@ public:
         kMaxReportRetriesReached = 5, //!< Maximum number of data retransmissions and status requests reached.
         kSendAbortFailed = 6, //!< Failed to send abort frame.
         kMaxSendAbortRetriesReached = 7, //!< Maximum number of abort retries reached.
-        kAbortNACKReceived = 8 //!< NACK received while waiting for abort ACK.
+        kAbortNACKReceived = 8, //!< NACK received while waiting for abort ACK.
+        kNone = 9 //!< No error (transfer completed).
     };
     Q_ENUM(SendBlockError)
 
@@ -63,10 +74,62 @@ public:
         kMaxSendStartRetriesReached = 3, //!< Maximum number of start retries reached.
         kSendAbortFailed = 4, //!< Failed to send abort frame.
         kMaxSendAbortRetriesReached = 5, //!< Maximum number of abort retries reached.
-        kAbortNACKReceived = 6 //!< NACK received while waiting for abort ACK.
+        kAbortNACKReceived = 6, //!< NACK received while waiting for abort ACK.
+        kSendBlockFailed = 7, //!< Set block preceding get block request failed (compound transaction only).
+        kNone = 8 //!< No error (transfer completed).
     };
     Q_ENUM(ReceiveBlockError)
 
+    //! Invoked once when telecommand transfer started by SendTC is finished.
+    /*!
+        \param success True if transfer completed, false if it failed.
+        \param error Error code (kNone if \a success is true).
+    */
+    using SendTCHandler = std::function<void(bool success, SendTCError error)>;
+
+    //! Invoked once when telemetry transfer started by ReceiveTM is finished.
+    /*!
+        \param success True if transfer completed, false if it failed.
+        \param data Received data (valid only if \a success is true).
+        \param error Error code (kNone if \a success is true).
+    */
+    using ReceiveTMHandler = std::function<void(bool success, const std::vector<uint8_t>& data, ReceiveTMError error)>;
+
+    //! Invoked once when set block transfer started by SendBlock is finished.
+    /*!
+        \param success True if transfer completed, false if it failed.
+        \param error Error code (kNone if \a success is true).
+    */
+    using SendBlockHandler = std::function<void(bool success, SendBlockError error)>;
+
+    //! Invoked once when get block transfer started by ReceiveBlock is finished.
+    /*!
+        \param success True if transfer completed, false if it failed.
+        \param data Received data (valid only if \a success is true).
+        \param error Error code (kNone if \a success is true).
+    */
+    using ReceiveBlockHandler = std::function<void(bool success, const std::vector<uint8_t>& data, ReceiveBlockError error)>;
+
+    //! Invoked when telecommand is received by a node hosted with AddNode.
+    /*!
+        \param node CAN address of the hosted node.
+        \param from CAN address of the client.
+        \param channel Channel number.
+        \param data Received data.
+        \return True to acknowledge the telecommand (ACK), false to reject it (NACK).
+    */
+    using ServeTCHandler = std::function<bool(uint8_t node, uint8_t from, uint8_t channel, const std::vector<uint8_t>& data)>;
+
+    //! Invoked when telemetry is requested from a node hosted with AddNode.
+    /*!
+        \param node CAN address of the hosted node.
+        \param from CAN address of the client.
+        \param channel Channel number.
+        \param data Telemetry which shall be returned (at most 8 bytes, empty on entry).
+        \return True to return \a data (ACK), false to reject the request (NACK).
+    */
+    using ServeTMHandler = std::function<bool(uint8_t node, uint8_t from, uint8_t channel, std::vector<uint8_t>& data)>;
+
     //! Abstract base class for lower-level protocol settings.
     struct DriverSettings {
         virtual ~DriverSettings() = 0;
@@ -75,10 +138,52 @@ public:
     //! Lower-level protocol settings in case if CANdelaber is used.
     struct CANdelaber : public DriverSettings {
         std::string port_name_can0 = ""; //!< Serial port used for communication via CAN bus 0.
-        std::string port_name_can1 = ""; //!< Serial port used for communication via CAN bus 1.
+        std::string port_name_can1 = ""; //!< Serial port used for communication via CAN bus 1. If empty or equal to \a port_name_can0, both buses share one port.
         uint32_t baud = 0; //!< Serial port baud rate.
     };
 
+    //! Lower-level protocol settings in case if transports are provided by caller (e.g. LoopbackTransport).
+    /*!
+        Transports must outlive the stack. They are closed by Stop.
+    */
+    struct Transport : public DriverSettings {
+        CanTransport* can0 = nullptr; //!< Transport of CAN bus 0.
+        CanTransport* can1 = nullptr; //!< Transport of CAN bus 1 (must differ from \a can0).
+    };
+
+    //! Settings of automatic bus switching driven by keep alive frames.
+    /*!
+        Every \a check_period_ms the stack counts nodes from which a keep alive was received within
+        \a silence_timeout_ms on the nominal and on the redundant bus. If at least one node is alive on
+        the redundant bus and more nodes are alive there than on the nominal bus for \a confirm_count
+        consecutive checks, the bus is switched. No automatic switch is made within \a hold_off_ms after
+        any bus switch.
+    */
+    struct RedundancySettings {
+        bool enabled = false; //!< Enables automatic bus switching.
+        uint32_t check_period_ms = 100; //!< Period of keep alive evaluation.
+        uint32_t silence_timeout_ms = 1000; //!< Node is considered silent on a bus if no keep alive was received for this long.
+        uint8_t confirm_count = 3; //!< Number of consecutive checks which must agree before bus is switched.
+        uint32_t hold_off_ms = 5000; //!< Minimum time after a bus switch before next automatic switch.
+    };
+
+    //! Time stamps of transfer stages.
+    /*!
+        Times are in nanoseconds of Trace::Now clock, 0 if stage was not reached. Frame stages
+        (enqueued to sent) refer to the last frame of the transfer sent before completion, response
+        stages to the frame which completed the transfer.
+    */
+    struct TransferTiming {
+        uint64_t start = 0; //!< Transfer requested by API call.
+        uint64_t enqueued = 0; //!< Frame passed to CommDriver::Send.
+        uint64_t write = 0; //!< Frame written to serial port (left transmit buffer).
+        uint64_t written = 0; //!< Serial port confirmed write.
+        uint64_t sent = 0; //!< Send notification handled by CAN_TS.
+        uint64_t read = 0; //!< Response read from serial port.
+        uint64_t received = 0; //!< Response handled by CAN_TS.
+        uint64_t complete = 0; //!< Completion signalled.
+    };
+
     //! Lower-level protocol settings in case if IFboard is used.
     struct IFboard : public DriverSettings {
         uint32_t ip = 0; //!< IP address of IFboard.
@@ -107,20 +212,44 @@ public:
         \param channel Channel number.
         \param data Data which shall be transmitted.
         \param retry_count Maximum number of request retries after each timeout before transfer fails.
+        \param handler Invoked when started transfer is finished (in addition to SendTCCompleted or SendTCFailed).
         \retval true Started transfer.
-        \retval false Cannot start transfer.
+        \retval false Cannot start transfer (\a handler is not invoked).
     */
-    bool SendTC(uint8_t address, uint8_t channel, const std::vector<uint8_t>& data, uint8_t retry_count = 0);
+    bool SendTC(uint8_t address, uint8_t channel, const std::vector<uint8_t>& data, uint8_t retry_count = 0,
+                SendTCHandler handler = nullptr);
 
     //! Starts receiving telemetry.
     /*!
+        If \a max_age_ms is non-zero and telemetry received from the same address and channel
+        is not older than \a max_age_ms, ReceiveTMCompleted is emitted immediately with cached
+        data and no frame is sent. If a transfer to the same address and channel is already
+        active, the request is merged with it instead of being rejected.
+
         \param address CAN address of the sink.
         \param channel Channel number.
         \param retry_count Maximum number of request retries after each timeout before transfer fails.
-        \retval true Started transfer.
-        \retval false Cannot start transfer.
+        \param max_age_ms Maximum age (in msec) of cached telemetry which may be returned. Zero disables cache.
+        \param handler Invoked when started transfer is finished (in addition to ReceiveTMCompleted or ReceiveTMFailed).
+        \retval true Started transfer (or served from cache).
+        \retval false Cannot start transfer (\a handler is not invoked).
+    */
+    bool ReceiveTM(uint8_t address, uint8_t channel, uint8_t retry_count = 3, uint32_t max_age_ms = 0,
+                   ReceiveTMHandler handler = nullptr);
+
+    //! Returns last received telemetry if it is not older than \a max_age_ms.
+    /*!
+        \param address CAN address of the sink.
+        \param channel Channel number.
+        \param max_age_ms Maximum age (in msec) of cached telemetry.
+        \param data Cached telemetry data (set only on success).
+        \retval true Fresh cached telemetry available.
+        \retval false No cached telemetry or cached telemetry too old.
     */
-    bool ReceiveTM(uint8_t address, uint8_t channel, uint8_t retry_count = 3);
+    bool GetCachedTM(uint8_t address, uint8_t channel, uint32_t max_age_ms, std::vector<uint8_t>& data) const;
+
+    //! Discards all cached telemetry.
+    void ClearTMCache();
 
     //! Starts sending a block of data.
     /*!
@@ -130,11 +259,12 @@ public:
         \param retry_count Maximum number of request retries after each timeout before transfer fails.
         \param report_delay_ms Time delay (in msec) between end of data transmission and status report request.
         \param report_retry_count Maximum number of data retransmissions and status requests before transfer fails.
+        \param handler Invoked when started transfer is finished (in addition to SendBlockCompleted or SendBlockFailed).
         \retval true Started transfer.
-        \retval false Cannot start transfer.
+        \retval false Cannot start transfer (\a handler is not invoked).
     */
     bool SendBlock(uint8_t address, uint64_t start, const std::vector<uint8_t>& data, uint8_t retry_count = 3,
-                   uint32_t report_delay_ms = 20, uint8_t report_retry_count = 3);
+                   uint32_t report_delay_ms = 20, uint8_t report_retry_count = 3, SendBlockHandler handler = nullptr);
 
     //! Starts receiving a block of data.
     /*!
@@ -143,11 +273,50 @@ public:
         \param length Number of data blocks to transfer (8 bytes each).
         \param retry_count Maximum number of request retries after each timeout before transfer fails.
         \param start_retry_count Maximum number of start retries before transfer fails.
+        \param handler Invoked when started transfer is finished (in addition to ReceiveBlockCompleted or ReceiveBlockFailed).
         \retval true Started transfer.
-        \retval false Cannot start transfer.
+        \retval false Cannot start transfer (\a handler is not invoked).
     */
     bool ReceiveBlock(uint8_t to_address, uint64_t start_address, uint8_t length,
-                      uint8_t retry_count = 3, uint8_t start_retry_count = 3);
+                      uint8_t retry_count = 3, uint8_t start_retry_count = 3, ReceiveBlockHandler handler = nullptr);
+
+    //! Sends a telecommand and reads back telemetry from the same channel.
+    /*!
+        Telemetry request is sent directly from the telecommand ACK handler.
+        Signals of both transfers are emitted as if SendTC and ReceiveTM were called separately.
+
+        \param address CAN address of the sink.
+        \param channel Channel number.
+        \param data Telecommand data which shall be transmitted.
+        \param handler Invoked when telemetry is received or when either of the transfers fails.
+        \param tc_retry_count Maximum number of telecommand request retries.
+        \param tm_retry_count Maximum number of telemetry request retries.
+        \retval true Started transaction.
+        \retval false Cannot start transaction (\a handler is not invoked).
+    */
+    bool SendTCReceiveTM(uint8_t address, uint8_t channel, const std::vector<uint8_t>& data,
+                         ReceiveTMHandler handler = nullptr, uint8_t tc_retry_count = 0, uint8_t tm_retry_count = 3);
+
+    //! Sends a block of data and reads it back from the same location.
+    /*!
+        Get block request is sent directly from the set block completion.
+        Signals of both transfers are emitted as if SendBlock and ReceiveBlock were called separately.
+
+        \param address CAN address of the sink.
+        \param start Starting address where data shall be saved at the sink.
+        \param data Data which shall be transmitted.
+        \param handler Invoked with read back data or when either of the transfers fails.
+        \param retry_count Maximum number of request retries (both transfers).
+        \param report_delay_ms Time delay (in msec) between end of data transmission and status report request.
+        \param report_retry_count Maximum number of data retransmissions and status requests before set block fails.
+        \param start_retry_count Maximum number of start retries before get block fails.
+        \retval true Started transaction.
+        \retval false Cannot start transaction (\a handler is not invoked).
+    */
+    bool SendBlockReceiveBlock(uint8_t address, uint64_t start, const std::vector<uint8_t>& data,
+                               ReceiveBlockHandler handler = nullptr, uint8_t retry_count = 3,
+                               uint32_t report_delay_ms = 20, uint8_t report_retry_count = 3,
+                               uint8_t start_retry_count = 3);
 
     //! Sends a time synchronisation frame.
     /*!
@@ -173,9 +342,54 @@ public:
     */
     CanBus GetActiveBus() const;
 
+    //! Returns transport of CAN \a bus (driver of CANdelaber or transport given to Start).
+    CanTransport& GetTransport(CanBus bus);
+
     //! Causes toggle active bus between nominal and redundat CAN bus.
+    /*!
+        Active transfers are preserved. Frames still waiting on the previous bus are discarded
+        and every transfer re-sends its current step on the new bus without consuming a retry.
+        Block transfers continue from their current bitmap.
+    */
     void CanBusSwitch();
 
+    //! Enables or disables dual bus transmission.
+    /*!
+        In dual bus mode every frame is transmitted via nominal and redundant bus, and responses to
+        active transfers are accepted from whichever bus delivers them first. The copy of a response
+        from the other bus is dropped silently. Frame sent and send error notifications are still
+        taken from nominal bus only.
+
+        \param enabled If true, dual bus transmission is enabled.
+    */
+    void SetDualBus(bool enabled);
+
+    //! Returns true if dual bus transmission is enabled.
+    bool IsDualBus() const;
+
+    //! Enables promiscuous mode feeding passive bus \a analyzer, nullptr disables it.
+    /*!
+        In promiscuous mode acceptance filters pass every frame, and every frame received or sent
+        via nominal bus is given to the analyzer, including transfers between other nodes.
+        Frames not addressed to this node or hosted nodes are still ignored by the stack.
+        Analyzer must outlive the stack or be reset before it is destroyed.
+    */
+    void SetAnalyzer(BusAnalyzer* analyzer);
+
+    //! Sets \a clock of all timeouts and delays of the stack (system clock by default).
+    /*!
+        Clock is also used by the internal Candelaber comm drivers (write timeout), transports
+        given to Start keep their own clock. Must be called while the stack is stopped. Clock must
+        outlive the stack.
+    */
+    void SetClock(Clock& clock);
+
+    //! Configures automatic bus switching.
+    /*!
+        \param settings Redundancy settings.
+    */
+    void SetRedundancy(const RedundancySettings& settings);
+
     //! Converts CAN TS frame structure to CAN frame structure.
     /*!
         \param can_ts_frame CAN TS frame structure.
@@ -185,6 +399,8 @@ public:
 
     //! Converts CAN frame structure to CAN TS frame structure.
     /*!
+        Identifier is decoded with CanTsFrame::DecodeId, which also decodes frames without copying data.
+
         \param can_frame CAN frame structure.
         \return CAN TS frame structure.
     */
@@ -193,6 +409,40 @@ public:
     //! Return address of the local CAN-TS node.
     uint8_t GetAddress() const;
 
+    //! Hosts a simulated node which answers transfers addressed to it.
+    /*!
+        Hosted node answers telecommands and telemetry requests with handlers set by SetTCHandler
+        and SetTMHandler (NACK if channel has no handler), and serves set and get block transfers of
+        any number of clients from its memory. Nodes are served on the nominal bus only and may be
+        added and removed while the stack is started.
+
+        \param address CAN address of the node (must differ from own address and broadcast addresses).
+        \param memory_size Size of node memory (in bytes) accessible by set and get block transfers.
+        \retval true Node added.
+        \retval false Invalid address or node already hosted.
+    */
+    bool AddNode(uint8_t address, size_t memory_size = 0x10000);
+
+    //! Removes hosted node with \a address. Block transfers in progress are discarded.
+    void RemoveNode(uint8_t address);
+
+    //! Sets \a handler of telecommands received by hosted \a node on \a channel (nullptr removes it).
+    /*!
+        \retval true Handler set.
+        \retval false Node is not hosted.
+    */
+    bool SetTCHandler(uint8_t node, uint8_t channel, ServeTCHandler handler);
+
+    //! Sets \a handler of telemetry requests received by hosted \a node on \a channel (nullptr removes it).
+    /*!
+        \retval true Handler set.
+        \retval false Node is not hosted.
+    */
+    bool SetTMHandler(uint8_t node, uint8_t channel, ServeTMHandler handler);
+
+    //! Returns memory of hosted \a node, nullptr if node is not hosted.
+    std::vector<uint8_t>* GetNodeMemory(uint8_t node);
+
 signals:
 
     //! Triggered when telecommand successfuly transmitted.
@@ -247,6 +497,20 @@ signals:
     */
     void KeepAliveReceivedRedundant(uint8_t address, uint8_t channel, const std::vector<uint8_t>& data);
 
+    //! Triggered when active bus is switched (manually or automatically).
+    /*!
+        \param bus New active CAN bus.
+    */
+    void BusSwitched(sky::CAN_TS::CanBus bus);
+
+    //! Triggered before completion signal of TC, TM, set block or get block transfer.
+    /*!
+        \param type Transfer type (CanTsFrame::TransferType).
+        \param address CAN address of transfer destination.
+        \param timing Time stamps of transfer stages.
+    */
+    void TransferTimed(uint8_t type, uint8_t address, sky::CAN_TS::TransferTiming timing);
+
     //! Triggered when time synchronisation frame successfuly transmitted.
     void SendTimeSyncCompleted();
 
@@ -304,14 +568,25 @@ signals:
     */
     void SendUnsolicitedFailed(uint8_t address, uint8_t channel);
 
+    //! Triggered when set block transfer to a hosted node is completed.
+    /*!
+        \param node CAN address of the hosted node.
+        \param from CAN address of the client.
+        \param start Memory address where data was written.
+        \param length Number of bytes written.
+    */
+    void NodeMemoryWritten(uint8_t node, uint8_t from, uint64_t start, uint32_t length);
+
 private:
     //! Disable copy and assignment constructors.
     Q_DISABLE_COPY(CAN_TS)
 
     //! Stores common tranmission state.
     struct Transfer {
+        uint32_t id = 0; //!< Transfer identifier (carried in frame tokens).
+        TransferTiming timing; //!< Time stamps of transfer stages.
         uint8_t address = 0; //!< Address of transfer destination.
-        std::shared_ptr<QTimer> watchdog = nullptr; //!< Watchdog timer.
+        std::shared_ptr<ClockTimer> watchdog = nullptr; //!< Watchdog timer.
         uint8_t retry_count = 0; //!< Number of request retries.
         uint8_t max_retries = 0; //!< Maximum number of request retries before transfer fails.
         uint8_t channel = 0; //!< Transfer channel number.
@@ -332,20 +607,24 @@ private:
     //! Stores state of a telecommand transfer.
     struct TelecommandTransfer : Transfer {
         std::vector<uint8_t> data; //!< Data to be transferred.
+        SendTCHandler handler; //!< Completion handler.
     };
 
     //! Stores state of a telemetry transfer.
     struct TelemetryTransfer : Transfer {
+        std::vector<ReceiveTMHandler> handlers; //!< Completion handlers of all requests served by this transfer.
     };
 
     //! Stores common block transmission state.
     struct BlockTransfer {
+        uint32_t id = 0; //!< Transfer identifier (carried in frame tokens).
+        TransferTiming timing; //!< Time stamps of transfer stages.
         uint8_t address = 0; //!< Address of transfer destination.
         std::vector<uint8_t> start; //!< Start address at transfer destination where data is stored.
         std::vector<uint8_t> data; //!< Data to be transferred.
         std::vector<uint8_t> bitmap; //!< Bitmap of data blocks.
         uint8_t blocks = 0; //!< Number of data blocks to be transfered.
-        std::shared_ptr<QTimer> watchdog = nullptr; //!< Watchdog timer.
+        std::shared_ptr<ClockTimer> watchdog = nullptr; //!< Watchdog timer.
         uint8_t retry_count = 0; //!< Number of request retries.
         uint8_t max_retries = 0; //!< Maximum number of request retransmissions before transfer fails.
 
@@ -372,22 +651,105 @@ private:
     //! Stores state of a set block transfer.
     struct SetBlockTransfer : BlockTransfer {
         bool done = false; //!< Indicates if transfer is complete.
-        std::shared_ptr<QTimer> report_delay_timer = nullptr; //!< Timer for generation of delay between data transmission and status request.
+        std::shared_ptr<ClockTimer> report_delay_timer = nullptr; //!< Timer for generation of delay between data transmission and status request.
         uint32_t report_delay = 0; //!< Delay between data transmission and status request.
         uint8_t report_retry_count = 0; //!< Number of data retransmissions and status requests.
         uint8_t max_report_retries = 0; //!< Maximum number of data retransmissions and status requests before transfer fails.
+        SendBlockHandler handler; //!< Completion handler.
     };
 
     //! Stores state of a get block transfer.
     struct GetBlockTransfer : BlockTransfer {
         uint8_t start_retry_count = 0; //!< Number of start request retransmissions.
         uint8_t max_start_retries = 0; //!< Maximum number of start request retransmissions before transfer fails.
+        ReceiveBlockHandler handler; //!< Completion handler.
+    };
+
+    //! Stores last received telemetry of a channel.
+    struct TelemetryCacheEntry {
+        std::vector<uint8_t> data; //!< Received data.
+        qint64 timestamp = 0; //!< Time of reception (in msec since Start).
+    };
+
+    // NOTE
+    // Transfers are kept in lists, so iterators captured by watchdog
+    // timers remain valid while other transfers start and finish.
+    std::list<TelecommandTransfer> tc_transfers_; //!< Outbound telecommand transfers.
+    std::list<TelemetryTransfer> tm_transfers_; //!< Outbound telemetry transfers.
+    std::list<SetBlockTransfer> sb_transfers_; //!< Outbound set block transfers.
+    std::list<GetBlockTransfer> gb_transfers_; //!< Outbound get block transfers.
+
+    // Transfer lookup by identifier from frame token (instead of searching by address and channel).
+    std::unordered_map<uint32_t, std::list<TelecommandTransfer>::iterator> tc_index_; //!< Telecommand transfers by identifier.
+    std::unordered_map<uint32_t, std::list<TelemetryTransfer>::iterator> tm_index_; //!< Telemetry transfers by identifier.
+    std::unordered_map<uint32_t, std::list<SetBlockTransfer>::iterator> sb_index_; //!< Set block transfers by identifier.
+    std::unordered_map<uint32_t, std::list<GetBlockTransfer>::iterator> gb_index_; //!< Get block transfers by identifier.
+
+    // Transfer lookup by response match key (node and channel, or node of block transfers), so responses
+    // are dispatched without searching active transfers.
+    std::unordered_map<uint32_t, std::list<TelecommandTransfer>::iterator> tc_nodes_; //!< Telecommand transfers by ChannelKey.
+    std::unordered_map<uint32_t, std::list<TelemetryTransfer>::iterator> tm_nodes_; //!< Telemetry transfers by ChannelKey.
+    std::unordered_map<uint32_t, std::list<SetBlockTransfer>::iterator> sb_nodes_; //!< Set block transfers by node address.
+    std::unordered_map<uint32_t, std::list<GetBlockTransfer>::iterator> gb_nodes_; //!< Get block transfers by node address.
+    uint32_t next_transfer_id_ = 0; //!< Last assigned transfer identifier.
+    std::unordered_map<uint32_t, MetricHistogram*> latency_metrics_; //!< Latency histograms by transfer type and node.
+    std::unordered_map<uint32_t, MetricHistogram*> stage_metrics_; //!< Stage latency histograms by transfer type and stage.
+    uint64_t rx_read_time_ = 0; //!< Read time of response being dispatched (0 outside of dispatch).
+    uint64_t rx_dispatch_time_ = 0; //!< Time when dispatch of response started (0 outside of dispatch).
+
+    //! Stores state of set or get block transfer served by a hosted node.
+    struct ServedBlock {
+        uint64_t start = 0; //!< Memory address of first block.
+        uint8_t blocks = 0; //!< Number of blocks.
+        std::vector<uint8_t> start_bytes; //!< Start address as received in request.
+        std::vector<uint8_t> bitmap; //!< Received blocks (set block only).
+        bool written = false; //!< NodeMemoryWritten emitted (set block only).
+    };
+
+    //! Stores state of a node hosted with AddNode.
+    struct ServedNode {
+        std::unordered_map<uint8_t, ServeTCHandler> tc_handlers; //!< Telecommand handlers by channel.
+        std::unordered_map<uint8_t, ServeTMHandler> tm_handlers; //!< Telemetry handlers by channel.
+        std::vector<uint8_t> memory; //!< Memory accessed by block transfers.
+        std::unordered_map<uint8_t, ServedBlock> set_blocks; //!< Set block transfers by client address.
+        std::unordered_map<uint8_t, ServedBlock> get_blocks; //!< Get block transfers by client address.
+    };
+
+    std::unordered_map<uint8_t, ServedNode> served_nodes_; //!< Hosted nodes by address.
+    std::unordered_map<uint32_t, MetricCounter*> served_metrics_; //!< Response counters by transfer type and result.
+
+    std::unordered_map<uint16_t, TelemetryCacheEntry> tm_cache_; //!< Last received telemetry per address and channel.
+    Clock* clock_ = &Clock::System(); //!< Time base of timeouts, telemetry cache and keep alive tracking.
+    qint64 start_time_ = -1; //!< Time of Start (in msec of clock_), -1 if not started.
+
+    //! Stores time of last keep alive received from a node on each bus.
+    struct NodeKeepAlive {
+        qint64 last_seen[2] = {-1, -1}; //!< Time of last keep alive (in msec since Start) on CAN0 and CAN1, -1 if none.
+    };
+
+    std::unordered_map<uint8_t, NodeKeepAlive> keep_alive_; //!< Keep alive tracking per node address.
+    RedundancySettings redundancy_; //!< Automatic bus switching settings.
+    std::unique_ptr<ClockTimer> redundancy_timer_; //!< Timer of periodic keep alive evaluation (created by SetRedundancy).
+    uint8_t redundancy_votes_ = 0; //!< Number of consecutive checks in favour of bus switch.
+    qint64 last_bus_switch_ = -1; //!< Time of last bus switch (in msec since Start), -1 if none.
+
+    bool dual_bus_ = false; //!< Transmit via both buses and accept responses from both.
+
+    //! Response accepted in dual bus mode whose copy from the other bus was not received yet.
+    struct DualBusResponse {
+        int64_t time = 0; //!< Clock time of acceptance (msec).
+        uint8_t bus = 0; //!< CAN bus (0 or 1) the response was accepted from.
+        uint8_t type = 0; //!< Transfer type.
+        uint8_t from_address = 0; //!< Address of the responding node.
+        uint16_t command = 0; //!< Command field.
+        uint8_t length = 0; //!< Number of data bytes.
+        uint8_t data[8] = {}; //!< Data bytes.
     };
 
-    std::vector<TelecommandTransfer> tc_transfers_; //!< Outbound telecommand transfers.
-    std::vector<TelemetryTransfer> tm_transfers_; //!< Outbound telemetry transfers.
-    std::vector<SetBlockTransfer> sb_transfers_; //!< Outbound set block transfers.
-    std::vector<GetBlockTransfer> gb_transfers_; //!< Outbound get block transfers.
+    static constexpr size_t kMaxDualBusResponses = 64; //!< Responses awaiting copy (whole get block window).
+    std::vector<DualBusResponse> dual_bus_responses_; //!< Responses awaiting copy, oldest first.
+    BusAnalyzer* analyzer_ = nullptr; //!< Passive analyzer of all nominal bus traffic (promiscuous mode), nullptr if disabled.
+    CanTsFrame analyzer_frame_; //!< Sent frame given to analyzer (data buffer is reused).
 
     uint8_t address_  = 0; //!< Address of the source.
     uint32_t timeout_ = 0; //!< CAN TS transfer response timeout.
@@ -396,80 +758,90 @@ private:
 
     CommDriver com0_; //!< CAN bus 0 comm driver.
     CommDriver com1_; //!< CAN bus 1 comm driver.
+    CanTransport* can0_ = &com0_; //!< CAN bus 0 transport (com0_ or transport given to Start).
+    CanTransport* can1_ = &com1_; //!< CAN bus 1 transport (com1_ or transport given to Start).
 
     //! Executed when telecommand frame successfuly transmitted by lower-level protocol.
     /*!
-        \param can_ts_frame Transmitted CAN TS frame structure.
+        \param can_ts_frame Transmitted CAN TS frame header (without data) restored from frame token.
+        \param transfer_id Identifier of transfer which sent the frame.
     */
-    void SendTCFrameSent(const CanTsFrame& can_ts_frame);
+    void SendTCFrameSent(const CanTsFrame& can_ts_frame, uint32_t transfer_id);
 
     //! Executed when telemetry frame successfuly transmitted by lower-level protocol.
     /*!
-        \param can_ts_frame Transmitted CAN TS frame structure.
+        \param can_ts_frame Transmitted CAN TS frame header (without data) restored from frame token.
+        \param transfer_id Identifier of transfer which sent the frame.
     */
-    void ReceiveTMFrameSent(const CanTsFrame& can_ts_frame);
+    void ReceiveTMFrameSent(const CanTsFrame& can_ts_frame, uint32_t transfer_id);
 
     //! Executed when get block frame successfuly transmitted by lower-level protocol.
     /*!
-        \param can_ts_frame Transmitted CAN TS frame structure.
+        \param can_ts_frame Transmitted CAN TS frame header (without data) restored from frame token.
+        \param transfer_id Identifier of transfer which sent the frame.
     */
-    void ReceiveBlockFrameSent(const CanTsFrame& can_ts_frame);
+    void ReceiveBlockFrameSent(const CanTsFrame& can_ts_frame, uint32_t transfer_id);
 
     //! Executed when set block frame successfuly transmitted by lower-level protocol.
     /*!
-        \param can_ts_frame Transmitted CAN TS frame structure.
+        \param can_ts_frame Transmitted CAN TS frame header (without data) restored from frame token.
+        \param transfer_id Identifier of transfer which sent the frame.
     */
-    void SendBlockFrameSent(const CanTsFrame& can_ts_frame);
+    void SendBlockFrameSent(const CanTsFrame& can_ts_frame, uint32_t transfer_id);
 
     //! Executed when time sync frame successfuly transmitted by lower-level protocol.
     void SendTimeSyncFrameSent();
 
     //! Executed when unsolicited telemetry frame successfuly transmitted by lower-level protocol.
     /*!
-        \param can_ts_frame Transmitted CAN TS frame structure.
+        \param can_ts_frame Transmitted CAN TS frame header (without data) restored from frame token.
     */
     void SendUnsolicitedFrameSent(const CanTsFrame& can_ts_frame);
 
     //! Executed when an error occured while lower-level protocol was transmitting a telecommand frame.
     /*!
-        \param can_ts_frame Transmitted CAN TS frame structure.
+        \param can_ts_frame Transmitted CAN TS frame header (without data) restored from frame token.
+        \param transfer_id Identifier of transfer which sent the frame.
         \param error Error code.
     */
-    void SendTCFrameSendError(const CanTsFrame& can_ts_frame, CommDriver::CanSendError error);
+    void SendTCFrameSendError(const CanTsFrame& can_ts_frame, uint32_t transfer_id, CanTransport::CanSendError error);
 
     //! Executed when an error occured while lower-level protocol was transmitting a telemetry frame.
     /*!
-        \param can_ts_frame Transmitted CAN TS frame structure.
+        \param can_ts_frame Transmitted CAN TS frame header (without data) restored from frame token.
+        \param transfer_id Identifier of transfer which sent the frame.
         \param error Error code.
     */
-    void ReceiveTMFrameSendError(const CanTsFrame& can_ts_frame, CommDriver::CanSendError error);
+    void ReceiveTMFrameSendError(const CanTsFrame& can_ts_frame, uint32_t transfer_id, CanTransport::CanSendError error);
 
     //! Executed when an error occured while lower-level protocol was transmitting a set block frame.
     /*!
-        \param can_ts_frame Transmitted CAN TS frame structure.
+        \param can_ts_frame Transmitted CAN TS frame header (without data) restored from frame token.
+        \param transfer_id Identifier of transfer which sent the frame.
         \param error Error code.
     */
-    void SendBlockFrameSendError(const CanTsFrame& can_ts_frame, CommDriver::CanSendError error);
+    void SendBlockFrameSendError(const CanTsFrame& can_ts_frame, uint32_t transfer_id, CanTransport::CanSendError error);
 
     //! Executed when an error occured while lower-level protocol was transmitting a get block frame.
     /*!
-        \param can_ts_frame Transmitted CAN TS frame structure.
+        \param can_ts_frame Transmitted CAN TS frame header (without data) restored from frame token.
+        \param transfer_id Identifier of transfer which sent the frame.
         \param error Error code.
     */
-    void ReceiveBlockFrameSendError(const CanTsFrame& can_ts_frame, CommDriver::CanSendError error);
+    void ReceiveBlockFrameSendError(const CanTsFrame& can_ts_frame, uint32_t transfer_id, CanTransport::CanSendError error);
 
     //! Executed when an error occured while lower-level protocol was transmitting a time sync frame.
     /*!
         \param error Error code.
     */
-    void SendTimeSyncFrameSendError(CommDriver::CanSendError error);
+    void SendTimeSyncFrameSendError(CanTransport::CanSendError error);
 
     //! Executed when an error occured while lower-level protocol was transmitting an unsolicited telemetry frame.
     /*!
-        \param can_ts_frame Transmitted CAN TS frame structure.
+        \param can_ts_frame Transmitted CAN TS frame header (without data) restored from frame token.
         \param error Error code.
     */
-    void SendUnsolicitedFrameSendError(const CanTsFrame& can_ts_frame, CommDriver::CanSendError error);
+    void SendUnsolicitedFrameSendError(const CanTsFrame& can_ts_frame, CanTransport::CanSendError error);
 
     //! Executed when telecommand frame successfuly received by lower-level protocol.
     /*!
@@ -514,82 +886,244 @@ private:
     */
     void ReceivedKeepAliveFrame(const CanTsFrame& can_ts_frame, bool nominal_bus);
 
-    //! Sends a CAN TS frame via nominal CAN bus.
+    //! Records keep alive reception for automatic bus switching.
+    /*!
+        \param address CAN address of the node.
+        \param nominal_bus If true, frame received via nominal bus. If false, frame received via redundant bus.
+    */
+    void RedundancyKeepAlive(uint8_t address, bool nominal_bus);
+
+    //! Returns acceptance filters for frames addressed to this node, hosted nodes, keep alive and time sync broadcasts (all frames in promiscuous mode).
+    std::vector<CanFilter> GetAcceptanceFilters() const;
+
+    //! Answers frame received by hosted \a node.
+    /*!
+        \param node Hosted node the frame is addressed to.
+        \param can_ts_frame Received CAN TS frame structure.
+    */
+    void ServeFrameReceived(ServedNode& node, const CanTsFrame& can_ts_frame);
+
+    //! Answers telecommand frame received by hosted \a node.
+    void ServeTC(ServedNode& node, const CanTsFrame& can_ts_frame);
+
+    //! Answers telemetry frame received by hosted \a node.
+    void ServeTM(ServedNode& node, const CanTsFrame& can_ts_frame);
+
+    //! Answers set block frame received by hosted \a node.
+    void ServeSetBlock(ServedNode& node, const CanTsFrame& can_ts_frame);
+
+    //! Answers get block frame received by hosted \a node.
+    void ServeGetBlock(ServedNode& node, const CanTsFrame& can_ts_frame);
+
+    //! Opens \a block of \a blocks blocks at start address \a start_bytes in memory of \a node.
+    /*!
+        \retval true Block fits into node memory.
+        \retval false Block is out of node memory range.
+    */
+    bool ServeBlockOpen(const ServedNode& node, ServedBlock& block, uint8_t blocks, const std::vector<uint8_t>& start_bytes);
+
+    //! Sends response \a frame of hosted node and counts it in metrics as \a accepted (ACK or data) or rejected (NACK).
+    void ServeResponse(const CanTsFrame& frame, bool accepted);
+
+    //! Executed when response frame of hosted node could not be transmitted by lower-level protocol.
+    /*!
+        \param can_ts_frame Transmitted CAN TS frame header (without data) restored from frame token.
+        \param error Error code.
+    */
+    void ServeFrameSendError(const CanTsFrame& can_ts_frame, CanTransport::CanSendError error);
+
+    //! Dispatches a received frame of TC, TM, set block or get block transfer to its handler.
+    /*!
+        \param can_ts_frame Received CAN TS frame addressed to this node.
+        \param read_time Time when frame was read from serial port (CanFrame::Timing::read).
+        \return False if frame is not of one of the transfer types.
+    */
+    bool ReceivedTransferFrame(const CanTsFrame& can_ts_frame, uint64_t read_time);
+
+    //! Checks if a response received in dual bus mode is a copy of one already accepted from the other bus.
     /*!
+        Responses which are not copies are remembered until their copy is received or transfer
+        response timeout elapses, so repeated responses (e.g. NACKs of retried requests) are still
+        accepted once per bus pair.
+
+        \param can_ts_frame Received CAN TS frame addressed to this node.
+        \param nominal_bus True if frame was received via nominal bus.
+        \return True if frame is a copy and shall be dropped.
+    */
+    bool DualBusDuplicate(const CanTsFrame& can_ts_frame, bool nominal_bus);
+
+    //! Sends a CAN TS frame via nominal CAN bus (and via redundant CAN bus in dual bus mode).
+    /*!
+        Frame header and \a transfer_id are packed into a token which lower-level protocol returns
+        with frame sent or send error notification.
+
         \param frame CAN TS frame.
+        \param transfer_id Identifier of transfer sending the frame (0 if none).
         \retval true CAN TS frame successfully sent.
         \retval false Cannot send CAN TS frame.
     */
-    bool SendFrame(const CanTsFrame& frame);
+    bool SendFrame(const CanTsFrame& frame, uint32_t transfer_id = 0);
+
+    //! Returns time since Start (in msec of clock_).
+    qint64 ElapsedSinceStart() const;
+
+    //! Returns index (0 or 1) of physical bus which is nominal (\a nominal_bus true) or redundant.
+    uint8_t BusIndex(bool nominal_bus) const;
+
+    //! Records transfer \a event of transfer \a type to \a address in trace and metrics.
+    /*!
+        On completion, response stages are stamped in \a timing, stage latencies are recorded and
+        TransferTimed is emitted.
+
+        \param timing Time stamps of transfer stages.
+        \param error Transfer specific error code of failed transfer.
+    */
+    void RecordTransfer(TraceEvent event, uint8_t type, uint8_t address, uint32_t transfer_id, TransferTiming& timing,
+                        uint8_t error = 0);
+
+    //! Records latency of each stage in \a timing of transfer \a type in metrics.
+    void RecordStages(uint8_t type, const TransferTiming& timing);
+
+    //! Returns stage time stamps of active transfer \a transfer_id of \a type, nullptr if transfer is not active.
+    TransferTiming* FindTiming(uint8_t type, uint32_t transfer_id);
+
+    //! Counts retransmission of \a frame of transfer \a type in metrics.
+    void CountRetry(uint8_t type, const char* frame) const;
+
+    //! Returns new non-zero transfer identifier.
+    uint32_t NextTransferId();
+
+    //! Packs header of \a frame and \a transfer_id into frame token (with sender if frame is sent by hosted node).
+    uint64_t MakeFrameToken(const CanTsFrame& frame, uint32_t transfer_id) const;
+
+    //! Restores frame header (without data) and \a transfer_id from frame \a token.
+    /*!
+        \retval true Token is valid.
+        \retval false Frame was not sent with a token.
+    */
+    bool FrameFromToken(uint64_t token, CanTsFrame& frame, uint32_t& transfer_id) const;
+
+    //! Returns response match key of telecommand and telemetry transfers with node \a address on \a channel.
+    static uint32_t ChannelKey(uint8_t address, uint8_t channel);
+
+    //! Returns transfer with \a id (identifier or match key of \a index) or end of \a transfers if it is no longer active.
+    template <typename T>
+    static typename std::list<T>::iterator FindTransfer(std::list<T>& transfers,
+            const std::unordered_map<uint32_t, typename std::list<T>::iterator>& index, uint32_t id) {
+        auto it = index.find(id);
+        return (it != index.end()) ? it->second : transfers.end();
+    }
+
+    //! Re-sends current step of all active transfers after bus switch.
+    void ResumeTransfers();
+
+    //! Re-sends current step of telecommand transfer.
+    void SendTCResume(const std::list<TelecommandTransfer>::iterator& transfer);
+
+    //! Re-sends current step of telemetry transfer.
+    void ReceiveTMResume(const std::list<TelemetryTransfer>::iterator& transfer);
+
+    //! Re-sends current step of set block transfer.
+    void SendBlockResume(const std::list<SetBlockTransfer>::iterator& transfer);
+
+    //! Re-sends current step of get block transfer.
+    void ReceiveBlockResume(const std::list<GetBlockTransfer>::iterator& transfer);
 
     //! Retry sending telecommand request.
     /*!
         \param transfer Selected telecommand transfer.
     */
-    void SendTCRetry(const std::vector<TelecommandTransfer>::iterator& transfer);
+    void SendTCRetry(const std::list<TelecommandTransfer>::iterator& transfer);
+
+    //! Finishes telecommand transfer successfully, notifies subscribers and removes the transfer.
+    void SendTCComplete(const std::list<TelecommandTransfer>::iterator& transfer);
+
+    //! Finishes telecommand transfer with \a error, notifies subscribers and removes the transfer.
+    void SendTCFail(const std::list<TelecommandTransfer>::iterator& transfer, SendTCError error);
+
+    //! Finishes telemetry transfer successfully with received \a data, notifies subscribers and removes the transfer.
+    void ReceiveTMComplete(const std::list<TelemetryTransfer>::iterator& transfer, const std::vector<uint8_t>& data);
+
+    //! Finishes telemetry transfer with \a error, notifies subscribers and removes the transfer.
+    void ReceiveTMFail(const std::list<TelemetryTransfer>::iterator& transfer, ReceiveTMError error);
+
+    //! Finishes set block transfer successfully, notifies subscribers and removes the transfer.
+    void SendBlockComplete(const std::list<SetBlockTransfer>::iterator& transfer);
+
+    //! Finishes set block transfer with \a error, notifies subscribers and removes the transfer.
+    void SendBlockFail(const std::list<SetBlockTransfer>::iterator& transfer, SendBlockError error);
+
+    //! Finishes get block transfer successfully, notifies subscribers and removes the transfer.
+    void ReceiveBlockComplete(const std::list<GetBlockTransfer>::iterator& transfer);
+
+    //! Finishes get block transfer with \a error, notifies subscribers and removes the transfer.
+    void ReceiveBlockFail(const std::list<GetBlockTransfer>::iterator& transfer, ReceiveBlockError error);
+
+    //! Returns telemetry cache key of given address and channel.
+    static uint16_t TelemetryCacheKey(uint8_t address, uint8_t channel);
 
     //! Retry sending telemetry request.
     /*!
         \param transfer Selected telemetry transfer.
     */
-    void ReceiveTMRetry(const std::vector<TelemetryTransfer>::iterator& transfer);
+    void ReceiveTMRetry(const std::list<TelemetryTransfer>::iterator& transfer);
 
     //! Retry sending set block request.
     /*!
         \param transfer Selected set block transfer.
     */
-    void SendBlockRetryRequest(const std::vector<SetBlockTransfer>::iterator& transfer);
+    void SendBlockRetryRequest(const std::list<SetBlockTransfer>::iterator& transfer);
 
     //! Retry sending set block status request.
     /*!
         \param transfer Selected set block transfer.
     */
-    void SendBlockRetryStatus(const std::vector<SetBlockTransfer>::iterator& transfer);
+    void SendBlockRetryStatus(const std::list<SetBlockTransfer>::iterator& transfer);
 
     //! Retry sending set block abort.
     /*!
         \param transfer Selected set block transfer.
     */
-    void SendBlockRetryAbort(const std::vector<SetBlockTransfer>::iterator& transfer);
+    void SendBlockRetryAbort(const std::list<SetBlockTransfer>::iterator& transfer);
 
     //! Retry sending get block request.
     /*!
         \param transfer Selected get block transfer.
     */
-    void ReceiveBlockRetryRequest(const std::vector<GetBlockTransfer>::iterator& transfer);
+    void ReceiveBlockRetryRequest(const std::list<GetBlockTransfer>::iterator& transfer);
 
     //! Retry sending get block start.
     /*!
         \param transfer Selected get block transfer.
     */
-    void ReceiveBlockRetryStart(const std::vector<GetBlockTransfer>::iterator& transfer);
+    void ReceiveBlockRetryStart(const std::list<GetBlockTransfer>::iterator& transfer);
 
     //! Retry sending get block abort.
     /*!
         \param transfer Selected get block transfer.
     */
-    void ReceiveBlockRetryAbort(const std::vector<GetBlockTransfer>::iterator& transfer);
+    void ReceiveBlockRetryAbort(const std::list<GetBlockTransfer>::iterator& transfer);
 
     //! Process received ACK frame during get block operation.
-    void ReceiveBlockFrameReceivedAck(const CanTsFrame& frame, const std::vector<GetBlockTransfer>::iterator& transfer);
+    void ReceiveBlockFrameReceivedAck(const CanTsFrame& frame, const std::list<GetBlockTransfer>::iterator& transfer);
 
     //! Process received NACK frame during get block operation.
-    void ReceiveBlockFrameReceivedNack(const CanTsFrame& frame, const std::vector<GetBlockTransfer>::iterator& transfer);
+    void ReceiveBlockFrameReceivedNack(const CanTsFrame& frame, const std::list<GetBlockTransfer>::iterator& transfer);
 
     //! Process received TRANSFER frame during get block operation.
-    void ReceiveBlockFrameReceivedTransfer(const CanTsFrame& frame, const std::vector<GetBlockTransfer>::iterator& transfer);
+    void ReceiveBlockFrameReceivedTransfer(const CanTsFrame& frame, const std::list<GetBlockTransfer>::iterator& transfer);
 
     //! Process send block state after frame sent.
-    void SendBlockWaitForResponse(const std::vector<SetBlockTransfer>::iterator& transfer, SetBlockTransfer::RxState rxstate) const;
+    void SendBlockWaitForResponse(const std::list<SetBlockTransfer>::iterator& transfer, SetBlockTransfer::RxState rxstate) const;
 
     //! Process received ACK.
-    void SendBlockFrameReceivedAck(const CanTsFrame& frame, const std::vector<SetBlockTransfer>::iterator& transfer);
+    void SendBlockFrameReceivedAck(const CanTsFrame& frame, const std::list<SetBlockTransfer>::iterator& transfer);
 
     //! Process received NACK.
-    void SendBlockFrameReceivedNack(const CanTsFrame& frame, const std::vector<SetBlockTransfer>::iterator& transfer);
+    void SendBlockFrameReceivedNack(const CanTsFrame& frame, const std::list<SetBlockTransfer>::iterator& transfer);
 
     //! Process received REPORT.
-    void SendBlockFrameReceivedReport(const CanTsFrame& frame, const std::vector<SetBlockTransfer>::iterator& transfer);
+    void SendBlockFrameReceivedReport(const CanTsFrame& frame, const std::list<SetBlockTransfer>::iterator& transfer);
 
 private slots:
 
@@ -597,44 +1131,49 @@ private slots:
     /*!
         \param transfer Pointer to telecommand transfer structure.
     */
-    void SendTCTimeout(const std::vector<TelecommandTransfer>::iterator& transfer);
+    void SendTCTimeout(const std::list<TelecommandTransfer>::iterator& transfer);
 
     //! Triggered when telemetry transmission timeout occurs.
     /*!
         \param transfer Pointer to telemetry transfer structure.
     */
-    void ReceiveTMTimeout(const std::vector<TelemetryTransfer>::iterator& transfer);
+    void ReceiveTMTimeout(const std::list<TelemetryTransfer>::iterator& transfer);
 
     //! Triggered when set block transfer timeout occurs.
     /*!
         \param transfer Pointer to set block transfer structure.
     */
-    void SendBlockFrameSentTimeout(const std::vector<SetBlockTransfer>::iterator& transfer);
+    void SendBlockFrameSentTimeout(const std::list<SetBlockTransfer>::iterator& transfer);
 
     //! Triggered when set block transfer status report request should be sent.
     /*!
         \param transfer Pointer to set block transfer structure.
     */
-    void SendBlockReportRequestDelayTimeout(const std::vector<SetBlockTransfer>::iterator& transfer);
+    void SendBlockReportRequestDelayTimeout(const std::list<SetBlockTransfer>::iterator& transfer);
 
     //! Triggered when get block transfer timeout occurs.
     /*!
         \param transfer Pointer to get block transfer structure.
     */
-    void ReceiveBlockFrameSentTimeout(const std::vector<GetBlockTransfer>::iterator& transfer);
+    void ReceiveBlockFrameSentTimeout(const std::list<GetBlockTransfer>::iterator& transfer);
+
+    //! Triggered periodically to evaluate keep alive reception and switch bus if needed.
+    void RedundancyCheck();
 
     //! Executed when frame successfuly transmitted by lower-level protocol via nominal CAN bus.
     /*!
         \param frame Transmitted CAN frame structure.
+        \param token Frame token passed to SendFrame.
     */
-    void CanFrameSentNominal(const sky::CanFrame& frame);
+    void CanFrameSentNominal(const sky::CanFrame& frame, uint64_t token);
 
     //! Executed when an error occured while lower-level protocol was transmitting a frame via nominal CAN bus.
     /*!
         \param frame CAN frame structure which should have been sent.
         \param error Error code.
+        \param token Frame token passed to SendFrame.
     */
-    void CanFrameSendErrorNominal(const sky::CanFrame& frame, CommDriver::CanSendError error);
+    void CanFrameSendErrorNominal(const sky::CanFrame& frame, CanTransport::CanSendError error, uint64_t token);
 
     //! Executed when frame successfuly received by lower-level protocol via nominal CAN bus.
     /*!
@@ -651,9 +1190,11 @@ private slots:
 
 } // namespace sky
 
+Q_DECLARE_METATYPE(sky::CAN_TS::CanBus);
 Q_DECLARE_METATYPE(sky::CAN_TS::SendTCError);
 Q_DECLARE_METATYPE(sky::CAN_TS::ReceiveTMError);
 Q_DECLARE_METATYPE(sky::CAN_TS::SendBlockError);
 Q_DECLARE_METATYPE(sky::CAN_TS::ReceiveBlockError);
+Q_DECLARE_METATYPE(sky::CAN_TS::TransferTiming);
 
 #endif // CAN_TS_H
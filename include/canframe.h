@@ -16,11 +16,38 @@ public:
     bool rtr = false; //!< Check for Retransmission bit.
     std::vector<uint8_t> data; //!< CanFrame payload (max 8 bytes).
 
+    //! Time stamps of frame passing through CommDriver (Trace::Now clock, 0 if not reached).
+    struct Timing {
+        uint64_t enqueued = 0; //!< Frame passed to CommDriver::Send.
+        uint64_t write = 0; //!< Frame written to serial port.
+        uint64_t written = 0; //!< Serial port confirmed write.
+        uint64_t read = 0; //!< Bytes completing received frame read from serial port.
+    } timing; //!< Driver time stamps (not part of frame on bus).
+
     //! Creates byte vector from CommDriver::CanFrame object.
     std::vector<uint8_t> ToStdVector() const;
 
     //! Converts input byte array \a data to CommDriver::CanFrame object.
     static CanFrame FromStdVector(const std::vector<uint8_t>& data);
+
+    //! Reads only \a id and \a extid from byte array \a data, returns false if \a data is too short.
+    static bool PeekId(const std::vector<uint8_t>& data, uint32_t& id, bool& extid);
+};
+
+//! The CanFilter class describes CAN acceptance filter.
+/*!
+    Frame is accepted if its ID type matches \a extid and (frame ID & \a mask) == (\a id & \a mask).
+*/
+class CanFilter {
+public:
+    uint32_t id = 0; //!< Acceptance ID.
+    uint32_t mask = 0; //!< Bits of ID which are compared (0 - don't care).
+    bool extid = true; //!< Filter matches extended (29-bit) or normal (11-bit) IDs.
+
+    //! Returns true if frame with \a frame_id and \a frame_extid passes the filter.
+    bool Matches(uint32_t frame_id, bool frame_extid) const {
+        return (frame_extid == extid) && ((frame_id & mask) == (id & mask));
+    }
 };
 
 }
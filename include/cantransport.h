@@ -0,0 +1,96 @@
+/* See the file "LICENSE.txt" for the full license governing this code. */
+
+#ifndef CANTRANSPORT_H
+#define CANTRANSPORT_H
+
+#include <QMetaMethod>
+#include <QObject>
+#include <cstdint>
+#include <vector>
+#include "canframe.h"
+
+namespace sky {
+
+/*! Interface of CAN frame transport used by CAN_TS.
+
+    Transport delivers frames to one CAN bus. Frames are passed with Send and
+    result of each transmission is reported with CanFrameSent or CanFrameError
+    signal carrying the token passed to Send. Frames received from the bus
+    and passing acceptance filters are delivered with CanFrameReceived, all
+    received frames (e.g. for capture of traffic between other nodes) with
+    CanFrameReceivedUnfiltered.
+
+    CommDriver is the transport of CANdelaber and USB2CAN devices,
+    LoopbackTransport connects CAN_TS to other endpoints in the same process.
+*/
+class CanTransport : public QObject
+{
+    Q_OBJECT
+
+public:
+
+    //! This enum describes errors that occur during frame transmission.
+    enum CanSendError {
+        WriteError, //!< Enough space on dongle, but PC could not write all bytes.
+        DongleBusy  //!< Not enough space on dongle.
+    };
+
+    ~CanTransport() override = default;
+
+    /*!
+      Method sends \a frame to remote unit.
+
+      If frame was accepted for transmission, this function returns \c true;
+      otherwise returns \c false. After a while, signal CanFrameSent() or
+      CanFrameError() is emitted with the same opaque \a token.
+    */
+    virtual bool Send(const CanFrame& frame, uint64_t token = 0) = 0;
+
+    //! Discards frames waiting in transmit buffer. Frame currently being written is not affected.
+    virtual void Flush() = 0;
+
+    /*!
+      Sets acceptance \a filters of received frames. Frame is delivered if it
+      passes any of the filters. Empty list accepts all frames.
+    */
+    virtual void SetFilters(const std::vector<CanFilter>& filters) = 0;
+
+    //! Close active connection.
+    virtual void Close() = 0;
+
+signals:
+    //! Signal emits when CAN \a frame was received and parsed.
+    void CanFrameReceived(sky::CanFrame frame);
+
+    //! Signal emits when CAN \a frame was received, before acceptance filtering.
+    void CanFrameReceivedUnfiltered(sky::CanFrame frame);
+
+    //! Signal emits when CAN \a frame with \a token was successfully sent.
+    void CanFrameSent(const sky::CanFrame& frame, uint64_t token);
+
+    /*!
+      Signal emits after \a error occured during \a frame transmission
+      and its retransmission also has failed. \a token is the one passed to Send.
+    */
+    void CanFrameError(const sky::CanFrame& frame, sky::CanTransport::CanSendError error, uint64_t token);
+
+protected:
+    //! Transport can only be created as part of derived class.
+    CanTransport() = default;
+
+    //! Returns true if CanFrameReceivedUnfiltered is connected (filtered frames need not be decoded otherwise).
+    bool IsUnfilteredConnected() const {
+        static const QMetaMethod signal = QMetaMethod::fromSignal(&CanTransport::CanFrameReceivedUnfiltered);
+        return isSignalConnected(signal);
+    }
+
+private:
+    Q_DISABLE_COPY(CanTransport)
+};
+
+} // namespace sky
+
+Q_DECLARE_METATYPE(sky::CanFrame);
+Q_DECLARE_METATYPE(sky::CanTransport::CanSendError);
+
+#endif // CANTRANSPORT_H
@@ -0,0 +1,230 @@
+/* See the file "LICENSE.txt" for the full license governing this code. */
+
+#ifndef CANTSANALYZER_H
+#define CANTSANALYZER_H
+
+#include <QJsonObject>
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <unordered_map>
+#include <vector>
+#include "cantsframe.h"
+#include "cantscapture.h"
+#include "cantsmetrics.h"
+
+namespace sky
+{
+
+/*! Passive analyzer of CAN TS transfers between any nodes on a bus.
+
+    Every frame is decoded and matched to a session of its transfer type and
+    node pair: client is the node which sends the request, node the one which
+    answers it (telecommand and telemetry sessions are also kept per channel).
+    Sessions follow the protocol as seen on the bus, including NACKs, request
+    retries, block bitmaps, status reports and aborts, and end when:
+
+    - telecommand or telemetry request is acknowledged,
+    - abort of block transfer is acknowledged (completed if all blocks were
+      confirmed, aborted otherwise) or NACKed,
+    - client starts a new transfer of the same type to the same node,
+    - no frame of the session was seen for longer than timeout.
+
+    Response latency is measured from each request (request, status request,
+    start, abort) to the first answer to it, so retried requests do not
+    inflate it. Retransmissions are repeated requests and data frames of
+    blocks which were already seen.
+
+    Analyzer allocates only when a session starts, not per frame. It is not
+    thread safe; independent instances can run in parallel. For time-sharded
+    analysis each instance is limited to a window: it is fed from some time
+    before the window, so it knows sessions in progress, and after the window
+    until sessions started in it have ended. Statistics of the windows are
+    then merged.
+*/
+class BusAnalyzer {
+public:
+
+    //! How session ended.
+    enum class Outcome : uint8_t {
+        kCompleted = 0, //!< Transfer completed.
+        kNacked = 1, //!< Last request was NACKed and not retried.
+        kAborted = 2, //!< Block transfer aborted before all blocks were confirmed.
+        kSuperseded = 3, //!< Client started a new transfer before this one ended.
+        kTimedOut = 4, //!< No frame of the session for longer than timeout.
+        kUnfinished = 5 //!< Session was still open when analysis finished.
+    };
+
+    static constexpr size_t kOutcomes = 6; //!< Number of outcomes.
+
+    //! Step of session the analyzer waits for.
+    enum class Phase : uint8_t {
+        kRequest, //!< Waiting for answer to request.
+        kData, //!< Block data transfer (after request ACK, start or status report).
+        kStatus, //!< Waiting for set block status report.
+        kAbort //!< Waiting for answer to abort.
+    };
+
+    //! Reconstructed transfer between two nodes.
+    struct Session {
+        uint8_t type = 0; //!< Transfer type (CanTsFrame::TransferType).
+        uint8_t client = 0; //!< Address of node which started the transfer.
+        uint8_t node = 0; //!< Address of node which answered it.
+        uint8_t channel = 0; //!< Telecommand or telemetry channel (0 for block transfers).
+        uint8_t blocks = 0; //!< Number of blocks of block transfer.
+        Phase phase = Phase::kRequest; //!< Current step.
+        Outcome outcome = Outcome::kUnfinished; //!< How session ended.
+        bool done = false; //!< All blocks confirmed (set block report with done bit, or all get block data seen).
+        bool waiting = false; //!< Request is waiting for answer.
+        bool nacked = false; //!< Last answer was NACK.
+        bool counted = true; //!< Session started in analysis window and is included in statistics.
+        uint64_t seen = 0; //!< Bitmap of blocks whose data frame was seen.
+        uint64_t start = 0; //!< Time stamp of first request (nsec).
+        uint64_t end = 0; //!< Time stamp of last frame (nsec).
+        uint64_t request = 0; //!< Time stamp of request waiting for answer (nsec).
+        uint64_t latency = 0; //!< Response time of first answered request (nsec), 0 if none.
+        uint32_t frames = 0; //!< Number of frames.
+        uint32_t retransmissions = 0; //!< Repeated requests and data frames.
+        uint32_t nacks = 0; //!< Number of NACKs.
+    };
+
+    //! Statistics of sessions of one transfer type and node pair.
+    struct PairStats {
+        uint64_t sessions = 0; //!< Number of ended sessions.
+        std::array<uint64_t, kOutcomes> outcomes {}; //!< Number of sessions per outcome.
+        uint64_t frames = 0; //!< Frames of ended sessions.
+        uint64_t retransmissions = 0; //!< Retransmissions of ended sessions.
+        uint64_t nacks = 0; //!< NACKs of ended sessions.
+        MetricHistogram::Snapshot latency; //!< Response latency (usec) of every answered request.
+        MetricHistogram::Snapshot duration; //!< Duration (usec) of ended sessions.
+
+        //! Adds ended \a session.
+        void Add(const Session& session);
+
+        //! Adds statistics of \a other.
+        void Merge(const PairStats& other);
+    };
+
+    //! Counters of frames which do not belong to sessions.
+    struct Counters {
+        uint64_t frames = 0; //!< All analyzed frames.
+        uint64_t time_sync = 0; //!< Time sync broadcasts.
+        uint64_t keep_alive = 0; //!< Keep alive broadcasts.
+        uint64_t unsolicited = 0; //!< Unsolicited telemetry (without keep alive).
+        uint64_t unmatched = 0; //!< Answers and data without session (e.g. session started before analysis).
+        uint64_t invalid = 0; //!< Frames with unknown transfer or frame type, or invalid block sequence.
+
+        //! Adds counters of \a other.
+        void Merge(const Counters& other);
+    };
+
+    //! Handler of ended sessions.
+    using SessionHandler = std::function<void(const Session& session)>;
+
+    //! Creates analyzer ending sessions idle for more than \a timeout_ns.
+    explicit BusAnalyzer(uint64_t timeout_ns = 1000000000);
+
+    //! Sets \a handler called for every ended session.
+    void SetSessionHandler(SessionHandler handler);
+
+    //! Limits statistics to frames seen and sessions started from \a begin up to (not including) \a end.
+    void SetWindow(uint64_t begin, uint64_t end);
+
+    //! Analyzes \a frame seen on the bus at \a timestamp (nsec, monotonic).
+    void Process(const CanTsFrame& frame, uint64_t timestamp);
+
+    //! Analyzes captured frame \a record. Transmissions which failed and non CAN TS frames are skipped.
+    void Process(const CaptureRecord& record);
+
+    //! Ends sessions idle for more than timeout at \a timestamp.
+    void Expire(uint64_t timestamp);
+
+    //! Ends all open sessions as unfinished.
+    void Finish();
+
+    //! Adds statistics and counters of \a other (e.g. analyzer of another window).
+    void Merge(const BusAnalyzer& other);
+
+    //! Returns number of open sessions started in analysis window.
+    size_t GetOpenSessions() const;
+
+    //! Returns frame counters.
+    const Counters& GetCounters() const;
+
+    //! Returns statistics per PairKey.
+    const std::map<uint32_t, PairStats>& GetStats() const;
+
+    //! Returns statistics and counters as JSON object.
+    QJsonObject ToJson() const;
+
+    //! Returns key of transfer \a type between \a client and \a node.
+    static uint32_t PairKey(uint8_t type, uint8_t client, uint8_t node);
+
+    //! Returns name of transfer \a type ("TC", "TM", "SB", "GB").
+    static const char* TypeName(uint8_t type);
+
+    //! Returns name of \a outcome.
+    static const char* OutcomeName(Outcome outcome);
+
+    //! Returns statistics \a stats of transfer pair \a key as JSON object.
+    static QJsonObject ToJson(uint32_t key, const PairStats& stats);
+
+private:
+    uint64_t timeout_; //!< Idle time after which session ends (nsec).
+    uint64_t next_expire_ = 0; //!< Time stamp of next check of idle sessions.
+    uint64_t window_begin_ = 0; //!< Start of analysis window.
+    uint64_t window_end_ = UINT64_MAX; //!< End of analysis window.
+    size_t open_counted_ = 0; //!< Open sessions started in analysis window.
+    SessionHandler handler_; //!< Handler of ended sessions.
+    std::unordered_map<uint32_t, Session> sessions_; //!< Open sessions by SessionKey.
+    std::map<uint32_t, PairStats> stats_; //!< Statistics by PairKey.
+    Counters counters_; //!< Frame counters.
+    Counters ignored_; //!< Counters of frames outside analysis window (discarded).
+    Counters* counting_ = &counters_; //!< Counters of frame being processed.
+    CanTsFrame record_frame_; //!< Decoded captured frame (data buffer is reused).
+    std::vector<uint32_t> expired_; //!< Keys of sessions ended by Expire (buffer is reused).
+
+    //! Returns key of session of transfer \a type between \a client and \a node on \a channel.
+    static uint32_t SessionKey(uint8_t type, uint8_t client, uint8_t node, uint8_t channel);
+
+    //! Returns true if \a timestamp is in analysis window.
+    bool InWindow(uint64_t timestamp) const;
+
+    //! Returns open session \a key, ending it first if it was idle for more than timeout at \a timestamp.
+    Session* Find(uint32_t key, uint64_t timestamp);
+
+    //! Analyzes telecommand or telemetry \a frame.
+    void ProcessTransfer(const CanTsFrame& frame, uint64_t timestamp);
+
+    //! Analyzes set block \a frame.
+    void ProcessSetBlock(const CanTsFrame& frame, uint64_t timestamp);
+
+    //! Analyzes get block \a frame.
+    void ProcessGetBlock(const CanTsFrame& frame, uint64_t timestamp);
+
+    //! Starts or retries session with request \a frame sent by client. Returns the session.
+    Session& Request(const CanTsFrame& frame, uint8_t channel, uint64_t timestamp);
+
+    //! Returns open session which \a frame sent by client belongs to, nullptr if none.
+    Session* FindFromClient(const CanTsFrame& frame, uint8_t channel, uint64_t timestamp);
+
+    //! Returns open session which \a frame sent by node belongs to, nullptr if none.
+    Session* FindFromNode(const CanTsFrame& frame, uint8_t channel, uint64_t timestamp);
+
+    //! Sends request of \a session (retry if still waiting for answer) at \a timestamp.
+    void SendRequest(Session& session, Phase phase, uint64_t timestamp);
+
+    //! Records answer of \a session at \a timestamp.
+    void Answer(Session& session, uint64_t timestamp);
+
+    //! Records data frame of block \a sequence of \a session.
+    void Data(Session& session, uint8_t sequence);
+
+    //! Ends open \a session with \a outcome.
+    void End(const Session& session, Outcome outcome);
+};
+
+} // namespace sky
+
+#endif // CANTSANALYZER_H
@@ -0,0 +1,217 @@
+/* See the file "LICENSE.txt" for the full license governing this code. */
+
+#ifndef CANTSCAPTURE_H
+#define CANTSCAPTURE_H
+
+#include <QFile>
+#include <QObject>
+#include <QString>
+#include <cstdint>
+#include <deque>
+#include <vector>
+#include "canframe.h"
+#include "cantransport.h"
+
+namespace sky
+{
+
+//! Direction of captured frame.
+enum class CaptureDirection : uint8_t {
+    kRx = 0,     //!< Frame received from bus.
+    kTx = 1,     //!< Frame transmitted to bus.
+    kTxError = 2 //!< Frame transmission failed.
+};
+
+//! Fixed size capture record of one CAN frame.
+struct CaptureRecord {
+    static constexpr uint8_t kExtId = 0x01; //!< Flag of frame with extended (29-bit) ID.
+    static constexpr uint8_t kRtr = 0x02; //!< Flag of remote frame.
+
+    uint64_t timestamp = 0; //!< Time in nanoseconds (Trace::Now clock).
+    uint32_t id = 0;        //!< CAN identifier.
+    uint8_t bus = 0;        //!< CAN bus.
+    uint8_t direction = 0;  //!< CaptureDirection.
+    uint8_t flags = 0;      //!< kExtId, kRtr.
+    uint8_t length = 0;     //!< Number of valid bytes in data.
+    uint8_t data[8] = {};   //!< Frame data.
+
+    //! Creates record of \a frame on \a bus in \a direction at \a timestamp.
+    static CaptureRecord FromCanFrame(const CanFrame& frame, uint8_t bus, CaptureDirection direction, uint64_t timestamp);
+
+    //! Returns captured frame (without driver time stamps).
+    CanFrame ToCanFrame() const;
+};
+
+static_assert(sizeof(CaptureRecord) == 24, "Capture record size is part of capture format");
+
+//! Index entry of one capture segment.
+struct CaptureSegment {
+    uint32_t sequence = 0;        //!< Segment number (part of file name).
+    uint32_t reserved = 0;        //!< Reserved, 0.
+    uint64_t count = 0;           //!< Number of records (0 while segment is written).
+    uint64_t first_timestamp = 0; //!< Time stamp of first record.
+    uint64_t last_timestamp = 0;  //!< Time stamp of last record.
+};
+
+static_assert(sizeof(CaptureSegment) == 32, "Capture segment size is part of index format");
+
+/*! Append-only writer of binary CAN capture.
+
+    Capture \a path consists of segment files "<path>.<sequence>.cap" and index
+    "<path>.idx". Each segment is preallocated for configured number of
+    records and memory-mapped, so appending a record is a copy into mapped
+    memory without system calls or formatting. Record count in segment
+    header is updated after each record, so segment left by a crashed
+    process is readable up to the last complete record.
+
+    Full segment is truncated to its records and closed, and writing
+    continues in the next one. Index lists kept segments with their record
+    counts and time range, and is rewritten on every rotation. Oldest
+    segments are removed if their number exceeds the limit. Opening an
+    existing capture appends new segments after those in its index.
+
+    Writer is not thread safe, each thread needs its own capture.
+*/
+class CaptureWriter {
+public:
+
+    //! Segment size and rotation settings.
+    struct Settings {
+        uint64_t segment_records = 1 << 20; //!< Records per segment (24 MiB).
+        uint32_t max_segments = 0;          //!< Number of kept segments (0 - unlimited).
+    };
+
+    CaptureWriter() = default;
+
+    //! Closes capture.
+    ~CaptureWriter();
+
+    //! Opens capture \a path with \a settings. Returns false if first segment cannot be created.
+    bool Open(const QString& path, const Settings& settings);
+
+    //! Closes current segment and writes index.
+    void Close();
+
+    //! Returns true if capture is open.
+    bool IsOpen() const;
+
+    //! Appends \a record, rotating segment if full. Returns false if capture is not open or rotation failed.
+    bool Append(const CaptureRecord& record);
+
+    //! Appends \a frame on \a bus in \a direction at \a timestamp.
+    bool Append(const CanFrame& frame, uint8_t bus, CaptureDirection direction, uint64_t timestamp);
+
+    //! Returns number of records appended since Open.
+    uint64_t GetRecordCount() const;
+
+    //! Returns path of segment \a sequence of capture \a path.
+    static QString SegmentPath(const QString& path, uint32_t sequence);
+
+    //! Returns path of index of capture \a path.
+    static QString IndexPath(const QString& path);
+
+private:
+    CaptureWriter(const CaptureWriter&) = delete;
+    CaptureWriter& operator=(const CaptureWriter&) = delete;
+
+    friend class CaptureReader;
+
+    struct SegmentHeader;
+
+    QString path_; //!< Capture path.
+    Settings settings_; //!< Writer settings.
+    QFile file_; //!< Current segment file.
+    uchar* map_ = nullptr; //!< Mapped current segment.
+    SegmentHeader* header_ = nullptr; //!< Header of current segment.
+    CaptureRecord* records_ = nullptr; //!< Records of current segment.
+    std::deque<CaptureSegment> segments_; //!< Kept segments, current one last.
+    uint32_t next_sequence_ = 0; //!< Sequence of next segment.
+    uint64_t record_count_ = 0; //!< Records appended since Open.
+
+    //! Creates and maps next segment.
+    bool OpenSegment();
+
+    //! Truncates current segment to its records and closes it.
+    void CloseSegment();
+
+    //! Rewrites index with kept segments.
+    bool WriteIndex() const;
+};
+
+/*! Memory-mapped reader of one capture segment.
+
+    Records are accessed in place, pointers stay valid until Close.
+*/
+class CaptureReader {
+public:
+    CaptureReader() = default;
+
+    //! Closes segment.
+    ~CaptureReader();
+
+    //! Maps segment file \a path. Returns false if it is not a valid segment.
+    bool Open(const QString& path);
+
+    //! Unmaps segment.
+    void Close();
+
+    //! Returns sequence of segment.
+    uint32_t GetSequence() const;
+
+    //! Returns offset which converts record time stamps to nanoseconds since Unix epoch.
+    int64_t GetEpochOffset() const;
+
+    //! Returns number of complete records.
+    uint64_t GetCount() const;
+
+    //! Returns records of segment.
+    const CaptureRecord* GetRecords() const;
+
+    //! Reads index of capture \a path into \a segments. Returns false if index is missing or invalid.
+    static bool ReadIndex(const QString& path, std::vector<CaptureSegment>& segments);
+
+    //! Returns existing segment files of capture \a path in order (\a path itself if it is a segment file).
+    static std::vector<QString> SegmentFiles(const QString& path);
+
+private:
+    CaptureReader(const CaptureReader&) = delete;
+    CaptureReader& operator=(const CaptureReader&) = delete;
+
+    QFile file_; //!< Segment file.
+    uchar* map_ = nullptr; //!< Mapped segment.
+    uint32_t sequence_ = 0; //!< Segment sequence.
+    int64_t epoch_offset_ = 0; //!< Offset of time stamps to Unix epoch.
+    uint64_t count_ = 0; //!< Number of complete records.
+};
+
+/*! Recorder of frames passing through CAN transports.
+
+    Frames received, transmitted and failed by attached transports are
+    appended to capture writer. Received frames are stamped with time they
+    were read from serial port if transport provides it (CommDriver).
+    All frames on the bus are recorded, including those dropped by acceptance
+    filters of transport (CanTransport::CanFrameReceivedUnfiltered).
+*/
+class CaptureRecorder : public QObject
+{
+    Q_OBJECT
+
+public:
+    //! Creates recorder appending to \a writer.
+    explicit CaptureRecorder(CaptureWriter& writer, QObject* parent = nullptr);
+
+    //! Records frames of \a transport as CAN \a bus.
+    void Attach(CanTransport& transport, uint8_t bus);
+
+    //! Stops recording frames of \a transport.
+    void Detach(CanTransport& transport);
+
+private:
+    Q_DISABLE_COPY(CaptureRecorder)
+
+    CaptureWriter& writer_; //!< Capture of recorded frames.
+};
+
+} // namespace sky
+
+#endif // CANTSCAPTURE_H
@@ -0,0 +1,95 @@
+/* See the file "LICENSE.txt" for the full license governing this code. */
+
+#ifndef CANTSCAPTUREEXPORT_H
+#define CANTSCAPTUREEXPORT_H
+
+#include <QString>
+#include <cstdint>
+#include <iosfwd>
+#include <map>
+#include <memory>
+#include <set>
+#include "cantsanalyzer.h"
+#include "cantscapture.h"
+
+namespace sky
+{
+
+/*! Export of capture records for standard CAN tools.
+
+    - pcapng: one interface per CAN bus ("can0", "can1", ...) with link type
+      LINKTYPE_CAN_SOCKETCAN and nanosecond time stamps, direction of frame
+      in packet flags. Opens in Wireshark.
+    - candump: log format of can-utils ("(seconds) can0 ID#DATA"), which can
+      be replayed with canplayer.
+    - Chrome trace event JSON: transfer timeline for Perfetto UI, like the one
+      exported from trace dumps (see ChromeTraceExport). Each CAN bus is a
+      process with a track of all frames and one track per node, on which
+      transfers reconstructed by BusAnalyzer are spans with their outcome.
+
+    Failed transmissions (CaptureDirection::kTxError) never reached the bus
+    and are exported only to the timeline (marked as errors).
+*/
+class CaptureExport {
+public:
+
+    //! Output format.
+    enum class Format {
+        kPcapng, //!< pcapng file.
+        kCandump, //!< candump log.
+        kChrome //!< Chrome trace event JSON.
+    };
+
+    //! Creates export of \a format written to \a out.
+    CaptureExport(std::ostream& out, Format format);
+
+    //! Writes \a record, whose time stamp plus \a epoch_offset is time since Unix epoch.
+    void Write(const CaptureRecord& record, int64_t epoch_offset);
+
+    //! Completes output (transfers still open end the timeline as unfinished).
+    void Close();
+
+    //! Returns false if writing failed.
+    bool IsGood() const;
+
+    //! Writes all segments of capture \a path to file \a output. Returns false on error.
+    static bool Export(const QString& path, const QString& output, Format format);
+
+private:
+    std::ostream& out_; //!< Output stream.
+    Format format_; //!< Output format.
+    bool header_written_ = false; //!< pcapng section header (or timeline header) was written.
+    bool event_written_ = false; //!< Timeline has an event (next one needs separator).
+    std::map<uint8_t, uint32_t> interfaces_; //!< pcapng interface id of each bus.
+    uint64_t t0_ = 0; //!< Time of first timeline event (nsec since Unix epoch).
+    std::map<uint8_t, std::unique_ptr<BusAnalyzer>> analyzers_; //!< Transfer reconstruction of each bus (timeline).
+    std::set<std::pair<uint8_t, uint32_t>> tracks_; //!< Timeline tracks used (bus, track).
+
+    //! Writes pcapng section header block.
+    void WriteSectionHeader();
+
+    //! Writes pcapng interface description block of \a bus.
+    void WriteInterface(uint8_t bus);
+
+    //! Writes \a record as pcapng enhanced packet block.
+    void WritePacket(const CaptureRecord& record, int64_t epoch_offset);
+
+    //! Writes \a record as candump log line.
+    void WriteCandump(const CaptureRecord& record, int64_t epoch_offset);
+
+    //! Writes \a record as timeline event and analyzes it.
+    void WriteChrome(const CaptureRecord& record, int64_t epoch_offset);
+
+    //! Writes transfer \a session reconstructed on \a bus as timeline span.
+    void WriteSession(uint8_t bus, const BusAnalyzer::Session& session);
+
+    //! Writes timeline event separator, returns output.
+    std::ostream& NextEvent();
+
+    //! Starts timeline event of \a phase on \a track of \a bus at \a timestamp, caller completes it.
+    std::ostream& BeginEvent(char phase, const std::string& name, uint8_t bus, uint32_t track, uint64_t timestamp);
+};
+
+} // namespace sky
+
+#endif // CANTSCAPTUREEXPORT_H
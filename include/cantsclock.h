@@ -0,0 +1,117 @@
+/* See the file "LICENSE.txt" for the full license governing this code. */
+
+#ifndef CANTSCLOCK_H
+#define CANTSCLOCK_H
+
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <unordered_map>
+#include <utility>
+
+namespace sky {
+
+//! Timer created by Clock. Callback given to Clock::CreateTimer is invoked when timer expires.
+class ClockTimer {
+public:
+    virtual ~ClockTimer() = default;
+
+    //! Starts or restarts timer to expire after \a interval_ms.
+    virtual void Start(uint32_t interval_ms) = 0;
+
+    //! Stops timer, callback of expired timer not yet invoked is discarded.
+    virtual void Stop() = 0;
+
+    //! Returns true if timer is running.
+    virtual bool IsActive() const = 0;
+};
+
+/*! Time source and timer service of CAN_TS and CommDriver.
+
+    All timeouts, delays and time stamps of the protocol engine are taken
+    from a Clock. System clock follows wall-clock time and runs timers in Qt
+    event loop. VirtualClock only advances when told to, so timeout and
+    retry behaviour can be exercised without waiting.
+*/
+class Clock {
+public:
+    virtual ~Clock() = default;
+
+    //! Returns monotonic time in milliseconds (origin is clock specific).
+    virtual int64_t Elapsed() const = 0;
+
+    /*!
+      Creates stopped timer which invokes \a callback when it expires. Single
+      shot timer stops after expiring, periodic timer restarts with the same
+      interval. Timer must not outlive the clock.
+    */
+    virtual std::unique_ptr<ClockTimer> CreateTimer(std::function<void()> callback, bool single_shot = true) = 0;
+
+    //! Returns clock following wall-clock time, used unless another clock is set.
+    static Clock& System();
+};
+
+/*! Manually advanced clock.
+
+    Time starts at 0 and only moves with Advance or AdvanceTo, which invoke
+    callbacks of expired timers in order of expiry (timers expiring at the
+    same time in order of Start). Callbacks run directly and may start, stop
+    or destroy timers.
+*/
+class VirtualClock : public Clock {
+public:
+    VirtualClock() = default;
+
+    int64_t Elapsed() const override;
+    std::unique_ptr<ClockTimer> CreateTimer(std::function<void()> callback, bool single_shot = true) override;
+
+    //! Returns current time in nanoseconds.
+    uint64_t Now() const;
+
+    //! Advances time by \a duration_ns.
+    void Advance(uint64_t duration_ns);
+
+    //! Advances time to \a time_ns (if later than current time).
+    void AdvanceTo(uint64_t time_ns);
+
+    //! Returns true and sets \a time_ns to expiry of the next timer if any timer is running.
+    bool NextDeadline(uint64_t& time_ns) const;
+
+private:
+    VirtualClock(const VirtualClock&) = delete;
+    VirtualClock& operator=(const VirtualClock&) = delete;
+
+    class Timer;
+
+    //! State of created timer.
+    struct Entry {
+        std::function<void()> callback; //!< Invoked on expiry.
+        bool single_shot = true; //!< Timer stops after expiry.
+        uint64_t interval_ns = 0; //!< Interval of last Start.
+        std::pair<uint64_t, uint64_t> key = {0, 0}; //!< Key in running_ (expiry, start order), valid while running.
+        bool active = false; //!< Timer is running.
+    };
+
+    uint64_t now_ = 0; //!< Current time.
+    uint64_t next_id_ = 0; //!< Last assigned timer identifier.
+    uint64_t starts_ = 0; //!< Number of timer starts (orders timers expiring at the same time).
+    std::unordered_map<uint64_t, Entry> timers_; //!< Created timers by identifier.
+    std::map<std::pair<uint64_t, uint64_t>, uint64_t> running_; //!< Running timers by expiry and start order.
+
+    //! Starts timer \a id to expire after \a interval_ns.
+    void StartTimer(uint64_t id, uint64_t interval_ns);
+
+    //! Stops timer \a id.
+    void StopTimer(uint64_t id);
+
+    //! Returns true if timer \a id is running.
+    bool IsTimerActive(uint64_t id) const;
+
+    //! Removes timer \a id.
+    void RemoveTimer(uint64_t id);
+};
+
+} // namespace sky
+
+#endif // CANTSCLOCK_H
@@ -172,6 +172,9 @@ public:
     //! Check if \a address is valid broadcast address (time sync or keep alive address).
     static bool IsBroadcastAddress(uint8_t address);
 
+    //! Sets addresses, transfer type and command from 29-bit CAN \a id, data is not changed (no allocation).
+    void DecodeId(uint32_t id);
+
     //! Returns telecommand frametype from frame.
     TelecommandFrameType GetFrameType() const;
 
@@ -0,0 +1,188 @@
+/* See the file "LICENSE.txt" for the full license governing this code. */
+
+#ifndef CANTSMETRICS_H
+#define CANTSMETRICS_H
+
+#include <QString>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+class QIODevice;
+
+namespace sky
+{
+
+//! Monotonically increasing counter.
+class MetricCounter {
+public:
+    //! Adds \a n to counter.
+    void Increment(uint64_t n = 1) {
+        value_.fetch_add(n, std::memory_order_relaxed);
+    }
+
+    //! Returns current value.
+    uint64_t Get() const {
+        return value_.load(std::memory_order_relaxed);
+    }
+
+private:
+    std::atomic<uint64_t> value_{0}; //!< Counter value.
+};
+
+//! Value which can go up and down.
+class MetricGauge {
+public:
+    //! Sets gauge to \a value.
+    void Set(int64_t value) {
+        value_.store(value, std::memory_order_relaxed);
+    }
+
+    //! Adds \a delta to gauge.
+    void Add(int64_t delta) {
+        value_.fetch_add(delta, std::memory_order_relaxed);
+    }
+
+    //! Raises gauge to \a value if it is higher than current value (high watermark).
+    void SetMax(int64_t value) {
+        int64_t current = value_.load(std::memory_order_relaxed);
+        while ((value > current) && !value_.compare_exchange_weak(current, value, std::memory_order_relaxed)) {}
+    }
+
+    //! Returns current value.
+    int64_t Get() const {
+        return value_.load(std::memory_order_relaxed);
+    }
+
+private:
+    std::atomic<int64_t> value_{0}; //!< Gauge value.
+};
+
+/*! Histogram with log-linear buckets (HDR style).
+
+    Values below kSubBuckets have own bucket, larger values are split into
+    kSubBuckets buckets per power of two, which bounds relative error of
+    reported quantiles to 1/kSubBuckets over the whole 64-bit range.
+*/
+class MetricHistogram {
+public:
+    static constexpr unsigned kSubBucketBits = 3; //!< Sub-bucket resolution in bits.
+    static constexpr uint64_t kSubBuckets = 1U << kSubBucketBits; //!< Buckets per power of two.
+    static constexpr size_t kBuckets = kSubBuckets + (64 - kSubBucketBits) * kSubBuckets; //!< Number of buckets.
+
+    //! Copy of histogram state.
+    struct Snapshot {
+        uint64_t count = 0; //!< Number of recorded values.
+        uint64_t sum = 0; //!< Sum of recorded values.
+        uint64_t max = 0; //!< Largest recorded value.
+        std::vector<uint64_t> buckets; //!< Count per bucket.
+
+        //! Returns upper bound of bucket containing quantile \a q (0..1), 0 if empty.
+        uint64_t ValueAtQuantile(double q) const;
+    };
+
+    //! Records \a value.
+    void Record(uint64_t value);
+
+    //! Returns copy of histogram state.
+    Snapshot GetSnapshot() const;
+
+    //! Returns bucket index of \a value.
+    static size_t BucketIndex(uint64_t value);
+
+    //! Returns largest value which falls into bucket \a index.
+    static uint64_t BucketUpperBound(size_t index);
+
+private:
+    std::array<std::atomic<uint64_t>, kBuckets> buckets_ {}; //!< Bucket counts.
+    std::atomic<uint64_t> count_{0}; //!< Number of recorded values.
+    std::atomic<uint64_t> sum_{0}; //!< Sum of recorded values.
+    std::atomic<uint64_t> max_{0}; //!< Largest recorded value.
+};
+
+/*! Process wide registry of metrics.
+
+    Metrics are identified by name and labels. Lookup takes a lock, so
+    callers keep returned references (which stay valid for the lifetime of
+    the process) and update them lock-free on hot paths. Same name and labels
+    always return the same metric, so instances of a component aggregate.
+*/
+class Metrics {
+public:
+    //! Label name and value pairs.
+    using Labels = std::vector<std::pair<std::string, std::string>>;
+
+    //! Type of metric.
+    enum class Type {
+        kCounter, //!< MetricCounter.
+        kGauge, //!< MetricGauge.
+        kHistogram //!< MetricHistogram.
+    };
+
+    //! Value of one metric at snapshot time.
+    struct Sample {
+        std::string name; //!< Metric name.
+        std::string help; //!< Metric description.
+        Labels labels; //!< Metric labels.
+        Type type = Type::kCounter; //!< Metric type.
+        int64_t value = 0; //!< Counter or gauge value.
+        MetricHistogram::Snapshot histogram; //!< Histogram state.
+        double scale = 1.0; //!< Factor converting histogram values to exported unit.
+    };
+
+    //! Returns registry instance.
+    static Metrics& Instance();
+
+    //! Returns counter \a name with \a labels, creating it if needed.
+    MetricCounter& GetCounter(const std::string& name, const Labels& labels = {}, const std::string& help = "");
+
+    //! Returns gauge \a name with \a labels, creating it if needed.
+    MetricGauge& GetGauge(const std::string& name, const Labels& labels = {}, const std::string& help = "");
+
+    //! Returns histogram \a name with \a labels, creating it if needed.
+    /*!
+        \a scale converts recorded values to exported unit (e.g. 1e-6 for values in usec exported in seconds).
+    */
+    MetricHistogram& GetHistogram(const std::string& name, const Labels& labels = {}, const std::string& help = "",
+                                  double scale = 1.0);
+
+    //! Returns values of all metrics ordered by name.
+    std::vector<Sample> GetSnapshot() const;
+
+    //! Returns all metrics in Prometheus text exposition format (histograms as summaries).
+    std::string ToPrometheus() const;
+
+    //! Writes Prometheus text to \a device. Returns false on write error.
+    bool WritePrometheus(QIODevice& device) const;
+
+    //! Writes Prometheus text to file \a path. Returns false on error.
+    bool WritePrometheus(const QString& path) const;
+
+private:
+    //! Registered metric.
+    struct Entry {
+        std::string name; //!< Metric name.
+        std::string help; //!< Metric description.
+        Labels labels; //!< Metric labels.
+        Type type; //!< Metric type.
+        double scale = 1.0; //!< Histogram export scale.
+        std::unique_ptr<MetricCounter> counter; //!< Counter (if type is kCounter).
+        std::unique_ptr<MetricGauge> gauge; //!< Gauge (if type is kGauge).
+        std::unique_ptr<MetricHistogram> histogram; //!< Histogram (if type is kHistogram).
+    };
+
+    mutable std::mutex mutex_; //!< Protects entries_ (not metric values).
+    std::vector<std::unique_ptr<Entry>> entries_; //!< Registered metrics.
+
+    //! Returns entry \a name with \a labels, creating it with \a type if needed. Caller holds mutex_.
+    Entry& Find(const std::string& name, const Labels& labels, const std::string& help, Type type);
+};
+
+} // namespace sky
+
+#endif // CANTSMETRICS_H
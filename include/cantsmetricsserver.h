@@ -0,0 +1,40 @@
+/* See the file "LICENSE.txt" for the full license governing this code. */
+
+#ifndef CANTSMETRICSSERVER_H
+#define CANTSMETRICSSERVER_H
+
+#include <QObject>
+#include <QString>
+
+class QLocalServer;
+
+namespace sky
+{
+
+//! Serves Prometheus text of Metrics registry to every client connecting to a local socket.
+class MetricsServer : public QObject {
+    Q_OBJECT
+
+public:
+    //! Default constructor.
+    explicit MetricsServer(QObject* parent = nullptr);
+
+    //! Starts listening on local socket \a name. Returns false if socket cannot be created.
+    bool Listen(const QString& name);
+
+    //! Stops listening.
+    void Close();
+
+private slots:
+    //! Writes metrics to pending connections and closes them.
+    void NewConnection();
+
+private:
+    Q_DISABLE_COPY(MetricsServer)
+
+    QLocalServer* server_ = nullptr; //!< Local socket server.
+};
+
+} // namespace sky
+
+#endif // CANTSMETRICSSERVER_H
@@ -0,0 +1,202 @@
+/* See the file "LICENSE.txt" for the full license governing this code. */
+
+#ifndef CANTSNETWORK_H
+#define CANTSNETWORK_H
+
+#include <QObject>
+#include <QThread>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <vector>
+#include "can_ts.h"
+
+namespace sky
+{
+
+/*! Runs multiple independent CAN networks, each served by its own CAN TS stack.
+
+    Every network (nominal and redundant CAN bus pair) gets a CAN_TS shard living
+    in a dedicated thread, so protocol processing and serial port I/O of different
+    networks run in parallel. Requests are routed to a shard by network index and
+    queued to its thread without waiting, so callers are not serialised behind the
+    shard event loops and shards may start transfers on each other. Only Start,
+    Stop and InvokeBlocking wait for the shard. Signals of all shards are
+    re-emitted in the thread of this object with the network index prepended.
+
+    Completion handlers passed to transfer functions are invoked in the shard
+    thread, also when the stack rejects the transfer. A handler may start a
+    follow-up transfer on the same network through this object (it is then
+    executed directly). Networks are added before requests are made.
+*/
+class CanTsNetwork : public QObject {
+    Q_OBJECT
+
+public:
+
+    //! Default constructor.
+    explicit CanTsNetwork(QObject* parent = nullptr);
+
+    //! Stops all networks and terminates shard threads.
+    ~CanTsNetwork() override;
+
+    //! Adds a network with its own CAN TS stack and thread.
+    /*!
+        \return Index of the new network.
+    */
+    int AddNetwork();
+
+    //! Returns number of networks.
+    int GetNetworkCount() const;
+
+    //! Starts communication on \a network.
+    /*!
+        \param network Network index.
+        \param address CAN address of the source.
+        \param timeout Response timeout in milliseconds.
+        \param driver Lower-layer protocol settings.
+        \retval true CAN communication established.
+        \retval false Invalid network or cannot start the communication.
+    */
+    bool Start(int network, uint8_t address, uint32_t timeout, const CAN_TS::DriverSettings& driver);
+
+    //! Stops communication on \a network.
+    void Stop(int network);
+
+    //! Stops communication on all networks.
+    void StopAll();
+
+    // NOTE
+    // Transfer functions below queue the request and return false only for invalid
+    // network. If the stack rejects a transfer, its handler is invoked with
+    // kSendRequestFailed.
+
+    //! Queues sending a telecommand on \a network (see CAN_TS::SendTC).
+    bool SendTC(int network, uint8_t address, uint8_t channel, const std::vector<uint8_t>& data,
+                uint8_t retry_count = 0, CAN_TS::SendTCHandler handler = nullptr);
+
+    //! Queues receiving telemetry on \a network (see CAN_TS::ReceiveTM).
+    bool ReceiveTM(int network, uint8_t address, uint8_t channel, uint8_t retry_count = 3,
+                   uint32_t max_age_ms = 0, CAN_TS::ReceiveTMHandler handler = nullptr);
+
+    //! Queues sending a block of data on \a network (see CAN_TS::SendBlock).
+    bool SendBlock(int network, uint8_t address, uint64_t start, const std::vector<uint8_t>& data,
+                   uint8_t retry_count = 3, uint32_t report_delay_ms = 20, uint8_t report_retry_count = 3,
+                   CAN_TS::SendBlockHandler handler = nullptr);
+
+    //! Queues receiving a block of data on \a network (see CAN_TS::ReceiveBlock).
+    bool ReceiveBlock(int network, uint8_t to_address, uint64_t start_address, uint8_t length,
+                      uint8_t retry_count = 3, uint8_t start_retry_count = 3,
+                      CAN_TS::ReceiveBlockHandler handler = nullptr);
+
+    //! Queues a time synchronisation frame on \a network (see CAN_TS::SendTimeSync, rejection is logged).
+    bool SendTimeSync(int network, uint64_t time);
+
+    //! Queues unsolicited telemetry on \a network (see CAN_TS::SendUnsolicited, rejection is logged).
+    bool SendUnsolicited(int network, uint8_t address, uint8_t channel, const std::vector<uint8_t>& data);
+
+    //! Queues toggling active bus of \a network (see CAN_TS::CanBusSwitch).
+    void CanBusSwitch(int network);
+
+    //! Queues \a call with CAN TS stack of \a network to its thread.
+    /*!
+        Calls queued to one network are executed in order. Call made in the shard thread
+        (e.g. from a completion handler) is executed directly.
+
+        \param network Network index.
+        \param call Function executed in shard thread.
+        \param done Invoked in thread of this object after \a call returned (optional).
+        \retval true Call queued.
+        \retval false Invalid network.
+    */
+    bool Invoke(int network, std::function<void(CAN_TS&)> call, std::function<void()> done = nullptr);
+
+    //! Executes \a call with CAN TS stack of \a network in its thread and waits for it to return.
+    /*!
+        Meant for setup and teardown (e.g. creating objects which shall live in the shard
+        thread). Caller waits behind the shard event loop, and shards blocking on each
+        other deadlock, so transfers are started with Invoke. Call made in the shard thread
+        is executed directly.
+
+        \param network Network index.
+        \param call Function executed in shard thread.
+        \retval true Function executed.
+        \retval false Invalid network.
+    */
+    bool InvokeBlocking(int network, const std::function<void(CAN_TS&)>& call);
+
+signals:
+    //! See CAN_TS::SendTCCompleted.
+    void SendTCCompleted(int network, uint8_t address, uint8_t channel);
+
+    //! See CAN_TS::ReceiveTMCompleted.
+    void ReceiveTMCompleted(int network, uint8_t address, uint8_t channel, const std::vector<uint8_t>& data);
+
+    //! See CAN_TS::SendBlockCompleted.
+    void SendBlockCompleted(int network, uint8_t address);
+
+    //! See CAN_TS::ReceiveBlockCompleted.
+    void ReceiveBlockCompleted(int network, uint8_t address, const std::vector<uint8_t>& data);
+
+    //! See CAN_TS::UnsolicitedReceived.
+    void UnsolicitedReceived(int network, uint8_t address, uint8_t channel, const std::vector<uint8_t>& data);
+
+    //! See CAN_TS::KeepAliveReceivedNominal.
+    void KeepAliveReceivedNominal(int network, uint8_t address, uint8_t channel, const std::vector<uint8_t>& data);
+
+    //! See CAN_TS::KeepAliveReceivedRedundant.
+    void KeepAliveReceivedRedundant(int network, uint8_t address, uint8_t channel, const std::vector<uint8_t>& data);
+
+    //! See CAN_TS::BusSwitched.
+    void BusSwitched(int network, sky::CAN_TS::CanBus bus);
+
+    //! See CAN_TS::TransferTimed.
+    void TransferTimed(int network, uint8_t type, uint8_t address, sky::CAN_TS::TransferTiming timing);
+
+    //! See CAN_TS::SendTimeSyncCompleted.
+    void SendTimeSyncCompleted(int network);
+
+    //! See CAN_TS::TimeSyncReceived.
+    void TimeSyncReceived(int network, uint8_t address, const std::vector<uint8_t>& time);
+
+    //! See CAN_TS::SendUnsolicitedCompleted.
+    void SendUnsolicitedCompleted(int network, uint8_t address, uint8_t channel);
+
+    //! See CAN_TS::SendTCFailed.
+    void SendTCFailed(int network, uint8_t address, uint8_t channel, sky::CAN_TS::SendTCError error);
+
+    //! See CAN_TS::ReceiveTMFailed.
+    void ReceiveTMFailed(int network, uint8_t address, uint8_t channel, sky::CAN_TS::ReceiveTMError error);
+
+    //! See CAN_TS::SendBlockFailed.
+    void SendBlockFailed(int network, uint8_t address, sky::CAN_TS::SendBlockError error);
+
+    //! See CAN_TS::ReceiveBlockFailed.
+    void ReceiveBlockFailed(int network, uint8_t address, sky::CAN_TS::ReceiveBlockError error);
+
+    //! See CAN_TS::SendTimeSyncFailed.
+    void SendTimeSyncFailed(int network);
+
+    //! See CAN_TS::SendUnsolicitedFailed.
+    void SendUnsolicitedFailed(int network, uint8_t address, uint8_t channel);
+
+private:
+
+    Q_DISABLE_COPY(CanTsNetwork)
+
+    //! CAN TS stack of one network and thread it lives in.
+    struct Shard {
+        std::unique_ptr<QThread> thread; //!< Shard thread (runs event loop).
+        QObject* context = nullptr; //!< Object living in shard thread used to run calls there.
+        CAN_TS* cants = nullptr; //!< CAN TS stack (created and destroyed in shard thread).
+    };
+
+    std::vector<std::unique_ptr<Shard>> shards_; //!< Shards by network index.
+
+    //! Re-emits signals of \a cants with \a network index.
+    void ConnectShard(int network, CAN_TS* cants);
+};
+
+} // namespace sky
+
+#endif // CANTSNETWORK_H
@@ -0,0 +1,48 @@
+/* See the file "LICENSE.txt" for the full license governing this code. */
+
+#ifndef CANTSPROBES_H
+#define CANTSPROBES_H
+
+/*! \file
+    Static user-space tracepoints (USDT) of provider "cants".
+
+    Probes are compiled in only when SKY_USDT is defined (qmake CONFIG+=usdt),
+    which requires sys/sdt.h (systemtap-sdt-dev). Each probe is a single nop
+    instruction with argument locations recorded in an ELF note, so a probe
+    costs nothing until a tracer (bpftrace, perf, systemtap) attaches to it:
+
+        bpftrace -e 'usdt:./cants-demo:cants:transfer_timeout { printf("%d %d\n", arg0, arg1); }'
+
+    Arguments must be integers or pointers. Probes and their arguments:
+
+    | Probe          | Arguments |
+    | :---           | :--- |
+    | frame_send     | to address, transfer type, command, transfer id, bus |
+    | frame_sent     | to address, transfer type, command, transfer id |
+    | frame_received | from address, to address, transfer type, command, nominal bus |
+    | transfer_timeout | transfer type, address, transfer id, rx state, retry count |
+    | write_packet   | CAN id, data length, SLIP command, transmit buffer depth |
+    | bytes_read     | byte count |
+    | slip_frame     | SLIP command, payload length |
+*/
+
+#ifdef SKY_USDT
+
+#include <sys/sdt.h>
+
+#define SKY_PROBE1(name, a1) DTRACE_PROBE1(cants, name, a1)
+#define SKY_PROBE2(name, a1, a2) DTRACE_PROBE2(cants, name, a1, a2)
+#define SKY_PROBE4(name, a1, a2, a3, a4) DTRACE_PROBE4(cants, name, a1, a2, a3, a4)
+#define SKY_PROBE5(name, a1, a2, a3, a4, a5) DTRACE_PROBE5(cants, name, a1, a2, a3, a4, a5)
+
+#else
+
+// Arguments are not evaluated when probes are compiled out.
+#define SKY_PROBE1(name, a1) do {} while (0)
+#define SKY_PROBE2(name, a1, a2) do {} while (0)
+#define SKY_PROBE4(name, a1, a2, a3, a4) do {} while (0)
+#define SKY_PROBE5(name, a1, a2, a3, a4, a5) do {} while (0)
+
+#endif
+
+#endif // CANTSPROBES_H
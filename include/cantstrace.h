@@ -0,0 +1,114 @@
+/* See the file "LICENSE.txt" for the full license governing this code. */
+
+#ifndef CANTSTRACE_H
+#define CANTSTRACE_H
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <iosfwd>
+#include <string>
+#include <vector>
+
+namespace sky
+{
+
+//! Events recorded by trace.
+enum class TraceEvent : uint16_t {
+    kFrameSend = 0,         //!< Frame passed to lower-level protocol (arg: transfer id).
+    kFrameSent = 1,         //!< Frame transmitted (arg: transfer id).
+    kFrameSendError = 2,    //!< Frame transmission failed (arg: transfer id, data[0]: error).
+    kFrameReceived = 3,     //!< Frame received (arg: 1 if nominal bus).
+    kSerialRead = 4,        //!< Bytes read from serial port (arg: byte count, data: first bytes).
+    kSerialWrite = 5,       //!< Bytes written to serial port (arg: byte count, data: first bytes).
+    kTransferStart = 6,     //!< Transfer started (id: transfer type and address, arg: transfer id).
+    kTransferComplete = 7,  //!< Transfer completed (id: transfer type and address, arg: transfer id).
+    kTransferFail = 8,      //!< Transfer failed (id: transfer type and address, arg: transfer id, data[0]: error).
+    kBusSwitch = 9,         //!< Active bus switched (bus: new active bus).
+    kCount                  //!< Number of events.
+};
+
+//! Fixed size trace record.
+struct TraceRecord {
+    uint64_t timestamp = 0; //!< Time in nanoseconds (steady clock).
+    uint32_t sequence = 0;  //!< Lower bits of record index in thread ring.
+    uint32_t id = 0;        //!< CAN identifier.
+    uint32_t arg = 0;       //!< Event specific argument.
+    uint16_t event = 0;     //!< TraceEvent.
+    uint8_t bus = 0;        //!< CAN bus (0, 1) or kNoBus.
+    uint8_t length = 0;     //!< Number of valid bytes in data.
+    uint8_t data[8] = {};   //!< Frame data (or first bytes of buffer).
+};
+
+static_assert(sizeof(TraceRecord) == 32, "Trace record size is part of dump format");
+
+//! Records of one thread restored from a dump.
+struct TraceThread {
+    uint32_t index = 0; //!< Thread index (order of first trace in thread).
+    std::vector<TraceRecord> records; //!< Records from oldest to newest.
+};
+
+/*! Binary trace of protocol events.
+
+    Each thread writes records into its own ring buffer without locks or
+    formatting, so tracing can remain enabled in production. Oldest records
+    are overwritten when ring is full. Rings of all threads are written to
+    a file with Dump and converted to text offline with tracedecode tool.
+
+    Dump may run concurrently with writers, records overwritten during the
+    dump are discarded.
+*/
+class Trace {
+public:
+    static constexpr size_t kRingSize = 4096; //!< Records per thread (power of two).
+    static constexpr uint8_t kNoBus = 0xFF; //!< Bus value of events not related to a bus.
+
+    //! Enables or disables recording.
+    static void SetEnabled(bool enabled);
+
+    //! Returns true if recording is enabled.
+    static bool IsEnabled() {
+        return enabled_.load(std::memory_order_relaxed);
+    }
+
+    //! Returns current time of trace clock (steady clock) in nanoseconds.
+    static uint64_t Now();
+
+    //! Writes a record into ring of calling thread.
+    static void Record(TraceEvent event, uint8_t bus, uint32_t id, uint32_t arg,
+                       const uint8_t* data = nullptr, size_t length = 0);
+
+    //! Copies records of all threads into \a threads.
+    static void Snapshot(std::vector<TraceThread>& threads);
+
+    //! Writes rings of all threads to \a out. Returns false on write error.
+    static bool Dump(std::ostream& out);
+
+    //! Writes rings of all threads to file \a path. Returns false on error.
+    static bool Dump(const std::string& path);
+
+    //! Reads a dump written by Dump from \a in. Returns false if dump is invalid.
+    static bool Load(std::istream& in, std::vector<TraceThread>& threads);
+
+    //! Returns name of \a event.
+    static const char* EventName(uint16_t event);
+
+private:
+    static std::atomic<bool> enabled_; //!< Recording enabled.
+};
+
+} // namespace sky
+
+//! Records a trace event if tracing is enabled. Arguments are not evaluated otherwise.
+#define SKY_TRACE(event, bus, id, arg, data, length) \
+    do { \
+        if (sky::Trace::IsEnabled()) \
+            sky::Trace::Record((event), (bus), (id), (arg), (data), (length)); \
+    } while (0)
+
+//! Records a trace event of CanFrame \a frame.
+#define SKY_TRACE_FRAME(event, bus, frame, arg) \
+    SKY_TRACE((event), (bus), (frame).id, (arg), (frame).data.data(), (frame).data.size())
+
+#endif // CANTSTRACE_H
@@ -0,0 +1,44 @@
+/* See the file "LICENSE.txt" for the full license governing this code. */
+
+#ifndef CANTSTRACEEXPORT_H
+#define CANTSTRACEEXPORT_H
+
+#include <cstdint>
+#include <iosfwd>
+#include <string>
+#include <vector>
+#include "cantstrace.h"
+
+namespace sky
+{
+
+/*! Export of trace records as Chrome trace event JSON.
+
+    Output can be opened in Perfetto UI (ui.perfetto.dev) or chrome://tracing.
+    Each trace thread (one CAN TS network) is a process with one track per CAN
+    bus and one track per node:
+
+    - bus tracks show frames from being passed to driver until transmitted
+      (or failed), and received frames as instants,
+    - node tracks show transfers as spans from start to completion or failure,
+      and every frame sent to or received from the node (requests, data
+      frames, status/report rounds, retries, aborts) as instants.
+*/
+class ChromeTraceExport {
+public:
+    // Prevent instancing of this class.
+    ChromeTraceExport() = delete;
+
+    //! Writes records of \a threads to \a out. Returns false on write error.
+    static bool Write(const std::vector<TraceThread>& threads, std::ostream& out);
+
+    //! Writes records of \a threads to file \a path. Returns false on error.
+    static bool Write(const std::vector<TraceThread>& threads, const std::string& path);
+
+    //! Returns name of CAN TS frame with transfer \a type and \a command (e.g. "SB TRANSFER").
+    static std::string FrameName(uint8_t type, uint16_t command);
+};
+
+} // namespace sky
+
+#endif // CANTSTRACEEXPORT_H
@@ -3,14 +3,15 @@
 #ifndef COMMDRIVER_H
 #define COMMDRIVER_H
 
-#include <QObject>
 #include <QSerialPort>
 #include <QByteArray>
-#include <QTimer>
 #include <cstdint>
 #include <memory>
 #include "skyslip.h"
 #include "canframe.h"
+#include "cantransport.h"
+#include "cantsclock.h"
+#include "cantsmetrics.h"
 
 namespace sky {
 
@@ -28,19 +29,19 @@ namespace sky {
     Data is received via CanFrameReceived signal.
 
     Signal CanBusError is emited if error is detected on CAN bus.
+
+    Both CAN interfaces of a device can be driven over a single serial port.
+    In that case one driver opens the port and the other is attached to it
+    with Attach. Frames are multiplexed by SKY-SLIP command byte (SendCan0,
+    SendCan1) and received frames are delivered to the driver of the
+    matching interface.
 */
-class CommDriver : public QObject
+class CommDriver : public CanTransport
 {
     Q_OBJECT
 
 public:
 
-    //! This enum describes errors that occur during frame transmission.
-    enum CanSendError {
-        WriteError, //!< Enough space on dongle, but PC could not write all bytes.
-        DongleBusy  //!< Not enough space on dongle.
-    };
-
     //! This enum describes state of transmission.
     enum class TxState {
         Idle,             //!< Ready to write.
@@ -54,34 +55,43 @@ public:
     //! Open serial port \a port_name with baud rate \a baud.
     bool Open(const std::string& port_name, uint32_t baud);
 
-    //! Close active connection.
-    void Close();
+    //! Attach driver as \a channel interface of already opened driver \a link.
+    /*!
+      Attached driver shares serial port of \a link. Frames sent via
+      attached driver are encoded with \a channel command and only frames
+      received with \a channel command are delivered to it.
+    */
+    bool Attach(CommDriver& link, SkySlip::Cmd channel);
+
+    //! Close active connection (or detach from link).
+    void Close() override;
 
     /*!
       Method sends \a frame to remote unit.
 
       If frame was written to serial port, this function returns \c true;
       otherwise returns \c false. After a while, signal CanFrameSent() or
-      CanFrameError() is emitted.
+      CanFrameError() is emitted with the same opaque \a token.
     */
-    bool Send(const CanFrame& frame);
+    bool Send(const CanFrame& frame, uint64_t token = 0) override;
 
-    //! Returns the driver port name
-    std::string GetPortName() const;
-
-signals:
-    //! Signal emits when CAN \a frame was received and parsed.
-    void CanFrameReceived(sky::CanFrame frame);
-
-    //! Signal emits when CAN \a frame was successfully sent.
-    void CanFrameSent(const sky::CanFrame& frame);
+    //! Discards frames waiting in transmit buffer. Frame currently being written is not affected.
+    void Flush() override;
 
     /*!
-      Signal emits after \a error occured during \a frame transmission
-      and its retransmission also has failed.
+      Sets acceptance \a filters of received frames. Frame is delivered if it
+      passes any of the filters. Frames are checked on raw SKY-SLIP payload
+      before being decoded. Empty list accepts all frames.
     */
-    void CanFrameError(const sky::CanFrame& frame, sky::CommDriver::CanSendError error);
+    void SetFilters(const std::vector<CanFilter>& filters) override;
+
+    //! Returns the driver port name
+    std::string GetPortName() const;
+
+    //! Sets \a clock of write timeout (system clock by default). Clock must outlive the driver.
+    void SetClock(Clock& clock);
 
+signals:
     //! Signal emits when \a data (raw) frame was received on CAN bus.
     void RawFrameReceived(const std::vector<uint8_t>& data);
 
@@ -108,6 +118,14 @@ private:
 
     Q_DISABLE_COPY(CommDriver)
 
+    //! Frame waiting in transmit buffer.
+    struct TxEntry {
+        CanFrame frame; //! CAN frame.
+        SkySlip::Cmd cmd; //! SKY-SLIP command (CAN interface) used to send the frame.
+        CommDriver* owner; //! Driver which notifies frame transmission result.
+        uint64_t token; //! Opaque token returned with transmission result.
+    };
+
     TxState state_ = TxState::Idle; //! State of transmission.
     QSerialPort serial_port_; //! Object for serial port operations.
 
@@ -118,27 +136,62 @@ private:
 
     SkySlip slip_; //! Slip encoder/decoder object.
 
-    std::vector<CanFrame> tx_buffer; //! Transmit buffer.
+    SkySlip::Cmd channel_ = SkySlip::Cmd::SendCan0; //! CAN interface used for transmission.
+    CommDriver* link_ = nullptr; //! Driver owning serial port if attached, otherwise nullptr.
+    std::vector<CommDriver*> channels_; //! Drivers attached to this driver.
+    std::vector<CanFilter> filters_; //! Acceptance filters of received frames.
+
+    std::vector<TxEntry> tx_buffer; //! Transmit buffer.
     uint8_t send_retry_ = 0;  //! Number of transmit retries to dongle.
 
     CanFrame last_can_frame_; //! Saved last transmitted CanFrame.
+    CommDriver* last_owner_ = nullptr; //! Driver which transmitted last CanFrame.
+    uint64_t last_token_ = 0; //! Token of last transmitted CanFrame.
     std::vector<uint8_t> last_slip_frame_; //! Saved current 'transmitting' SLIP frame. Used also during retransmission.
 
     static constexpr uint8_t kWriteTimeoutMs = 200; //! Write timeout in ms.
     static constexpr uint8_t kSendRetryNum = 3; //! Number of send retries.
 
-    QTimer tmr; //! Internal timer used for write timeout.
+    std::unique_ptr<ClockTimer> tmr; //! Internal timer used for write timeout.
+
+    //! Metrics of driver, labelled with port name and CAN interface.
+    struct DriverMetrics {
+        MetricCounter* frames_sent = nullptr; //! Frames written to dongle.
+        MetricCounter* frames_received = nullptr; //! Frames delivered to driver.
+        MetricCounter* frames_filtered = nullptr; //! Frames dropped by acceptance filters.
+        MetricCounter* send_errors = nullptr; //! Frames which could not be written.
+        MetricCounter* bus_bits = nullptr; //! Estimated CAN bus bits of sent and received frames.
+        MetricCounter* bytes_read = nullptr; //! Bytes read from serial port.
+        MetricCounter* bytes_written = nullptr; //! Bytes written to serial port.
+        MetricGauge* tx_queue_depth = nullptr; //! Frames in transmit buffer.
+        MetricGauge* tx_queue_max = nullptr; //! Highest number of frames in transmit buffer.
+    } metrics_;
 
     //! Writes bytes in \a data to opened serial port.
     bool WriteBytes(const std::vector<uint8_t>& data);
 
-    //! Writes \a frame to opened serial port.
-    void WritePacket(const CanFrame& frame);
+    //! Queues or writes \a frame with \a token of \a owner driver using \a cmd interface.
+    bool Enqueue(const CanFrame& frame, SkySlip::Cmd cmd, CommDriver* owner, uint64_t token);
+
+    //! Writes \a entry to opened serial port.
+    void WritePacket(const TxEntry& entry);
+
+    //! Returns true if raw frame \a payload passes acceptance filters.
+    bool Accepts(const std::vector<uint8_t>& payload) const;
+
+    //! Removes attached \a channel and its buffered frames.
+    void Detach(CommDriver* channel);
+
+    //! Looks up driver metrics for current port name and CAN interface.
+    void BindMetrics();
+
+    //! Updates transmit buffer gauges after buffer changed.
+    void UpdateQueueMetrics();
+
+    //! Records sent or received \a frame in bus load metric.
+    void CountBusBits(const CanFrame& frame) const;
 };
 
 } // namespace sky
 
-Q_DECLARE_METATYPE(sky::CanFrame);
-Q_DECLARE_METATYPE(sky::CommDriver::CanSendError);
-
 #endif
@@ -0,0 +1,103 @@
+/* See the file "LICENSE.txt" for the full license governing this code. */
+
+#ifndef LOOPBACKBUS_H
+#define LOOPBACKBUS_H
+
+#include <cstdint>
+#include <random>
+#include <vector>
+#include "cantransport.h"
+
+namespace sky {
+
+class LoopbackTransport;
+
+/*! CAN bus simulated in process.
+
+    Frame sent by one LoopbackTransport is delivered to all other transports
+    attached to the bus whose acceptance filters it passes. Each delivery may
+    be dropped with configured loss probability, drops are drawn from
+    generator with fixed seed, so runs with the same traffic are reproducible.
+*/
+class LoopbackBus {
+public:
+    //! Creates bus dropping each delivery with probability \a loss_rate, drops are drawn with \a seed.
+    explicit LoopbackBus(double loss_rate = 0.0, uint32_t seed = 1);
+
+    //! Sets probability of dropping a delivery (0 - no loss, 1 - all frames lost).
+    void SetLossRate(double loss_rate);
+
+    //! Returns number of frames sent to the bus.
+    uint64_t GetFramesSent() const;
+
+    //! Returns number of frame deliveries dropped.
+    uint64_t GetFramesLost() const;
+
+private:
+    friend class LoopbackTransport;
+
+    std::vector<LoopbackTransport*> endpoints_; //!< Attached transports.
+    std::mt19937 random_; //!< Generator of frame loss.
+    std::bernoulli_distribution loss_; //!< Frame loss distribution.
+    uint64_t frames_sent_ = 0; //!< Frames sent to the bus.
+    uint64_t frames_lost_ = 0; //!< Frame deliveries dropped.
+
+    //! Delivers \a frame sent by \a sender to other endpoints.
+    void Deliver(const LoopbackTransport* sender, const CanFrame& frame);
+};
+
+/*! Transport attached to LoopbackBus.
+
+    Sent frames are transmitted from event loop in order of Send calls, so
+    like with CommDriver, results and responses are never reported from
+    within Send.
+*/
+class LoopbackTransport : public CanTransport
+{
+    Q_OBJECT
+
+public:
+    //! Attaches transport to \a bus.
+    explicit LoopbackTransport(LoopbackBus& bus);
+
+    //! Detaches transport from bus.
+    ~LoopbackTransport() override;
+
+    bool Send(const CanFrame& frame, uint64_t token = 0) override;
+    void Flush() override;
+    void SetFilters(const std::vector<CanFilter>& filters) override;
+
+    //! Detaches transport from bus, later Send fails.
+    void Close() override;
+
+    //! Attaches closed transport back to bus.
+    void Open();
+
+private slots:
+    //! Transmits frames waiting in transmit buffer.
+    void Transmit();
+
+private:
+    Q_DISABLE_COPY(LoopbackTransport)
+
+    friend class LoopbackBus;
+
+    //! Frame waiting in transmit buffer.
+    struct TxEntry {
+        CanFrame frame; //! CAN frame.
+        uint64_t token; //! Opaque token returned with transmission result.
+    };
+
+    LoopbackBus& bus_; //!< Bus the transport is attached to.
+    bool open_ = false; //!< Transport is attached to bus.
+    bool scheduled_ = false; //!< Transmit is scheduled in event loop.
+    std::vector<TxEntry> tx_buffer_; //!< Transmit buffer.
+    std::vector<CanFilter> filters_; //!< Acceptance filters of received frames.
+
+    //! Returns true if \a frame passes acceptance filters.
+    bool Accepts(const CanFrame& frame) const;
+};
+
+} // namespace sky
+
+#endif // LOOPBACKBUS_H
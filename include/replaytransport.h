@@ -0,0 +1,165 @@
+/* See the file "LICENSE.txt" for the full license governing this code. */
+
+#ifndef REPLAYTRANSPORT_H
+#define REPLAYTRANSPORT_H
+
+#include <QString>
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include "cantransport.h"
+#include "cantsclock.h"
+#include "cantscapture.h"
+
+namespace sky {
+
+/*! Transport replaying recorded capture of one CAN bus.
+
+    Frames received in the capture are delivered to the stack as received
+    frames (if they pass acceptance filters), frames sent by the stack are
+    confirmed as transmitted, recorded and checked against frames
+    transmitted in the capture in order. With mirror setting directions are
+    swapped, so traffic recorded by a client can be replayed into a stack
+    hosting the nodes it talked to.
+
+    Replay runs at original timing, scaled by speed setting or, with speed
+    0, as fast as possible: next frame is delivered when the event loop
+    has processed reactions to the previous one. Timing follows clock set
+    with SetClock, so with VirtualClock replay at original timing is
+    deterministic.
+*/
+class ReplayTransport : public CanTransport
+{
+    Q_OBJECT
+
+public:
+
+    //! Replay settings.
+    struct Settings {
+        double speed = 1.0; //!< Time scale (1 - original timing, 2 - twice as fast, 0 - as fast as possible).
+        bool mirror = false; //!< Recorded transmissions are received and recorded receptions are expected.
+    };
+
+    //! Creates open transport with \a settings and no recorded frames.
+    explicit ReplayTransport(const Settings& settings);
+
+    ~ReplayTransport() override;
+
+    //! Sets recorded frames of CAN \a bus from \a records, replay is rewound.
+    void SetRecords(const std::vector<CaptureRecord>& records, uint8_t bus);
+
+    //! Loads recorded frames of CAN \a bus from capture \a path. Returns false if capture has no segments.
+    /*!
+        Time stamps are converted to nanoseconds since Unix epoch, so segments appended by
+        later runs follow earlier ones (also after a reboot). Time between runs is replayed
+        as well, unless speed is 0.
+    */
+    bool Load(const QString& path, uint8_t bus);
+
+    //! Sets \a clock of replay timing (system clock by default). Clock must outlive the transport.
+    void SetClock(Clock& clock);
+
+    //! Starts or resumes delivering recorded frames.
+    void Start();
+
+    //! Pauses replay.
+    void Stop();
+
+    //! Returns true if all recorded frames were delivered.
+    bool IsFinished() const;
+
+    //! Returns number of recorded frames delivered to the stack.
+    uint64_t GetFramesReplayed() const;
+
+    //! Returns number of recorded frames rejected by acceptance filters.
+    uint64_t GetFramesFiltered() const;
+
+    //! Returns number of sent frames equal to the recorded transmission at the same position.
+    uint64_t GetFramesMatched() const;
+
+    //! Returns number of sent frames different from the recorded transmission at the same position.
+    uint64_t GetFramesMismatched() const;
+
+    //! Returns number of recorded transmissions not sent (yet).
+    uint64_t GetFramesMissing() const;
+
+    //! Returns number of sent frames beyond the recorded transmissions.
+    uint64_t GetFramesUnexpected() const;
+
+    //! Returns frames sent by the stack, stamped with replay position in capture time.
+    const std::vector<CaptureRecord>& GetTransmitted() const;
+
+    bool Send(const CanFrame& frame, uint64_t token = 0) override;
+    void Flush() override;
+    void SetFilters(const std::vector<CanFilter>& filters) override;
+
+    //! Stops replay and fails later Send.
+    void Close() override;
+
+    //! Opens closed transport.
+    void Open();
+
+signals:
+    //! Signal emits when the last recorded frame was delivered.
+    void Finished();
+
+    //! Signal emits when \a actual frame sent at position \a index differs from \a expected recorded one.
+    void TransmitMismatch(uint64_t index, const sky::CanFrame& expected, const sky::CanFrame& actual);
+
+private slots:
+    //! Delivers recorded frames which are due.
+    void Deliver();
+
+    //! Confirms frames waiting in transmit buffer.
+    void Transmit();
+
+private:
+    Q_DISABLE_COPY(ReplayTransport)
+
+    //! Frame waiting in transmit buffer.
+    struct TxEntry {
+        CanFrame frame; //!< CAN frame.
+        uint64_t token; //!< Opaque token returned with transmission result.
+    };
+
+    Settings settings_; //!< Replay settings.
+    Clock* clock_ = &Clock::System(); //!< Clock of replay timing.
+    std::unique_ptr<ClockTimer> timer_; //!< Timer of next due frame.
+    uint8_t bus_ = 0; //!< Replayed CAN bus.
+    bool open_ = true; //!< Transport accepts frames.
+    bool running_ = false; //!< Replay is running.
+    bool deliver_scheduled_ = false; //!< Deliver is scheduled in event loop.
+    bool transmit_scheduled_ = false; //!< Transmit is scheduled in event loop.
+
+    std::vector<CaptureRecord> stimulus_; //!< Recorded frames delivered to the stack.
+    std::vector<CaptureRecord> expected_; //!< Recorded frames expected from the stack.
+    std::vector<CaptureRecord> transmitted_; //!< Frames sent by the stack.
+    std::vector<CanFilter> filters_; //!< Acceptance filters of received frames.
+    std::vector<TxEntry> tx_buffer_; //!< Transmit buffer.
+
+    size_t next_ = 0; //!< Index of next stimulus frame.
+    uint64_t position_ = 0; //!< Replay position (capture time stamp).
+    int64_t start_ms_ = 0; //!< Clock time at which replay was (re)started.
+    uint64_t origin_ = 0; //!< Replay position at which replay was (re)started.
+
+    uint64_t frames_replayed_ = 0; //!< Stimulus frames delivered.
+    uint64_t frames_filtered_ = 0; //!< Stimulus frames rejected by filters.
+    uint64_t frames_matched_ = 0; //!< Sent frames equal to recorded ones.
+    uint64_t frames_mismatched_ = 0; //!< Sent frames different from recorded ones.
+
+    //! Returns true if \a frame passes acceptance filters.
+    bool Accepts(const CanFrame& frame) const;
+
+    //! Updates replay position from clock (timed replay).
+    void UpdatePosition();
+
+    //! Delivers stimulus frame \a record. Returns false if it did not pass acceptance filters.
+    bool DeliverRecord(const CaptureRecord& record);
+
+    //! Schedules delivery of next stimulus frame.
+    void ScheduleNext();
+};
+
+} // namespace sky
+
+#endif // REPLAYTRANSPORT_H
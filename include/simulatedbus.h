@@ -0,0 +1,202 @@
+/* See the file "LICENSE.txt" for the full license governing this code. */
+
+#ifndef SIMULATEDBUS_H
+#define SIMULATEDBUS_H
+
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <queue>
+#include <random>
+#include <vector>
+#include "cantransport.h"
+#include "cantsclock.h"
+
+namespace sky {
+
+class SimulatedTransport;
+
+/*! CAN bus simulated in virtual time.
+
+    Frames sent by attached SimulatedTransport objects contend for the bus
+    like on CAN: when the bus becomes idle, the pending frame with the lowest
+    arbitration field wins and occupies the bus for its length in bits
+    (including stuff bits) at configured bitrate. Receivers see the frame
+    after their processing delay.
+
+    Faults are drawn from generator with fixed seed, so runs with the same
+    traffic are reproducible:
+    - error: transmission is destroyed by an error frame and retransmitted,
+    - drop: a receiver misses the frame (it is not retransmitted),
+    - corrupt: a receiver gets the frame with one data bit flipped.
+
+    Time only advances when events are processed by Step or RunUntil, which
+    also process pending Qt events, so reactions of receivers happen at the
+    virtual time of the event which caused them. VirtualClock set with
+    SetClock (e.g. the clock of CAN_TS) is advanced together with the bus and
+    its timers expire in order with bus events.
+*/
+class SimulatedBus {
+public:
+
+    //! Bus timing and fault injection settings.
+    struct Settings {
+        uint32_t bitrate = 1000000; //!< Bus bitrate (bit/s).
+        double error_rate = 0.0; //!< Probability that transmission is destroyed by error frame.
+        double drop_rate = 0.0; //!< Probability that a receiver misses a frame.
+        double corrupt_rate = 0.0; //!< Probability that a receiver gets a frame with flipped data bit.
+        uint32_t seed = 1; //!< Seed of fault generator.
+    };
+
+    //! Creates idle bus at virtual time 0 with \a settings.
+    explicit SimulatedBus(const Settings& settings);
+
+    //! Returns virtual time (in nanoseconds).
+    uint64_t Now() const;
+
+    //! Sets \a clock advanced by the bus (nullptr for none). Clock must not be advanced by others.
+    void SetClock(VirtualClock* clock);
+
+    //! Schedules \a action to be executed at virtual \a time_ns (not before current time).
+    void Schedule(uint64_t time_ns, std::function<void()> action);
+
+    //! Processes pending Qt events and the next bus event or timer expiry. Returns false if none is scheduled.
+    bool Step();
+
+    //! Processes events and timers scheduled up to \a time_ns, then advances virtual time to \a time_ns.
+    void RunUntil(uint64_t time_ns);
+
+    //! Returns number of frames transmitted successfully.
+    uint64_t GetFramesSent() const;
+
+    //! Returns number of transmissions destroyed by error frames.
+    uint64_t GetErrorFrames() const;
+
+    //! Returns number of frame receptions dropped.
+    uint64_t GetFramesDropped() const;
+
+    //! Returns number of frame receptions corrupted.
+    uint64_t GetFramesCorrupted() const;
+
+    //! Returns number of times a pending frame lost arbitration.
+    uint64_t GetArbitrationLosses() const;
+
+    //! Returns time bus was occupied by frames, error frames and interframe space (in nanoseconds).
+    uint64_t GetBusyTime() const;
+
+    //! Returns bus load since virtual time 0 (0 - idle, 1 - saturated).
+    double GetLoad() const;
+
+    //! Returns length of \a frame in bits from start of frame to end of frame, including stuff bits.
+    static uint32_t FrameBits(const CanFrame& frame);
+
+private:
+    friend class SimulatedTransport;
+
+    //! Action scheduled in virtual time.
+    struct Event {
+        uint64_t time; //!< Virtual time of execution.
+        uint64_t sequence; //!< Order of scheduling (events at the same time run in order).
+        std::function<void()> action; //!< Executed action.
+
+        bool operator>(const Event& other) const {
+            return (time != other.time) ? (time > other.time) : (sequence > other.sequence);
+        }
+    };
+
+    Settings settings_; //!< Bus settings.
+    VirtualClock* clock_ = nullptr; //!< Clock advanced with the bus.
+    std::vector<SimulatedTransport*> endpoints_; //!< Attached transports.
+    std::priority_queue<Event, std::vector<Event>, std::greater<Event>> events_; //!< Scheduled events.
+    uint64_t now_ = 0; //!< Virtual time.
+    uint64_t sequence_ = 0; //!< Number of scheduled events.
+    uint64_t idle_at_ = 0; //!< Time when bus becomes idle after current frame.
+    bool transmitting_ = false; //!< Frame or error frame is on the bus.
+    bool arbitration_scheduled_ = false; //!< Arbitration is scheduled.
+
+    std::mt19937 random_; //!< Generator of faults.
+    std::bernoulli_distribution error_; //!< Error frame distribution.
+    std::bernoulli_distribution drop_; //!< Reception drop distribution.
+    std::bernoulli_distribution corrupt_; //!< Reception corruption distribution.
+
+    uint64_t frames_sent_ = 0; //!< Frames transmitted successfully.
+    uint64_t error_frames_ = 0; //!< Transmissions destroyed by error frames.
+    uint64_t frames_dropped_ = 0; //!< Frame receptions dropped.
+    uint64_t frames_corrupted_ = 0; //!< Frame receptions corrupted.
+    uint64_t arbitration_losses_ = 0; //!< Pending frames which lost arbitration.
+    uint64_t busy_ns_ = 0; //!< Time bus was occupied.
+
+    //! Sets \a time_ns to time of next bus event or timer expiry. Returns false if none is scheduled.
+    bool NextEvent(uint64_t& time_ns) const;
+
+    //! Returns duration of \a bits at bus bitrate (in nanoseconds).
+    uint64_t BitsTime(uint32_t bits) const;
+
+    //! Schedules arbitration when bus becomes idle if any transport has a frame pending.
+    void RequestArbitration();
+
+    //! Starts transmission of the pending frame with the lowest arbitration field.
+    void Arbitrate();
+
+    //! Completes transmission of \a frame with \a token sent by \a sender.
+    void Complete(SimulatedTransport* sender, const CanFrame& frame, uint64_t token);
+
+    //! Returns true if \a transport is attached to the bus.
+    bool IsAttached(const SimulatedTransport* transport) const;
+};
+
+/*! Transport attached to SimulatedBus.
+
+    Transport models CAN controller with a transmit queue: frames are sent in
+    order of Send calls, head of the queue takes part in arbitration.
+    Transmission results and received frames are emitted from SimulatedBus
+    event processing, never from within Send.
+*/
+class SimulatedTransport : public CanTransport
+{
+    Q_OBJECT
+
+public:
+    //! Attaches transport to \a bus, received frames are delivered after \a processing_delay_ns.
+    explicit SimulatedTransport(SimulatedBus& bus, uint64_t processing_delay_ns = 0);
+
+    //! Detaches transport from bus.
+    ~SimulatedTransport() override;
+
+    bool Send(const CanFrame& frame, uint64_t token = 0) override;
+    void Flush() override;
+    void SetFilters(const std::vector<CanFilter>& filters) override;
+
+    //! Detaches transport from bus, later Send fails.
+    void Close() override;
+
+    //! Attaches closed transport back to bus.
+    void Open();
+
+    //! Sets delay between end of frame on bus and its delivery (in nanoseconds).
+    void SetProcessingDelay(uint64_t processing_delay_ns);
+
+private:
+    Q_DISABLE_COPY(SimulatedTransport)
+
+    friend class SimulatedBus;
+
+    //! Frame waiting in transmit queue.
+    struct TxEntry {
+        CanFrame frame; //!< CAN frame.
+        uint64_t token; //!< Opaque token returned with transmission result.
+    };
+
+    SimulatedBus& bus_; //!< Bus the transport is attached to.
+    bool open_ = false; //!< Transport is attached to bus.
+    uint64_t processing_delay_ns_; //!< Delay of received frames.
+    std::deque<TxEntry> tx_queue_; //!< Transmit queue.
+    std::vector<CanFilter> filters_; //!< Acceptance filters of received frames.
+
+    //! Returns true if \a frame passes acceptance filters.
+    bool Accepts(const CanFrame& frame) const;
+};
+
+} // namespace sky
+
+#endif // SIMULATEDBUS_H
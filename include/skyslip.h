@@ -42,13 +42,17 @@ public:
     struct Frame {
         Cmd cmd = Cmd::SendCan0;
         std::vector<uint8_t> payload;
+        uint64_t timestamp = 0; //!< Time stamp passed to Decode with bytes completing the frame.
     };
 
     //! Encodes bytes in \a data into SLIP frame, adds \a cmd and returns SKY-SLIP frame.
     std::vector<uint8_t> Encode(Cmd cmd, const std::vector<uint8_t>& data);
 
     //! Decodes \a data from SKY-SLIP frame and returns decoded bytes via Qt signal.
-    void Decode(const std::vector<uint8_t>& data);
+    /*!
+        \param timestamp Time when \a data was read, stored in decoded frames.
+    */
+    void Decode(const std::vector<uint8_t>& data, uint64_t timestamp = 0);
 
     //! Flushes current SLIP processing information.
     void Flush();
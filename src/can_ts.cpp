@@ -2,12 +2,36 @@
 
 #include "can_ts.h"
 #include "cantsutils.h"
+#include "cantsprobes.h"
+#include "cantstrace.h"
 #include <QDebug>
 #include <QLoggingCategory>
+#include <algorithm>
 #include <memory>
+#include <string>
 
 Q_LOGGING_CATEGORY(cants, "sky::CAN_TS")
 
+namespace
+{
+
+//! Returns metric label of transfer \a type.
+const char* TransferTypeName(uint8_t type)
+{
+    static const char* const names[] = {"time_sync", "unsolicited", "telecommand", "telemetry", "set_block", "get_block"};
+    return (type < sizeof(names) / sizeof(names[0])) ? names[type] : "unknown";
+}
+
+//! Returns stage time stamps of transfer \a id in transfer \a index, nullptr if not found.
+template <typename Index>
+sky::CAN_TS::TransferTiming* IndexedTiming(const Index& index, uint32_t id)
+{
+    auto it = index.find(id);
+    return (it != index.end()) ? &it->second->timing : nullptr;
+}
+
+} // namespace
+
 namespace sky
 {
 
@@ -19,7 +43,7 @@ CAN_TS::DriverSettings::~DriverSettings() = default;
 
 bool CAN_TS::Start(uint8_t address, uint32_t timeout, const DriverSettings& driver)
 {
-    if (CanTsFrame::IsBroadcastAddress(address)) {
+    if (CanTsFrame::IsBroadcastAddress(address) || served_nodes_.count(address)) {
         qCCritical(cants) << "Invalid address" << address;
         return false;
     }
@@ -27,58 +51,114 @@ bool CAN_TS::Start(uint8_t address, uint32_t timeout, const DriverSettings& driv
     address_ = address;
     timeout_ = timeout;
 
+    tm_cache_.clear();
+    keep_alive_.clear();
+    redundancy_votes_ = 0;
+    last_bus_switch_ = -1;
+    start_time_ = clock_->Elapsed();
+
     auto candelaber = dynamic_cast<const CANdelaber*>(&driver);
+    auto transport = dynamic_cast<const Transport*>(&driver);
+
     if (candelaber) {
         if (!com0_.Open(candelaber->port_name_can0, candelaber->baud)) {
             qCCritical(cants) << "Port open failed" << candelaber->port_name_can0.data();
             return false;
         }
 
-        if (!com1_.Open(candelaber->port_name_can1, candelaber->baud)) {
+        if (candelaber->port_name_can1.empty() || (candelaber->port_name_can1 == candelaber->port_name_can0)) {
+            // Both buses multiplexed over single serial port.
+            if (!com1_.Attach(com0_, SkySlip::Cmd::SendCan1)) {
+                qCCritical(cants) << "Attaching CAN1 to port failed" << candelaber->port_name_can0.data();
+                com0_.Close();
+                return false;
+            }
+        } else if (!com1_.Open(candelaber->port_name_can1, candelaber->baud)) {
             qCCritical(cants) << "Port open failed" << candelaber->port_name_can1.data();
+            com0_.Close();
             return false;
         }
 
-        // Set CAN0 as nominal bus.
-        active_bus_ = CanBus::CAN0;
-
-        // Initialise nominal bus.
-        connect(&com0_, &sky::CommDriver::CanFrameSent, this, &sky::CAN_TS::CanFrameSentNominal, Qt::QueuedConnection);
-        connect(&com0_, &sky::CommDriver::CanFrameError, this, &sky::CAN_TS::CanFrameSendErrorNominal, Qt::QueuedConnection);
-        connect(&com0_, &sky::CommDriver::CanFrameReceived, this, &sky::CAN_TS::CanFrameReceivedNominal, Qt::QueuedConnection);
-
-        // Initialise redundant bus.
-        connect(&com1_, &sky::CommDriver::CanFrameReceived, this, &sky::CAN_TS::CanFrameReceivedRedundant, Qt::QueuedConnection);
+        can0_ = &com0_;
+        can1_ = &com1_;
+    } else if (transport) {
+        if (!transport->can0 || !transport->can1 || (transport->can0 == transport->can1)) {
+            qCCritical(cants) << "Invalid transports";
+            return false;
+        }
 
-        qCDebug(cants) << "Started CAN-TS stack (using candelaber) with address =" << address << "timeout =" << timeout;
-        return true;
+        can0_ = transport->can0;
+        can1_ = transport->can1;
     } else {
         return false;
     }
+
+    // Only frames for this node and broadcasts handled by the stack reach it.
+    can0_->SetFilters(GetAcceptanceFilters());
+    can1_->SetFilters(GetAcceptanceFilters());
+
+    // Set CAN0 as nominal bus.
+    active_bus_ = CanBus::CAN0;
+
+    // Initialise nominal bus.
+    connect(can0_, &sky::CanTransport::CanFrameSent, this, &sky::CAN_TS::CanFrameSentNominal, Qt::QueuedConnection);
+    connect(can0_, &sky::CanTransport::CanFrameError, this, &sky::CAN_TS::CanFrameSendErrorNominal, Qt::QueuedConnection);
+    connect(can0_, &sky::CanTransport::CanFrameReceived, this, &sky::CAN_TS::CanFrameReceivedNominal, Qt::QueuedConnection);
+
+    // Initialise redundant bus.
+    connect(can1_, &sky::CanTransport::CanFrameReceived, this, &sky::CAN_TS::CanFrameReceivedRedundant, Qt::QueuedConnection);
+
+    if (redundancy_.enabled)
+        redundancy_timer_->Start(redundancy_.check_period_ms);
+
+    qCDebug(cants) << "Started CAN-TS stack (using" << (candelaber ? "candelaber)" : "transport)")
+                   << "with address =" << address << "timeout =" << timeout;
+    return true;
 }
 
 void CAN_TS::Stop()
 {
+    if (redundancy_timer_)
+        redundancy_timer_->Stop();
+
     // Uninitialise nominal and redundant bus signals.
     if (active_bus_ == CanBus::CAN0) {
-        disconnect(&com0_, &sky::CommDriver::CanFrameSent, this, &sky::CAN_TS::CanFrameSentNominal);
-        disconnect(&com0_, &sky::CommDriver::CanFrameError, this, &sky::CAN_TS::CanFrameSendErrorNominal);
-        disconnect(&com0_, &sky::CommDriver::CanFrameReceived, this, &sky::CAN_TS::CanFrameReceivedNominal);
-        disconnect(&com1_, &sky::CommDriver::CanFrameReceived, this, &sky::CAN_TS::CanFrameReceivedRedundant);
+        disconnect(can0_, &sky::CanTransport::CanFrameSent, this, &sky::CAN_TS::CanFrameSentNominal);
+        disconnect(can0_, &sky::CanTransport::CanFrameError, this, &sky::CAN_TS::CanFrameSendErrorNominal);
+        disconnect(can0_, &sky::CanTransport::CanFrameReceived, this, &sky::CAN_TS::CanFrameReceivedNominal);
+        disconnect(can1_, &sky::CanTransport::CanFrameReceived, this, &sky::CAN_TS::CanFrameReceivedRedundant);
     } else {
-        disconnect(&com1_, &sky::CommDriver::CanFrameSent, this, &sky::CAN_TS::CanFrameSentNominal);
-        disconnect(&com1_, &sky::CommDriver::CanFrameError, this, &sky::CAN_TS::CanFrameSendErrorNominal);
-        disconnect(&com1_, &sky::CommDriver::CanFrameReceived, this, &sky::CAN_TS::CanFrameReceivedNominal);
-        disconnect(&com0_, &sky::CommDriver::CanFrameReceived, this, &sky::CAN_TS::CanFrameReceivedRedundant);
+        disconnect(can1_, &sky::CanTransport::CanFrameSent, this, &sky::CAN_TS::CanFrameSentNominal);
+        disconnect(can1_, &sky::CanTransport::CanFrameError, this, &sky::CAN_TS::CanFrameSendErrorNominal);
+        disconnect(can1_, &sky::CanTransport::CanFrameReceived, this, &sky::CAN_TS::CanFrameReceivedNominal);
+        disconnect(can0_, &sky::CanTransport::CanFrameReceived, this, &sky::CAN_TS::CanFrameReceivedRedundant);
     }
 
     tc_transfers_.clear();
     tm_transfers_.clear();
     sb_transfers_.clear();
     gb_transfers_.clear();
+    tc_index_.clear();
+    tm_index_.clear();
+    sb_index_.clear();
+    gb_index_.clear();
+    tc_nodes_.clear();
+    tm_nodes_.clear();
+    sb_nodes_.clear();
+    gb_nodes_.clear();
+    tm_cache_.clear();
+    dual_bus_responses_.clear();
+
+    // Stopped stack: SetRedundancy does not start checks and keep alives are ignored until next Start.
+    start_time_ = -1;
+
+    for (auto& node : served_nodes_) {
+        node.second.set_blocks.clear();
+        node.second.get_blocks.clear();
+    }
 
-    com0_.Close();
-    com1_.Close();
+    can1_->Close();
+    can0_->Close();
 
     qCDebug(cants) << "Stopped CAN-TS stack";
 }
@@ -88,24 +168,30 @@ CAN_TS::CanBus CAN_TS::GetActiveBus() const
     return active_bus_;
 }
 
+CanTransport& CAN_TS::GetTransport(CanBus bus)
+{
+    return (bus == CanBus::CAN0) ? *can0_ : *can1_;
+}
+
 void CAN_TS::CanBusSwitch()
 {
-    tc_transfers_.clear();
-    tm_transfers_.clear();
-    sb_transfers_.clear();
-    gb_transfers_.clear();
+    // Frames queued on previous nominal bus are re-sent on the new one.
+    if (active_bus_ == CanBus::CAN0)
+        can0_->Flush();
+    else
+        can1_->Flush();
 
     // Uninitialise nominal and  bus signals.
     if (active_bus_ == CanBus::CAN0) {
-        disconnect(&com0_, &sky::CommDriver::CanFrameSent, this, &sky::CAN_TS::CanFrameSentNominal);
-        disconnect(&com0_, &sky::CommDriver::CanFrameError, this, &sky::CAN_TS::CanFrameSendErrorNominal);
-        disconnect(&com0_, &sky::CommDriver::CanFrameReceived, this, &sky::CAN_TS::CanFrameReceivedNominal);
-        disconnect(&com1_, &sky::CommDriver::CanFrameReceived, this, &sky::CAN_TS::CanFrameReceivedRedundant);
+        disconnect(can0_, &sky::CanTransport::CanFrameSent, this, &sky::CAN_TS::CanFrameSentNominal);
+        disconnect(can0_, &sky::CanTransport::CanFrameError, this, &sky::CAN_TS::CanFrameSendErrorNominal);
+        disconnect(can0_, &sky::CanTransport::CanFrameReceived, this, &sky::CAN_TS::CanFrameReceivedNominal);
+        disconnect(can1_, &sky::CanTransport::CanFrameReceived, this, &sky::CAN_TS::CanFrameReceivedRedundant);
     } else {
-        disconnect(&com1_, &sky::CommDriver::CanFrameSent, this, &sky::CAN_TS::CanFrameSentNominal);
-        disconnect(&com1_, &sky::CommDriver::CanFrameError, this, &sky::CAN_TS::CanFrameSendErrorNominal);
-        disconnect(&com1_, &sky::CommDriver::CanFrameReceived, this, &sky::CAN_TS::CanFrameReceivedNominal);
-        disconnect(&com0_, &sky::CommDriver::CanFrameReceived, this, &sky::CAN_TS::CanFrameReceivedRedundant);
+        disconnect(can1_, &sky::CanTransport::CanFrameSent, this, &sky::CAN_TS::CanFrameSentNominal);
+        disconnect(can1_, &sky::CanTransport::CanFrameError, this, &sky::CAN_TS::CanFrameSendErrorNominal);
+        disconnect(can1_, &sky::CanTransport::CanFrameReceived, this, &sky::CAN_TS::CanFrameReceivedNominal);
+        disconnect(can0_, &sky::CanTransport::CanFrameReceived, this, &sky::CAN_TS::CanFrameReceivedRedundant);
     }
 
     // Switch buses.
@@ -116,18 +202,103 @@ void CAN_TS::CanBusSwitch()
 
     // Initialise nominal and redundant bus signals.
     if (active_bus_ == CanBus::CAN0) {
-        connect(&com0_, &sky::CommDriver::CanFrameSent, this, &sky::CAN_TS::CanFrameSentNominal, Qt::QueuedConnection);
-        connect(&com0_, &sky::CommDriver::CanFrameError, this, &sky::CAN_TS::CanFrameSendErrorNominal, Qt::QueuedConnection);
-        connect(&com0_, &sky::CommDriver::CanFrameReceived, this, &sky::CAN_TS::CanFrameReceivedNominal, Qt::QueuedConnection);
-        connect(&com1_, &sky::CommDriver::CanFrameReceived, this, &sky::CAN_TS::CanFrameReceivedRedundant, Qt::QueuedConnection);
+        connect(can0_, &sky::CanTransport::CanFrameSent, this, &sky::CAN_TS::CanFrameSentNominal, Qt::QueuedConnection);
+        connect(can0_, &sky::CanTransport::CanFrameError, this, &sky::CAN_TS::CanFrameSendErrorNominal, Qt::QueuedConnection);
+        connect(can0_, &sky::CanTransport::CanFrameReceived, this, &sky::CAN_TS::CanFrameReceivedNominal, Qt::QueuedConnection);
+        connect(can1_, &sky::CanTransport::CanFrameReceived, this, &sky::CAN_TS::CanFrameReceivedRedundant, Qt::QueuedConnection);
     } else {
-        connect(&com1_, &sky::CommDriver::CanFrameSent, this, &sky::CAN_TS::CanFrameSentNominal, Qt::QueuedConnection);
-        connect(&com1_, &sky::CommDriver::CanFrameError, this, &sky::CAN_TS::CanFrameSendErrorNominal, Qt::QueuedConnection);
-        connect(&com1_, &sky::CommDriver::CanFrameReceived, this, &sky::CAN_TS::CanFrameReceivedNominal, Qt::QueuedConnection);
-        connect(&com0_, &sky::CommDriver::CanFrameReceived, this, &sky::CAN_TS::CanFrameReceivedRedundant, Qt::QueuedConnection);
+        connect(can1_, &sky::CanTransport::CanFrameSent, this, &sky::CAN_TS::CanFrameSentNominal, Qt::QueuedConnection);
+        connect(can1_, &sky::CanTransport::CanFrameError, this, &sky::CAN_TS::CanFrameSendErrorNominal, Qt::QueuedConnection);
+        connect(can1_, &sky::CanTransport::CanFrameReceived, this, &sky::CAN_TS::CanFrameReceivedNominal, Qt::QueuedConnection);
+        connect(can0_, &sky::CanTransport::CanFrameReceived, this, &sky::CAN_TS::CanFrameReceivedRedundant, Qt::QueuedConnection);
     }
 
     qCDebug(cants) << "Bus switched";
+
+    redundancy_votes_ = 0;
+    last_bus_switch_ = (start_time_ >= 0) ? ElapsedSinceStart() : -1;
+
+    SKY_TRACE(TraceEvent::kBusSwitch, BusIndex(true), 0, 0, nullptr, 0);
+
+    ResumeTransfers();
+    emit BusSwitched(active_bus_);
+}
+
+void CAN_TS::SetDualBus(bool enabled)
+{
+    dual_bus_ = enabled;
+    dual_bus_responses_.clear();
+    qCDebug(cants) << "Dual bus transmission enabled =" << enabled;
+}
+
+bool CAN_TS::IsDualBus() const
+{
+    return dual_bus_;
+}
+
+void CAN_TS::SetAnalyzer(BusAnalyzer* analyzer)
+{
+    analyzer_ = analyzer;
+    can0_->SetFilters(GetAcceptanceFilters());
+    can1_->SetFilters(GetAcceptanceFilters());
+    qCDebug(cants) << "Promiscuous mode enabled =" << (analyzer != nullptr);
+}
+
+void CAN_TS::ResumeTransfers()
+{
+    // Resume functions may remove a failed transfer, so advance iterator before the call.
+    for (auto it = tc_transfers_.begin(); it != tc_transfers_.end();)
+        SendTCResume(it++);
+
+    for (auto it = tm_transfers_.begin(); it != tm_transfers_.end();)
+        ReceiveTMResume(it++);
+
+    for (auto it = sb_transfers_.begin(); it != sb_transfers_.end();)
+        SendBlockResume(it++);
+
+    for (auto it = gb_transfers_.begin(); it != gb_transfers_.end();)
+        ReceiveBlockResume(it++);
+}
+
+std::vector<CanFilter> CAN_TS::GetAcceptanceFilters() const
+{
+    // See ToCanFrame for CAN TS identifier layout.
+    constexpr uint32_t kToAddressMask = 0xFFU << 21;
+    constexpr uint32_t kTypeMask = 0x07U << 18;
+
+    CanFilter local;
+    local.id = static_cast<uint32_t>(address_) << 21;
+    local.mask = kToAddressMask;
+
+    CanFilter keep_alive;
+    keep_alive.id = (static_cast<uint32_t>(CanTsFrame::Address::KEEP_ALIVE) << 21) |
+                    (static_cast<uint32_t>(CanTsFrame::TransferType::UNSOLICITED) << 18);
+    keep_alive.mask = kToAddressMask | kTypeMask;
+
+    CanFilter time_sync;
+    time_sync.id = (static_cast<uint32_t>(CanTsFrame::Address::TIME_SYNC) << 21) |
+                   (static_cast<uint32_t>(CanTsFrame::TransferType::TIME_SYNC) << 18);
+    time_sync.mask = kToAddressMask | kTypeMask;
+
+    // Filters are matched one by one, many hosted nodes are cheaper to reject after decoding.
+    constexpr size_t kMaxNodeFilters = 16;
+
+    if (analyzer_ || (served_nodes_.size() > kMaxNodeFilters)) {
+        CanFilter any;
+        any.mask = 0;
+        return {any};
+    }
+
+    std::vector<CanFilter> filters = {local, keep_alive, time_sync};
+
+    for (const auto& node : served_nodes_) {
+        CanFilter hosted;
+        hosted.id = static_cast<uint32_t>(node.first) << 21;
+        hosted.mask = kToAddressMask;
+        filters.push_back(hosted);
+    }
+
+    return filters;
 }
 
 CanFrame CAN_TS::ToCanFrame(const CanTsFrame& can_ts_frame)
@@ -148,49 +319,246 @@ CanFrame CAN_TS::ToCanFrame(const CanTsFrame& can_ts_frame)
 CanTsFrame CAN_TS::FromCanFrame(const CanFrame& can_frame)
 {
     CanTsFrame can_ts_frame;
-    can_ts_frame.command_ = static_cast<uint16_t>(can_frame.id & 0x3FF);
-    can_ts_frame.fromAddress_ = static_cast<uint8_t>((can_frame.id >> 10) & 0xFF);
-    can_ts_frame.type_ = static_cast<uint8_t>((can_frame.id >> 18) & 0x07);
-    can_ts_frame.toAddress_ = static_cast<uint8_t>((can_frame.id >> 21) & 0xFF);
+    can_ts_frame.DecodeId(can_frame.id);
     can_ts_frame.data_ = can_frame.data;
     return can_ts_frame;
 }
 
-bool CAN_TS::SendFrame(const CanTsFrame& frame)
+bool CAN_TS::SendFrame(const CanTsFrame& frame, uint32_t transfer_id)
 {
-    qCDebug(cants) << "Sending frame" << frame;
+    CanTransport& nominal = (active_bus_ == CanBus::CAN0) ? *can0_ : *can1_;
+    CanTransport& redundant = (active_bus_ == CanBus::CAN0) ? *can1_ : *can0_;
+    CanFrame can_frame = ToCanFrame(frame);
+    uint64_t token = MakeFrameToken(frame, transfer_id);
 
-    if (active_bus_ == CanBus::CAN0)
-        return com0_.Send(ToCanFrame(frame));
-    else
-        return com1_.Send(ToCanFrame(frame));
+    SKY_TRACE_FRAME(TraceEvent::kFrameSend, BusIndex(true), can_frame, transfer_id);
+    SKY_PROBE5(frame_send, frame.toAddress_, frame.type_, frame.command_, transfer_id, BusIndex(true));
+
+    // Copy on redundant bus is best effort, transfer state follows nominal bus only.
+    if (dual_bus_ && !redundant.Send(can_frame, token))
+        qCDebug(cants) << "Sending frame via redundant bus failed";
+
+    return nominal.Send(can_frame, token);
 }
 
-void CAN_TS::CanFrameSentNominal(const CanFrame& frame)
+void CAN_TS::SetClock(Clock& clock)
 {
-    CanTsFrame can_ts_frame = FromCanFrame(frame);
+    clock_ = &clock;
+    start_time_ = -1;
+    com0_.SetClock(clock);
+    com1_.SetClock(clock);
+
+    // Timer of the previous clock must not outlive the clock.
+    if (redundancy_timer_)
+        redundancy_timer_ = clock_->CreateTimer([this]() { RedundancyCheck(); }, false);
+}
+
+qint64 CAN_TS::ElapsedSinceStart() const
+{
+    return clock_->Elapsed() - start_time_;
+}
+
+uint8_t CAN_TS::BusIndex(bool nominal_bus) const
+{
+    return static_cast<uint8_t>((active_bus_ == CanBus::CAN0) == nominal_bus ? 0 : 1);
+}
+
+void CAN_TS::RecordTransfer(TraceEvent event, uint8_t type, uint8_t address, uint32_t transfer_id, TransferTiming& timing,
+                            uint8_t error)
+{
+    SKY_TRACE(event, Trace::kNoBus, (static_cast<uint32_t>(address) << 21) | (static_cast<uint32_t>(type) << 18),
+              transfer_id, &error, (event == TraceEvent::kTransferFail) ? 1 : 0);
+
+    Metrics& metrics = Metrics::Instance();
+
+    if (event == TraceEvent::kTransferStart) {
+        metrics.GetCounter("cants_transfers_started_total", {{"type", TransferTypeName(type)}},
+                           "Number of started transfers.").Increment();
+    } else if (event == TraceEvent::kTransferFail) {
+        metrics.GetCounter("cants_transfers_failed_total", {{"type", TransferTypeName(type)}, {"error", std::to_string(error)}},
+                           "Number of failed transfers by transfer specific error code.").Increment();
+    } else if (event == TraceEvent::kTransferComplete) {
+        timing.read = rx_read_time_;
+        timing.received = rx_dispatch_time_;
+        timing.complete = Trace::Now();
+
+        // Histograms are looked up once per transfer type and node, completion only records.
+        uint32_t key = (static_cast<uint32_t>(type) << 8) | address;
+        auto it = latency_metrics_.find(key);
+
+        if (it == latency_metrics_.end()) {
+            MetricHistogram& histogram = metrics.GetHistogram(
+                "cants_transfer_latency_seconds", {{"type", TransferTypeName(type)}, {"node", std::to_string(address)}},
+                "Time from transfer start to completion.", 1e-6);
+            it = latency_metrics_.emplace(key, &histogram).first;
+        }
+
+        it->second->Record((timing.complete - timing.start) / 1000);
+        RecordStages(type, timing);
+        emit TransferTimed(type, address, timing);
+    }
+}
+
+void CAN_TS::RecordStages(uint8_t type, const TransferTiming& timing)
+{
+    struct Stage {
+        const char* name;
+        uint64_t from;
+        uint64_t to;
+    };
+
+    // Response is read after frame was written, send notification is handled in parallel with it.
+    const Stage stages[] = {
+        {"request", timing.start, timing.enqueued},
+        {"queue", timing.enqueued, timing.write},
+        {"serial", timing.write, timing.written},
+        {"notify", timing.written, timing.sent},
+        {"remote", timing.written, timing.read},
+        {"dispatch", timing.read, timing.received},
+        {"complete", timing.received, timing.complete}
+    };
+
+    for (uint32_t i = 0; i < sizeof(stages) / sizeof(stages[0]); i++) {
+        const Stage& stage = stages[i];
+
+        if (!stage.from || (stage.to < stage.from))
+            continue;
+
+        uint32_t key = (static_cast<uint32_t>(type) << 8) | i;
+        auto it = stage_metrics_.find(key);
+
+        if (it == stage_metrics_.end()) {
+            MetricHistogram& histogram = Metrics::Instance().GetHistogram(
+                "cants_transfer_stage_seconds", {{"type", TransferTypeName(type)}, {"stage", stage.name}},
+                "Latency of transfer stages.", 1e-6);
+            it = stage_metrics_.emplace(key, &histogram).first;
+        }
+
+        it->second->Record((stage.to - stage.from) / 1000);
+    }
+}
+
+CAN_TS::TransferTiming* CAN_TS::FindTiming(uint8_t type, uint32_t transfer_id)
+{
+    switch (type) {
+    case CanTsFrame::TransferType::TELECOMMAND:
+        return IndexedTiming(tc_index_, transfer_id);
+
+    case CanTsFrame::TransferType::TELEMETRY:
+        return IndexedTiming(tm_index_, transfer_id);
+
+    case CanTsFrame::TransferType::SET_BLOCK:
+        return IndexedTiming(sb_index_, transfer_id);
+
+    case CanTsFrame::TransferType::GET_BLOCK:
+        return IndexedTiming(gb_index_, transfer_id);
+
+    default:
+        return nullptr;
+    }
+}
+
+void CAN_TS::CountRetry(uint8_t type, const char* frame) const
+{
+    // Retries are rare, so counter is looked up on each retry.
+    Metrics::Instance().GetCounter("cants_transfer_retries_total", {{"type", TransferTypeName(type)}, {"frame", frame}},
+                                   "Number of retransmitted transfer frames.").Increment();
+}
+
+uint32_t CAN_TS::NextTransferId()
+{
+    // Zero is reserved for frames not belonging to a transfer.
+    if (++next_transfer_id_ == 0)
+        ++next_transfer_id_;
+
+    return next_transfer_id_;
+}
+
+uint32_t CAN_TS::ChannelKey(uint8_t address, uint8_t channel)
+{
+    return (static_cast<uint32_t>(address) << 8) | channel;
+}
+
+uint64_t CAN_TS::MakeFrameToken(const CanTsFrame& frame, uint32_t transfer_id) const
+{
+    // Token layout: bit 63 - valid, bits 62-55 - to address, bits 54-52 - transfer type,
+    // bits 51-42 - command, bit 41 - sent by hosted node, bits 39-32 - hosted node address,
+    // bits 31-0 - transfer identifier.
+    uint64_t token = (1ULL << 63) |
+                     (static_cast<uint64_t>(frame.toAddress_) << 55) |
+                     (static_cast<uint64_t>(frame.type_ & 0x07) << 52) |
+                     (static_cast<uint64_t>(frame.command_ & 0x3FF) << 42) |
+                     static_cast<uint64_t>(transfer_id);
+
+    if (frame.fromAddress_ != address_)
+        token |= (1ULL << 41) | (static_cast<uint64_t>(frame.fromAddress_) << 32);
+
+    return token;
+}
+
+bool CAN_TS::FrameFromToken(uint64_t token, CanTsFrame& frame, uint32_t& transfer_id) const
+{
+    if (!(token >> 63))
+        return false;
+
+    frame.toAddress_ = static_cast<uint8_t>((token >> 55) & 0xFF);
+    frame.type_ = static_cast<uint8_t>((token >> 52) & 0x07);
+    frame.command_ = static_cast<uint16_t>((token >> 42) & 0x3FF);
+    frame.fromAddress_ = ((token >> 41) & 1) ? static_cast<uint8_t>((token >> 32) & 0xFF) : address_;
+    transfer_id = static_cast<uint32_t>(token);
+    return true;
+}
+
+void CAN_TS::CanFrameSentNominal(const CanFrame& frame, uint64_t token)
+{
+    CanTsFrame can_ts_frame;
+    uint32_t transfer_id = 0;
 
     // Sanity checks.
     assert(frame.extid && (!frame.rtr));
-    assert(can_ts_frame.fromAddress_ == address_);
 
-    qCDebug(cants) << "Sent frame" << can_ts_frame;
+    // Frame is not decoded, header and transfer are known from token.
+    if (!FrameFromToken(token, can_ts_frame, transfer_id)) {
+        qCCritical(cants) << "Sent frame without token";
+        return;
+    }
+
+    SKY_TRACE_FRAME(TraceEvent::kFrameSent, BusIndex(true), frame, transfer_id);
+    SKY_PROBE4(frame_sent, can_ts_frame.toAddress_, can_ts_frame.type_, can_ts_frame.command_, transfer_id);
+
+    // Own frames are not received back, analyzer sees them when sent (decoded into reused buffer).
+    if (analyzer_) {
+        analyzer_frame_.DecodeId(frame.id);
+        analyzer_frame_.data_.assign(frame.data.begin(), frame.data.end());
+        analyzer_->Process(analyzer_frame_, frame.timing.written ? frame.timing.written : Trace::Now());
+    }
+
+    // Responses of hosted nodes do not belong to any transfer of this node.
+    if (can_ts_frame.fromAddress_ != address_)
+        return;
+
+    if (TransferTiming* timing = FindTiming(can_ts_frame.type_, transfer_id)) {
+        timing->enqueued = frame.timing.enqueued;
+        timing->write = frame.timing.write;
+        timing->written = frame.timing.written;
+        timing->sent = Trace::Now();
+    }
 
     switch (can_ts_frame.type_) {
     case CanTsFrame::TransferType::TELECOMMAND:
-        SendTCFrameSent(can_ts_frame);
+        SendTCFrameSent(can_ts_frame, transfer_id);
         break;
 
     case CanTsFrame::TransferType::TELEMETRY:
-        ReceiveTMFrameSent(can_ts_frame);
+        ReceiveTMFrameSent(can_ts_frame, transfer_id);
         break;
 
     case CanTsFrame::TransferType::SET_BLOCK:
-        SendBlockFrameSent(can_ts_frame);
+        SendBlockFrameSent(can_ts_frame, transfer_id);
         break;
 
     case CanTsFrame::TransferType::GET_BLOCK:
-        ReceiveBlockFrameSent(can_ts_frame);
+        ReceiveBlockFrameSent(can_ts_frame, transfer_id);
         break;
 
     case CanTsFrame::TransferType::TIME_SYNC:
@@ -203,31 +571,43 @@ void CAN_TS::CanFrameSentNominal(const CanFrame& frame)
     }
 }
 
-void CAN_TS::CanFrameSendErrorNominal(const CanFrame& frame, CommDriver::CanSendError error)
+void CAN_TS::CanFrameSendErrorNominal(const CanFrame& frame, CanTransport::CanSendError error, uint64_t token)
 {
-    CanTsFrame can_ts_frame = FromCanFrame(frame);
+    CanTsFrame can_ts_frame;
+    uint32_t transfer_id = 0;
 
     // Sanity checks.
     assert(frame.extid && (!frame.rtr));
-    assert(can_ts_frame.fromAddress_ == address_);
 
-    qCDebug(cants) << "Failed sending frame" << can_ts_frame;
+    if (!FrameFromToken(token, can_ts_frame, transfer_id)) {
+        qCCritical(cants) << "Failed sending frame without token";
+        return;
+    }
+
+    uint8_t code = static_cast<uint8_t>(error);
+    SKY_TRACE(TraceEvent::kFrameSendError, BusIndex(true), frame.id, transfer_id, &code, 1);
+    qCDebug(cants) << "Failed sending frame" << can_ts_frame << "transfer_id =" << transfer_id;
+
+    if (can_ts_frame.fromAddress_ != address_) {
+        ServeFrameSendError(can_ts_frame, error);
+        return;
+    }
 
     switch (can_ts_frame.type_) {
     case CanTsFrame::TransferType::TELECOMMAND:
-        SendTCFrameSendError(can_ts_frame, error);
+        SendTCFrameSendError(can_ts_frame, transfer_id, error);
         break;
 
     case CanTsFrame::TransferType::TELEMETRY:
-        ReceiveTMFrameSendError(can_ts_frame, error);
+        ReceiveTMFrameSendError(can_ts_frame, transfer_id, error);
         break;
 
     case CanTsFrame::TransferType::SET_BLOCK:
-        SendBlockFrameSendError(can_ts_frame, error);
+        SendBlockFrameSendError(can_ts_frame, transfer_id, error);
         break;
 
     case CanTsFrame::TransferType::GET_BLOCK:
-        ReceiveBlockFrameSendError(can_ts_frame, error);
+        ReceiveBlockFrameSendError(can_ts_frame, transfer_id, error);
         break;
 
     case CanTsFrame::TransferType::TIME_SYNC:
@@ -242,42 +622,31 @@ void CAN_TS::CanFrameSendErrorNominal(const CanFrame& frame, CommDriver::CanSend
 
 void CAN_TS::CanFrameReceivedNominal(const CanFrame& frame)
 {
-    // Basic 11-bit idendifier is not supported.
+    // Basic 11-bit idendifier is not supported (foreign traffic passes filters in promiscuous mode).
     if (!frame.extid || frame.rtr) {
-        qCCritical(cants) << "Error: 11-bit ID and RTR not supported";
+        if (analyzer_)
+            qCDebug(cants) << "Ignored 11-bit ID or RTR frame";
+        else
+            qCCritical(cants) << "Error: 11-bit ID and RTR not supported";
         return;
     }
 
+    SKY_TRACE_FRAME(TraceEvent::kFrameReceived, BusIndex(true), frame, 1);
     CanTsFrame can_ts_frame = FromCanFrame(frame);
-    qCDebug(cants) << "Received frame" << can_ts_frame;
+    SKY_PROBE5(frame_received, can_ts_frame.fromAddress_, can_ts_frame.toAddress_, can_ts_frame.type_,
+               can_ts_frame.command_, 1);
+
+    if (analyzer_)
+        analyzer_->Process(can_ts_frame, frame.timing.read ? frame.timing.read : Trace::Now());
 
     if (can_ts_frame.toAddress_ == address_) {
         // If we are the recepient.
-        switch (can_ts_frame.type_) {
-        case CanTsFrame::TransferType::TELECOMMAND:
-            SendTCFrameReceived(can_ts_frame);
-            break;
-
-        case CanTsFrame::TransferType::TELEMETRY:
-            ReceiveTMFrameReceived(can_ts_frame);
-            break;
-
-        case CanTsFrame::TransferType::SET_BLOCK:
-            FrameReceivedSetBlock(can_ts_frame);
-            break;
-
-        case CanTsFrame::TransferType::GET_BLOCK:
-            ReceiveBlockFrameReceived(can_ts_frame);
-            break;
-
-        case CanTsFrame::TransferType::UNSOLICITED:
+        if (can_ts_frame.type_ == CanTsFrame::TransferType::UNSOLICITED)
             ReceivedUnsolicitedFrame(can_ts_frame);
-            break;
-
-        default:
+        else if (dual_bus_ && DualBusDuplicate(can_ts_frame, true))
+            return;
+        else if (!ReceivedTransferFrame(can_ts_frame, frame.timing.read))
             qCCritical(cants) << "Invalid transfer type" << static_cast<int>(can_ts_frame.type_);
-            break;
-        }
     } else if (can_ts_frame.toAddress_ == static_cast<uint8_t>(sky::CanTsFrame::Address::KEEP_ALIVE) &&
               (can_ts_frame.type_ == CanTsFrame::TransferType::UNSOLICITED)) {
         // If keep alive transfer.
@@ -286,25 +655,111 @@ void CAN_TS::CanFrameReceivedNominal(const CanFrame& frame)
                can_ts_frame.type_ == CanTsFrame::TransferType::TIME_SYNC) {
         // If time sync transfer.
         SendTimeSyncFrameReceived(can_ts_frame);
+    } else if (!served_nodes_.empty()) {
+        // If hosted node is the recipient.
+        auto node = served_nodes_.find(can_ts_frame.toAddress_);
+
+        if (node != served_nodes_.end())
+            ServeFrameReceived(node->second, can_ts_frame);
     }
 }
 
 void CAN_TS::CanFrameReceivedRedundant(const CanFrame& frame)
 {
-    // Basic 11-bit idendifier is not supported.
+    // Basic 11-bit idendifier is not supported (foreign traffic passes filters in promiscuous mode).
     if (!frame.extid || frame.rtr) {
-        qCCritical(cants) << "Error: 11-bit ID and RTR not supported";
+        if (analyzer_)
+            qCDebug(cants) << "Ignored 11-bit ID or RTR frame";
+        else
+            qCCritical(cants) << "Error: 11-bit ID and RTR not supported";
         return;
     }
 
+    SKY_TRACE_FRAME(TraceEvent::kFrameReceived, BusIndex(false), frame, 0);
     CanTsFrame can_ts_frame = FromCanFrame(frame);
-    qCDebug(cants) << "Received frame" << can_ts_frame;
+    SKY_PROBE5(frame_received, can_ts_frame.fromAddress_, can_ts_frame.toAddress_, can_ts_frame.type_,
+               can_ts_frame.command_, 0);
 
-    // On redundat bus we are interested only in keep alive transfers.
+    // On redundat bus we are interested only in keep alive transfers, and in dual bus mode also in
+    // responses to our transfers. Copies of responses accepted from nominal bus are dropped.
     if (can_ts_frame.toAddress_ == static_cast<uint8_t>(sky::CanTsFrame::Address::KEEP_ALIVE) &&
        (can_ts_frame.type_ == CanTsFrame::TransferType::UNSOLICITED)) {
         ReceivedKeepAliveFrame(can_ts_frame, false);
+    } else if (dual_bus_ && (can_ts_frame.toAddress_ == address_) &&
+               (can_ts_frame.type_ != CanTsFrame::TransferType::UNSOLICITED) &&
+               !DualBusDuplicate(can_ts_frame, false)) {
+        ReceivedTransferFrame(can_ts_frame, frame.timing.read);
+    }
+}
+
+bool CAN_TS::ReceivedTransferFrame(const CanTsFrame& can_ts_frame, uint64_t read_time)
+{
+    bool transfer_frame = true;
+
+    // Transfers completed by this frame take response time stamps from here.
+    rx_read_time_ = read_time;
+    rx_dispatch_time_ = Trace::Now();
+
+    switch (can_ts_frame.type_) {
+    case CanTsFrame::TransferType::TELECOMMAND:
+        SendTCFrameReceived(can_ts_frame);
+        break;
+
+    case CanTsFrame::TransferType::TELEMETRY:
+        ReceiveTMFrameReceived(can_ts_frame);
+        break;
+
+    case CanTsFrame::TransferType::SET_BLOCK:
+        FrameReceivedSetBlock(can_ts_frame);
+        break;
+
+    case CanTsFrame::TransferType::GET_BLOCK:
+        ReceiveBlockFrameReceived(can_ts_frame);
+        break;
+
+    default:
+        transfer_frame = false;
+        break;
+    }
+
+    rx_read_time_ = 0;
+    rx_dispatch_time_ = 0;
+    return transfer_frame;
+}
+
+bool CAN_TS::DualBusDuplicate(const CanTsFrame& can_ts_frame, bool nominal_bus)
+{
+    DualBusResponse response;
+    response.time = clock_->Elapsed();
+    response.bus = BusIndex(nominal_bus);
+    response.type = can_ts_frame.type_;
+    response.from_address = can_ts_frame.fromAddress_;
+    response.command = can_ts_frame.command_;
+    response.length = static_cast<uint8_t>(std::min<size_t>(can_ts_frame.data_.size(), sizeof(response.data)));
+    std::copy_n(can_ts_frame.data_.begin(), response.length, response.data);
+
+    // Copy arrives within bus latency, so a response unmatched for a whole timeout lost its copy.
+    auto live = std::find_if(dual_bus_responses_.begin(), dual_bus_responses_.end(),
+                             [&response, this](const DualBusResponse& accepted) {
+                                 return response.time - accepted.time <= static_cast<int64_t>(timeout_);
+                             });
+    dual_bus_responses_.erase(dual_bus_responses_.begin(), live);
+
+    // Bus index is physical, so copies still match across a bus switch.
+    for (auto it = dual_bus_responses_.begin(); it != dual_bus_responses_.end(); ++it) {
+        if ((it->bus != response.bus) && (it->type == response.type) && (it->from_address == response.from_address) &&
+            (it->command == response.command) && (it->length == response.length) &&
+            std::equal(response.data, response.data + response.length, it->data)) {
+            dual_bus_responses_.erase(it);
+            return true;
+        }
     }
+
+    if (dual_bus_responses_.size() >= kMaxDualBusResponses)
+        dual_bus_responses_.erase(dual_bus_responses_.begin());
+
+    dual_bus_responses_.push_back(response);
+    return false;
 }
 
 uint8_t CAN_TS::GetAddress() const
@@ -0,0 +1,67 @@
+/* See the file "LICENSE.txt" for the full license governing this code. */
+
+#include "can_ts.h"
+#include <QDebug>
+#include <QLoggingCategory>
+
+Q_LOGGING_CATEGORY(cants_cp, "sky::CAN_TS::Compound")
+
+namespace sky
+{
+
+bool CAN_TS::SendTCReceiveTM(uint8_t address, uint8_t channel, const std::vector<uint8_t>& data,
+                             ReceiveTMHandler handler, uint8_t tc_retry_count, uint8_t tm_retry_count)
+{
+    auto tc_handler = [this, address, channel, handler, tm_retry_count] (bool success, SendTCError) {
+        if (!success) {
+            if (handler)
+                handler(false, std::vector<uint8_t>(), ReceiveTMError::kSendTCFailed);
+            return;
+        }
+
+        qCDebug(cants_cp) << "TC acknowledged, requesting TM from address =" << address << "channel =" << channel;
+
+        if (!ReceiveTM(address, channel, tm_retry_count, 0, handler)) {
+            qCCritical(cants_cp) << "Failed starting TM to address =" << address << "channel =" << channel;
+            if (handler)
+                handler(false, std::vector<uint8_t>(), ReceiveTMError::kSendRequestFailed);
+        }
+    };
+
+    if (!SendTC(address, channel, data, tc_retry_count, tc_handler))
+        return false;
+
+    qCDebug(cants_cp) << "Starting TC-TM transaction to address =" << address << "channel =" << channel << "data =" << data;
+    return true;
+}
+
+bool CAN_TS::SendBlockReceiveBlock(uint8_t address, uint64_t start, const std::vector<uint8_t>& data,
+                                   ReceiveBlockHandler handler, uint8_t retry_count,
+                                   uint32_t report_delay_ms, uint8_t report_retry_count, uint8_t start_retry_count)
+{
+    auto num_blocks = static_cast<uint8_t>((data.size() + 7) / 8);
+
+    auto sb_handler = [this, address, start, num_blocks, handler, retry_count, start_retry_count] (bool success, SendBlockError) {
+        if (!success) {
+            if (handler)
+                handler(false, std::vector<uint8_t>(), ReceiveBlockError::kSendBlockFailed);
+            return;
+        }
+
+        qCDebug(cants_cp) << "Block sent, reading back from address =" << address << "memory address =" << start;
+
+        if (!ReceiveBlock(address, start, num_blocks, retry_count, start_retry_count, handler)) {
+            qCCritical(cants_cp) << "Failed starting get block to address =" << address;
+            if (handler)
+                handler(false, std::vector<uint8_t>(), ReceiveBlockError::kSendRequestFailed);
+        }
+    };
+
+    if (!SendBlock(address, start, data, retry_count, report_delay_ms, report_retry_count, sb_handler))
+        return false;
+
+    qCDebug(cants_cp) << "Starting set-get block transaction to address =" << address << "memory address =" << start;
+    return true;
+}
+
+} // namespace sky
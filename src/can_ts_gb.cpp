@@ -1,6 +1,7 @@
 /* See the file "LICENSE.txt" for the full license governing this code. */
 
 #include "can_ts.h"
+#include "cantsprobes.h"
 #include "cantsutils.h"
 #include <QDebug>
 #include <QLoggingCategory>
@@ -11,15 +12,15 @@ Q_LOGGING_CATEGORY(cants_gb, "sky::CAN_TS::GetBlock")
 namespace sky
 {
 
-bool CAN_TS::ReceiveBlock(uint8_t to_address, uint64_t start_address, uint8_t length, uint8_t retry_count, uint8_t start_retry_count)
+bool CAN_TS::ReceiveBlock(uint8_t to_address, uint64_t start_address, uint8_t length, uint8_t retry_count, uint8_t start_retry_count,
+                          ReceiveBlockHandler handler)
 {
     if (CanTsFrame::IsBroadcastAddress(to_address)) {
         qCCritical(cants_gb) << "Invalid address" << to_address;
         return false;
     }
 
-    if(std::any_of(gb_transfers_.begin(), gb_transfers_.end(),
-                   [to_address](const GetBlockTransfer& t) { return (t.address == to_address); })) {
+    if (gb_nodes_.count(to_address)) {
         qCCritical(cants_gb) << "Transfer already active to address" << to_address;
         return false;
     }
@@ -32,13 +33,17 @@ bool CAN_TS::ReceiveBlock(uint8_t to_address, uint64_t start_address, uint8_t le
     std::vector<uint8_t> start_addr = CanTsUtils::ToByteVector(start_address, true);
     CanTsFrame frame = CanTsFrame::CreateGetBlockRequest(to_address, address_, length - 1, start_addr);
 
-    if (!SendFrame(frame)) {
+    uint32_t id = NextTransferId();
+
+    if (!SendFrame(frame, id)) {
         qCCritical(cants_gb) << "Failed sending request frame" << frame;
         emit ReceiveBlockFailed(frame.toAddress_, ReceiveBlockError::kSendRequestFailed);
         return false;
     }
 
     GetBlockTransfer transfer;
+    transfer.id = id;
+    transfer.timing.start = Trace::Now();
     transfer.address = frame.toAddress_;
     transfer.bitmap.resize((length + 7)/ 8);
     transfer.blocks = length;
@@ -50,129 +55,157 @@ bool CAN_TS::ReceiveBlock(uint8_t to_address, uint64_t start_address, uint8_t le
     transfer.start_retry_count = 0;
     transfer.rxState = GetBlockTransfer::RxState::kIdle;
     transfer.txState = GetBlockTransfer::TxState::kSendingRequest;
-    transfer.watchdog = std::make_shared<QTimer>();
-    transfer.watchdog->setSingleShot(true);
     CanTsUtils::SetBitmap(transfer.bitmap, length);
+    transfer.handler = std::move(handler);
     gb_transfers_.push_back(transfer);
 
-    auto it = gb_transfers_.end() - 1;
-    connect(transfer.watchdog.get(), &QTimer::timeout, this, [this, it] () {
+    auto it = std::prev(gb_transfers_.end());
+    gb_index_[it->id] = it;
+    gb_nodes_[it->address] = it;
+    RecordTransfer(TraceEvent::kTransferStart, CanTsFrame::TransferType::GET_BLOCK, it->address, it->id, it->timing);
+    it->watchdog = clock_->CreateTimer([this, it] () {
         emit ReceiveBlockFrameSentTimeout(it);
-    }, Qt::QueuedConnection);
+    });
 
     qCDebug(cants_gb) << "Starting receive (get) block transfer to destination address =" << to_address
             << "memory address =" << start_address << "retry_count =" << retry_count << "report_delay_ms =";
     return true;
 }
 
-void CAN_TS::ReceiveBlockRetryRequest(const std::vector<GetBlockTransfer>::iterator& transfer)
+void CAN_TS::ReceiveBlockRetryRequest(const std::list<GetBlockTransfer>::iterator& transfer)
 {
     if (transfer->retry_count > transfer->max_retries) {
         qCCritical(cants_gb) << "Max retries reached";
-        emit ReceiveBlockFailed(transfer->address, ReceiveBlockError::kMaxSendRequestRetriesReached);
-        gb_transfers_.erase(transfer);
+        ReceiveBlockFail(transfer, ReceiveBlockError::kMaxSendRequestRetriesReached);
     } else {
         CanTsFrame frame = CanTsFrame::CreateGetBlockRequest(transfer->address, address_, transfer->blocks - 1, transfer->start);
 
-        if (!SendFrame(frame)) {
+        if (!SendFrame(frame, transfer->id)) {
             qCCritical(cants_gb) << "Send retry failed";
-            emit ReceiveBlockFailed(frame.toAddress_, ReceiveBlockError::kSendRequestFailed);
-            gb_transfers_.erase(transfer);
+            ReceiveBlockFail(transfer, ReceiveBlockError::kSendRequestFailed);
         } else {
             transfer->txState = GetBlockTransfer::TxState::kSendingRequest;
+            CountRetry(CanTsFrame::TransferType::GET_BLOCK, "request");
             qCDebug(cants_gb) << "Retrying block request";
         }
     }
 }
 
-void CAN_TS::ReceiveBlockRetryStart(const std::vector<GetBlockTransfer>::iterator& transfer)
+void CAN_TS::ReceiveBlockRetryStart(const std::list<GetBlockTransfer>::iterator& transfer)
 {
     if (transfer->start_retry_count > transfer->max_start_retries) {
         qCCritical(cants_gb) << "Max retries reached";
 
         CanTsFrame frame = CanTsFrame::CreateGetBlockAbort(transfer->address, address_);
-        if (!SendFrame(frame)) {
+        if (!SendFrame(frame, transfer->id)) {
             qCCritical(cants_gb) << "Sending abort frame failed";
-            emit ReceiveBlockFailed(frame.toAddress_, ReceiveBlockError::kSendAbortFailed);
-            gb_transfers_.erase(transfer);
+            ReceiveBlockFail(transfer, ReceiveBlockError::kSendAbortFailed);
         } else {
             transfer->txState = GetBlockTransfer::TxState::kSendingAbort;
+            CountRetry(CanTsFrame::TransferType::GET_BLOCK, "abort");
             qCDebug(cants_gb) << "Retrying abort frame";
         }
     } else {
         CanTsFrame frame = CanTsFrame::CreateGetBlockStart(transfer->address, address_, transfer->bitmap);
 
-        if (!SendFrame(frame)) {
+        if (!SendFrame(frame, transfer->id)) {
             qCCritical(cants_gb) << "Sending start frame failed";
-            emit ReceiveBlockFailed(frame.toAddress_, ReceiveBlockError::kSendStartFailed);
-            gb_transfers_.erase(transfer);
+            ReceiveBlockFail(transfer, ReceiveBlockError::kSendStartFailed);
         } else {
             transfer->txState = GetBlockTransfer::TxState::kSendingStart;
+            CountRetry(CanTsFrame::TransferType::GET_BLOCK, "start");
             qCDebug(cants_gb) << "Retrying start frame";
         }
     }
 }
 
-void CAN_TS::ReceiveBlockRetryAbort(const std::vector<GetBlockTransfer>::iterator& transfer)
+void CAN_TS::ReceiveBlockRetryAbort(const std::list<GetBlockTransfer>::iterator& transfer)
 {
     if (transfer->retry_count > transfer->max_retries) {
         qCCritical(cants_gb) << "Max retries reached";
-        emit ReceiveBlockFailed(transfer->address, ReceiveBlockError::kMaxSendAbortRetriesReached);
-        gb_transfers_.erase(transfer);
+        ReceiveBlockFail(transfer, ReceiveBlockError::kMaxSendAbortRetriesReached);
     } else {
         CanTsFrame frame = CanTsFrame::CreateGetBlockAbort(transfer->address, address_);
 
-        if (!SendFrame(frame)) {
+        if (!SendFrame(frame, transfer->id)) {
             qCCritical(cants_gb) << "Sending abort frame failed";
-            emit ReceiveBlockFailed(frame.toAddress_, ReceiveBlockError::kSendAbortFailed);
-            gb_transfers_.erase(transfer);
+            ReceiveBlockFail(transfer, ReceiveBlockError::kSendAbortFailed);
         } else {
             transfer->txState = GetBlockTransfer::TxState::kSendingAbort;
+            CountRetry(CanTsFrame::TransferType::GET_BLOCK, "abort");
             qCDebug(cants_gb) << "Retrying abort frame";
         }
     }
 }
 
-void CAN_TS::ReceiveBlockFrameSentTimeout(const std::vector<GetBlockTransfer>::iterator& transfer)
+void CAN_TS::ReceiveBlockResume(const std::list<GetBlockTransfer>::iterator& transfer)
 {
+    transfer->watchdog->Stop();
+
+    auto rx_state = transfer->rxState;
+    auto tx_state = transfer->txState;
+    transfer->rxState = GetBlockTransfer::RxState::kIdle;
+
+    qCDebug(cants_gb) << "Resuming get block transfer to address =" << transfer->address << "bitmap =" << transfer->bitmap;
+
+    // Frame sent via previous bus does not count as a retry.
+    if ((tx_state == GetBlockTransfer::TxState::kSendingStart) ||
+        (rx_state == GetBlockTransfer::RxState::kWaitingForData)) {
+        if ((rx_state == GetBlockTransfer::RxState::kWaitingForData) && (transfer->start_retry_count > 0))
+            transfer->start_retry_count--;
+
+        // Bitmap contains only blocks which were not received yet.
+        ReceiveBlockRetryStart(transfer);
+    } else {
+        if ((rx_state != GetBlockTransfer::RxState::kIdle) && (transfer->retry_count > 0))
+            transfer->retry_count--;
+
+        if ((tx_state == GetBlockTransfer::TxState::kSendingAbort) ||
+            (rx_state == GetBlockTransfer::RxState::kWaitingForAbortACK))
+            ReceiveBlockRetryAbort(transfer);
+        else
+            ReceiveBlockRetryRequest(transfer);
+    }
+}
+
+void CAN_TS::ReceiveBlockFrameSentTimeout(const std::list<GetBlockTransfer>::iterator& transfer)
+{
+    SKY_PROBE5(transfer_timeout, CanTsFrame::TransferType::GET_BLOCK, transfer->address, transfer->id,
+               static_cast<uint8_t>(transfer->rxState), transfer->retry_count);
     assert(transfer->rxState != GetBlockTransfer::RxState::kIdle);
 
-    transfer->watchdog->stop();
+    transfer->watchdog->Stop();
     transfer->rxState = GetBlockTransfer::RxState::kIdle;
     ReceiveBlockRetryRequest(transfer);
 
     qCCritical(cants_gb) << "Transfer timeout";
 }
 
-void CAN_TS::ReceiveBlockFrameSent(const CanTsFrame& frame)
+void CAN_TS::ReceiveBlockFrameSent(const CanTsFrame& frame, uint32_t transfer_id)
 {
-    auto to_address = frame.GetToAddress();
     auto frame_type = frame.GetGBFrameType();
 
-    auto it = std::find_if(std::begin(gb_transfers_), std::end(gb_transfers_),
-                           [to_address](const GetBlockTransfer& t) -> bool {
-        return (t.address == to_address);
-    });
+    auto it = FindTransfer(gb_transfers_, gb_index_, transfer_id);
 
     if (it == gb_transfers_.end()) {
         qCDebug(cants_gb) << "Transfer not active";
     } else if (frame_type == CanTsFrame::GetBlockFrameType::REQUEST &&
                it->txState == GetBlockTransfer::TxState::kSendingRequest) {
-        it->watchdog->start(static_cast<int>(timeout_));
+        it->watchdog->Start(timeout_);
         it->txState = GetBlockTransfer::TxState::kIdle;
         it->rxState = GetBlockTransfer::RxState::kWaitingForRequestACK;
         it->retry_count++;
         qCDebug(cants_gb) << "Request frame sent";
     } else if (frame_type == CanTsFrame::GetBlockFrameType::ABORT &&
                it->txState == GetBlockTransfer::TxState::kSendingAbort) {
-        it->watchdog->start(static_cast<int>(timeout_));
+        it->watchdog->Start(timeout_);
         it->txState = GetBlockTransfer::TxState::kIdle;
         it->rxState = GetBlockTransfer::RxState::kWaitingForAbortACK;
         it->retry_count++;
         qCDebug(cants_gb) << "Abort frame sent";
     } else if (frame_type == CanTsFrame::GetBlockFrameType::START &&
                it->txState == GetBlockTransfer::TxState::kSendingStart) {
-        it->watchdog->start(static_cast<int>(timeout_));
+        it->watchdog->Start(timeout_);
         it->txState = GetBlockTransfer::TxState::kIdle;
         it->rxState = GetBlockTransfer::RxState::kWaitingForData;
         it->start_retry_count++;
@@ -180,34 +213,31 @@ void CAN_TS::ReceiveBlockFrameSent(const CanTsFrame& frame)
     }
 }
 
-void CAN_TS::ReceiveBlockFrameSendError(const CanTsFrame& frame, CommDriver::CanSendError error)
+void CAN_TS::ReceiveBlockFrameSendError(const CanTsFrame& frame, uint32_t transfer_id, CanTransport::CanSendError error)
 {
     auto to_address = frame.GetToAddress();
     auto frame_type = frame.GetGBFrameType();
 
-    auto it = std::find_if(std::begin(gb_transfers_), std::end(gb_transfers_),
-                           [to_address](const GetBlockTransfer& t) -> bool {
-        return (t.address == to_address);
-    });
+    auto it = FindTransfer(gb_transfers_, gb_index_, transfer_id);
 
     if  (it == gb_transfers_.end()) {
         qCCritical(cants_gb) << "Transfer not active";
     } else {
-        gb_transfers_.erase(it);
-
         qCCritical(cants_gb) << "Frame send failed to_address =" << to_address << "error =" << error;
 
-        if (frame_type == CanTsFrame::GetBlockFrameType::REQUEST) {
-            emit ReceiveBlockFailed(to_address, ReceiveBlockError::kSendRequestFailed);
-        } else if (frame_type == CanTsFrame::GetBlockFrameType::ABORT) {
-            emit ReceiveBlockFailed(to_address, ReceiveBlockError::kSendAbortFailed);
+        it->watchdog->Stop();
+
+        if (frame_type == CanTsFrame::GetBlockFrameType::ABORT) {
+            ReceiveBlockFail(it, ReceiveBlockError::kSendAbortFailed);
         } else if (frame_type == CanTsFrame::GetBlockFrameType::START) {
-            emit ReceiveBlockFailed(to_address, ReceiveBlockError::kSendStartFailed);
+            ReceiveBlockFail(it, ReceiveBlockError::kSendStartFailed);
+        } else {
+            ReceiveBlockFail(it, ReceiveBlockError::kSendRequestFailed);
         }
     }
 }
 
-void CAN_TS::ReceiveBlockFrameReceivedAck(const CanTsFrame& frame, const std::vector<GetBlockTransfer>::iterator& transfer)
+void CAN_TS::ReceiveBlockFrameReceivedAck(const CanTsFrame& frame, const std::list<GetBlockTransfer>::iterator& transfer)
 {
     if (transfer->rxState == GetBlockTransfer::RxState::kWaitingForRequestACK) {
 
@@ -217,14 +247,13 @@ void CAN_TS::ReceiveBlockFrameReceivedAck(const CanTsFrame& frame, const std::ve
             return;
         }
 
-        transfer->watchdog->stop();
+        transfer->watchdog->Stop();
         transfer->retry_count = 0;
 
         CanTsFrame frame = CanTsFrame::CreateGetBlockStart(transfer->address, address_, transfer->bitmap);
-        if (!SendFrame(frame)) {
+        if (!SendFrame(frame, transfer->id)) {
             qCCritical(cants_gb) << "Start frame send failed";
-            emit ReceiveBlockFailed(frame.toAddress_, ReceiveBlockError::kSendStartFailed);
-            gb_transfers_.erase(transfer);
+            ReceiveBlockFail(transfer, ReceiveBlockError::kSendStartFailed);
         } else {
             qCDebug(cants_gb) << "Sending start frame to_address =" << frame.toAddress_;
             transfer->txState = GetBlockTransfer::TxState::kSendingStart;
@@ -237,15 +266,13 @@ void CAN_TS::ReceiveBlockFrameReceivedAck(const CanTsFrame& frame, const std::ve
         if ((frame.GetBlockCmdBits() != 0) || (!frame.data_.empty())) {
             qCCritical(cants_gb) << "Invalid abort response";
         } else {
-            transfer->watchdog->stop();
+            transfer->watchdog->Stop();
             qCDebug(cants_gb) << "ACK received";
 
             if (transfer->start_retry_count > transfer->max_start_retries) {
-                emit ReceiveBlockFailed(frame.fromAddress_, ReceiveBlockError::kMaxSendStartRetriesReached);
-                gb_transfers_.erase(transfer);
+                ReceiveBlockFail(transfer, ReceiveBlockError::kMaxSendStartRetriesReached);
             } else {
-                emit ReceiveBlockCompleted(frame.fromAddress_, transfer->data);
-                gb_transfers_.erase(transfer);
+                ReceiveBlockComplete(transfer);
             }
         }
     } else {
@@ -253,13 +280,13 @@ void CAN_TS::ReceiveBlockFrameReceivedAck(const CanTsFrame& frame, const std::ve
     }
 }
 
-void CAN_TS::ReceiveBlockFrameReceivedNack(const CanTsFrame& frame, const std::vector<GetBlockTransfer>::iterator& transfer)
+void CAN_TS::ReceiveBlockFrameReceivedNack(const CanTsFrame& frame, const std::list<GetBlockTransfer>::iterator& transfer)
 {
     if (transfer->rxState == GetBlockTransfer::RxState::kWaitingForRequestACK) {
         if ((frame.GetBlockCmdBits() != 0) || (!frame.data_.empty())) {
             qCDebug(cants_gb) << "Invalid NACK received from_address =" << frame.GetFromAddress();
         } else {
-            transfer->watchdog->stop();
+            transfer->watchdog->Stop();
             transfer->rxState = GetBlockTransfer::RxState::kIdle;
             qCCritical(cants_gb) << "NACK received from_address =" << frame.GetFromAddress();
             ReceiveBlockRetryRequest(transfer);
@@ -268,7 +295,7 @@ void CAN_TS::ReceiveBlockFrameReceivedNack(const CanTsFrame& frame, const std::v
         if ((frame.GetBlockCmdBits() != 0) || (!frame.data_.empty())) {
             qCDebug(cants_gb) << "Invalid NACK received from_address =" << frame.GetFromAddress();
         } else {
-            transfer->watchdog->stop();
+            transfer->watchdog->Stop();
             transfer->rxState = GetBlockTransfer::RxState::kIdle;
             qCCritical(cants_gb) << "NACK received from_address =" << frame.GetFromAddress();
             ReceiveBlockRetryStart(transfer);
@@ -277,17 +304,16 @@ void CAN_TS::ReceiveBlockFrameReceivedNack(const CanTsFrame& frame, const std::v
         if ((frame.GetBlockCmdBits() != 0) || (!frame.data_.empty())) {
             qCDebug(cants_gb) << "Invalid NACK received from_address=" << frame.GetFromAddress();
         } else {
-            transfer->watchdog->stop();
-            gb_transfers_.erase(transfer);
+            transfer->watchdog->Stop();
             qCCritical(cants_gb) << "NACK received from_address =" << frame.GetFromAddress();
-            emit ReceiveBlockFailed(frame.fromAddress_, ReceiveBlockError::kAbortNACKReceived);
+            ReceiveBlockFail(transfer, ReceiveBlockError::kAbortNACKReceived);
         }
     } else {
         qCCritical(cants_gb) << "Unexpected NACK";
     }
 }
 
-void CAN_TS::ReceiveBlockFrameReceivedTransfer(const CanTsFrame &frame, const std::vector<GetBlockTransfer>::iterator& transfer)
+void CAN_TS::ReceiveBlockFrameReceivedTransfer(const CanTsFrame &frame, const std::list<GetBlockTransfer>::iterator& transfer)
 {
     // Check if received frame is valid.
     if ((frame.data_.size() != 8) || (frame.GetBlockCmdBits() >= transfer->blocks)) {
@@ -301,7 +327,7 @@ void CAN_TS::ReceiveBlockFrameReceivedTransfer(const CanTsFrame &frame, const st
         return;
     }
 
-    transfer->watchdog->stop();
+    transfer->watchdog->Stop();
     transfer->retry_count = 0;
     CanTsUtils::ClearBitmapBit(transfer->bitmap, frame.GetBlockCmdBits());
     qCDebug(cants_gb) << "Received transfer frame from_address =" << frame.fromAddress_
@@ -315,10 +341,9 @@ void CAN_TS::ReceiveBlockFrameReceivedTransfer(const CanTsFrame &frame, const st
     if (CanTsUtils::IsBitmapCleared(transfer->bitmap, transfer->blocks)) {
         CanTsFrame frame = CanTsFrame::CreateGetBlockAbort(transfer->address, address_);
 
-        if (!SendFrame(frame)) {
-            gb_transfers_.erase(transfer);
+        if (!SendFrame(frame, transfer->id)) {
             qCCritical(cants_gb) << "Sending abort failed";
-            emit ReceiveBlockFailed(frame.toAddress_, ReceiveBlockError::kSendAbortFailed);
+            ReceiveBlockFail(transfer, ReceiveBlockError::kSendAbortFailed);
         } else {
             transfer->txState = GetBlockTransfer::TxState::kSendingAbort;
             transfer->rxState = GetBlockTransfer::RxState::kIdle;
@@ -332,10 +357,7 @@ void CAN_TS::ReceiveBlockFrameReceived(const CanTsFrame& frame)
     auto frame_type = frame.GetGBFrameType();
     auto from_address = frame.GetFromAddress();
 
-    auto transfer = std::find_if(std::begin(gb_transfers_), std::end(gb_transfers_),
-                           [from_address](const GetBlockTransfer& t) -> bool {
-        return (t.address == from_address);
-    });
+    auto transfer = FindTransfer(gb_transfers_, gb_nodes_, from_address);
 
     if (transfer == gb_transfers_.end()) {
         qCCritical(cants_gb) << "Transfer not active";
@@ -350,4 +372,36 @@ void CAN_TS::ReceiveBlockFrameReceived(const CanTsFrame& frame)
     }
 }
 
+void CAN_TS::ReceiveBlockComplete(const std::list<GetBlockTransfer>::iterator& transfer)
+{
+    auto address = transfer->address;
+    std::vector<uint8_t> data = std::move(transfer->data);
+    ReceiveBlockHandler handler = std::move(transfer->handler);
+
+    // Transfer is removed before notification, so subscribers can immediately start a new one.
+    RecordTransfer(TraceEvent::kTransferComplete, CanTsFrame::TransferType::GET_BLOCK, transfer->address, transfer->id, transfer->timing);
+    gb_index_.erase(transfer->id);
+    gb_nodes_.erase(transfer->address);
+    gb_transfers_.erase(transfer);
+    emit ReceiveBlockCompleted(address, data);
+
+    if (handler)
+        handler(true, data, ReceiveBlockError::kNone);
+}
+
+void CAN_TS::ReceiveBlockFail(const std::list<GetBlockTransfer>::iterator& transfer, ReceiveBlockError error)
+{
+    auto address = transfer->address;
+    ReceiveBlockHandler handler = std::move(transfer->handler);
+
+    RecordTransfer(TraceEvent::kTransferFail, CanTsFrame::TransferType::GET_BLOCK, transfer->address, transfer->id, transfer->timing, static_cast<uint8_t>(error));
+    gb_index_.erase(transfer->id);
+    gb_nodes_.erase(transfer->address);
+    gb_transfers_.erase(transfer);
+    emit ReceiveBlockFailed(address, error);
+
+    if (handler)
+        handler(false, std::vector<uint8_t>(), error);
+}
+
 } // namespace sky
@@ -0,0 +1,83 @@
+/* See the file "LICENSE.txt" for the full license governing this code. */
+
+#include "can_ts.h"
+#include <QDebug>
+#include <QLoggingCategory>
+
+Q_LOGGING_CATEGORY(cants_rd, "sky::CAN_TS::Redundancy")
+
+namespace sky
+{
+
+void CAN_TS::SetRedundancy(const RedundancySettings& settings)
+{
+    redundancy_ = settings;
+    redundancy_votes_ = 0;
+
+    if (!redundancy_timer_)
+        redundancy_timer_ = clock_->CreateTimer([this]() { RedundancyCheck(); }, false);
+
+    if (redundancy_.enabled && (start_time_ >= 0))
+        redundancy_timer_->Start(redundancy_.check_period_ms);
+    else
+        redundancy_timer_->Stop();
+
+    qCDebug(cants_rd) << "Automatic bus switching enabled =" << redundancy_.enabled
+                      << "check_period_ms =" << redundancy_.check_period_ms
+                      << "silence_timeout_ms =" << redundancy_.silence_timeout_ms
+                      << "confirm_count =" << redundancy_.confirm_count
+                      << "hold_off_ms =" << redundancy_.hold_off_ms;
+}
+
+void CAN_TS::RedundancyKeepAlive(uint8_t address, bool nominal_bus)
+{
+    if (start_time_ < 0)
+        return;
+
+    // Keep alive is tracked per physical bus, so history survives bus switch.
+    bool can0 = (active_bus_ == CanBus::CAN0) == nominal_bus;
+    keep_alive_[address].last_seen[can0 ? 0 : 1] = ElapsedSinceStart();
+}
+
+void CAN_TS::RedundancyCheck()
+{
+    qint64 now = ElapsedSinceStart();
+
+    if ((last_bus_switch_ >= 0) && (now - last_bus_switch_ < static_cast<qint64>(redundancy_.hold_off_ms))) {
+        redundancy_votes_ = 0;
+        return;
+    }
+
+    auto nominal = (active_bus_ == CanBus::CAN0) ? 0 : 1;
+    auto redundant = 1 - nominal;
+    auto timeout = static_cast<qint64>(redundancy_.silence_timeout_ms);
+    size_t alive_nominal = 0;
+    size_t alive_redundant = 0;
+
+    for (const auto& node : keep_alive_) {
+        const auto& last_seen = node.second.last_seen;
+
+        if ((last_seen[nominal] >= 0) && (now - last_seen[nominal] <= timeout))
+            alive_nominal++;
+
+        if ((last_seen[redundant] >= 0) && (now - last_seen[redundant] <= timeout))
+            alive_redundant++;
+    }
+
+    if ((alive_redundant == 0) || (alive_redundant <= alive_nominal)) {
+        redundancy_votes_ = 0;
+        return;
+    }
+
+    redundancy_votes_++;
+    qCDebug(cants_rd) << "Nodes alive on nominal bus =" << alive_nominal << "redundant bus =" << alive_redundant
+                      << "votes =" << redundancy_votes_;
+
+    if (redundancy_votes_ >= redundancy_.confirm_count) {
+        qCCritical(cants_rd) << "Switching bus, nodes alive on nominal bus =" << alive_nominal
+                             << "redundant bus =" << alive_redundant;
+        CanBusSwitch();
+    }
+}
+
+} // namespace sky
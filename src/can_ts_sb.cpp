@@ -1,6 +1,7 @@
 /* See the file "LICENSE.txt" for the full license governing this code. */
 
 #include "can_ts.h"
+#include "cantsprobes.h"
 #include "cantsutils.h"
 #include <QDebug>
 #include <QLoggingCategory>
@@ -13,15 +14,14 @@ namespace sky
 {
 
 bool CAN_TS::SendBlock(uint8_t to_address, uint64_t start_address, const std::vector<uint8_t>& data, uint8_t retry_count,
-                       uint32_t report_delay_ms, uint8_t report_retry_count)
+                       uint32_t report_delay_ms, uint8_t report_retry_count, SendBlockHandler handler)
 {
     if (CanTsFrame::IsBroadcastAddress(to_address)) {
         qCCritical(cants_sb) << "Invalid to address =" << to_address;
         return false;
     }
 
-    if(std::any_of(sb_transfers_.begin(), sb_transfers_.end(),
-                   [to_address](const SetBlockTransfer& t) { return (t.address == to_address); })) {
+    if (sb_nodes_.count(to_address)) {
         qCCritical(cants_sb) << "Transfer already active";
         return false;
     }
@@ -35,13 +35,17 @@ bool CAN_TS::SendBlock(uint8_t to_address, uint64_t start_address, const std::ve
     std::vector<uint8_t> start_addr = CanTsUtils::ToByteVector(start_address, true);
     CanTsFrame frame = CanTsFrame::CreateSetBlockRequest(to_address, address_, num_blocks-1, start_addr);
 
-    if (!SendFrame(frame)) {
+    uint32_t id = NextTransferId();
+
+    if (!SendFrame(frame, id)) {
         qCCritical(cants_sb) << "Failed sending request frame to address =" << frame.toAddress_;
         emit SendBlockFailed(frame.toAddress_, SendBlockError::kSendRequestFailed);
         return false;
     }
 
     SetBlockTransfer transfer;
+    transfer.id = id;
+    transfer.timing.start = Trace::Now();
     transfer.address = frame.toAddress_;
     transfer.blocks = num_blocks;
     transfer.bitmap.resize((data.size() + 63) / 64);
@@ -56,143 +60,165 @@ bool CAN_TS::SendBlock(uint8_t to_address, uint64_t start_address, const std::ve
     transfer.report_delay = report_delay_ms;
     transfer.rxState = SetBlockTransfer::RxState::kIdle;
     transfer.txState = SetBlockTransfer::TxState::kSendingRequest;
-    transfer.watchdog = std::make_shared<QTimer>();
-    transfer.watchdog->setSingleShot(true);
-    transfer.report_delay_timer = std::make_shared<QTimer>();
-    transfer.report_delay_timer->setSingleShot(true);
+    transfer.handler = std::move(handler);
     sb_transfers_.push_back(transfer);
 
-    auto it = sb_transfers_.end() - 1;
-    connect(transfer.watchdog.get(), &QTimer::timeout, this, [this, it] () {
+    auto it = std::prev(sb_transfers_.end());
+    sb_index_[it->id] = it;
+    sb_nodes_[it->address] = it;
+    RecordTransfer(TraceEvent::kTransferStart, CanTsFrame::TransferType::SET_BLOCK, it->address, it->id, it->timing);
+    it->watchdog = clock_->CreateTimer([this, it] () {
         emit SendBlockFrameSentTimeout(it);
-    }, Qt::QueuedConnection);
+    });
 
-    connect(transfer.report_delay_timer.get(), &QTimer::timeout, this, [this, it] () {
+    it->report_delay_timer = clock_->CreateTimer([this, it] () {
         emit SendBlockReportRequestDelayTimeout(it);
-    }, Qt::QueuedConnection);
+    });
 
     qCDebug(cants_sb) << "Starting send (set) block transfer to destination address =" << to_address << "memory address =" << start_address
         << "retry_count =" << retry_count << "report_delay_ms =" << report_delay_ms << "report_retry_count =" << report_retry_count << "data =" << data;
     return true;
 }
 
-void CAN_TS::SendBlockRetryRequest(const std::vector<SetBlockTransfer>::iterator& transfer)
+void CAN_TS::SendBlockRetryRequest(const std::list<SetBlockTransfer>::iterator& transfer)
 {
     if (transfer->retry_count > transfer->max_retries) {
         qCCritical(cants_sb) << "Max retries reached to address =" << transfer->address;
-        emit SendBlockFailed(transfer->address, SendBlockError::kMaxSendRequestRetriesReached);
-        sb_transfers_.erase(transfer);
+        SendBlockFail(transfer, SendBlockError::kMaxSendRequestRetriesReached);
     } else {
         CanTsFrame frame = CanTsFrame::CreateSetBlockRequest(transfer->address, address_, transfer->blocks - 1, transfer->start);
-        if (!SendFrame(frame)) {
-            sb_transfers_.erase(transfer);
+        if (!SendFrame(frame, transfer->id)) {
             qCCritical(cants_sb) << "Failed retrying request frame to address =" << frame.toAddress_;
-            emit SendBlockFailed(frame.toAddress_, SendBlockError::kSendRequestFailed);
+            SendBlockFail(transfer, SendBlockError::kSendRequestFailed);
         } else {
             transfer->txState = SetBlockTransfer::TxState::kSendingRequest;
+            CountRetry(CanTsFrame::TransferType::SET_BLOCK, "request");
             qCDebug(cants_sb) << "Retrying request frame to address =" << frame.toAddress_;
         }
     }
 }
 
-void CAN_TS::SendBlockRetryStatus(const std::vector<SetBlockTransfer>::iterator& transfer)
+void CAN_TS::SendBlockRetryStatus(const std::list<SetBlockTransfer>::iterator& transfer)
 {
     if (transfer->retry_count > transfer->max_retries) {
         qCCritical(cants_sb) << "Max retries reached to address =" << transfer->address;
-        emit SendBlockFailed(transfer->address, SendBlockError::kMaxSendStatusRetriesReached);
-        sb_transfers_.erase(transfer);
+        SendBlockFail(transfer, SendBlockError::kMaxSendStatusRetriesReached);
     } else {
         CanTsFrame frame = CanTsFrame::CreateSetBlockStatus(transfer->address, address_);
-        if (!SendFrame(frame)) {
-            sb_transfers_.erase(transfer);
+        if (!SendFrame(frame, transfer->id)) {
             qCCritical(cants_sb) << "Failed retrying status frame to address =" << frame.toAddress_;
-            emit SendBlockFailed(frame.toAddress_, SendBlockError::kSendStatusRequestFailed);
+            SendBlockFail(transfer, SendBlockError::kSendStatusRequestFailed);
         } else {
             transfer->txState = SetBlockTransfer::TxState::kSendingStatusRequest;
+            CountRetry(CanTsFrame::TransferType::SET_BLOCK, "status");
             qCDebug(cants_sb) << "Retrying status frame to address =" << frame.toAddress_;
         }
     }
 }
 
-void CAN_TS::SendBlockRetryAbort(const std::vector<SetBlockTransfer>::iterator& transfer)
+void CAN_TS::SendBlockRetryAbort(const std::list<SetBlockTransfer>::iterator& transfer)
 {
     if (transfer->retry_count > transfer->max_retries) {
         qCCritical(cants_sb) << "Max retries reached to address =" << transfer->address;
 
         if (transfer->done && CanTsUtils::IsBitmapSet(transfer->bitmap, transfer->blocks)) {
             // If abort was sent because transfer completed.
-            emit SendBlockFailed(transfer->address, SendBlockError::kMaxSendAbortRetriesReached);
-            sb_transfers_.erase(transfer);
+            SendBlockFail(transfer, SendBlockError::kMaxSendAbortRetriesReached);
         } else {
             // If abort was sent because max report retries reached.
-            emit SendBlockFailed(transfer->address, SendBlockError::kMaxReportRetriesReached);
-            sb_transfers_.erase(transfer);
+            SendBlockFail(transfer, SendBlockError::kMaxReportRetriesReached);
         }
     } else {
         CanTsFrame frame = CanTsFrame::CreateSetBlockAbort(transfer->address, address_);
 
-        if (!SendFrame(frame)) {
+        if (!SendFrame(frame, transfer->id)) {
             qCCritical(cants_sb) << "Failed retrying abort frame to address =" << frame.toAddress_;
 
             if (transfer->done && CanTsUtils::IsBitmapSet(transfer->bitmap, transfer->blocks)) {
                 // If abort was sent because transfer completed.
-                sb_transfers_.erase(transfer);
-                emit SendBlockFailed(frame.toAddress_, SendBlockError::kSendAbortFailed);
+                SendBlockFail(transfer, SendBlockError::kSendAbortFailed);
             } else {
                 // If abort was sent because max report retries reached.
-                sb_transfers_.erase(transfer);
-                emit SendBlockFailed(frame.toAddress_, SendBlockError::kMaxReportRetriesReached);
+                SendBlockFail(transfer, SendBlockError::kMaxReportRetriesReached);
             }
         } else {
             transfer->txState = SetBlockTransfer::TxState::kSendingAbort;
+            CountRetry(CanTsFrame::TransferType::SET_BLOCK, "abort");
             qCDebug(cants_sb) << "Retrying abort frame to address =" << frame.toAddress_;
         }
     }
 }
 
-void CAN_TS::SendBlockFrameSentTimeout(const std::vector<SetBlockTransfer>::iterator& transfer)
+void CAN_TS::SendBlockResume(const std::list<SetBlockTransfer>::iterator& transfer)
+{
+    // Waiting for status request delay, status request will be sent via new bus.
+    if (transfer->txState == SetBlockTransfer::TxState::kWaitingForSendStatusRequest)
+        return;
+
+    transfer->watchdog->Stop();
+
+    // Frame sent via previous bus does not count as a retry.
+    if ((transfer->rxState != SetBlockTransfer::RxState::kIdle) && (transfer->retry_count > 0))
+        transfer->retry_count--;
+
+    auto rx_state = transfer->rxState;
+    auto tx_state = transfer->txState;
+    transfer->rxState = SetBlockTransfer::RxState::kIdle;
+
+    qCDebug(cants_sb) << "Resuming set block transfer to address =" << transfer->address << "bitmap =" << transfer->bitmap;
+
+    if ((tx_state == SetBlockTransfer::TxState::kSendingRequest) ||
+        (rx_state == SetBlockTransfer::RxState::kWaitingForRequestACK)) {
+        SendBlockRetryRequest(transfer);
+    } else if ((tx_state == SetBlockTransfer::TxState::kSendingAbort) ||
+               (rx_state == SetBlockTransfer::RxState::kWaitingForAbortACK)) {
+        SendBlockRetryAbort(transfer);
+    } else {
+        // Sending data or waiting for report. Status report tells which blocks sink is still missing.
+        SendBlockRetryStatus(transfer);
+    }
+}
+
+void CAN_TS::SendBlockFrameSentTimeout(const std::list<SetBlockTransfer>::iterator& transfer)
 {
+    SKY_PROBE5(transfer_timeout, CanTsFrame::TransferType::SET_BLOCK, transfer->address, transfer->id,
+               static_cast<uint8_t>(transfer->rxState), transfer->retry_count);
     assert(transfer->rxState != SetBlockTransfer::RxState::kIdle);
 
-    transfer->watchdog->stop();
+    transfer->watchdog->Stop();
     transfer->rxState = SetBlockTransfer::RxState::kIdle;
     SendBlockRetryStatus(transfer);
 
     qCCritical(cants_sb) << "Frame transfer timeout";
 }
 
-void CAN_TS::SendBlockReportRequestDelayTimeout(const std::vector<SetBlockTransfer>::iterator& transfer)
+void CAN_TS::SendBlockReportRequestDelayTimeout(const std::list<SetBlockTransfer>::iterator& transfer)
 {
-    transfer->report_delay_timer->stop();
+    transfer->report_delay_timer->Stop();
     CanTsFrame frame = CanTsFrame::CreateSetBlockStatus(transfer->address, address_);
 
-    if (!SendFrame(frame)) {
+    if (!SendFrame(frame, transfer->id)) {
         qCCritical(cants_sb) << "Failed sending status frame to address =" << frame.toAddress_;
-        emit SendBlockFailed(frame.toAddress_, SendBlockError::kSendStatusRequestFailed);
-        sb_transfers_.erase(transfer);
+        SendBlockFail(transfer, SendBlockError::kSendStatusRequestFailed);
     } else {
         transfer->txState = SetBlockTransfer::TxState::kSendingStatusRequest;
         qCDebug(cants_sb) << "Sending status frame to address =" << frame.toAddress_;
     }
 }
 
-void CAN_TS::SendBlockWaitForResponse(const std::vector<SetBlockTransfer>::iterator& transfer, SetBlockTransfer::RxState rxstate) const
+void CAN_TS::SendBlockWaitForResponse(const std::list<SetBlockTransfer>::iterator& transfer, SetBlockTransfer::RxState rxstate) const
 {
-    transfer->watchdog->start(static_cast<int>(timeout_));
+    transfer->watchdog->Start(timeout_);
     transfer->txState = SetBlockTransfer::TxState::kIdle;
     transfer->rxState = rxstate;
     transfer->retry_count++;
 }
 
-void CAN_TS::SendBlockFrameSent(const CanTsFrame& frame)
+void CAN_TS::SendBlockFrameSent(const CanTsFrame& frame, uint32_t transfer_id)
 {
-    auto to_address = frame.GetToAddress();
     auto frame_type = frame.GetSBFrameType();
 
-    auto transfer = std::find_if(std::begin(sb_transfers_), std::end(sb_transfers_),
-                           [to_address](const SetBlockTransfer& t) -> bool {
-        return (t.address == to_address);
-    });
+    auto transfer = FindTransfer(sb_transfers_, sb_index_, transfer_id);
 
     if (transfer == sb_transfers_.end()) {
         qCDebug(cants_sb) << "Transfer not active";
@@ -229,10 +255,10 @@ void CAN_TS::SendBlockFrameSent(const CanTsFrame& frame)
                     data_to_send = std::vector<uint8_t>(transfer->data.begin() + 8 * sequence, transfer->data.end());
 
                 CanTsFrame frame = CanTsFrame::CreateSetBlockTransfer(transfer->address, address_, sequence, data_to_send);
-                if (!SendFrame(frame)) {
-                    sb_transfers_.erase(transfer);
+                if (!SendFrame(frame, transfer->id)) {
                     qCCritical(cants_sb) << "Failed sending transfer frame to address =" << frame.toAddress_ << "sequence =" << sequence;
-                    emit SendBlockFailed(frame.toAddress_, SendBlockError::kSendDataFailed);
+                    SendBlockFail(transfer, SendBlockError::kSendDataFailed);
+                    return;
                 } else {
                     qCDebug(cants_sb) << "Sending transfer frame to address =" << frame.toAddress_ << "sequence =" << sequence << "data =" << data_to_send;
                     framesent = true;
@@ -243,49 +269,48 @@ void CAN_TS::SendBlockFrameSent(const CanTsFrame& frame)
 
         if (!framesent) {
             // If all frames are transferred, generate some delay and then request status report.
-            transfer->report_delay_timer->start(static_cast<int>(transfer->report_delay));
+            transfer->report_delay_timer->Start(transfer->report_delay);
             transfer->txState = SetBlockTransfer::TxState::kWaitingForSendStatusRequest;
         }
     }
 }
 
-void CAN_TS::SendBlockFrameSendError(const CanTsFrame& frame, CommDriver::CanSendError error)
+void CAN_TS::SendBlockFrameSendError(const CanTsFrame& frame, uint32_t transfer_id, CanTransport::CanSendError error)
 {
-    auto to_address = frame.GetToAddress();
     auto frame_type = frame.GetSBFrameType();
 
-    auto transfer = std::find_if(std::begin(sb_transfers_), std::end(sb_transfers_),
-                           [to_address](const SetBlockTransfer& t) -> bool {
-        return (t.address == to_address);
-    });
+    auto transfer = FindTransfer(sb_transfers_, sb_index_, transfer_id);
+
+    if (transfer == sb_transfers_.end()) {
+        qCDebug(cants_sb) << "Transfer not active";
+        return;
+    }
+
+    transfer->watchdog->Stop();
+    transfer->report_delay_timer->Stop();
 
     if (frame_type == CanTsFrame::SetBlockFrameType::REQUEST) {
         qCCritical(cants_sb) << "Failed sending request frame to address =" << frame.toAddress_ << "error =" << error;
-        emit SendBlockFailed(frame.toAddress_, SendBlockError::kSendRequestFailed);
-        sb_transfers_.erase(transfer);
+        SendBlockFail(transfer, SendBlockError::kSendRequestFailed);
     } else if (frame_type == CanTsFrame::SetBlockFrameType::STATUS) {
         qCCritical(cants_sb) << "Failed sending status frame to address =" << frame.toAddress_ << "error =" << error;
-        emit SendBlockFailed(frame.toAddress_, SendBlockError::kSendStatusRequestFailed);
-        sb_transfers_.erase(transfer);
+        SendBlockFail(transfer, SendBlockError::kSendStatusRequestFailed);
     } else if (frame_type == CanTsFrame::SetBlockFrameType::ABORT) {
         qCCritical(cants_sb) << "Failed sending abort frame to address =" << frame.toAddress_ << "error =" << error;
         if (transfer->done && CanTsUtils::IsBitmapSet(transfer->bitmap, transfer->blocks)) {
             // If abort was sent because transfer completed.
-            sb_transfers_.erase(transfer);
-            emit SendBlockFailed(frame.toAddress_, SendBlockError::kSendAbortFailed);
+            SendBlockFail(transfer, SendBlockError::kSendAbortFailed);
         } else {
             // If abort was sent because max report retries reached.
-            sb_transfers_.erase(transfer);
-            emit SendBlockFailed(frame.toAddress_, SendBlockError::kMaxReportRetriesReached);
+            SendBlockFail(transfer, SendBlockError::kMaxReportRetriesReached);
         }
     } else if (frame_type == CanTsFrame::SetBlockFrameType::TRANSFER) {
         qCCritical(cants_sb) << "Failed sending transfer frame to address =" << frame.toAddress_ << "error =" << error;
-        sb_transfers_.erase(transfer);
-        emit SendBlockFailed(frame.toAddress_, SendBlockError::kSendDataFailed);
+        SendBlockFail(transfer, SendBlockError::kSendDataFailed);
     }
 }
 
-void CAN_TS::SendBlockFrameReceivedAck(const CanTsFrame& frame, const std::vector<SetBlockTransfer>::iterator& transfer)
+void CAN_TS::SendBlockFrameReceivedAck(const CanTsFrame& frame, const std::list<SetBlockTransfer>::iterator& transfer)
 {
     auto blocks_bits = frame.GetBlockCmdBits();
 
@@ -297,7 +322,7 @@ void CAN_TS::SendBlockFrameReceivedAck(const CanTsFrame& frame, const std::vecto
             return;
         }
 
-        transfer->watchdog->stop();
+        transfer->watchdog->Stop();
         transfer->retry_count = 0;
 
         qCDebug(cants_sb) << "Received request frame ACK from address =" << frame.fromAddress_;
@@ -309,10 +334,9 @@ void CAN_TS::SendBlockFrameReceivedAck(const CanTsFrame& frame, const std::vecto
             data_to_send = std::vector<uint8_t>(transfer->data.begin(), transfer->data.end());
 
         CanTsFrame frame = CanTsFrame::CreateSetBlockTransfer(transfer->address, address_, 0, data_to_send);
-        if (!SendFrame(frame)) {
-            sb_transfers_.erase(transfer);
+        if (!SendFrame(frame, transfer->id)) {
             qCCritical(cants_sb) << "Failed sending transfer frame to address =" << frame.toAddress_;
-            emit SendBlockFailed(frame.toAddress_, SendBlockError::kSendDataFailed);
+            SendBlockFail(transfer, SendBlockError::kSendDataFailed);
         } else {
             transfer->txState = SetBlockTransfer::TxState::kSendingData;
             transfer->rxState = SetBlockTransfer::RxState::kIdle;
@@ -326,24 +350,22 @@ void CAN_TS::SendBlockFrameReceivedAck(const CanTsFrame& frame, const std::vecto
             return;
         }
 
-        transfer->watchdog->stop();
+        transfer->watchdog->Stop();
         qCDebug(cants_sb) << "Received abort frame ACK from address =" << frame.fromAddress_;
 
         if (transfer->done && CanTsUtils::IsBitmapSet(transfer->bitmap, transfer->blocks)) {
             // If abort was sent because transfer completed.
-            sb_transfers_.erase(transfer);
-            emit SendBlockCompleted(frame.fromAddress_);
+            SendBlockComplete(transfer);
         } else {
             // If abort was sent because max report retries reached.
-            sb_transfers_.erase(transfer);
-            emit SendBlockFailed(frame.fromAddress_, SendBlockError::kMaxReportRetriesReached);
+            SendBlockFail(transfer, SendBlockError::kMaxReportRetriesReached);
         }
     } else {
         qCCritical(cants_sb) << "Unexpected ACK from address =" << frame.fromAddress_;
     }
 }
 
-void CAN_TS::SendBlockFrameReceivedNack(const CanTsFrame& frame, const std::vector<SetBlockTransfer>::iterator& transfer)
+void CAN_TS::SendBlockFrameReceivedNack(const CanTsFrame& frame, const std::list<SetBlockTransfer>::iterator& transfer)
 {
     auto blocks_bits = frame.GetBlockCmdBits();
 
@@ -355,7 +377,7 @@ void CAN_TS::SendBlockFrameReceivedNack(const CanTsFrame& frame, const std::vect
             return;
         }
 
-        transfer->watchdog->stop();
+        transfer->watchdog->Stop();
         transfer->rxState = SetBlockTransfer::RxState::kIdle;
         qCCritical(cants_sb) << "Received request frame NACK from address =" << frame.fromAddress_;
         SendBlockRetryRequest(transfer);
@@ -367,7 +389,7 @@ void CAN_TS::SendBlockFrameReceivedNack(const CanTsFrame& frame, const std::vect
             return;
         }
 
-        transfer->watchdog->stop();
+        transfer->watchdog->Stop();
         transfer->rxState = SetBlockTransfer::RxState::kIdle;
         qCCritical(cants_sb) << "Received status frame NACK from address =" << frame.fromAddress_;
         SendBlockRetryStatus(transfer);
@@ -379,24 +401,22 @@ void CAN_TS::SendBlockFrameReceivedNack(const CanTsFrame& frame, const std::vect
             return;
         }
 
-        transfer->watchdog->stop();
+        transfer->watchdog->Stop();
         qCCritical(cants_sb) << "Received abort frame NACK from address =" << frame.fromAddress_;
 
         if (transfer->done && CanTsUtils::IsBitmapSet(transfer->bitmap, transfer->blocks)) {
             // If abort was sent because transfer completed.
-            sb_transfers_.erase(transfer);
-            emit SendBlockFailed(frame.fromAddress_, SendBlockError::kAbortNACKReceived);
+            SendBlockFail(transfer, SendBlockError::kAbortNACKReceived);
         } else {
             // If abort was sent because max report retries reached.
-            sb_transfers_.erase(transfer);
-            emit SendBlockFailed(frame.fromAddress_, SendBlockError::kMaxReportRetriesReached);
+            SendBlockFail(transfer, SendBlockError::kMaxReportRetriesReached);
         }
     } else {
         qCCritical(cants_sb) << "Unexpectd NACK from address =" << frame.fromAddress_;
     }
 }
 
-void CAN_TS::SendBlockFrameReceivedReport(const CanTsFrame& frame, const std::vector<SetBlockTransfer>::iterator& transfer)
+void CAN_TS::SendBlockFrameReceivedReport(const CanTsFrame& frame, const std::list<SetBlockTransfer>::iterator& transfer)
 {
     auto done_bit = frame.GetDoneBit();
 
@@ -410,16 +430,15 @@ void CAN_TS::SendBlockFrameReceivedReport(const CanTsFrame& frame, const std::ve
             qCDebug(cants_sb) << "Received report frame from address =" << frame.fromAddress_ << "done = true"
                               << "bitmap =" << frame.data_;
 
-            transfer->watchdog->stop();
+            transfer->watchdog->Stop();
             transfer->retry_count = 0;
             transfer->bitmap = frame.data_;
             transfer->done = true;
 
             CanTsFrame frame = CanTsFrame::CreateSetBlockAbort(transfer->address, address_);
-            if (!SendFrame(frame)) {
-                sb_transfers_.erase(transfer);
+            if (!SendFrame(frame, transfer->id)) {
                 qCCritical(cants_sb) << "Failed sending abort frame to address =" << frame.toAddress_;
-                emit SendBlockFailed(frame.toAddress_, SendBlockError::kSendAbortFailed);
+                SendBlockFail(transfer, SendBlockError::kSendAbortFailed);
             } else {
                 transfer->txState = SetBlockTransfer::TxState::kSendingAbort;
                 transfer->rxState = SetBlockTransfer::RxState::kIdle;
@@ -429,7 +448,7 @@ void CAN_TS::SendBlockFrameReceivedReport(const CanTsFrame& frame, const std::ve
             qCDebug(cants_sb) << "Received report frame from address =" << frame.fromAddress_ << "done = false"
                               << "bitmap =" << frame.data_;
 
-            transfer->watchdog->stop();
+            transfer->watchdog->Stop();
             transfer->retry_count = 0;
             transfer->bitmap = frame.data_;
             transfer->done = false;
@@ -437,9 +456,8 @@ void CAN_TS::SendBlockFrameReceivedReport(const CanTsFrame& frame, const std::ve
             if (transfer->report_retry_count > transfer->max_report_retries) {
                 CanTsFrame frame = CanTsFrame::CreateSetBlockAbort(transfer->address, address_);
 
-                if (!SendFrame(frame)) {
-                    sb_transfers_.erase(transfer);
-                    emit SendBlockFailed(frame.toAddress_, SendBlockError::kMaxReportRetriesReached);
+                if (!SendFrame(frame, transfer->id)) {
+                    SendBlockFail(transfer, SendBlockError::kMaxReportRetriesReached);
                     qCCritical(cants_sb) << "Failed sending abort frame to address =" << frame.toAddress_;
                 } else {
                     transfer->txState = SetBlockTransfer::TxState::kSendingAbort;
@@ -448,7 +466,7 @@ void CAN_TS::SendBlockFrameReceivedReport(const CanTsFrame& frame, const std::ve
                 }
             } else {
                 transfer->report_retry_count++;
-                transfer->report_delay_timer->start(static_cast<int>(transfer->report_delay));
+                transfer->report_delay_timer->Start(transfer->report_delay);
                 transfer->txState = SetBlockTransfer::TxState::kWaitingForSendStatusRequest;
                 transfer->rxState = SetBlockTransfer::RxState::kIdle;
             }
@@ -456,7 +474,7 @@ void CAN_TS::SendBlockFrameReceivedReport(const CanTsFrame& frame, const std::ve
             qCDebug(cants_sb) << "Received report from address =" << frame.fromAddress_ << "done = false"
                               << "bitmap =" << frame.data_;
 
-            transfer->watchdog->stop();
+            transfer->watchdog->Stop();
             transfer->retry_count = 0;
             transfer->bitmap = frame.data_;
             transfer->done = false;
@@ -464,9 +482,8 @@ void CAN_TS::SendBlockFrameReceivedReport(const CanTsFrame& frame, const std::ve
             if (transfer->report_retry_count > transfer->max_report_retries) {
                 CanTsFrame frame = CanTsFrame::CreateSetBlockAbort(transfer->address, address_);
 
-                if (!SendFrame(frame)) {
-                    sb_transfers_.erase(transfer);
-                    emit SendBlockFailed(frame.toAddress_, SendBlockError::kMaxReportRetriesReached);
+                if (!SendFrame(frame, transfer->id)) {
+                    SendBlockFail(transfer, SendBlockError::kMaxReportRetriesReached);
                     qCCritical(cants_sb) << "Failed sending abort frame to address =" << frame.toAddress_;
                 } else {
                     transfer->txState = SetBlockTransfer::TxState::kSendingAbort;
@@ -484,10 +501,10 @@ void CAN_TS::SendBlockFrameReceivedReport(const CanTsFrame& frame, const std::ve
                             data_to_send = std::vector<uint8_t>(transfer->data.begin() + 8 * sequence, transfer->data.end());
 
                         CanTsFrame frame = CanTsFrame::CreateSetBlockTransfer(transfer->address, address_, sequence, data_to_send);
-                        if (!SendFrame(frame)) {
-                            sb_transfers_.erase(transfer);
+                        if (!SendFrame(frame, transfer->id)) {
                             qCCritical(cants_sb) << "Failed sending transfer frame to address =" << frame.toAddress_ << "sequence =" << sequence;
-                            emit SendBlockFailed(frame.toAddress_, SendBlockError::kSendDataFailed);
+                            SendBlockFail(transfer, SendBlockError::kSendDataFailed);
+                            return;
                         } else {
                             transfer->report_retry_count++;
                             transfer->txState = SetBlockTransfer::TxState::kSendingData;
@@ -508,8 +525,7 @@ void CAN_TS::FrameReceivedSetBlock(const CanTsFrame& frame)
     auto frame_type = frame.GetSBFrameType();
     auto from_address = frame.GetFromAddress();
 
-    auto transfer = std::find_if(std::begin(sb_transfers_), std::end(sb_transfers_),
-        [from_address](const SetBlockTransfer& t) -> bool { return (t.address == from_address); });
+    auto transfer = FindTransfer(sb_transfers_, sb_nodes_, from_address);
 
     if (transfer == sb_transfers_.end()) {
         qCCritical(cants_sb) << "Transfer not active";
@@ -524,4 +540,35 @@ void CAN_TS::FrameReceivedSetBlock(const CanTsFrame& frame)
     }
 }
 
+void CAN_TS::SendBlockComplete(const std::list<SetBlockTransfer>::iterator& transfer)
+{
+    auto address = transfer->address;
+    SendBlockHandler handler = std::move(transfer->handler);
+
+    // Transfer is removed before notification, so subscribers can immediately start a new one.
+    RecordTransfer(TraceEvent::kTransferComplete, CanTsFrame::TransferType::SET_BLOCK, transfer->address, transfer->id, transfer->timing);
+    sb_index_.erase(transfer->id);
+    sb_nodes_.erase(transfer->address);
+    sb_transfers_.erase(transfer);
+    emit SendBlockCompleted(address);
+
+    if (handler)
+        handler(true, SendBlockError::kNone);
+}
+
+void CAN_TS::SendBlockFail(const std::list<SetBlockTransfer>::iterator& transfer, SendBlockError error)
+{
+    auto address = transfer->address;
+    SendBlockHandler handler = std::move(transfer->handler);
+
+    RecordTransfer(TraceEvent::kTransferFail, CanTsFrame::TransferType::SET_BLOCK, transfer->address, transfer->id, transfer->timing, static_cast<uint8_t>(error));
+    sb_index_.erase(transfer->id);
+    sb_nodes_.erase(transfer->address);
+    sb_transfers_.erase(transfer);
+    emit SendBlockFailed(address, error);
+
+    if (handler)
+        handler(false, error);
+}
+
 } // namespace sky
@@ -0,0 +1,325 @@
+/* See the file "LICENSE.txt" for the full license governing this code. */
+
+#include "can_ts.h"
+#include "cantsutils.h"
+#include <QDebug>
+#include <QLoggingCategory>
+#include <algorithm>
+
+Q_LOGGING_CATEGORY(cants_sv, "sky::CAN_TS::Server")
+
+namespace sky
+{
+
+bool CAN_TS::AddNode(uint8_t address, size_t memory_size)
+{
+    if (CanTsFrame::IsBroadcastAddress(address) || (address == address_)) {
+        qCCritical(cants_sv) << "Invalid node address" << address;
+        return false;
+    }
+
+    if (served_nodes_.count(address)) {
+        qCCritical(cants_sv) << "Node already hosted, address =" << address;
+        return false;
+    }
+
+    served_nodes_[address].memory.assign(memory_size, 0);
+
+    can0_->SetFilters(GetAcceptanceFilters());
+    can1_->SetFilters(GetAcceptanceFilters());
+
+    qCDebug(cants_sv) << "Hosting node address =" << address << "memory_size =" << memory_size;
+    return true;
+}
+
+void CAN_TS::RemoveNode(uint8_t address)
+{
+    if (!served_nodes_.erase(address))
+        return;
+
+    can0_->SetFilters(GetAcceptanceFilters());
+    can1_->SetFilters(GetAcceptanceFilters());
+
+    qCDebug(cants_sv) << "Removed node address =" << address;
+}
+
+bool CAN_TS::SetTCHandler(uint8_t node, uint8_t channel, ServeTCHandler handler)
+{
+    auto it = served_nodes_.find(node);
+    if (it == served_nodes_.end()) {
+        qCCritical(cants_sv) << "Node not hosted, address =" << node;
+        return false;
+    }
+
+    if (handler)
+        it->second.tc_handlers[channel] = std::move(handler);
+    else
+        it->second.tc_handlers.erase(channel);
+
+    return true;
+}
+
+bool CAN_TS::SetTMHandler(uint8_t node, uint8_t channel, ServeTMHandler handler)
+{
+    auto it = served_nodes_.find(node);
+    if (it == served_nodes_.end()) {
+        qCCritical(cants_sv) << "Node not hosted, address =" << node;
+        return false;
+    }
+
+    if (handler)
+        it->second.tm_handlers[channel] = std::move(handler);
+    else
+        it->second.tm_handlers.erase(channel);
+
+    return true;
+}
+
+std::vector<uint8_t>* CAN_TS::GetNodeMemory(uint8_t node)
+{
+    auto it = served_nodes_.find(node);
+    return (it != served_nodes_.end()) ? &it->second.memory : nullptr;
+}
+
+void CAN_TS::ServeFrameReceived(ServedNode& node, const CanTsFrame& can_ts_frame)
+{
+    switch (can_ts_frame.type_) {
+    case CanTsFrame::TransferType::TELECOMMAND:
+        ServeTC(node, can_ts_frame);
+        break;
+
+    case CanTsFrame::TransferType::TELEMETRY:
+        ServeTM(node, can_ts_frame);
+        break;
+
+    case CanTsFrame::TransferType::SET_BLOCK:
+        ServeSetBlock(node, can_ts_frame);
+        break;
+
+    case CanTsFrame::TransferType::GET_BLOCK:
+        ServeGetBlock(node, can_ts_frame);
+        break;
+
+    default:
+        qCDebug(cants_sv) << "Ignored frame" << can_ts_frame;
+        break;
+    }
+}
+
+void CAN_TS::ServeTC(ServedNode& node, const CanTsFrame& can_ts_frame)
+{
+    if (can_ts_frame.GetFrameType() != CanTsFrame::TelecommandFrameType::REQUEST)
+        return;
+
+    uint8_t channel = can_ts_frame.GetChannel();
+    auto handler = node.tc_handlers.find(channel);
+    bool ack = (handler != node.tc_handlers.end()) &&
+               handler->second(can_ts_frame.toAddress_, can_ts_frame.fromAddress_, channel, can_ts_frame.data_);
+
+    if (ack)
+        ServeResponse(CanTsFrame::CreateTelecommandAck(can_ts_frame.fromAddress_, can_ts_frame.toAddress_, channel), true);
+    else
+        ServeResponse(CanTsFrame::CreateTelecommandNack(can_ts_frame.fromAddress_, can_ts_frame.toAddress_, channel), false);
+}
+
+void CAN_TS::ServeTM(ServedNode& node, const CanTsFrame& can_ts_frame)
+{
+    // Telemetry shares frame type bits with telecommand.
+    if (can_ts_frame.GetFrameType() != CanTsFrame::TelecommandFrameType::REQUEST)
+        return;
+
+    uint8_t channel = can_ts_frame.GetChannel();
+    auto handler = node.tm_handlers.find(channel);
+    std::vector<uint8_t> data;
+    bool ack = (handler != node.tm_handlers.end()) &&
+               handler->second(can_ts_frame.toAddress_, can_ts_frame.fromAddress_, channel, data);
+
+    if (ack && (data.size() > 8)) {
+        qCCritical(cants_sv) << "Invalid telemetry length" << data.size() << "node =" << can_ts_frame.toAddress_
+                             << "channel =" << channel;
+        ack = false;
+    }
+
+    if (ack)
+        ServeResponse(CanTsFrame::CreateTelemetryAck(can_ts_frame.fromAddress_, can_ts_frame.toAddress_, channel, data), true);
+    else
+        ServeResponse(CanTsFrame::CreateTelemetryNack(can_ts_frame.fromAddress_, can_ts_frame.toAddress_, channel), false);
+}
+
+void CAN_TS::ServeSetBlock(ServedNode& node, const CanTsFrame& can_ts_frame)
+{
+    uint8_t client = can_ts_frame.fromAddress_;
+    uint8_t address = can_ts_frame.toAddress_;
+
+    switch (can_ts_frame.GetSBFrameType()) {
+    case CanTsFrame::SetBlockFrameType::REQUEST: {
+        // Repeated request restarts the transfer of this client.
+        ServedBlock& block = node.set_blocks[client];
+        uint8_t blocks = static_cast<uint8_t>(can_ts_frame.GetBlockCmdBits() + 1);
+
+        if (ServeBlockOpen(node, block, blocks, can_ts_frame.data_)) {
+            ServeResponse(CanTsFrame::CreateSetBlockAck(client, address, can_ts_frame.GetBlockCmdBits(), block.start_bytes), true);
+        } else {
+            node.set_blocks.erase(client);
+            ServeResponse(CanTsFrame::CreateSetBlockNack(client, address), false);
+        }
+        break;
+    }
+
+    case CanTsFrame::SetBlockFrameType::TRANSFER: {
+        auto block = node.set_blocks.find(client);
+        uint8_t sequence = can_ts_frame.GetBlockSequence();
+
+        if ((block == node.set_blocks.end()) || (sequence >= block->second.blocks)) {
+            qCDebug(cants_sv) << "Ignored transfer frame" << can_ts_frame;
+            break;
+        }
+
+        // Block range was checked against memory size when transfer was opened.
+        size_t length = std::min<size_t>(can_ts_frame.data_.size(), 8);
+        std::copy_n(can_ts_frame.data_.begin(), length, node.memory.begin() + block->second.start + 8 * sequence);
+        CanTsUtils::SetBitmapBit(block->second.bitmap, sequence);
+        break;
+    }
+
+    case CanTsFrame::SetBlockFrameType::STATUS: {
+        auto block = node.set_blocks.find(client);
+
+        if (block == node.set_blocks.end()) {
+            ServeResponse(CanTsFrame::CreateSetBlockNack(client, address), false);
+            break;
+        }
+
+        ServedBlock& served = block->second;
+        bool done = CanTsUtils::IsBitmapSet(served.bitmap, served.blocks);
+
+        // Status may be requested again if report is lost, memory is reported written once.
+        if (done && !served.written) {
+            served.written = true;
+            emit NodeMemoryWritten(address, client, served.start, 8U * served.blocks);
+        }
+
+        ServeResponse(CanTsFrame::CreateSetBlockReport(client, address, done, served.bitmap), true);
+        break;
+    }
+
+    case CanTsFrame::SetBlockFrameType::ABORT:
+        node.set_blocks.erase(client);
+        ServeResponse(CanTsFrame::CreateSetBlockAck(client, address, 0, {}), true);
+        break;
+
+    default:
+        qCDebug(cants_sv) << "Ignored frame" << can_ts_frame;
+        break;
+    }
+}
+
+void CAN_TS::ServeGetBlock(ServedNode& node, const CanTsFrame& can_ts_frame)
+{
+    uint8_t client = can_ts_frame.fromAddress_;
+    uint8_t address = can_ts_frame.toAddress_;
+
+    switch (can_ts_frame.GetGBFrameType()) {
+    case CanTsFrame::GetBlockFrameType::REQUEST: {
+        ServedBlock& block = node.get_blocks[client];
+        uint8_t blocks = static_cast<uint8_t>(can_ts_frame.GetBlockCmdBits() + 1);
+
+        if (ServeBlockOpen(node, block, blocks, can_ts_frame.data_)) {
+            ServeResponse(CanTsFrame::CreateGetBlockAck(client, address, can_ts_frame.GetBlockCmdBits(), block.start_bytes), true);
+        } else {
+            node.get_blocks.erase(client);
+            ServeResponse(CanTsFrame::CreateGetBlockNack(client, address), false);
+        }
+        break;
+    }
+
+    case CanTsFrame::GetBlockFrameType::START: {
+        auto block = node.get_blocks.find(client);
+
+        if (block == node.get_blocks.end()) {
+            ServeResponse(CanTsFrame::CreateGetBlockNack(client, address), false);
+            break;
+        }
+
+        // Bitmap marks blocks which client is still missing. Transfer is kept until
+        // next request or abort, so lost blocks may be requested again.
+        const ServedBlock& served = block->second;
+        for (uint8_t sequence = 0; sequence < served.blocks; sequence++) {
+            if ((sequence / 8U >= can_ts_frame.data_.size()) || !CanTsUtils::IsBitmapBitSet(can_ts_frame.data_, sequence))
+                continue;
+
+            auto data = node.memory.begin() + served.start + 8 * sequence;
+            ServeResponse(CanTsFrame::CreateGetBlockTransfer(client, address, sequence, std::vector<uint8_t>(data, data + 8)), true);
+        }
+        break;
+    }
+
+    case CanTsFrame::GetBlockFrameType::ABORT:
+        node.get_blocks.erase(client);
+        ServeResponse(CanTsFrame::CreateGetBlockAck(client, address, 0, {}), true);
+        break;
+
+    default:
+        qCDebug(cants_sv) << "Ignored frame" << can_ts_frame;
+        break;
+    }
+}
+
+bool CAN_TS::ServeBlockOpen(const ServedNode& node, ServedBlock& block, uint8_t blocks, const std::vector<uint8_t>& start_bytes)
+{
+    if (start_bytes.size() > 8)
+        return false;
+
+    // Start address is sent in little endian format with leading zeros removed.
+    uint64_t start = 0;
+    for (size_t i = 0; i < start_bytes.size(); i++)
+        start |= static_cast<uint64_t>(start_bytes[i]) << (8 * i);
+
+    if ((start > node.memory.size()) || (node.memory.size() - start < 8U * blocks)) {
+        qCDebug(cants_sv) << "Block out of memory range, start =" << start << "blocks =" << blocks;
+        return false;
+    }
+
+    block.start = start;
+    block.blocks = blocks;
+    block.start_bytes = start_bytes;
+    block.bitmap.assign(CanTsUtils::GetBitmapNumBytes(blocks), 0);
+    block.written = false;
+    return true;
+}
+
+void CAN_TS::ServeResponse(const CanTsFrame& frame, bool accepted)
+{
+    static const char* const types[] = {"telecommand", "telemetry", "set_block", "get_block"};
+
+    if (!SendFrame(frame)) {
+        qCCritical(cants_sv) << "Sending response failed" << frame;
+        return;
+    }
+
+    // Counters are looked up once per transfer type and result, responses only increment.
+    uint32_t key = (static_cast<uint32_t>(frame.type_) << 1) | (accepted ? 1 : 0);
+    auto it = served_metrics_.find(key);
+
+    if (it == served_metrics_.end()) {
+        uint8_t index = static_cast<uint8_t>(frame.type_ - CanTsFrame::TransferType::TELECOMMAND);
+        MetricCounter& counter = Metrics::Instance().GetCounter(
+            "cants_server_responses_total", {{"type", (index < 4) ? types[index] : "unknown"}, {"result", accepted ? "ack" : "nack"}},
+            "Number of response frames sent by hosted nodes.");
+        it = served_metrics_.emplace(key, &counter).first;
+    }
+
+    it->second->Increment();
+}
+
+void CAN_TS::ServeFrameSendError(const CanTsFrame& can_ts_frame, CanTransport::CanSendError error)
+{
+    // Client repeats its request after timeout, nothing to recover here.
+    qCDebug(cants_sv) << "Failed sending response of node =" << can_ts_frame.fromAddress_
+                      << "to address =" << can_ts_frame.toAddress_ << "error =" << error;
+
+    Metrics::Instance().GetCounter("cants_server_send_errors_total", {}, "Number of response frames of hosted nodes which failed to send.")
+        .Increment();
+}
+
+} // namespace sky
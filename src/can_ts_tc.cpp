@@ -1,6 +1,7 @@
 /* See the file "LICENSE.txt" for the full license governing this code. */
 
 #include "can_ts.h"
+#include "cantsprobes.h"
 #include "cantsutils.h"
 #include <QDebug>
 #include <QLoggingCategory>
@@ -10,15 +11,15 @@ Q_LOGGING_CATEGORY(cants_tc, "sky::CAN_TS::TC")
 namespace sky
 {
 
-bool CAN_TS::SendTC(uint8_t address, uint8_t channel, const std::vector<uint8_t> &data, uint8_t retry_count)
+bool CAN_TS::SendTC(uint8_t address, uint8_t channel, const std::vector<uint8_t> &data, uint8_t retry_count,
+                    SendTCHandler handler)
 {
     if (CanTsFrame::IsBroadcastAddress(address)) {
         qCCritical(cants_tc) << "Invalid address =" << address << "channel =" << channel;
         return false;
     }
 
-    if(std::any_of(std::begin(tc_transfers_), std::end(tc_transfers_),
-                   [address, channel](const TelecommandTransfer& t) { return (t.address == address) && (t.channel == channel); })) {
+    if (tc_nodes_.count(ChannelKey(address, channel))) {
         qCCritical(cants_tc) << "Transfer already active to address =" << address << "channel =" << channel;
         return false;
     }
@@ -31,74 +32,90 @@ bool CAN_TS::SendTC(uint8_t address, uint8_t channel, const std::vector<uint8_t>
 
     CanTsFrame frame = CanTsFrame::CreateTelecommandRequest(address, address_, channel, data);
 
-    if (!SendFrame(frame)) {
+    uint32_t id = NextTransferId();
+
+    if (!SendFrame(frame, id)) {
         qCCritical(cants_tc) << "Sending frame failed to address =" << frame.toAddress_ << "channel =" << channel;
         emit SendTCFailed(frame.toAddress_, channel, SendTCError::kSendRequestFailed);
         return false;
     }
 
     TelecommandTransfer transfer;
+    transfer.id = id;
+    transfer.timing.start = Trace::Now();
     transfer.address = frame.toAddress_;
     transfer.channel = channel;
     transfer.data = data;
     transfer.txState = Transfer::TxState::kSendingRequest;
     transfer.rxState = Transfer::RxState::kIdle;
-    transfer.watchdog = std::make_shared<QTimer>();
-    transfer.watchdog->setSingleShot(true);
     transfer.retry_count = 0;
     transfer.max_retries = retry_count;
+    transfer.handler = std::move(handler);
     tc_transfers_.push_back(transfer);
 
-    auto it = tc_transfers_.end() - 1;
-    connect(transfer.watchdog.get(), &QTimer::timeout, this, [this, it] () {
+    auto it = std::prev(tc_transfers_.end());
+    tc_index_[it->id] = it;
+    tc_nodes_[ChannelKey(it->address, it->channel)] = it;
+    RecordTransfer(TraceEvent::kTransferStart, CanTsFrame::TransferType::TELECOMMAND, it->address, it->id, it->timing);
+    it->watchdog = clock_->CreateTimer([this, it] () {
         emit SendTCTimeout(it);
-    }, Qt::QueuedConnection);
+    });
 
     qCDebug(cants_tc) << "Starting TC transfer to address =" << address << "channel =" << channel << "data =" << data << "retry_count =" << retry_count;
     return true;
 }
 
-void CAN_TS::SendTCRetry(const std::vector<TelecommandTransfer>::iterator& transfer)
+void CAN_TS::SendTCRetry(const std::list<TelecommandTransfer>::iterator& transfer)
 {
     if (transfer->retry_count > transfer->max_retries) {
         qCCritical(cants_tc) << "Max retries reached to address =" << transfer->address << "channel =" << transfer->channel;
-        emit SendTCFailed(transfer->address, transfer->channel, SendTCError::kMaxRetriesReached);
-        tc_transfers_.erase(transfer);
+        SendTCFail(transfer, SendTCError::kMaxRetriesReached);
     } else {
         CanTsFrame frame = CanTsFrame::CreateTelecommandRequest(transfer->address, address_, transfer->channel, transfer->data);
 
-        if (!SendFrame(frame)) {
-            transfer->watchdog->stop();
+        if (!SendFrame(frame, transfer->id)) {
+            transfer->watchdog->Stop();
             qCCritical(cants_tc) << "Failed sending TC retry to address =" << transfer->address << "channel =" << transfer->channel;
-            emit SendTCFailed(frame.toAddress_, transfer->channel, SendTCError::kSendRequestFailed);
-            tc_transfers_.erase(transfer);
+            SendTCFail(transfer, SendTCError::kSendRequestFailed);
         } else {
             transfer->txState = Transfer::TxState::kSendingRequest;
+            CountRetry(CanTsFrame::TransferType::TELECOMMAND, "request");
             qCDebug(cants_tc) << "Sending TC retry to address =" << transfer->address << "channel =" << transfer->channel;
         }
     }
 }
 
-void CAN_TS::SendTCTimeout(const std::vector<TelecommandTransfer>::iterator& transfer)
+void CAN_TS::SendTCResume(const std::list<TelecommandTransfer>::iterator& transfer)
+{
+    transfer->watchdog->Stop();
+
+    // Request sent via previous bus does not count as a retry.
+    if ((transfer->rxState == Transfer::RxState::kWaitingForRequestACK) && (transfer->retry_count > 0))
+        transfer->retry_count--;
+
+    transfer->rxState = Transfer::RxState::kIdle;
+    qCDebug(cants_tc) << "Resuming TC transfer to address =" << transfer->address << "channel =" << transfer->channel;
+    SendTCRetry(transfer);
+}
+
+void CAN_TS::SendTCTimeout(const std::list<TelecommandTransfer>::iterator& transfer)
 {
+    SKY_PROBE5(transfer_timeout, CanTsFrame::TransferType::TELECOMMAND, transfer->address, transfer->id,
+               static_cast<uint8_t>(transfer->rxState), transfer->retry_count);
     transfer->rxState = Transfer::RxState::kIdle;
     qCCritical(cants_tc) << "TC ACK timeout address =" << transfer->address << "channel =" << transfer->channel;
     SendTCRetry(transfer);
 }
 
-void CAN_TS::SendTCFrameSent(const CanTsFrame& frame)
+void CAN_TS::SendTCFrameSent(const CanTsFrame& frame, uint32_t transfer_id)
 {
     auto channel = frame.GetChannel();
     auto to_address = frame.GetToAddress();
 
-    auto it = std::find_if(std::begin(tc_transfers_), std::end(tc_transfers_),
-                           [channel, to_address](const TelecommandTransfer& t) -> bool {
-        return (t.address == to_address) && (t.channel == channel) &&
-               (t.txState == Transfer::TxState::kSendingRequest);
-    });
+    auto it = FindTransfer(tc_transfers_, tc_index_, transfer_id);
 
-    if (it != std::end(tc_transfers_)) {
-        it->watchdog->start(static_cast<int>(timeout_));
+    if ((it != std::end(tc_transfers_)) && (it->txState == Transfer::TxState::kSendingRequest)) {
+        it->watchdog->Start(timeout_);
         it->rxState = Transfer::RxState::kWaitingForRequestACK;
         it->txState = Transfer::TxState::kIdle;
         it->retry_count++;
@@ -106,21 +123,17 @@ void CAN_TS::SendTCFrameSent(const CanTsFrame& frame)
     }
 }
 
-void CAN_TS::SendTCFrameSendError(const CanTsFrame& frame, CommDriver::CanSendError error)
+void CAN_TS::SendTCFrameSendError(const CanTsFrame& frame, uint32_t transfer_id, CanTransport::CanSendError error)
 {
     auto channel = frame.GetChannel();
-    auto to_address = frame.GetToAddress();
 
-    auto it = std::find_if(tc_transfers_.begin(), tc_transfers_.end(),
-                           [channel, to_address](const TelecommandTransfer& t) -> bool {
-        return (t.address == to_address) && (t.channel == channel) &&
-               (t.txState == Transfer::TxState::kSendingRequest);
-    });
+    auto it = FindTransfer(tc_transfers_, tc_index_, transfer_id);
 
-    if (it != std::end(tc_transfers_)) {
+    if ((it != std::end(tc_transfers_)) && (it->txState == Transfer::TxState::kSendingRequest)) {
         qCCritical(cants_tc) << "Failed sending to address =" << frame.toAddress_
                              << "channel =" << channel << "error =" << error;
-        emit SendTCFailed(frame.toAddress_, channel, SendTCError::kSendRequestFailed);
+        it->watchdog->Stop();
+        SendTCFail(it, SendTCError::kSendRequestFailed);
     }
 }
 
@@ -130,24 +143,52 @@ void CAN_TS::SendTCFrameReceived(const CanTsFrame& frame)
     auto channel = frame.GetChannel();
     auto from_address = frame.GetFromAddress();
 
-    auto it = std::find_if(std::begin(tc_transfers_), std::end(tc_transfers_),
-                           [from_address, channel](const TelecommandTransfer& t) -> bool {
-        return (t.address == from_address) && (t.channel == channel) &&
-               (t.rxState == TelemetryTransfer::RxState::kWaitingForRequestACK);
-    });
+    auto it = FindTransfer(tc_transfers_, tc_nodes_, ChannelKey(from_address, channel));
 
-    if (it == std::end(tc_transfers_)) {
+    if ((it == std::end(tc_transfers_)) || (it->rxState != Transfer::RxState::kWaitingForRequestACK)) {
         qCCritical(cants_tc) << "Received invalid frame (non active transfer) from address =" << from_address << "channel =" << channel;
     } else if (frame_type == CanTsFrame::TelecommandFrameType::ACK) {
-        tc_transfers_.erase(it);
-        emit SendTCCompleted(from_address, channel);
         qCDebug(cants_tc) << "Received TC ACK from address =" << from_address << "channel =" << channel;
+        SendTCComplete(it);
     } else if (frame_type == CanTsFrame::TelecommandFrameType::NACK) {
-        it->watchdog->stop();
+        it->watchdog->Stop();
         it->rxState = Transfer::RxState::kIdle;
         SendTCRetry(it);
         qCCritical(cants_tc) << "Received TC NACK from address =" << from_address << "channel =" << channel;
     }
 }
 
+void CAN_TS::SendTCComplete(const std::list<TelecommandTransfer>::iterator& transfer)
+{
+    auto address = transfer->address;
+    auto channel = transfer->channel;
+    SendTCHandler handler = std::move(transfer->handler);
+
+    // Transfer is removed before notification, so subscribers can immediately start a new one.
+    RecordTransfer(TraceEvent::kTransferComplete, CanTsFrame::TransferType::TELECOMMAND, transfer->address, transfer->id, transfer->timing);
+    tc_index_.erase(transfer->id);
+    tc_nodes_.erase(ChannelKey(transfer->address, transfer->channel));
+    tc_transfers_.erase(transfer);
+    emit SendTCCompleted(address, channel);
+
+    if (handler)
+        handler(true, SendTCError::kNone);
+}
+
+void CAN_TS::SendTCFail(const std::list<TelecommandTransfer>::iterator& transfer, SendTCError error)
+{
+    auto address = transfer->address;
+    auto channel = transfer->channel;
+    SendTCHandler handler = std::move(transfer->handler);
+
+    RecordTransfer(TraceEvent::kTransferFail, CanTsFrame::TransferType::TELECOMMAND, transfer->address, transfer->id, transfer->timing, static_cast<uint8_t>(error));
+    tc_index_.erase(transfer->id);
+    tc_nodes_.erase(ChannelKey(transfer->address, transfer->channel));
+    tc_transfers_.erase(transfer);
+    emit SendTCFailed(address, channel, error);
+
+    if (handler)
+        handler(false, error);
+}
+
 } // namespace sky
@@ -1,6 +1,7 @@
 /* See the file "LICENSE.txt" for the full license governing this code. */
 
 #include "can_ts.h"
+#include "cantsprobes.h"
 #include "cantsutils.h"
 #include <QDebug>
 #include <QLoggingCategory>
@@ -10,88 +11,132 @@ Q_LOGGING_CATEGORY(cants_tm, "sky::CAN_TS::TM")
 namespace sky
 {
 
-bool CAN_TS::ReceiveTM(uint8_t address, uint8_t channel, uint8_t retry_count)
+bool CAN_TS::ReceiveTM(uint8_t address, uint8_t channel, uint8_t retry_count, uint32_t max_age_ms,
+                       ReceiveTMHandler handler)
 {
     if (CanTsFrame::IsBroadcastAddress(address)) {
         qCCritical(cants_tm) << "Invalid address =" << address;
         return false;
     }
 
-    if (std::any_of(std::begin(tm_transfers_), std::end(tm_transfers_),
-                    [address, channel](const TelemetryTransfer& t) { return (t.address == address) && (t.channel == channel); })) {
+    if (max_age_ms > 0) {
+        std::vector<uint8_t> data;
+
+        if (GetCachedTM(address, channel, max_age_ms, data)) {
+            qCDebug(cants_tm) << "Serving TM from cache address =" << address << "channel =" << channel << "data =" << data;
+            emit ReceiveTMCompleted(address, channel, data);
+
+            if (handler)
+                handler(true, data, ReceiveTMError::kNone);
+
+            return true;
+        }
+    }
+
+    auto active = FindTransfer(tm_transfers_, tm_nodes_, ChannelKey(address, channel));
+
+    if (active != std::end(tm_transfers_)) {
+        if (max_age_ms > 0) {
+            // Completion of active transfer also completes this request.
+            if (handler)
+                active->handlers.push_back(std::move(handler));
+
+            qCDebug(cants_tm) << "Merged with active transfer to address =" << address << "channel =" << channel;
+            return true;
+        }
+
         qCCritical(cants_tm) << "Transfer already active to address =" << address << "and channel =" << channel;
         return false;
     }
 
     CanTsFrame frame = CanTsFrame::CreateTelemetryRequest(address, address_, channel);
 
-    if (!SendFrame(frame)) {
+    uint32_t id = NextTransferId();
+
+    if (!SendFrame(frame, id)) {
         qCCritical(cants_tm) << "Sending frame failed to address =" << address << "channel =" << channel;
         emit ReceiveTMFailed(frame.toAddress_, channel, ReceiveTMError::kSendRequestFailed);
         return false;
     }
 
     TelemetryTransfer transfer;
+    transfer.id = id;
+    transfer.timing.start = Trace::Now();
     transfer.address = frame.toAddress_;
     transfer.channel = channel;
     transfer.rxState = Transfer::RxState::kIdle;
     transfer.txState = Transfer::TxState::kSendingRequest;
-    transfer.watchdog = std::make_shared<QTimer>();
-    transfer.watchdog->setSingleShot(true);
     transfer.retry_count = 0;
     transfer.max_retries = retry_count;
+
+    if (handler)
+        transfer.handlers.push_back(std::move(handler));
+
     tm_transfers_.push_back(transfer);
 
-    auto it = tm_transfers_.end() - 1;
-    connect(transfer.watchdog.get(), &QTimer::timeout, this, [this, it] () {
+    auto it = std::prev(tm_transfers_.end());
+    tm_index_[it->id] = it;
+    tm_nodes_[ChannelKey(it->address, it->channel)] = it;
+    RecordTransfer(TraceEvent::kTransferStart, CanTsFrame::TransferType::TELEMETRY, it->address, it->id, it->timing);
+    it->watchdog = clock_->CreateTimer([this, it] () {
         emit ReceiveTMTimeout(it);
-    }, Qt::QueuedConnection);
+    });
 
     qCDebug(cants_tm) << "Starting TM transfer to address =" << address << "channel =" << channel << "retry_count =" << retry_count;
     return true;
 }
 
-void CAN_TS::ReceiveTMRetry(const std::vector<TelemetryTransfer>::iterator& transfer)
+void CAN_TS::ReceiveTMRetry(const std::list<TelemetryTransfer>::iterator& transfer)
 {
     if (transfer->retry_count > transfer->max_retries) {
         qCCritical(cants_tm) << "Max retries reached address=" << transfer->address << "channel =" << transfer->channel;
-        emit ReceiveTMFailed(transfer->address, transfer->channel, ReceiveTMError::kMaxRetriesReached);
-        tm_transfers_.erase(transfer);
+        ReceiveTMFail(transfer, ReceiveTMError::kMaxRetriesReached);
     } else {
         CanTsFrame frame = CanTsFrame::CreateTelemetryRequest(transfer->address, address_, transfer->channel);
 
-        if (!SendFrame(frame)) {
+        if (!SendFrame(frame, transfer->id)) {
             qCCritical(cants_tm) << "Failed sending retry to address =" << transfer->address << "channel =" << transfer->channel;
-            emit ReceiveTMFailed(transfer->address, transfer->channel, ReceiveTMError::kSendRequestFailed);
-            tm_transfers_.erase(transfer);
+            ReceiveTMFail(transfer, ReceiveTMError::kSendRequestFailed);
         } else {
             transfer->txState = Transfer::TxState::kSendingRequest;
+            CountRetry(CanTsFrame::TransferType::TELEMETRY, "request");
             qCDebug(cants_tm) << "Sending TM retry to address =" << transfer->address << "channel =" << transfer->channel;
         }
     }
 }
 
-void CAN_TS::ReceiveTMTimeout(const std::vector<TelemetryTransfer>::iterator& transfer)
+void CAN_TS::ReceiveTMResume(const std::list<TelemetryTransfer>::iterator& transfer)
+{
+    transfer->watchdog->Stop();
+
+    // Request sent via previous bus does not count as a retry.
+    if ((transfer->rxState == Transfer::RxState::kWaitingForRequestACK) && (transfer->retry_count > 0))
+        transfer->retry_count--;
+
+    transfer->rxState = Transfer::RxState::kIdle;
+    qCDebug(cants_tm) << "Resuming TM transfer to address =" << transfer->address << "channel =" << transfer->channel;
+    ReceiveTMRetry(transfer);
+}
+
+void CAN_TS::ReceiveTMTimeout(const std::list<TelemetryTransfer>::iterator& transfer)
 {
-    transfer->watchdog->stop();
+    SKY_PROBE5(transfer_timeout, CanTsFrame::TransferType::TELEMETRY, transfer->address, transfer->id,
+               static_cast<uint8_t>(transfer->rxState), transfer->retry_count);
+    transfer->watchdog->Stop();
     transfer->rxState = Transfer::RxState::kIdle;
     qCCritical(cants_tm) << "TM ACK timeout address =" << transfer->address << "channel =" << transfer->channel;
     ReceiveTMRetry(transfer);
 }
 
-void CAN_TS::ReceiveTMFrameSent(const CanTsFrame& frame)
+void CAN_TS::ReceiveTMFrameSent(const CanTsFrame& frame, uint32_t transfer_id)
 {
     auto channel = frame.GetChannel();
     auto to_address = frame.GetToAddress();
 
-    auto it = std::find_if(std::begin(tm_transfers_), std::end(tm_transfers_),
-                           [channel, to_address](const TelemetryTransfer& t) -> bool {
-        return (t.address == to_address) && (t.channel == channel) &&
-               (t.txState == Transfer::TxState::kSendingRequest);
-    });
+    auto it = FindTransfer(tm_transfers_, tm_index_, transfer_id);
 
-    if (it != std::end(tm_transfers_)) {
-        it->watchdog->start(static_cast<int>(timeout_));
+    if ((it != std::end(tm_transfers_)) && (it->txState == Transfer::TxState::kSendingRequest)) {
+        it->watchdog->Start(timeout_);
         it->rxState = TelemetryTransfer::RxState::kWaitingForRequestACK;
         it->txState = TelemetryTransfer::TxState::kIdle;
         it->retry_count++;
@@ -99,21 +144,17 @@ void CAN_TS::ReceiveTMFrameSent(const CanTsFrame& frame)
     }
 }
 
-void CAN_TS::ReceiveTMFrameSendError(const CanTsFrame& frame, CommDriver::CanSendError error)
+void CAN_TS::ReceiveTMFrameSendError(const CanTsFrame& frame, uint32_t transfer_id, CanTransport::CanSendError error)
 {
     auto channel = frame.GetChannel();
-    auto to_address = frame.GetToAddress();
 
-    auto it = std::find_if(tm_transfers_.begin(), tm_transfers_.end(),
-                           [channel, to_address](const TelemetryTransfer& t) -> bool {
-        return (t.address == to_address) && (t.channel == channel) &&
-               (t.txState == Transfer::TxState::kSendingRequest);
-    });
+    auto it = FindTransfer(tm_transfers_, tm_index_, transfer_id);
 
-    if (it != std::end(tm_transfers_)) {
+    if ((it != std::end(tm_transfers_)) && (it->txState == Transfer::TxState::kSendingRequest)) {
         qCCritical(cants_tm) << "Failed sending to address =" << frame.GetToAddress()
                              << "channel =" << channel << "error =" << error;
-        emit ReceiveTMFailed(frame.toAddress_, channel, ReceiveTMError::kSendRequestFailed);
+        it->watchdog->Stop();
+        ReceiveTMFail(it, ReceiveTMError::kSendRequestFailed);
     }
 }
 
@@ -123,24 +164,79 @@ void CAN_TS::ReceiveTMFrameReceived(const CanTsFrame& frame)
     auto channel = frame.GetChannel();
     auto from_address = frame.GetFromAddress();
 
-    auto it = std::find_if(std::begin(tm_transfers_), std::end(tm_transfers_),
-                           [from_address, channel](const TelemetryTransfer& t) -> bool {
-        return (t.address == from_address) && (t.channel == channel) &&
-               (t.rxState == TelemetryTransfer::RxState::kWaitingForRequestACK);
-    });
+    auto it = FindTransfer(tm_transfers_, tm_nodes_, ChannelKey(from_address, channel));
 
-    if (it == std::end(tm_transfers_)) {
+    if ((it == std::end(tm_transfers_)) || (it->rxState != Transfer::RxState::kWaitingForRequestACK)) {
         qCCritical(cants_tm) << "Received invalid frame (non activa transfer) from address =" << from_address << "channel =" << channel;
     } else if (frame_type == CanTsFrame::TelecommandFrameType::ACK) {
-        tm_transfers_.erase(it);
-        emit ReceiveTMCompleted(from_address, channel, frame.data_);
+        TelemetryCacheEntry& entry = tm_cache_[TelemetryCacheKey(from_address, channel)];
+        entry.data = frame.data_;
+        entry.timestamp = ElapsedSinceStart();
+
         qCDebug(cants_tm) << "Received TM ACK from address =" << from_address << "channel =" << channel;
+        ReceiveTMComplete(it, frame.data_);
     } else if (frame_type == CanTsFrame::TelecommandFrameType::NACK) {
-        it->watchdog->stop();
+        it->watchdog->Stop();
         it->rxState = Transfer::RxState::kIdle;
         ReceiveTMRetry(it);
         qCCritical(cants_tm) << "Received TM NACK from address =" << from_address << "channel =" << channel;
     }
 }
 
+void CAN_TS::ReceiveTMComplete(const std::list<TelemetryTransfer>::iterator& transfer, const std::vector<uint8_t>& data)
+{
+    auto address = transfer->address;
+    auto channel = transfer->channel;
+    std::vector<ReceiveTMHandler> handlers = std::move(transfer->handlers);
+
+    // Transfer is removed before notification, so subscribers can immediately start a new one.
+    RecordTransfer(TraceEvent::kTransferComplete, CanTsFrame::TransferType::TELEMETRY, transfer->address, transfer->id, transfer->timing);
+    tm_index_.erase(transfer->id);
+    tm_nodes_.erase(ChannelKey(transfer->address, transfer->channel));
+    tm_transfers_.erase(transfer);
+    emit ReceiveTMCompleted(address, channel, data);
+
+    for (auto& handler : handlers)
+        handler(true, data, ReceiveTMError::kNone);
+}
+
+void CAN_TS::ReceiveTMFail(const std::list<TelemetryTransfer>::iterator& transfer, ReceiveTMError error)
+{
+    auto address = transfer->address;
+    auto channel = transfer->channel;
+    std::vector<ReceiveTMHandler> handlers = std::move(transfer->handlers);
+
+    RecordTransfer(TraceEvent::kTransferFail, CanTsFrame::TransferType::TELEMETRY, transfer->address, transfer->id, transfer->timing, static_cast<uint8_t>(error));
+    tm_index_.erase(transfer->id);
+    tm_nodes_.erase(ChannelKey(transfer->address, transfer->channel));
+    tm_transfers_.erase(transfer);
+    emit ReceiveTMFailed(address, channel, error);
+
+    for (auto& handler : handlers)
+        handler(false, std::vector<uint8_t>(), error);
+}
+
+bool CAN_TS::GetCachedTM(uint8_t address, uint8_t channel, uint32_t max_age_ms, std::vector<uint8_t>& data) const
+{
+    auto it = tm_cache_.find(TelemetryCacheKey(address, channel));
+
+    if ((it == tm_cache_.end()) || (start_time_ < 0) ||
+        (ElapsedSinceStart() - it->second.timestamp > static_cast<qint64>(max_age_ms))) {
+        return false;
+    }
+
+    data = it->second.data;
+    return true;
+}
+
+void CAN_TS::ClearTMCache()
+{
+    tm_cache_.clear();
+}
+
+uint16_t CAN_TS::TelemetryCacheKey(uint8_t address, uint8_t channel)
+{
+    return static_cast<uint16_t>((address << 8) | channel);
+}
+
 } // namespace sky
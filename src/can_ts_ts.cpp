@@ -31,7 +31,7 @@ void CAN_TS::SendTimeSyncFrameSent()
     emit SendTimeSyncCompleted();
 }
 
-void CAN_TS::SendTimeSyncFrameSendError(CommDriver::CanSendError error)
+void CAN_TS::SendTimeSyncFrameSendError(CanTransport::CanSendError error)
 {
     qCCritical(cants_ts) << "Failed sending time sync error=" << error;
     emit SendTimeSyncFailed();
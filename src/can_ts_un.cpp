@@ -40,7 +40,7 @@ void CAN_TS::SendUnsolicitedFrameSent(const CanTsFrame& frame)
     emit SendUnsolicitedCompleted(frame.GetToAddress(), frame.GetChannel());
 }
 
-void CAN_TS::SendUnsolicitedFrameSendError(const CanTsFrame& frame, CommDriver::CanSendError error)
+void CAN_TS::SendUnsolicitedFrameSendError(const CanTsFrame& frame, CanTransport::CanSendError error)
 {
     qCCritical(cants_un) << "Failed sending unsolicited to address =" << frame.GetToAddress()
                          << "channel =" << frame.GetChannel() << "error =" << error;
@@ -61,6 +61,8 @@ void CAN_TS::ReceivedKeepAliveFrame(const CanTsFrame& frame, bool nominal_bus)
     qCDebug(cants_un) << "Received keep alive fram from address=" << frame.GetFromAddress()
                       << "channel =" << frame.GetChannel() << "data =" << frame.GetData() << "nominal_bus =" << nominal_bus;
 
+    RedundancyKeepAlive(frame.GetFromAddress(), nominal_bus);
+
     if (nominal_bus)
         emit KeepAliveReceivedNominal(frame.GetFromAddress(), frame.GetChannel(), frame.GetData());
     else
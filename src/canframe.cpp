@@ -56,4 +56,27 @@ CanFrame CanFrame::FromStdVector(const std::vector<uint8_t>& data) {
     return f;
 }
 
+bool CanFrame::PeekId(const std::vector<uint8_t>& data, uint32_t& id, bool& extid) {
+
+    if (data.empty())
+        return false;
+
+    extid = static_cast<bool>((data[0] >> 7) & 1);
+
+    if (extid) {
+        if (data.size() < 5)
+            return false;
+
+        id = static_cast<uint32_t>(data[4]<<24U) | static_cast<uint32_t>(data[3]<<16U) |
+             static_cast<uint32_t>(data[2]<<8U) | static_cast<uint32_t>(data[1]);
+    } else {
+        if (data.size() < 3)
+            return false;
+
+        id = static_cast<uint32_t>(data[2]<<8U) | static_cast<uint32_t>(data[1]);
+    }
+
+    return true;
+}
+
 }
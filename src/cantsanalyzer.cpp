@@ -0,0 +1,579 @@
+/* See the file "LICENSE.txt" for the full license governing this code. */
+
+#include "cantsanalyzer.h"
+#include "cantsutils.h"
+#include <QJsonArray>
+#include <algorithm>
+
+namespace sky
+{
+
+namespace
+{
+
+//! Records \a value in histogram \a histogram.
+void Record(MetricHistogram::Snapshot& histogram, uint64_t value)
+{
+    if (histogram.buckets.empty())
+        histogram.buckets.resize(MetricHistogram::kBuckets);
+
+    histogram.buckets[MetricHistogram::BucketIndex(value)]++;
+    histogram.count++;
+    histogram.sum += value;
+    histogram.max = std::max(histogram.max, value);
+}
+
+//! Adds histogram \a other to \a histogram.
+void Merge(MetricHistogram::Snapshot& histogram, const MetricHistogram::Snapshot& other)
+{
+    if (other.buckets.empty())
+        return;
+
+    if (histogram.buckets.empty())
+        histogram.buckets.resize(MetricHistogram::kBuckets);
+
+    for (size_t i = 0; i < other.buckets.size(); i++)
+        histogram.buckets[i] += other.buckets[i];
+
+    histogram.count += other.count;
+    histogram.sum += other.sum;
+    histogram.max = std::max(histogram.max, other.max);
+}
+
+//! Returns summary of \a histogram as JSON object.
+QJsonObject ToJson(const MetricHistogram::Snapshot& histogram)
+{
+    QJsonObject json;
+    json["count"] = static_cast<double>(histogram.count);
+    json["mean"] = histogram.count ? static_cast<double>(histogram.sum) / static_cast<double>(histogram.count) : 0.0;
+    json["p50"] = static_cast<double>(histogram.ValueAtQuantile(0.5));
+    json["p99"] = static_cast<double>(histogram.ValueAtQuantile(0.99));
+    json["max"] = static_cast<double>(histogram.max);
+    return json;
+}
+
+//! Returns bitmap with first \a blocks bits set.
+uint64_t BlockMask(uint8_t blocks)
+{
+    return (blocks >= 64) ? ~0ULL : ((1ULL << blocks) - 1);
+}
+
+} // namespace
+
+void BusAnalyzer::PairStats::Add(const Session& session)
+{
+    sessions++;
+    outcomes[static_cast<size_t>(session.outcome)]++;
+    frames += session.frames;
+    retransmissions += session.retransmissions;
+    nacks += session.nacks;
+    Record(duration, (session.end - std::min(session.end, session.start)) / 1000);
+}
+
+void BusAnalyzer::PairStats::Merge(const PairStats& other)
+{
+    sessions += other.sessions;
+
+    for (size_t i = 0; i < kOutcomes; i++)
+        outcomes[i] += other.outcomes[i];
+
+    frames += other.frames;
+    retransmissions += other.retransmissions;
+    nacks += other.nacks;
+    sky::Merge(latency, other.latency);
+    sky::Merge(duration, other.duration);
+}
+
+void BusAnalyzer::Counters::Merge(const Counters& other)
+{
+    frames += other.frames;
+    time_sync += other.time_sync;
+    keep_alive += other.keep_alive;
+    unsolicited += other.unsolicited;
+    unmatched += other.unmatched;
+    invalid += other.invalid;
+}
+
+BusAnalyzer::BusAnalyzer(uint64_t timeout_ns) :
+    timeout_(std::max<uint64_t>(timeout_ns, 1))
+{
+}
+
+void BusAnalyzer::SetSessionHandler(SessionHandler handler)
+{
+    handler_ = std::move(handler);
+}
+
+void BusAnalyzer::SetWindow(uint64_t begin, uint64_t end)
+{
+    window_begin_ = begin;
+    window_end_ = end;
+}
+
+void BusAnalyzer::Process(const CanTsFrame& frame, uint64_t timestamp)
+{
+    counting_ = InWindow(timestamp) ? &counters_ : &ignored_;
+    counting_->frames++;
+
+    // Idle sessions are checked twice per timeout, not per frame.
+    if (timestamp >= next_expire_) {
+        Expire(timestamp);
+        next_expire_ = timestamp + std::max<uint64_t>(timeout_ / 2, 1);
+    }
+
+    switch (frame.type_) {
+    case CanTsFrame::TransferType::TIME_SYNC:
+        counting_->time_sync++;
+        break;
+
+    case CanTsFrame::TransferType::UNSOLICITED:
+        if (frame.GetToAddress() == static_cast<uint8_t>(CanTsFrame::Address::KEEP_ALIVE))
+            counting_->keep_alive++;
+        else
+            counting_->unsolicited++;
+        break;
+
+    case CanTsFrame::TransferType::TELECOMMAND:
+    case CanTsFrame::TransferType::TELEMETRY:
+        ProcessTransfer(frame, timestamp);
+        break;
+
+    case CanTsFrame::TransferType::SET_BLOCK:
+        ProcessSetBlock(frame, timestamp);
+        break;
+
+    case CanTsFrame::TransferType::GET_BLOCK:
+        ProcessGetBlock(frame, timestamp);
+        break;
+
+    default:
+        counting_->invalid++;
+        break;
+    }
+}
+
+void BusAnalyzer::Process(const CaptureRecord& record)
+{
+    if ((record.direction == static_cast<uint8_t>(CaptureDirection::kTxError)) ||
+        !(record.flags & CaptureRecord::kExtId) || (record.flags & CaptureRecord::kRtr))
+        return;
+
+    // Decoded in place (as CAN_TS::FromCanFrame does), so the data buffer is reused.
+    record_frame_.DecodeId(record.id);
+    record_frame_.data_.assign(record.data, record.data + std::min<size_t>(record.length, sizeof(record.data)));
+
+    Process(record_frame_, record.timestamp);
+}
+
+void BusAnalyzer::Expire(uint64_t timestamp)
+{
+    expired_.clear();
+
+    for (const auto& session : sessions_) {
+        if (timestamp > session.second.end + timeout_)
+            expired_.push_back(session.first);
+    }
+
+    for (uint32_t key : expired_) {
+        const Session& session = sessions_.at(key);
+        End(session, session.nacked ? Outcome::kNacked : Outcome::kTimedOut);
+    }
+}
+
+void BusAnalyzer::Finish()
+{
+    while (!sessions_.empty())
+        End(sessions_.begin()->second, Outcome::kUnfinished);
+}
+
+void BusAnalyzer::Merge(const BusAnalyzer& other)
+{
+    counters_.Merge(other.counters_);
+
+    for (const auto& stats : other.stats_)
+        stats_[stats.first].Merge(stats.second);
+}
+
+size_t BusAnalyzer::GetOpenSessions() const
+{
+    return open_counted_;
+}
+
+const BusAnalyzer::Counters& BusAnalyzer::GetCounters() const
+{
+    return counters_;
+}
+
+const std::map<uint32_t, BusAnalyzer::PairStats>& BusAnalyzer::GetStats() const
+{
+    return stats_;
+}
+
+QJsonObject BusAnalyzer::ToJson() const
+{
+    QJsonObject frames;
+    frames["total"] = static_cast<double>(counters_.frames);
+    frames["time_sync"] = static_cast<double>(counters_.time_sync);
+    frames["keep_alive"] = static_cast<double>(counters_.keep_alive);
+    frames["unsolicited"] = static_cast<double>(counters_.unsolicited);
+    frames["unmatched"] = static_cast<double>(counters_.unmatched);
+    frames["invalid"] = static_cast<double>(counters_.invalid);
+
+    QJsonArray pairs;
+
+    for (const auto& stats : stats_)
+        pairs.append(ToJson(stats.first, stats.second));
+
+    QJsonObject json;
+    json["frames"] = frames;
+    json["open_sessions"] = static_cast<double>(open_counted_);
+    json["pairs"] = pairs;
+    return json;
+}
+
+uint32_t BusAnalyzer::PairKey(uint8_t type, uint8_t client, uint8_t node)
+{
+    return (static_cast<uint32_t>(type) << 16) | (static_cast<uint32_t>(client) << 8) | node;
+}
+
+const char* BusAnalyzer::TypeName(uint8_t type)
+{
+    switch (type) {
+    case CanTsFrame::TransferType::TELECOMMAND:
+        return "TC";
+    case CanTsFrame::TransferType::TELEMETRY:
+        return "TM";
+    case CanTsFrame::TransferType::SET_BLOCK:
+        return "SB";
+    case CanTsFrame::TransferType::GET_BLOCK:
+        return "GB";
+    default:
+        return "?";
+    }
+}
+
+const char* BusAnalyzer::OutcomeName(Outcome outcome)
+{
+    static const char* const kNames[kOutcomes] = {"completed", "nacked", "aborted", "superseded", "timed_out", "unfinished"};
+    return kNames[static_cast<size_t>(outcome)];
+}
+
+QJsonObject BusAnalyzer::ToJson(uint32_t key, const PairStats& stats)
+{
+    QJsonObject outcomes;
+
+    for (size_t i = 0; i < kOutcomes; i++)
+        outcomes[OutcomeName(static_cast<Outcome>(i))] = static_cast<double>(stats.outcomes[i]);
+
+    QJsonObject json;
+    json["type"] = TypeName(static_cast<uint8_t>(key >> 16));
+    json["client"] = static_cast<int>((key >> 8) & 0xFF);
+    json["node"] = static_cast<int>(key & 0xFF);
+    json["sessions"] = static_cast<double>(stats.sessions);
+    json["outcomes"] = outcomes;
+    json["frames"] = static_cast<double>(stats.frames);
+    json["retransmissions"] = static_cast<double>(stats.retransmissions);
+    json["nacks"] = static_cast<double>(stats.nacks);
+    json["latency_us"] = sky::ToJson(stats.latency);
+    json["duration_us"] = sky::ToJson(stats.duration);
+    return json;
+}
+
+uint32_t BusAnalyzer::SessionKey(uint8_t type, uint8_t client, uint8_t node, uint8_t channel)
+{
+    return (PairKey(type, client, node) << 8) | channel;
+}
+
+bool BusAnalyzer::InWindow(uint64_t timestamp) const
+{
+    return (timestamp >= window_begin_) && (timestamp < window_end_);
+}
+
+BusAnalyzer::Session* BusAnalyzer::Find(uint32_t key, uint64_t timestamp)
+{
+    auto it = sessions_.find(key);
+
+    if (it == sessions_.end())
+        return nullptr;
+
+    // Outcome does not depend on when idle sessions were last checked.
+    if (timestamp > it->second.end + timeout_) {
+        End(it->second, it->second.nacked ? Outcome::kNacked : Outcome::kTimedOut);
+        return nullptr;
+    }
+
+    return &it->second;
+}
+
+void BusAnalyzer::ProcessTransfer(const CanTsFrame& frame, uint64_t timestamp)
+{
+    // Telemetry frame types have the same values as telecommand ones.
+    uint8_t channel = frame.GetChannel();
+    Session* session = nullptr;
+
+    switch (frame.GetFrameType()) {
+    case CanTsFrame::TelecommandFrameType::REQUEST:
+        Request(frame, channel, timestamp);
+        break;
+
+    case CanTsFrame::TelecommandFrameType::ACK:
+        if ((session = FindFromNode(frame, channel, timestamp))) {
+            Answer(*session, timestamp);
+            End(*session, Outcome::kCompleted);
+        }
+        break;
+
+    case CanTsFrame::TelecommandFrameType::NACK:
+        // Client retries the request or gives up (ends by timeout).
+        if ((session = FindFromNode(frame, channel, timestamp))) {
+            Answer(*session, timestamp);
+            session->nacks++;
+            session->nacked = true;
+        }
+        break;
+
+    default:
+        counting_->invalid++;
+        break;
+    }
+}
+
+void BusAnalyzer::ProcessSetBlock(const CanTsFrame& frame, uint64_t timestamp)
+{
+    uint8_t bits = frame.GetBlockCmdBits();
+    Session* session = nullptr;
+
+    switch (frame.GetSBFrameType()) {
+    case CanTsFrame::SetBlockFrameType::REQUEST:
+        Request(frame, 0, timestamp).blocks = static_cast<uint8_t>(bits + 1);
+        break;
+
+    case CanTsFrame::SetBlockFrameType::ACK:
+        if ((session = FindFromNode(frame, 0, timestamp))) {
+            Answer(*session, timestamp);
+
+            if (session->phase == Phase::kAbort)
+                End(*session, session->done ? Outcome::kCompleted : Outcome::kAborted);
+            else
+                session->phase = Phase::kData;
+        }
+        break;
+
+    case CanTsFrame::SetBlockFrameType::NACK:
+        if ((session = FindFromNode(frame, 0, timestamp))) {
+            Answer(*session, timestamp);
+            session->nacks++;
+            session->nacked = true;
+
+            if (session->phase == Phase::kAbort)
+                End(*session, Outcome::kNacked);
+        }
+        break;
+
+    case CanTsFrame::SetBlockFrameType::TRANSFER:
+        if ((session = FindFromClient(frame, 0, timestamp)))
+            Data(*session, bits);
+        break;
+
+    case CanTsFrame::SetBlockFrameType::STATUS:
+        if ((session = FindFromClient(frame, 0, timestamp)))
+            SendRequest(*session, Phase::kStatus, timestamp);
+        break;
+
+    case CanTsFrame::SetBlockFrameType::REPORT:
+        // Report tells which blocks sink has, missing ones are sent again.
+        if ((session = FindFromNode(frame, 0, timestamp))) {
+            Answer(*session, timestamp);
+            session->done = frame.GetDoneBit() && CanTsUtils::IsBitmapSet(frame.data_, session->blocks);
+            session->phase = Phase::kData;
+        }
+        break;
+
+    case CanTsFrame::SetBlockFrameType::ABORT:
+        if ((session = FindFromClient(frame, 0, timestamp)))
+            SendRequest(*session, Phase::kAbort, timestamp);
+        break;
+
+    default:
+        counting_->invalid++;
+        break;
+    }
+}
+
+void BusAnalyzer::ProcessGetBlock(const CanTsFrame& frame, uint64_t timestamp)
+{
+    uint8_t bits = frame.GetBlockCmdBits();
+    Session* session = nullptr;
+
+    switch (frame.GetGBFrameType()) {
+    case CanTsFrame::GetBlockFrameType::REQUEST:
+        Request(frame, 0, timestamp).blocks = static_cast<uint8_t>(bits + 1);
+        break;
+
+    case CanTsFrame::GetBlockFrameType::ACK:
+        if ((session = FindFromNode(frame, 0, timestamp))) {
+            Answer(*session, timestamp);
+
+            if (session->phase == Phase::kAbort)
+                End(*session, session->done ? Outcome::kCompleted : Outcome::kAborted);
+            else
+                session->phase = Phase::kData;
+        }
+        break;
+
+    case CanTsFrame::GetBlockFrameType::NACK:
+        if ((session = FindFromNode(frame, 0, timestamp))) {
+            Answer(*session, timestamp);
+            session->nacks++;
+            session->nacked = true;
+
+            if (session->phase == Phase::kAbort)
+                End(*session, Outcome::kNacked);
+        }
+        break;
+
+    case CanTsFrame::GetBlockFrameType::START:
+        if ((session = FindFromClient(frame, 0, timestamp)))
+            SendRequest(*session, Phase::kData, timestamp);
+        break;
+
+    case CanTsFrame::GetBlockFrameType::TRANSFER:
+        // First data frame answers start.
+        if ((session = FindFromNode(frame, 0, timestamp))) {
+            if (session->waiting)
+                Answer(*session, timestamp);
+
+            Data(*session, bits);
+            session->done = (session->seen == BlockMask(session->blocks));
+        }
+        break;
+
+    case CanTsFrame::GetBlockFrameType::ABORT:
+        if ((session = FindFromClient(frame, 0, timestamp)))
+            SendRequest(*session, Phase::kAbort, timestamp);
+        break;
+
+    default:
+        counting_->invalid++;
+        break;
+    }
+}
+
+BusAnalyzer::Session& BusAnalyzer::Request(const CanTsFrame& frame, uint8_t channel, uint64_t timestamp)
+{
+    uint32_t key = SessionKey(frame.type_, frame.GetFromAddress(), frame.GetToAddress(), channel);
+    Session* session = Find(key, timestamp);
+
+    // Request after the previous one was answered starts a new transfer.
+    if (session && (session->phase != Phase::kRequest)) {
+        End(*session, Outcome::kSuperseded);
+        session = nullptr;
+    }
+
+    if (!session) {
+        Session started;
+        started.type = frame.type_;
+        started.client = frame.GetFromAddress();
+        started.node = frame.GetToAddress();
+        started.channel = channel;
+        started.start = timestamp;
+        started.counted = InWindow(timestamp);
+        session = &sessions_.emplace(key, started).first->second;
+
+        if (session->counted)
+            open_counted_++;
+    }
+
+    session->frames++;
+    session->end = timestamp;
+    SendRequest(*session, Phase::kRequest, timestamp);
+    return *session;
+}
+
+BusAnalyzer::Session* BusAnalyzer::FindFromClient(const CanTsFrame& frame, uint8_t channel, uint64_t timestamp)
+{
+    Session* session = Find(SessionKey(frame.type_, frame.GetFromAddress(), frame.GetToAddress(), channel), timestamp);
+
+    if (!session) {
+        counting_->unmatched++;
+        return nullptr;
+    }
+
+    session->frames++;
+    session->end = timestamp;
+    return session;
+}
+
+BusAnalyzer::Session* BusAnalyzer::FindFromNode(const CanTsFrame& frame, uint8_t channel, uint64_t timestamp)
+{
+    Session* session = Find(SessionKey(frame.type_, frame.GetToAddress(), frame.GetFromAddress(), channel), timestamp);
+
+    if (!session) {
+        counting_->unmatched++;
+        return nullptr;
+    }
+
+    session->frames++;
+    session->end = timestamp;
+    return session;
+}
+
+void BusAnalyzer::SendRequest(Session& session, Phase phase, uint64_t timestamp)
+{
+    // Unanswered or NACKed request sent again is a retry, get block start is also retried after partial data.
+    if ((session.phase == phase) && (session.waiting || session.nacked || ((phase == Phase::kData) && session.seen)))
+        session.retransmissions++;
+
+    session.phase = phase;
+    session.waiting = true;
+    session.nacked = false;
+    session.request = timestamp;
+}
+
+void BusAnalyzer::Answer(Session& session, uint64_t timestamp)
+{
+    if (!session.waiting)
+        return;
+
+    uint64_t latency = timestamp - std::min(timestamp, session.request);
+    session.waiting = false;
+
+    if (!session.latency)
+        session.latency = latency;
+
+    if (session.counted)
+        Record(stats_[PairKey(session.type, session.client, session.node)].latency, latency / 1000);
+}
+
+void BusAnalyzer::Data(Session& session, uint8_t sequence)
+{
+    if (sequence >= session.blocks) {
+        counting_->invalid++;
+        return;
+    }
+
+    uint64_t bit = 1ULL << sequence;
+
+    if (session.seen & bit)
+        session.retransmissions++;
+
+    session.seen |= bit;
+}
+
+void BusAnalyzer::End(const Session& session, Outcome outcome)
+{
+    Session ended = session;
+    ended.outcome = outcome;
+    sessions_.erase(SessionKey(ended.type, ended.client, ended.node, ended.channel));
+
+    if (!ended.counted)
+        return;
+
+    open_counted_--;
+    stats_[PairKey(ended.type, ended.client, ended.node)].Add(ended);
+
+    if (handler_)
+        handler_(ended);
+}
+
+} // namespace sky
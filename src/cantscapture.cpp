@@ -0,0 +1,419 @@
+/* See the file "LICENSE.txt" for the full license governing this code. */
+
+#include "cantscapture.h"
+#include <QDebug>
+#include <QFileInfo>
+#include <QLoggingCategory>
+#include <QSaveFile>
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include "cantstrace.h"
+
+Q_LOGGING_CATEGORY(capture, "sky::Capture")
+
+namespace sky
+{
+
+namespace
+{
+
+constexpr char kSegmentMagic[8] = {'S', 'K', 'Y', 'C', 'A', 'P', 'T', 'R'};
+constexpr char kIndexMagic[8] = {'S', 'K', 'Y', 'C', 'A', 'P', 'I', 'X'};
+constexpr uint32_t kVersion = 1;
+
+//! Header of capture index, followed by CaptureSegment entries.
+struct IndexHeader {
+    char magic[8]; //!< kIndexMagic.
+    uint32_t version; //!< kVersion.
+    uint32_t entry_size; //!< sizeof(CaptureSegment).
+    uint32_t count; //!< Number of entries.
+    uint32_t reserved; //!< Reserved, 0.
+};
+
+//! Returns offset between system clock (Unix epoch) and trace clock in nanoseconds.
+int64_t EpochOffset()
+{
+    auto now = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                   std::chrono::system_clock::now().time_since_epoch()).count();
+    return static_cast<int64_t>(now) - static_cast<int64_t>(Trace::Now());
+}
+
+} // namespace
+
+//! Header at the start of each segment file, followed by records.
+struct CaptureWriter::SegmentHeader {
+    char magic[8]; //!< kSegmentMagic.
+    uint32_t version; //!< kVersion.
+    uint32_t record_size; //!< sizeof(CaptureRecord).
+    uint32_t sequence; //!< Segment number.
+    uint32_t reserved; //!< Reserved, 0.
+    int64_t epoch_offset; //!< Added to time stamps gives nanoseconds since Unix epoch.
+    uint64_t capacity; //!< Number of preallocated records.
+    uint64_t count; //!< Number of complete records.
+    uint64_t first_timestamp; //!< Time stamp of first record.
+    uint64_t last_timestamp; //!< Time stamp of last record.
+};
+
+CaptureRecord CaptureRecord::FromCanFrame(const CanFrame& frame, uint8_t bus, CaptureDirection direction, uint64_t timestamp)
+{
+    CaptureRecord record;
+    record.timestamp = timestamp;
+    record.id = frame.id;
+    record.bus = bus;
+    record.direction = static_cast<uint8_t>(direction);
+    record.flags = static_cast<uint8_t>((frame.extid ? kExtId : 0) | (frame.rtr ? kRtr : 0));
+    record.length = static_cast<uint8_t>(std::min<size_t>(frame.data.size(), sizeof(record.data)));
+
+    if (record.length)
+        std::memcpy(record.data, frame.data.data(), record.length);
+
+    return record;
+}
+
+CanFrame CaptureRecord::ToCanFrame() const
+{
+    CanFrame frame;
+    frame.id = id;
+    frame.extid = (flags & kExtId) != 0;
+    frame.rtr = (flags & kRtr) != 0;
+    frame.data.assign(data, data + std::min<size_t>(length, sizeof(data)));
+    return frame;
+}
+
+CaptureWriter::~CaptureWriter()
+{
+    Close();
+}
+
+bool CaptureWriter::Open(const QString& path, const Settings& settings)
+{
+    Close();
+
+    path_ = path;
+    settings_ = settings;
+    settings_.segment_records = std::max<uint64_t>(settings_.segment_records, 1);
+    record_count_ = 0;
+
+    // Segments of previous runs are kept, segment left open by a crash is listed with its final count.
+    std::vector<CaptureSegment> previous;
+    segments_.clear();
+
+    if (CaptureReader::ReadIndex(path_, previous)) {
+        for (auto segment : previous) {
+            CaptureReader reader;
+
+            if (!reader.Open(SegmentPath(path_, segment.sequence)))
+                continue;
+
+            segment.count = reader.GetCount();
+            if (segment.count) {
+                segment.first_timestamp = reader.GetRecords()[0].timestamp;
+                segment.last_timestamp = reader.GetRecords()[segment.count - 1].timestamp;
+            }
+
+            segments_.push_back(segment);
+        }
+
+        next_sequence_ = previous.empty() ? 0 : (previous.back().sequence + 1);
+    } else {
+        next_sequence_ = 0;
+    }
+
+    return OpenSegment();
+}
+
+void CaptureWriter::Close()
+{
+    if (!map_)
+        return;
+
+    CloseSegment();
+    WriteIndex();
+    qCDebug(capture) << "Closed" << path_ << "records =" << record_count_;
+}
+
+bool CaptureWriter::IsOpen() const
+{
+    return map_ != nullptr;
+}
+
+bool CaptureWriter::Append(const CaptureRecord& record)
+{
+    if (!map_)
+        return false;
+
+    if (header_->count == header_->capacity) {
+        CloseSegment();
+
+        if (!OpenSegment())
+            return false;
+    }
+
+    uint64_t index = header_->count;
+    records_[index] = record;
+
+    if (!index)
+        header_->first_timestamp = record.timestamp;
+
+    header_->last_timestamp = record.timestamp;
+
+    // Count is published after the record, so it never covers a partially written record.
+    header_->count = index + 1;
+    record_count_++;
+    return true;
+}
+
+bool CaptureWriter::Append(const CanFrame& frame, uint8_t bus, CaptureDirection direction, uint64_t timestamp)
+{
+    return Append(CaptureRecord::FromCanFrame(frame, bus, direction, timestamp));
+}
+
+uint64_t CaptureWriter::GetRecordCount() const
+{
+    return record_count_;
+}
+
+QString CaptureWriter::SegmentPath(const QString& path, uint32_t sequence)
+{
+    return path + QString(".%1.cap").arg(sequence, 6, 10, QChar('0'));
+}
+
+QString CaptureWriter::IndexPath(const QString& path)
+{
+    return path + ".idx";
+}
+
+bool CaptureWriter::OpenSegment()
+{
+    static_assert(sizeof(SegmentHeader) == 64, "Segment header size is part of capture format");
+
+    uint32_t sequence = next_sequence_++;
+    qint64 size = static_cast<qint64>(sizeof(SegmentHeader) + settings_.segment_records * sizeof(CaptureRecord));
+
+    file_.setFileName(SegmentPath(path_, sequence));
+
+    if (!file_.open(QIODevice::ReadWrite | QIODevice::Truncate) || !file_.resize(size) ||
+        !(map_ = file_.map(0, size))) {
+        qCCritical(capture) << "Cannot create segment" << file_.fileName() << file_.errorString();
+        file_.close();
+        map_ = nullptr;
+        return false;
+    }
+
+    header_ = reinterpret_cast<SegmentHeader*>(map_);
+    records_ = reinterpret_cast<CaptureRecord*>(map_ + sizeof(SegmentHeader));
+
+    std::memset(header_, 0, sizeof(SegmentHeader));
+    std::memcpy(header_->magic, kSegmentMagic, sizeof(kSegmentMagic));
+    header_->version = kVersion;
+    header_->record_size = sizeof(CaptureRecord);
+    header_->sequence = sequence;
+    header_->epoch_offset = EpochOffset();
+    header_->capacity = settings_.segment_records;
+
+    CaptureSegment segment;
+    segment.sequence = sequence;
+    segments_.push_back(segment);
+
+    while (settings_.max_segments && (segments_.size() > settings_.max_segments)) {
+        QFile::remove(SegmentPath(path_, segments_.front().sequence));
+        segments_.pop_front();
+    }
+
+    WriteIndex();
+    qCDebug(capture) << "Opened segment" << file_.fileName();
+    return true;
+}
+
+void CaptureWriter::CloseSegment()
+{
+    CaptureSegment& segment = segments_.back();
+    segment.count = header_->count;
+    segment.first_timestamp = header_->first_timestamp;
+    segment.last_timestamp = header_->last_timestamp;
+
+    qint64 size = static_cast<qint64>(sizeof(SegmentHeader) + segment.count * sizeof(CaptureRecord));
+
+    file_.unmap(map_);
+    map_ = nullptr;
+    header_ = nullptr;
+    records_ = nullptr;
+
+    if (!file_.resize(size))
+        qCWarning(capture) << "Cannot truncate segment" << file_.fileName();
+
+    file_.close();
+}
+
+bool CaptureWriter::WriteIndex() const
+{
+    IndexHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, kIndexMagic, sizeof(kIndexMagic));
+    header.version = kVersion;
+    header.entry_size = sizeof(CaptureSegment);
+    header.count = static_cast<uint32_t>(segments_.size());
+
+    QByteArray data(reinterpret_cast<const char*>(&header), sizeof(header));
+
+    for (const auto& segment : segments_)
+        data.append(reinterpret_cast<const char*>(&segment), sizeof(segment));
+
+    // Written to temporary file which atomically replaces the index, so readers never see partial or missing index.
+    QString path = IndexPath(path_);
+    QSaveFile file(path);
+
+    if (!file.open(QIODevice::WriteOnly)) {
+        qCCritical(capture) << "Cannot open" << path;
+        return false;
+    }
+
+    return (file.write(data) == data.size()) && file.commit();
+}
+
+CaptureReader::~CaptureReader()
+{
+    Close();
+}
+
+bool CaptureReader::Open(const QString& path)
+{
+    Close();
+
+    using SegmentHeader = CaptureWriter::SegmentHeader;
+
+    file_.setFileName(path);
+
+    if (!file_.open(QIODevice::ReadOnly))
+        return false;
+
+    qint64 size = file_.size();
+
+    if ((size < static_cast<qint64>(sizeof(SegmentHeader))) || !(map_ = file_.map(0, size))) {
+        file_.close();
+        return false;
+    }
+
+    const auto* header = reinterpret_cast<const SegmentHeader*>(map_);
+
+    if (std::memcmp(header->magic, kSegmentMagic, sizeof(kSegmentMagic)) || (header->version != kVersion) ||
+        (header->record_size != sizeof(CaptureRecord))) {
+        Close();
+        return false;
+    }
+
+    sequence_ = header->sequence;
+    epoch_offset_ = header->epoch_offset;
+    count_ = std::min<uint64_t>(header->count, static_cast<uint64_t>(size - sizeof(SegmentHeader)) / sizeof(CaptureRecord));
+    return true;
+}
+
+void CaptureReader::Close()
+{
+    if (map_)
+        file_.unmap(map_);
+
+    map_ = nullptr;
+    count_ = 0;
+    file_.close();
+}
+
+uint32_t CaptureReader::GetSequence() const
+{
+    return sequence_;
+}
+
+int64_t CaptureReader::GetEpochOffset() const
+{
+    return epoch_offset_;
+}
+
+uint64_t CaptureReader::GetCount() const
+{
+    return count_;
+}
+
+const CaptureRecord* CaptureReader::GetRecords() const
+{
+    return map_ ? reinterpret_cast<const CaptureRecord*>(map_ + sizeof(CaptureWriter::SegmentHeader)) : nullptr;
+}
+
+bool CaptureReader::ReadIndex(const QString& path, std::vector<CaptureSegment>& segments)
+{
+    QFile file(CaptureWriter::IndexPath(path));
+
+    if (!file.open(QIODevice::ReadOnly))
+        return false;
+
+    QByteArray data = file.readAll();
+    IndexHeader header;
+
+    if (data.size() < static_cast<int>(sizeof(header)))
+        return false;
+
+    std::memcpy(&header, data.constData(), sizeof(header));
+
+    if (std::memcmp(header.magic, kIndexMagic, sizeof(kIndexMagic)) || (header.version != kVersion) ||
+        (header.entry_size != sizeof(CaptureSegment)) ||
+        (static_cast<uint64_t>(data.size()) < sizeof(header) + static_cast<uint64_t>(header.count) * sizeof(CaptureSegment))) {
+        return false;
+    }
+
+    segments.resize(header.count);
+
+    if (header.count)
+        std::memcpy(segments.data(), data.constData() + sizeof(header), header.count * sizeof(CaptureSegment));
+
+    return true;
+}
+
+std::vector<QString> CaptureReader::SegmentFiles(const QString& path)
+{
+    std::vector<QString> files;
+    std::vector<CaptureSegment> segments;
+
+    if (ReadIndex(path, segments)) {
+        for (const auto& segment : segments) {
+            QString file = CaptureWriter::SegmentPath(path, segment.sequence);
+
+            if (QFileInfo::exists(file))
+                files.push_back(file);
+        }
+    } else if (QFileInfo::exists(path)) {
+        files.push_back(path);
+    }
+
+    return files;
+}
+
+CaptureRecorder::CaptureRecorder(CaptureWriter& writer, QObject* parent) :
+    QObject(parent),
+    writer_(writer)
+{
+}
+
+void CaptureRecorder::Attach(CanTransport& transport, uint8_t bus)
+{
+    // Frames are recorded in the thread of transport, before queued consumers see them. Received
+    // frames are recorded before acceptance filtering, so traffic between other nodes is included.
+    connect(&transport, &CanTransport::CanFrameReceivedUnfiltered, this, [this, bus](const CanFrame& frame) {
+        writer_.Append(frame, bus, CaptureDirection::kRx, frame.timing.read ? frame.timing.read : Trace::Now());
+    }, Qt::DirectConnection);
+
+    connect(&transport, &CanTransport::CanFrameSent, this, [this, bus](const CanFrame& frame, uint64_t) {
+        writer_.Append(frame, bus, CaptureDirection::kTx, frame.timing.written ? frame.timing.written : Trace::Now());
+    }, Qt::DirectConnection);
+
+    connect(&transport, &CanTransport::CanFrameError, this,
+            [this, bus](const CanFrame& frame, CanTransport::CanSendError, uint64_t) {
+        writer_.Append(frame, bus, CaptureDirection::kTxError, Trace::Now());
+    }, Qt::DirectConnection);
+}
+
+void CaptureRecorder::Detach(CanTransport& transport)
+{
+    disconnect(&transport, nullptr, this, nullptr);
+}
+
+} // namespace sky
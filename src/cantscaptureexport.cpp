@@ -0,0 +1,330 @@
+/* See the file "LICENSE.txt" for the full license governing this code. */
+
+#include "cantscaptureexport.h"
+#include "cantstraceexport.h"
+#include <algorithm>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <string>
+
+namespace sky
+{
+
+namespace
+{
+
+constexpr uint32_t kSectionHeaderBlock = 0x0A0D0D0A;
+constexpr uint32_t kInterfaceBlock = 0x00000001;
+constexpr uint32_t kEnhancedPacketBlock = 0x00000006;
+constexpr uint32_t kByteOrderMagic = 0x1A2B3C4D;
+constexpr uint16_t kLinkTypeCanSocketCan = 227;
+
+constexpr uint16_t kOptionEnd = 0;
+constexpr uint16_t kOptionIfName = 2;
+constexpr uint16_t kOptionIfTsResol = 9;
+constexpr uint16_t kOptionEpbFlags = 2;
+
+constexpr uint32_t kCanEffFlag = 0x80000000; //!< SocketCAN extended frame flag.
+constexpr uint32_t kCanRtrFlag = 0x40000000; //!< SocketCAN remote frame flag.
+
+constexpr uint32_t kBusTrack = 1000; //!< Timeline track of all frames, node tracks use node address.
+
+//! Returns nanoseconds \a ns as microseconds text.
+std::string Micros(uint64_t ns)
+{
+    char text[32];
+    std::snprintf(text, sizeof(text), "%" PRIu64 ".%03" PRIu64, ns / 1000, ns % 1000);
+    return text;
+}
+
+//! Appends \a value to \a block in host byte order (pcapng section byte order).
+template <typename T>
+void Put(std::string& block, T value)
+{
+    block.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+//! Appends pcapng option \a code with \a value padded to 32 bits.
+void PutOption(std::string& block, uint16_t code, const void* value, uint16_t length)
+{
+    Put(block, code);
+    Put(block, length);
+
+    if (length) {
+        block.append(static_cast<const char*>(value), length);
+        block.append((4 - length % 4) % 4, '\0');
+    }
+}
+
+//! Writes pcapng block of \a type with \a body (multiple of 32 bits) to \a out.
+void WriteBlock(std::ostream& out, uint32_t type, const std::string& body)
+{
+    auto length = static_cast<uint32_t>(body.size() + 12);
+    out.write(reinterpret_cast<const char*>(&type), sizeof(type));
+    out.write(reinterpret_cast<const char*>(&length), sizeof(length));
+    out.write(body.data(), static_cast<std::streamsize>(body.size()));
+    out.write(reinterpret_cast<const char*>(&length), sizeof(length));
+}
+
+} // namespace
+
+CaptureExport::CaptureExport(std::ostream& out, Format format) :
+    out_(out),
+    format_(format)
+{
+}
+
+void CaptureExport::Write(const CaptureRecord& record, int64_t epoch_offset)
+{
+    if (format_ == Format::kChrome) {
+        WriteChrome(record, epoch_offset);
+        return;
+    }
+
+    if (record.direction == static_cast<uint8_t>(CaptureDirection::kTxError))
+        return;
+
+    if (format_ == Format::kPcapng)
+        WritePacket(record, epoch_offset);
+    else
+        WriteCandump(record, epoch_offset);
+}
+
+void CaptureExport::Close()
+{
+    if (format_ != Format::kChrome)
+        return;
+
+    if (!header_written_) {
+        out_ << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+        header_written_ = true;
+    }
+
+    for (auto& analyzer : analyzers_)
+        analyzer.second->Finish();
+
+    std::set<uint8_t> processes;
+
+    for (const auto& track : tracks_) {
+        uint32_t pid = track.first + 1u;
+        char name[32];
+
+        if (processes.insert(track.first).second) {
+            std::snprintf(name, sizeof(name), "CAN bus %u", track.first);
+            NextEvent() << "{\"ph\":\"M\",\"name\":\"process_name\",\"pid\":" << pid << ",\"args\":{\"name\":\"" << name << "\"}}";
+        }
+
+        if (track.second == kBusTrack)
+            std::snprintf(name, sizeof(name), "Frames");
+        else
+            std::snprintf(name, sizeof(name), "Node 0x%02X", track.second);
+
+        // Frames are listed above nodes.
+        NextEvent() << "{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":" << pid << ",\"tid\":" << track.second
+                    << ",\"args\":{\"name\":\"" << name << "\"}},\n"
+                    << "{\"ph\":\"M\",\"name\":\"thread_sort_index\",\"pid\":" << pid << ",\"tid\":" << track.second
+                    << ",\"args\":{\"sort_index\":" << ((track.second == kBusTrack) ? 0 : track.second + 1) << "}}";
+    }
+
+    out_ << "\n]}\n";
+}
+
+bool CaptureExport::IsGood() const
+{
+    return static_cast<bool>(out_);
+}
+
+bool CaptureExport::Export(const QString& path, const QString& output, Format format)
+{
+    std::vector<QString> files = CaptureReader::SegmentFiles(path);
+
+    if (files.empty())
+        return false;
+
+    std::ofstream out(output.toStdString(), std::ios::binary | std::ios::trunc);
+    CaptureExport capture_export(out, format);
+
+    for (const auto& file : files) {
+        CaptureReader reader;
+
+        if (!reader.Open(file))
+            return false;
+
+        const CaptureRecord* records = reader.GetRecords();
+
+        for (uint64_t i = 0; i < reader.GetCount(); i++)
+            capture_export.Write(records[i], reader.GetEpochOffset());
+    }
+
+    capture_export.Close();
+    return capture_export.IsGood();
+}
+
+void CaptureExport::WriteSectionHeader()
+{
+    std::string body;
+    Put(body, kByteOrderMagic);
+    Put(body, static_cast<uint16_t>(1)); // major version
+    Put(body, static_cast<uint16_t>(0)); // minor version
+    Put(body, static_cast<int64_t>(-1)); // section length not specified
+
+    WriteBlock(out_, kSectionHeaderBlock, body);
+    header_written_ = true;
+}
+
+void CaptureExport::WriteInterface(uint8_t bus)
+{
+    std::string name = "can" + std::to_string(bus);
+    uint8_t resolution = 9; // nanoseconds
+
+    std::string body;
+    Put(body, kLinkTypeCanSocketCan);
+    Put(body, static_cast<uint16_t>(0)); // reserved
+    Put(body, static_cast<uint32_t>(16)); // snap length (struct can_frame)
+    PutOption(body, kOptionIfName, name.data(), static_cast<uint16_t>(name.size()));
+    PutOption(body, kOptionIfTsResol, &resolution, sizeof(resolution));
+    PutOption(body, kOptionEnd, nullptr, 0);
+
+    WriteBlock(out_, kInterfaceBlock, body);
+
+    auto id = static_cast<uint32_t>(interfaces_.size());
+    interfaces_[bus] = id;
+}
+
+void CaptureExport::WritePacket(const CaptureRecord& record, int64_t epoch_offset)
+{
+    if (!header_written_)
+        WriteSectionHeader();
+
+    if (!interfaces_.count(record.bus))
+        WriteInterface(record.bus);
+
+    auto timestamp = static_cast<uint64_t>(static_cast<int64_t>(record.timestamp) + epoch_offset);
+    uint8_t length = std::min<uint8_t>(record.length, sizeof(record.data));
+
+    // struct can_frame with identifier in network byte order.
+    uint32_t can_id = record.id | ((record.flags & CaptureRecord::kExtId) ? kCanEffFlag : 0) |
+                      ((record.flags & CaptureRecord::kRtr) ? kCanRtrFlag : 0);
+    uint8_t packet[16] = {static_cast<uint8_t>(can_id >> 24), static_cast<uint8_t>(can_id >> 16),
+                          static_cast<uint8_t>(can_id >> 8), static_cast<uint8_t>(can_id), length};
+    std::memcpy(packet + 8, record.data, length);
+
+    // Direction: 1 - inbound, 2 - outbound.
+    uint32_t flags = (record.direction == static_cast<uint8_t>(CaptureDirection::kRx)) ? 1 : 2;
+    auto captured = static_cast<uint32_t>(8 + length);
+
+    std::string body;
+    Put(body, interfaces_[record.bus]);
+    Put(body, static_cast<uint32_t>(timestamp >> 32));
+    Put(body, static_cast<uint32_t>(timestamp));
+    Put(body, captured);
+    Put(body, captured);
+    body.append(reinterpret_cast<const char*>(packet), captured);
+    body.append((4 - captured % 4) % 4, '\0');
+    PutOption(body, kOptionEpbFlags, &flags, sizeof(flags));
+    PutOption(body, kOptionEnd, nullptr, 0);
+
+    WriteBlock(out_, kEnhancedPacketBlock, body);
+}
+
+void CaptureExport::WriteCandump(const CaptureRecord& record, int64_t epoch_offset)
+{
+    auto timestamp = static_cast<uint64_t>(static_cast<int64_t>(record.timestamp) + epoch_offset);
+    char line[64];
+    int n = std::snprintf(line, sizeof(line), "(%" PRIu64 ".%06" PRIu64 ") can%u ",
+                          timestamp / 1000000000, (timestamp % 1000000000) / 1000, record.bus);
+
+    if (record.flags & CaptureRecord::kExtId)
+        n += std::snprintf(line + n, sizeof(line) - n, "%08X#", record.id & 0x1FFFFFFF);
+    else
+        n += std::snprintf(line + n, sizeof(line) - n, "%03X#", record.id & 0x7FF);
+
+    if (record.flags & CaptureRecord::kRtr) {
+        n += std::snprintf(line + n, sizeof(line) - n, "R");
+    } else {
+        for (uint8_t i = 0; i < record.length && i < sizeof(record.data); i++)
+            n += std::snprintf(line + n, sizeof(line) - n, "%02X", record.data[i]);
+    }
+
+    out_ << line << '\n';
+}
+
+void CaptureExport::WriteChrome(const CaptureRecord& record, int64_t epoch_offset)
+{
+    // Epoch time keeps segments recorded by different runs in order.
+    auto timestamp = static_cast<uint64_t>(static_cast<int64_t>(record.timestamp) + epoch_offset);
+
+    if (!header_written_) {
+        out_ << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+        header_written_ = true;
+        t0_ = timestamp;
+    }
+
+    bool error = (record.direction == static_cast<uint8_t>(CaptureDirection::kTxError));
+    bool cants = (record.flags & CaptureRecord::kExtId) && !(record.flags & CaptureRecord::kRtr);
+    uint8_t length = std::min<uint8_t>(record.length, sizeof(record.data));
+    char text[96];
+
+    if (cants)
+        std::snprintf(text, sizeof(text), "%s", ChromeTraceExport::FrameName((record.id >> 18) & 0x07, record.id & 0x3FF).c_str());
+    else
+        std::snprintf(text, sizeof(text), "CAN 0x%X%s", record.id, (record.flags & CaptureRecord::kRtr) ? " RTR" : "");
+
+    std::string name = std::string(text) + (error ? " (error)" : "");
+    std::snprintf(text, sizeof(text), ",\"s\":\"t\",\"args\":{\"id\":%u,\"direction\":\"%s\",\"data\":\"", record.id,
+                  (record.direction == static_cast<uint8_t>(CaptureDirection::kRx)) ? "rx" : error ? "tx error" : "tx");
+
+    std::ostream& event = BeginEvent('i', name, record.bus, kBusTrack, timestamp) << text;
+    for (uint8_t i = 0; i < length; i++) {
+        std::snprintf(text, sizeof(text), "%02x", record.data[i]);
+        event << text;
+    }
+    event << "\"}}";
+
+    std::unique_ptr<BusAnalyzer>& analyzer = analyzers_[record.bus];
+
+    if (!analyzer) {
+        analyzer.reset(new BusAnalyzer);
+        uint8_t bus = record.bus;
+        analyzer->SetSessionHandler([this, bus](const BusAnalyzer::Session& session) { WriteSession(bus, session); });
+    }
+
+    CaptureRecord stamped = record;
+    stamped.timestamp = timestamp;
+    analyzer->Process(stamped);
+}
+
+void CaptureExport::WriteSession(uint8_t bus, const BusAnalyzer::Session& session)
+{
+    char text[96];
+    std::snprintf(text, sizeof(text), "%s 0x%02X", BusAnalyzer::TypeName(session.type), session.client);
+
+    BeginEvent('X', text, bus, session.node, session.start)
+        << ",\"dur\":" << Micros(session.end - std::min(session.end, session.start))
+        << ",\"args\":{\"client\":" << static_cast<unsigned>(session.client)
+        << ",\"channel\":" << static_cast<unsigned>(session.channel)
+        << ",\"outcome\":\"" << BusAnalyzer::OutcomeName(session.outcome) << "\""
+        << ",\"frames\":" << session.frames
+        << ",\"retransmissions\":" << session.retransmissions
+        << ",\"nacks\":" << session.nacks
+        << ",\"latency_us\":" << Micros(session.latency) << "}}";
+}
+
+std::ostream& CaptureExport::NextEvent()
+{
+    out_ << (event_written_ ? ",\n" : "\n");
+    event_written_ = true;
+    return out_;
+}
+
+std::ostream& CaptureExport::BeginEvent(char phase, const std::string& name, uint8_t bus, uint32_t track, uint64_t timestamp)
+{
+    tracks_.insert({bus, track});
+    NextEvent() << "{\"ph\":\"" << phase << "\",\"name\":\"" << name << "\",\"pid\":" << bus + 1u << ",\"tid\":" << track
+         << ",\"ts\":" << Micros((timestamp > t0_) ? (timestamp - t0_) : 0);
+    return out_;
+}
+
+} // namespace sky
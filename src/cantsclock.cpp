@@ -0,0 +1,182 @@
+/* See the file "LICENSE.txt" for the full license governing this code. */
+
+#include "cantsclock.h"
+#include <QElapsedTimer>
+#include <QTimer>
+#include <algorithm>
+
+namespace
+{
+
+//! Timer of system clock running in Qt event loop.
+class SystemTimer : public sky::ClockTimer {
+public:
+    SystemTimer(std::function<void()> callback, bool single_shot) {
+        timer_.setSingleShot(single_shot);
+
+        // Callback is queued, so it runs outside of timer event and is
+        // discarded if timer is destroyed before it is invoked.
+        QObject::connect(&timer_, &QTimer::timeout, &timer_, std::move(callback), Qt::QueuedConnection);
+    }
+
+    void Start(uint32_t interval_ms) override {
+        timer_.start(static_cast<int>(interval_ms));
+    }
+
+    void Stop() override {
+        timer_.stop();
+    }
+
+    bool IsActive() const override {
+        return timer_.isActive();
+    }
+
+private:
+    QTimer timer_;
+};
+
+//! Clock following wall-clock time.
+class SystemClock : public sky::Clock {
+public:
+    SystemClock() {
+        elapsed_.start();
+    }
+
+    int64_t Elapsed() const override {
+        return elapsed_.elapsed();
+    }
+
+    std::unique_ptr<sky::ClockTimer> CreateTimer(std::function<void()> callback, bool single_shot) override {
+        return std::unique_ptr<sky::ClockTimer>(new SystemTimer(std::move(callback), single_shot));
+    }
+
+private:
+    QElapsedTimer elapsed_;
+};
+
+} // namespace
+
+namespace sky {
+
+Clock& Clock::System()
+{
+    static SystemClock clock;
+    return clock;
+}
+
+//! Timer of virtual clock.
+class VirtualClock::Timer : public ClockTimer {
+public:
+    Timer(VirtualClock& clock, uint64_t id) : clock_(clock), id_(id) {}
+
+    ~Timer() override {
+        clock_.RemoveTimer(id_);
+    }
+
+    void Start(uint32_t interval_ms) override {
+        clock_.StartTimer(id_, static_cast<uint64_t>(interval_ms) * 1000000);
+    }
+
+    void Stop() override {
+        clock_.StopTimer(id_);
+    }
+
+    bool IsActive() const override {
+        return clock_.IsTimerActive(id_);
+    }
+
+private:
+    VirtualClock& clock_;
+    uint64_t id_;
+};
+
+int64_t VirtualClock::Elapsed() const
+{
+    return static_cast<int64_t>(now_ / 1000000);
+}
+
+std::unique_ptr<ClockTimer> VirtualClock::CreateTimer(std::function<void()> callback, bool single_shot)
+{
+    uint64_t id = ++next_id_;
+    Entry& entry = timers_[id];
+    entry.callback = std::move(callback);
+    entry.single_shot = single_shot;
+    return std::unique_ptr<ClockTimer>(new Timer(*this, id));
+}
+
+uint64_t VirtualClock::Now() const
+{
+    return now_;
+}
+
+void VirtualClock::Advance(uint64_t duration_ns)
+{
+    AdvanceTo(now_ + duration_ns);
+}
+
+void VirtualClock::AdvanceTo(uint64_t time_ns)
+{
+    while (!running_.empty() && (running_.begin()->first.first <= time_ns)) {
+        auto next = running_.begin();
+        uint64_t id = next->second;
+        Entry& entry = timers_[id];
+
+        now_ = std::max(now_, next->first.first);
+        running_.erase(next);
+        entry.active = false;
+
+        // Periodic timer with zero interval would never let time advance.
+        if (!entry.single_shot)
+            StartTimer(id, std::max<uint64_t>(entry.interval_ns, 1));
+
+        // Callback may destroy its timer, so it is invoked from a copy.
+        std::function<void()> callback = entry.callback;
+        callback();
+    }
+
+    now_ = std::max(now_, time_ns);
+}
+
+bool VirtualClock::NextDeadline(uint64_t& time_ns) const
+{
+    if (running_.empty())
+        return false;
+
+    time_ns = running_.begin()->first.first;
+    return true;
+}
+
+void VirtualClock::StartTimer(uint64_t id, uint64_t interval_ns)
+{
+    StopTimer(id);
+
+    Entry& entry = timers_[id];
+    entry.interval_ns = interval_ns;
+    entry.key = {now_ + interval_ns, ++starts_};
+    entry.active = true;
+    running_[entry.key] = id;
+}
+
+void VirtualClock::StopTimer(uint64_t id)
+{
+    auto it = timers_.find(id);
+
+    if ((it != timers_.end()) && it->second.active) {
+        running_.erase(it->second.key);
+        it->second.active = false;
+    }
+}
+
+bool VirtualClock::IsTimerActive(uint64_t id) const
+{
+    auto it = timers_.find(id);
+    return (it != timers_.end()) && it->second.active;
+}
+
+void VirtualClock::RemoveTimer(uint64_t id)
+{
+    StopTimer(id);
+    timers_.erase(id);
+}
+
+} // namespace sky
@@ -159,6 +159,14 @@ bool CanTsFrame::IsBroadcastAddress(uint8_t address)
             (address == static_cast<uint8_t>(CanTsFrame::Address::KEEP_ALIVE)));
 }
 
+void CanTsFrame::DecodeId(uint32_t id)
+{
+    command_ = static_cast<uint16_t>(id & 0x3FF);
+    fromAddress_ = static_cast<uint8_t>((id >> 10) & 0xFF);
+    type_ = static_cast<uint8_t>((id >> 18) & 0x07);
+    toAddress_ = static_cast<uint8_t>((id >> 21) & 0xFF);
+}
+
 QString CanTsFrame::ToQString() const
 {    
     return QString("%1 %2 %3 %4 %5")
@@ -0,0 +1,278 @@
+/* See the file "LICENSE.txt" for the full license governing this code. */
+
+#include "cantsmetrics.h"
+#include <QDebug>
+#include <QSaveFile>
+#include <QLoggingCategory>
+#include <algorithm>
+#include <cassert>
+#include <sstream>
+
+Q_LOGGING_CATEGORY(metrics, "sky::Metrics")
+
+namespace sky
+{
+
+namespace
+{
+
+std::string FormatLabels(const Metrics::Labels& labels, const std::string& extra = "")
+{
+    if (labels.empty() && extra.empty())
+        return "";
+
+    std::string text = "{";
+
+    for (const auto& label : labels) {
+        if (text.size() > 1)
+            text += ",";
+
+        text += label.first + "=\"";
+
+        // Escape label value as required by text format.
+        for (char c : label.second) {
+            if (c == '\\' || c == '"')
+                text += '\\';
+            if (c == '\n')
+                text += "\\n";
+            else
+                text += c;
+        }
+
+        text += "\"";
+    }
+
+    if (!extra.empty()) {
+        if (text.size() > 1)
+            text += ",";
+        text += extra;
+    }
+
+    return text + "}";
+}
+
+} // namespace
+
+uint64_t MetricHistogram::Snapshot::ValueAtQuantile(double q) const
+{
+    if (count == 0)
+        return 0;
+
+    auto rank = static_cast<uint64_t>(std::max(0.0, std::min(1.0, q)) * static_cast<double>(count - 1)) + 1;
+    uint64_t seen = 0;
+
+    for (size_t i = 0; i < buckets.size(); i++) {
+        seen += buckets[i];
+        if (seen >= rank)
+            return std::min(BucketUpperBound(i), max);
+    }
+
+    return max;
+}
+
+size_t MetricHistogram::BucketIndex(uint64_t value)
+{
+    if (value < kSubBuckets)
+        return static_cast<size_t>(value);
+
+    unsigned magnitude = 63;
+    while (!(value >> magnitude))
+        magnitude--;
+
+    unsigned shift = magnitude - kSubBucketBits;
+    uint64_t sub = (value >> shift) & (kSubBuckets - 1);
+    return static_cast<size_t>(kSubBuckets + shift * kSubBuckets + sub);
+}
+
+uint64_t MetricHistogram::BucketUpperBound(size_t index)
+{
+    if (index < kSubBuckets)
+        return index;
+
+    uint64_t shift = (index - kSubBuckets) / kSubBuckets;
+    uint64_t sub = (index - kSubBuckets) % kSubBuckets;
+    uint64_t upper = ((kSubBuckets + sub + 1) << shift) - 1;
+
+    // Upper bound of last bucket does not fit into 64 bits.
+    return (shift + kSubBucketBits >= 63 && sub == kSubBuckets - 1) ? UINT64_MAX : upper;
+}
+
+void MetricHistogram::Record(uint64_t value)
+{
+    buckets_[BucketIndex(value)].fetch_add(1, std::memory_order_relaxed);
+    count_.fetch_add(1, std::memory_order_relaxed);
+    sum_.fetch_add(value, std::memory_order_relaxed);
+
+    uint64_t current = max_.load(std::memory_order_relaxed);
+    while ((value > current) && !max_.compare_exchange_weak(current, value, std::memory_order_relaxed)) {}
+}
+
+MetricHistogram::Snapshot MetricHistogram::GetSnapshot() const
+{
+    Snapshot snapshot;
+    snapshot.buckets.resize(kBuckets);
+
+    // Count is taken from buckets, so quantiles are consistent with it.
+    for (size_t i = 0; i < kBuckets; i++) {
+        snapshot.buckets[i] = buckets_[i].load(std::memory_order_relaxed);
+        snapshot.count += snapshot.buckets[i];
+    }
+
+    snapshot.sum = sum_.load(std::memory_order_relaxed);
+    snapshot.max = max_.load(std::memory_order_relaxed);
+    return snapshot;
+}
+
+Metrics& Metrics::Instance()
+{
+    static Metrics instance;
+    return instance;
+}
+
+Metrics::Entry& Metrics::Find(const std::string& name, const Labels& labels, const std::string& help, Type type)
+{
+    auto it = std::find_if(entries_.begin(), entries_.end(), [&](const std::unique_ptr<Entry>& e) {
+        return (e->name == name) && (e->labels == labels);
+    });
+
+    if (it != entries_.end()) {
+        assert((*it)->type == type);
+        return **it;
+    }
+
+    std::unique_ptr<Entry> entry(new Entry);
+    entry->name = name;
+    entry->help = help;
+    entry->labels = labels;
+    entry->type = type;
+    entries_.push_back(std::move(entry));
+    return *entries_.back();
+}
+
+MetricCounter& Metrics::GetCounter(const std::string& name, const Labels& labels, const std::string& help)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    Entry& entry = Find(name, labels, help, Type::kCounter);
+
+    if (!entry.counter)
+        entry.counter.reset(new MetricCounter);
+
+    return *entry.counter;
+}
+
+MetricGauge& Metrics::GetGauge(const std::string& name, const Labels& labels, const std::string& help)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    Entry& entry = Find(name, labels, help, Type::kGauge);
+
+    if (!entry.gauge)
+        entry.gauge.reset(new MetricGauge);
+
+    return *entry.gauge;
+}
+
+MetricHistogram& Metrics::GetHistogram(const std::string& name, const Labels& labels, const std::string& help,
+                                       double scale)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    Entry& entry = Find(name, labels, help, Type::kHistogram);
+
+    if (!entry.histogram) {
+        entry.histogram.reset(new MetricHistogram);
+        entry.scale = scale;
+    }
+
+    return *entry.histogram;
+}
+
+std::vector<Metrics::Sample> Metrics::GetSnapshot() const
+{
+    std::vector<Sample> samples;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        samples.reserve(entries_.size());
+
+        for (const auto& entry : entries_) {
+            Sample sample;
+            sample.name = entry->name;
+            sample.help = entry->help;
+            sample.labels = entry->labels;
+            sample.type = entry->type;
+            sample.scale = entry->scale;
+
+            if (entry->counter)
+                sample.value = static_cast<int64_t>(entry->counter->Get());
+            else if (entry->gauge)
+                sample.value = entry->gauge->Get();
+            else if (entry->histogram)
+                sample.histogram = entry->histogram->GetSnapshot();
+
+            samples.push_back(std::move(sample));
+        }
+    }
+
+    std::stable_sort(samples.begin(), samples.end(), [](const Sample& a, const Sample& b) {
+        return a.name < b.name;
+    });
+
+    return samples;
+}
+
+std::string Metrics::ToPrometheus() const
+{
+    static const double quantiles[] = {0.5, 0.9, 0.99, 0.999};
+    std::ostringstream out;
+    std::string last_name;
+
+    for (const auto& sample : GetSnapshot()) {
+        if (sample.name != last_name) {
+            static const char* const types[] = {"counter", "gauge", "summary"};
+
+            if (!sample.help.empty())
+                out << "# HELP " << sample.name << " " << sample.help << "\n";
+
+            out << "# TYPE " << sample.name << " " << types[static_cast<int>(sample.type)] << "\n";
+            last_name = sample.name;
+        }
+
+        if (sample.type != Type::kHistogram) {
+            out << sample.name << FormatLabels(sample.labels) << " " << sample.value << "\n";
+            continue;
+        }
+
+        for (double q : quantiles) {
+            std::ostringstream quantile;
+            quantile << "quantile=\"" << q << "\"";
+            out << sample.name << FormatLabels(sample.labels, quantile.str()) << " "
+                << static_cast<double>(sample.histogram.ValueAtQuantile(q)) * sample.scale << "\n";
+        }
+
+        out << sample.name << "_sum" << FormatLabels(sample.labels) << " "
+            << static_cast<double>(sample.histogram.sum) * sample.scale << "\n";
+        out << sample.name << "_count" << FormatLabels(sample.labels) << " " << sample.histogram.count << "\n";
+    }
+
+    return out.str();
+}
+
+bool Metrics::WritePrometheus(QIODevice& device) const
+{
+    std::string text = ToPrometheus();
+    return device.write(text.data(), static_cast<qint64>(text.size())) == static_cast<qint64>(text.size());
+}
+
+bool Metrics::WritePrometheus(const QString& path) const
+{
+    // Written to temporary file which atomically replaces path, so scrapers never read partial or missing output.
+    QSaveFile file(path);
+
+    if (!file.open(QIODevice::WriteOnly)) {
+        qCCritical(metrics) << "Cannot open" << path;
+        return false;
+    }
+
+    return WritePrometheus(file) && file.commit();
+}
+
+} // namespace sky
@@ -0,0 +1,49 @@
+/* See the file "LICENSE.txt" for the full license governing this code. */
+
+#include "cantsmetricsserver.h"
+#include <QDebug>
+#include <QLocalServer>
+#include <QLocalSocket>
+#include <QLoggingCategory>
+#include "cantsmetrics.h"
+
+Q_LOGGING_CATEGORY(metrics_server, "sky::MetricsServer")
+
+namespace sky
+{
+
+MetricsServer::MetricsServer(QObject* parent) :
+    QObject(parent),
+    server_(new QLocalServer(this))
+{
+    connect(server_, &QLocalServer::newConnection, this, &MetricsServer::NewConnection);
+}
+
+bool MetricsServer::Listen(const QString& name)
+{
+    QLocalServer::removeServer(name);
+
+    if (!server_->listen(name)) {
+        qCCritical(metrics_server) << "Cannot listen on" << name << server_->errorString();
+        return false;
+    }
+
+    qCDebug(metrics_server) << "Serving metrics on" << server_->fullServerName();
+    return true;
+}
+
+void MetricsServer::Close()
+{
+    server_->close();
+}
+
+void MetricsServer::NewConnection()
+{
+    while (QLocalSocket* socket = server_->nextPendingConnection()) {
+        connect(socket, &QLocalSocket::disconnected, socket, &QObject::deleteLater);
+        Metrics::Instance().WritePrometheus(*socket);
+        socket->disconnectFromServer();
+    }
+}
+
+} // namespace sky
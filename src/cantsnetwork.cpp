@@ -0,0 +1,244 @@
+/* See the file "LICENSE.txt" for the full license governing this code. */
+
+#include "cantsnetwork.h"
+#include <QDebug>
+#include <QLoggingCategory>
+
+Q_LOGGING_CATEGORY(cants_net, "sky::CanTsNetwork")
+
+namespace sky
+{
+
+CanTsNetwork::CanTsNetwork(QObject* parent) :
+    QObject(parent)
+{
+}
+
+CanTsNetwork::~CanTsNetwork()
+{
+    for (auto& shard : shards_) {
+        // CAN TS stack owns serial ports and timers of its thread, so it is destroyed there.
+        QMetaObject::invokeMethod(shard->context, [&shard] () {
+            shard->cants->Stop();
+            delete shard->cants;
+            shard->cants = nullptr;
+        }, Qt::BlockingQueuedConnection);
+
+        shard->thread->quit();
+        shard->thread->wait();
+        delete shard->context;
+    }
+}
+
+int CanTsNetwork::AddNetwork()
+{
+    int network = static_cast<int>(shards_.size());
+    std::unique_ptr<Shard> shard(new Shard);
+
+    shard->thread.reset(new QThread);
+    shard->thread->setObjectName(QString("cants-net%1").arg(network));
+    shard->context = new QObject;
+    shard->context->moveToThread(shard->thread.get());
+    shard->thread->start();
+
+    // Objects created in shard thread (including CAN TS members) belong to it.
+    Shard* s = shard.get();
+    QMetaObject::invokeMethod(shard->context, [s] () {
+        s->cants = new CAN_TS;
+    }, Qt::BlockingQueuedConnection);
+
+    ConnectShard(network, shard->cants);
+    shards_.push_back(std::move(shard));
+
+    qCDebug(cants_net) << "Added network" << network;
+    return network;
+}
+
+int CanTsNetwork::GetNetworkCount() const
+{
+    return static_cast<int>(shards_.size());
+}
+
+bool CanTsNetwork::Invoke(int network, std::function<void(CAN_TS&)> call, std::function<void()> done)
+{
+    if ((network < 0) || (network >= GetNetworkCount())) {
+        qCCritical(cants_net) << "Invalid network" << network;
+        return false;
+    }
+
+    Shard* shard = shards_[static_cast<size_t>(network)].get();
+    auto run = [this, shard, call, done] () {
+        call(*shard->cants);
+
+        if (done)
+            QMetaObject::invokeMethod(this, done, Qt::QueuedConnection);
+    };
+
+    // Calls from handlers already run in shard thread and keep their order with the transfer.
+    if (QThread::currentThread() == shard->thread.get())
+        run();
+    else
+        QMetaObject::invokeMethod(shard->context, run, Qt::QueuedConnection);
+
+    return true;
+}
+
+bool CanTsNetwork::InvokeBlocking(int network, const std::function<void(CAN_TS&)>& call)
+{
+    if ((network < 0) || (network >= GetNetworkCount())) {
+        qCCritical(cants_net) << "Invalid network" << network;
+        return false;
+    }
+
+    Shard& shard = *shards_[static_cast<size_t>(network)];
+
+    // Calls from handlers already run in shard thread, blocking on it would deadlock.
+    if (QThread::currentThread() == shard.thread.get()) {
+        call(*shard.cants);
+    } else {
+        QMetaObject::invokeMethod(shard.context, [&shard, &call] () {
+            call(*shard.cants);
+        }, Qt::BlockingQueuedConnection);
+    }
+
+    return true;
+}
+
+bool CanTsNetwork::Start(int network, uint8_t address, uint32_t timeout, const CAN_TS::DriverSettings& driver)
+{
+    bool ok = false;
+    InvokeBlocking(network, [&] (CAN_TS& cants) { ok = cants.Start(address, timeout, driver); });
+
+    qCDebug(cants_net) << "Started network" << network << "ok =" << ok;
+    return ok;
+}
+
+void CanTsNetwork::Stop(int network)
+{
+    InvokeBlocking(network, [] (CAN_TS& cants) { cants.Stop(); });
+}
+
+void CanTsNetwork::StopAll()
+{
+    for (int network = 0; network < GetNetworkCount(); network++)
+        Stop(network);
+}
+
+bool CanTsNetwork::SendTC(int network, uint8_t address, uint8_t channel, const std::vector<uint8_t>& data,
+                          uint8_t retry_count, CAN_TS::SendTCHandler handler)
+{
+    return Invoke(network, [=] (CAN_TS& cants) {
+        if (!cants.SendTC(address, channel, data, retry_count, handler) && handler)
+            handler(false, CAN_TS::SendTCError::kSendRequestFailed);
+    });
+}
+
+bool CanTsNetwork::ReceiveTM(int network, uint8_t address, uint8_t channel, uint8_t retry_count,
+                             uint32_t max_age_ms, CAN_TS::ReceiveTMHandler handler)
+{
+    return Invoke(network, [=] (CAN_TS& cants) {
+        if (!cants.ReceiveTM(address, channel, retry_count, max_age_ms, handler) && handler)
+            handler(false, std::vector<uint8_t>(), CAN_TS::ReceiveTMError::kSendRequestFailed);
+    });
+}
+
+bool CanTsNetwork::SendBlock(int network, uint8_t address, uint64_t start, const std::vector<uint8_t>& data,
+                             uint8_t retry_count, uint32_t report_delay_ms, uint8_t report_retry_count,
+                             CAN_TS::SendBlockHandler handler)
+{
+    return Invoke(network, [=] (CAN_TS& cants) {
+        if (!cants.SendBlock(address, start, data, retry_count, report_delay_ms, report_retry_count, handler) && handler)
+            handler(false, CAN_TS::SendBlockError::kSendRequestFailed);
+    });
+}
+
+bool CanTsNetwork::ReceiveBlock(int network, uint8_t to_address, uint64_t start_address, uint8_t length,
+                                uint8_t retry_count, uint8_t start_retry_count, CAN_TS::ReceiveBlockHandler handler)
+{
+    return Invoke(network, [=] (CAN_TS& cants) {
+        if (!cants.ReceiveBlock(to_address, start_address, length, retry_count, start_retry_count, handler) && handler)
+            handler(false, std::vector<uint8_t>(), CAN_TS::ReceiveBlockError::kSendRequestFailed);
+    });
+}
+
+bool CanTsNetwork::SendTimeSync(int network, uint64_t time)
+{
+    return Invoke(network, [network, time] (CAN_TS& cants) {
+        if (!cants.SendTimeSync(time))
+            qCWarning(cants_net) << "Time sync rejected on network" << network;
+    });
+}
+
+bool CanTsNetwork::SendUnsolicited(int network, uint8_t address, uint8_t channel, const std::vector<uint8_t>& data)
+{
+    return Invoke(network, [=] (CAN_TS& cants) {
+        if (!cants.SendUnsolicited(address, channel, data))
+            qCWarning(cants_net) << "Unsolicited telemetry rejected on network" << network << "address =" << address << "channel =" << channel;
+    });
+}
+
+void CanTsNetwork::CanBusSwitch(int network)
+{
+    Invoke(network, [] (CAN_TS& cants) { cants.CanBusSwitch(); });
+}
+
+void CanTsNetwork::ConnectShard(int network, CAN_TS* cants)
+{
+    // Lambdas have this object as context, so they are queued to its thread.
+    connect(cants, &CAN_TS::SendTCCompleted, this, [this, network] (uint8_t address, uint8_t channel) {
+        emit SendTCCompleted(network, address, channel);
+    }, Qt::QueuedConnection);
+    connect(cants, &CAN_TS::ReceiveTMCompleted, this, [this, network] (uint8_t address, uint8_t channel, const std::vector<uint8_t>& data) {
+        emit ReceiveTMCompleted(network, address, channel, data);
+    }, Qt::QueuedConnection);
+    connect(cants, &CAN_TS::SendBlockCompleted, this, [this, network] (uint8_t address) {
+        emit SendBlockCompleted(network, address);
+    }, Qt::QueuedConnection);
+    connect(cants, &CAN_TS::ReceiveBlockCompleted, this, [this, network] (uint8_t address, const std::vector<uint8_t>& data) {
+        emit ReceiveBlockCompleted(network, address, data);
+    }, Qt::QueuedConnection);
+    connect(cants, &CAN_TS::UnsolicitedReceived, this, [this, network] (uint8_t address, uint8_t channel, const std::vector<uint8_t>& data) {
+        emit UnsolicitedReceived(network, address, channel, data);
+    }, Qt::QueuedConnection);
+    connect(cants, &CAN_TS::KeepAliveReceivedNominal, this, [this, network] (uint8_t address, uint8_t channel, const std::vector<uint8_t>& data) {
+        emit KeepAliveReceivedNominal(network, address, channel, data);
+    }, Qt::QueuedConnection);
+    connect(cants, &CAN_TS::KeepAliveReceivedRedundant, this, [this, network] (uint8_t address, uint8_t channel, const std::vector<uint8_t>& data) {
+        emit KeepAliveReceivedRedundant(network, address, channel, data);
+    }, Qt::QueuedConnection);
+    connect(cants, &CAN_TS::BusSwitched, this, [this, network] (CAN_TS::CanBus bus) {
+        emit BusSwitched(network, bus);
+    }, Qt::QueuedConnection);
+    connect(cants, &CAN_TS::TransferTimed, this, [this, network] (uint8_t type, uint8_t address, CAN_TS::TransferTiming timing) {
+        emit TransferTimed(network, type, address, timing);
+    }, Qt::QueuedConnection);
+    connect(cants, &CAN_TS::SendTimeSyncCompleted, this, [this, network] () {
+        emit SendTimeSyncCompleted(network);
+    }, Qt::QueuedConnection);
+    connect(cants, &CAN_TS::TimeSyncReceived, this, [this, network] (uint8_t address, const std::vector<uint8_t>& time) {
+        emit TimeSyncReceived(network, address, time);
+    }, Qt::QueuedConnection);
+    connect(cants, &CAN_TS::SendUnsolicitedCompleted, this, [this, network] (uint8_t address, uint8_t channel) {
+        emit SendUnsolicitedCompleted(network, address, channel);
+    }, Qt::QueuedConnection);
+    connect(cants, &CAN_TS::SendTCFailed, this, [this, network] (uint8_t address, uint8_t channel, CAN_TS::SendTCError error) {
+        emit SendTCFailed(network, address, channel, error);
+    }, Qt::QueuedConnection);
+    connect(cants, &CAN_TS::ReceiveTMFailed, this, [this, network] (uint8_t address, uint8_t channel, CAN_TS::ReceiveTMError error) {
+        emit ReceiveTMFailed(network, address, channel, error);
+    }, Qt::QueuedConnection);
+    connect(cants, &CAN_TS::SendBlockFailed, this, [this, network] (uint8_t address, CAN_TS::SendBlockError error) {
+        emit SendBlockFailed(network, address, error);
+    }, Qt::QueuedConnection);
+    connect(cants, &CAN_TS::ReceiveBlockFailed, this, [this, network] (uint8_t address, CAN_TS::ReceiveBlockError error) {
+        emit ReceiveBlockFailed(network, address, error);
+    }, Qt::QueuedConnection);
+    connect(cants, &CAN_TS::SendTimeSyncFailed, this, [this, network] () {
+        emit SendTimeSyncFailed(network);
+    }, Qt::QueuedConnection);
+    connect(cants, &CAN_TS::SendUnsolicitedFailed, this, [this, network] (uint8_t address, uint8_t channel) {
+        emit SendUnsolicitedFailed(network, address, channel);
+    }, Qt::QueuedConnection);
+}
+
+} // namespace sky
@@ -0,0 +1,206 @@
+/* See the file "LICENSE.txt" for the full license governing this code. */
+
+#include "cantstrace.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <mutex>
+
+namespace sky
+{
+
+namespace
+{
+
+constexpr char kMagic[8] = {'S', 'K', 'Y', 'T', 'R', 'A', 'C', 'E'};
+constexpr uint32_t kVersion = 1;
+
+static_assert((Trace::kRingSize & (Trace::kRingSize - 1)) == 0, "Ring size must be power of two");
+
+//! Single writer ring of one thread.
+struct TraceRing {
+    uint32_t index = 0; //!< Thread index.
+    std::atomic<uint64_t> head{0}; //!< Number of records ever written.
+    std::array<TraceRecord, Trace::kRingSize> records; //!< Record storage.
+};
+
+//! Rings of all threads. Rings are never released, so records of finished threads remain available.
+struct TraceRegistry {
+    std::mutex mutex;
+    std::vector<std::unique_ptr<TraceRing>> rings;
+};
+
+TraceRegistry& Registry()
+{
+    static TraceRegistry registry;
+    return registry;
+}
+
+TraceRing& LocalRing()
+{
+    // Registration takes a lock once per thread, recording itself does not.
+    thread_local TraceRing* ring = nullptr;
+
+    if (!ring) {
+        TraceRegistry& registry = Registry();
+        std::lock_guard<std::mutex> lock(registry.mutex);
+        registry.rings.emplace_back(new TraceRing);
+        ring = registry.rings.back().get();
+        ring->index = static_cast<uint32_t>(registry.rings.size() - 1);
+    }
+
+    return *ring;
+}
+
+template <typename T>
+void WriteValue(std::ostream& out, const T& value)
+{
+    out.write(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+template <typename T>
+bool ReadValue(std::istream& in, T& value)
+{
+    return static_cast<bool>(in.read(reinterpret_cast<char*>(&value), sizeof(value)));
+}
+
+} // namespace
+
+std::atomic<bool> Trace::enabled_{false};
+
+void Trace::SetEnabled(bool enabled)
+{
+    enabled_.store(enabled, std::memory_order_relaxed);
+}
+
+uint64_t Trace::Now()
+{
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+void Trace::Record(TraceEvent event, uint8_t bus, uint32_t id, uint32_t arg, const uint8_t* data, size_t length)
+{
+    TraceRing& ring = LocalRing();
+    uint64_t head = ring.head.load(std::memory_order_relaxed);
+    TraceRecord& record = ring.records[head & (kRingSize - 1)];
+
+    record.timestamp = Now();
+    record.sequence = static_cast<uint32_t>(head);
+    record.id = id;
+    record.arg = arg;
+    record.event = static_cast<uint16_t>(event);
+    record.bus = bus;
+    record.length = static_cast<uint8_t>(std::min<size_t>(length, sizeof(record.data)));
+
+    if (data && record.length)
+        std::memcpy(record.data, data, record.length);
+
+    // Publish record to dumping thread.
+    ring.head.store(head + 1, std::memory_order_release);
+}
+
+void Trace::Snapshot(std::vector<TraceThread>& threads)
+{
+    TraceRegistry& registry = Registry();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+
+    threads.clear();
+
+    for (const auto& ring : registry.rings) {
+        TraceThread thread;
+        thread.index = ring->index;
+
+        uint64_t head = ring->head.load(std::memory_order_acquire);
+        uint64_t first = (head > kRingSize) ? (head - kRingSize) : 0;
+
+        for (uint64_t i = first; i < head; i++)
+            thread.records.push_back(ring->records[i & (kRingSize - 1)]);
+
+        // Records overwritten by writer while copying are not consistent, including the one in the slot of
+        // head_after, which writer may be filling (head is published after the record is written).
+        uint64_t head_after = ring->head.load(std::memory_order_acquire);
+        uint64_t valid_from = (head_after >= kRingSize) ? (head_after + 1 - kRingSize) : 0;
+
+        if (valid_from > first)
+            thread.records.erase(thread.records.begin(), thread.records.begin() +
+                                 static_cast<std::ptrdiff_t>(std::min<uint64_t>(valid_from - first, thread.records.size())));
+
+        threads.push_back(std::move(thread));
+    }
+}
+
+bool Trace::Dump(std::ostream& out)
+{
+    std::vector<TraceThread> threads;
+    Snapshot(threads);
+
+    out.write(kMagic, sizeof(kMagic));
+    WriteValue(out, kVersion);
+    WriteValue(out, static_cast<uint32_t>(sizeof(TraceRecord)));
+    WriteValue(out, static_cast<uint32_t>(threads.size()));
+
+    for (const auto& thread : threads) {
+        WriteValue(out, thread.index);
+        WriteValue(out, static_cast<uint32_t>(thread.records.size()));
+        out.write(reinterpret_cast<const char*>(thread.records.data()),
+                  static_cast<std::streamsize>(thread.records.size() * sizeof(TraceRecord)));
+    }
+
+    return static_cast<bool>(out);
+}
+
+bool Trace::Dump(const std::string& path)
+{
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    return out && Dump(out);
+}
+
+bool Trace::Load(std::istream& in, std::vector<TraceThread>& threads)
+{
+    char magic[sizeof(kMagic)];
+    uint32_t version = 0;
+    uint32_t record_size = 0;
+    uint32_t thread_count = 0;
+
+    if (!in.read(magic, sizeof(magic)) || std::memcmp(magic, kMagic, sizeof(kMagic)) ||
+        !ReadValue(in, version) || (version != kVersion) ||
+        !ReadValue(in, record_size) || (record_size != sizeof(TraceRecord)) ||
+        !ReadValue(in, thread_count)) {
+        return false;
+    }
+
+    threads.clear();
+
+    for (uint32_t t = 0; t < thread_count; t++) {
+        TraceThread thread;
+        uint32_t count = 0;
+
+        if (!ReadValue(in, thread.index) || !ReadValue(in, count) || (count > kRingSize))
+            return false;
+
+        thread.records.resize(count);
+        if (!in.read(reinterpret_cast<char*>(thread.records.data()), static_cast<std::streamsize>(count * sizeof(TraceRecord))))
+            return false;
+
+        threads.push_back(std::move(thread));
+    }
+
+    return true;
+}
+
+const char* Trace::EventName(uint16_t event)
+{
+    static const char* const names[] = {
+        "FrameSend", "FrameSent", "FrameSendError", "FrameReceived", "SerialRead",
+        "SerialWrite", "TransferStart", "TransferComplete", "TransferFail", "BusSwitch"
+    };
+
+    static_assert(sizeof(names) / sizeof(names[0]) == static_cast<size_t>(TraceEvent::kCount), "Missing event name");
+
+    return (event < static_cast<uint16_t>(TraceEvent::kCount)) ? names[event] : "Unknown";
+}
+
+} // namespace sky
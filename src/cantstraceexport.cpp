@@ -0,0 +1,241 @@
+/* See the file "LICENSE.txt" for the full license governing this code. */
+
+#include "cantstraceexport.h"
+#include <algorithm>
+#include <cinttypes>
+#include <cstdio>
+#include <deque>
+#include <fstream>
+#include <map>
+#include <set>
+#include <tuple>
+
+namespace sky
+{
+
+namespace
+{
+
+constexpr uint32_t kBusTrack = 1000; //!< Track id of bus 0 (bus 1 is next), node tracks use node address.
+
+const char* const kTypeNames[] = {"TIME SYNC", "UNSOLICITED", "TC", "TM", "SB", "GB"};
+
+//! Returns nanoseconds \a ns as microseconds text.
+std::string Micros(uint64_t ns)
+{
+    char text[32];
+    std::snprintf(text, sizeof(text), "%" PRIu64 ".%03" PRIu64, ns / 1000, ns % 1000);
+    return text;
+}
+
+//! Writes Chrome trace events, separating them with commas.
+class EventWriter {
+public:
+    EventWriter(std::ostream& out, uint64_t t0) : out_(out), t0_(t0) {}
+
+    //! Starts event of \a phase on track \a tid of process \a pid at \a timestamp, caller completes it.
+    std::ostream& Begin(char phase, const std::string& name, uint32_t pid, uint32_t tid, uint64_t timestamp) {
+        Separate();
+        out_ << "{\"ph\":\"" << phase << "\",\"name\":\"" << name << "\",\"pid\":" << pid << ",\"tid\":" << tid
+             << ",\"ts\":" << Micros((timestamp > t0_) ? (timestamp - t0_) : 0);
+        return out_;
+    }
+
+    //! Names process \a pid.
+    void ProcessName(uint32_t pid, const std::string& name) {
+        Separate();
+        out_ << "{\"ph\":\"M\",\"name\":\"process_name\",\"pid\":" << pid << ",\"args\":{\"name\":\"" << name << "\"}}";
+    }
+
+    //! Names track \a tid of process \a pid and sets its position.
+    void TrackName(uint32_t pid, uint32_t tid, const std::string& name, uint32_t sort_index) {
+        Separate();
+        out_ << "{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":" << pid << ",\"tid\":" << tid
+             << ",\"args\":{\"name\":\"" << name << "\"}},\n"
+             << "{\"ph\":\"M\",\"name\":\"thread_sort_index\",\"pid\":" << pid << ",\"tid\":" << tid
+             << ",\"args\":{\"sort_index\":" << sort_index << "}}";
+    }
+
+private:
+    std::ostream& out_;
+    uint64_t t0_;
+    bool first_ = true;
+
+    void Separate() {
+        out_ << (first_ ? "\n" : ",\n");
+        first_ = false;
+    }
+};
+
+//! Record with index of thread which wrote it.
+struct Entry {
+    uint32_t thread;
+    const TraceRecord* record;
+};
+
+//! Returns JSON args of frame \a r, record argument is named \a arg_name.
+std::string FrameArgs(const TraceRecord& r, const char* arg_name = "transfer")
+{
+    char text[128];
+    std::snprintf(text, sizeof(text), ",\"args\":{\"to\":%u,\"from\":%u,\"command\":%u,\"%s\":%u,\"data\":\"",
+                  (r.id >> 21) & 0xFF, (r.id >> 10) & 0xFF, r.id & 0x3FF, arg_name, r.arg);
+
+    std::string args = text;
+    for (uint8_t i = 0; i < r.length && i < sizeof(r.data); i++) {
+        std::snprintf(text, sizeof(text), "%02x", r.data[i]);
+        args += text;
+    }
+
+    return args + "\"}";
+}
+
+} // namespace
+
+std::string ChromeTraceExport::FrameName(uint8_t type, uint16_t command)
+{
+    static const char* const tc_tm[] = {"REQUEST", "ACK", "NACK", "3"};
+    static const char* const sb[] = {"REQUEST", "TRANSFER", "ACK", "ABORT", "NACK", "5", "STATUS", "REPORT"};
+    static const char* const gb[] = {"REQUEST", "1", "ACK", "ABORT", "NACK", "5", "START", "TRANSFER"};
+
+    std::string name = (type < sizeof(kTypeNames) / sizeof(kTypeNames[0])) ? kTypeNames[type] : "UNKNOWN";
+
+    switch (type) {
+    case 2: // Telecommand.
+    case 3: // Telemetry.
+        return name + " " + tc_tm[(command >> 8) & 3];
+    case 4: // Set block.
+        return name + " " + sb[(command >> 7) & 7];
+    case 5: // Get block.
+        return name + " " + gb[(command >> 7) & 7];
+    default:
+        return name;
+    }
+}
+
+bool ChromeTraceExport::Write(const std::vector<TraceThread>& threads, std::ostream& out)
+{
+    std::vector<Entry> entries;
+    for (const auto& thread : threads) {
+        for (const auto& record : thread.records)
+            entries.push_back({thread.index, &record});
+    }
+
+    std::stable_sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) {
+        return a.record->timestamp < b.record->timestamp;
+    });
+
+    uint64_t t0 = entries.empty() ? 0 : entries.front().record->timestamp;
+    EventWriter writer(out, t0);
+
+    // Frames passed to driver, waiting for transmission result: (thread, bus, id, transfer) -> start times.
+    std::map<std::tuple<uint32_t, uint8_t, uint32_t, uint32_t>, std::deque<uint64_t>> pending;
+    std::set<std::pair<uint32_t, uint32_t>> tracks;
+
+    out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+
+    for (const auto& entry : entries) {
+        const TraceRecord& r = *entry.record;
+        uint32_t pid = entry.thread + 1;
+        uint8_t type = (r.id >> 18) & 0x07;
+        uint8_t to = (r.id >> 21) & 0xFF;
+        uint8_t from = (r.id >> 10) & 0xFF;
+
+        switch (static_cast<TraceEvent>(r.event)) {
+        case TraceEvent::kFrameSend:
+            pending[std::make_tuple(entry.thread, r.bus, r.id, r.arg)].push_back(r.timestamp);
+            writer.Begin('i', FrameName(type, r.id & 0x3FF), pid, to, r.timestamp) << ",\"s\":\"t\"" << FrameArgs(r) << "}";
+            tracks.insert({pid, to});
+            break;
+
+        case TraceEvent::kFrameSent:
+        case TraceEvent::kFrameSendError: {
+            bool error = (static_cast<TraceEvent>(r.event) == TraceEvent::kFrameSendError);
+            auto it = pending.find(std::make_tuple(entry.thread, r.bus, r.id, r.arg));
+            uint64_t start = r.timestamp;
+
+            if (it != pending.end() && !it->second.empty()) {
+                start = it->second.front();
+                it->second.pop_front();
+            }
+
+            writer.Begin('X', FrameName(type, r.id & 0x3FF) + (error ? " (error)" : ""), pid, kBusTrack + r.bus, start)
+                << ",\"dur\":" << Micros(r.timestamp - start) << FrameArgs(r) << "}";
+            tracks.insert({pid, kBusTrack + r.bus});
+            break;
+        }
+
+        case TraceEvent::kFrameReceived:
+            writer.Begin('i', FrameName(type, r.id & 0x3FF), pid, kBusTrack + r.bus, r.timestamp) << ",\"s\":\"t\"" << FrameArgs(r, "nominal") << "}";
+            writer.Begin('i', FrameName(type, r.id & 0x3FF), pid, from, r.timestamp) << ",\"s\":\"t\"" << FrameArgs(r, "nominal") << "}";
+            tracks.insert({pid, kBusTrack + r.bus});
+            tracks.insert({pid, from});
+            break;
+
+        case TraceEvent::kTransferStart:
+        case TraceEvent::kTransferComplete:
+        case TraceEvent::kTransferFail: {
+            // Async span, so transfers of different types to the same node may overlap.
+            char phase = (static_cast<TraceEvent>(r.event) == TraceEvent::kTransferStart) ? 'b' : 'e';
+            std::string name = (type < sizeof(kTypeNames) / sizeof(kTypeNames[0])) ? kTypeNames[type] : "UNKNOWN";
+
+            std::ostream& event = writer.Begin(phase, name, pid, to, r.timestamp);
+            event << ",\"cat\":\"transfer\",\"id2\":{\"local\":\"" << r.arg << "\"}";
+
+            if (static_cast<TraceEvent>(r.event) == TraceEvent::kTransferFail)
+                event << ",\"args\":{\"result\":\"failed\",\"error\":" << static_cast<unsigned>(r.data[0]) << "}";
+            else if (phase == 'e')
+                event << ",\"args\":{\"result\":\"completed\"}";
+
+            event << "}";
+            tracks.insert({pid, to});
+            break;
+        }
+
+        case TraceEvent::kBusSwitch:
+            writer.Begin('i', "Bus switch", pid, kBusTrack + r.bus, r.timestamp)
+                << ",\"s\":\"p\",\"args\":{\"bus\":" << static_cast<unsigned>(r.bus) << "}}";
+            break;
+
+        default:
+            break;
+        }
+    }
+
+    // Frames without transmission result.
+    for (const auto& item : pending) {
+        for (uint64_t start : item.second) {
+            writer.Begin('i', "Frame without result", std::get<0>(item.first) + 1, kBusTrack + std::get<1>(item.first), start)
+                << ",\"s\":\"t\"}";
+        }
+    }
+
+    std::set<uint32_t> processes;
+    for (const auto& track : tracks) {
+        char name[32];
+
+        if (processes.insert(track.first).second) {
+            std::snprintf(name, sizeof(name), "CAN TS T%u", track.first - 1);
+            writer.ProcessName(track.first, name);
+        }
+
+        if (track.second >= kBusTrack)
+            std::snprintf(name, sizeof(name), "Bus %u", track.second - kBusTrack);
+        else
+            std::snprintf(name, sizeof(name), "Node 0x%02X", track.second);
+
+        // Buses are listed above nodes.
+        writer.TrackName(track.first, track.second, name,
+                         (track.second >= kBusTrack) ? (track.second - kBusTrack) : (track.second + 16));
+    }
+
+    out << "\n]}\n";
+    return static_cast<bool>(out);
+}
+
+bool ChromeTraceExport::Write(const std::vector<TraceThread>& threads, const std::string& path)
+{
+    std::ofstream out(path, std::ios::trunc);
+    return out && Write(threads, out);
+}
+
+} // namespace sky
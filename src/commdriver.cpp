@@ -1,8 +1,11 @@
 /* See the file "LICENSE.txt" for the full license governing this code. */
 
 #include "commdriver.h"
+#include "cantsprobes.h"
+#include "cantstrace.h"
 #include <QDebug>
 #include <QLoggingCategory>
+#include <algorithm>
 
 Q_LOGGING_CATEGORY(com, "sky::commdriver")
 
@@ -19,9 +22,9 @@ CommDriver::CommDriver()
     connect(&slip_, &SkySlip::FrameReceived,
             this, &CommDriver::SlipFrameReceived, Qt::QueuedConnection);
 
-    connect(&tmr, &QTimer::timeout, this, &CommDriver::WriteTimeout, Qt::QueuedConnection);
-    tmr.setInterval(kWriteTimeoutMs);
-    tmr.setSingleShot(true);
+    SetClock(Clock::System());
+
+    BindMetrics();
 }
 
 bool CommDriver::Open(const std::string& port_name, uint32_t baud)
@@ -42,19 +45,64 @@ bool CommDriver::Open(const std::string& port_name, uint32_t baud)
     serial_port_.setDataBits(QSerialPort::Data8);
     serial_port_.setFlowControl(QSerialPort::NoFlowControl);
 
-    return serial_port_.open(QSerialPort::ReadWrite);
+    if (!serial_port_.open(QSerialPort::ReadWrite))
+        return false;
+
+    BindMetrics();
+    return true;
+}
+
+bool CommDriver::Attach(CommDriver& link, SkySlip::Cmd channel)
+{
+    qCDebug(com) << "Attach to" << link.GetPortName().c_str() << "channel" << channel;
+
+    if (serial_port_.isOpen() || link_ || (&link == this) || link.link_ || !link.serial_port_.isOpen())
+        return false;
+
+    link_ = &link;
+    channel_ = channel;
+    link.channels_.push_back(this);
+    BindMetrics();
+    return true;
 }
 
 void CommDriver::Close()
 {
     qCDebug(com) << "Close";
+
+    if (link_) {
+        link_->Detach(this);
+        link_ = nullptr;
+        channel_ = SkySlip::Cmd::SendCan0;
+        return;
+    }
+
+    for (auto channel : channels_) {
+        channel->link_ = nullptr;
+        channel->channel_ = SkySlip::Cmd::SendCan0;
+    }
+
+    channels_.clear();
     tx_buffer.clear();
+    UpdateQueueMetrics();
     serial_port_.close();
 }
 
+void CommDriver::Detach(CommDriver* channel)
+{
+    channels_.erase(std::remove(channels_.begin(), channels_.end(), channel), channels_.end());
+    tx_buffer.erase(std::remove_if(tx_buffer.begin(), tx_buffer.end(),
+                                   [channel](const TxEntry& e) { return e.owner == channel; }), tx_buffer.end());
+    UpdateQueueMetrics();
+
+    // Result of frame being written is not reported to detached driver.
+    if (last_owner_ == channel)
+        last_owner_ = nullptr;
+}
+
 bool CommDriver::WriteBytes(const std::vector<uint8_t>& data)
 {
-    tmr.start();
+    tmr->Start(kWriteTimeoutMs);
     qint64 ret = serial_port_.write(reinterpret_cast<const char*>(data.data()),
                                     static_cast<qint64>(data.size()));
     serial_port_.flush();
@@ -70,7 +118,10 @@ void CommDriver::WriteTimeout()
         if (send_retry_--) { // Retransmit last packet.
            WriteBytes(last_slip_frame_);
         } else { // Not all bytes sent successfully after multiple retries.
-           emit CanFrameError(last_can_frame_, CanSendError::WriteError);
+           if (last_owner_) {
+               last_owner_->metrics_.send_errors->Increment();
+               emit last_owner_->CanFrameError(last_can_frame_, CanSendError::WriteError, last_token_);
+           }
            state_ = TxState::Idle;
         }
     }
@@ -82,32 +133,62 @@ void CommDriver::WriteTimeout()
             WriteBytes(slip_space_);
         } else {
             // Not all bytes sent successfully after multiple retries.
-            emit CanFrameError(last_can_frame_, CanSendError::DongleBusy);
+            if (last_owner_) {
+                last_owner_->metrics_.send_errors->Increment();
+                emit last_owner_->CanFrameError(last_can_frame_, CanSendError::DongleBusy, last_token_);
+            }
             state_ = TxState::Idle;
         }
     }
 #endif
 }
 
-bool CommDriver::Send(const CanFrame& frame)
+bool CommDriver::Send(const CanFrame& frame, uint64_t token)
+{
+    if (link_)
+        return link_->Enqueue(frame, channel_, this, token);
+
+    return Enqueue(frame, channel_, this, token);
+}
+
+bool CommDriver::Enqueue(const CanFrame& frame, SkySlip::Cmd cmd, CommDriver* owner, uint64_t token)
 {
     if (!serial_port_.isOpen())
         return false;
 
+    TxEntry entry = {frame, cmd, owner, token};
+    entry.frame.timing.enqueued = Trace::Now();
+
     if (state_ != TxState::Idle) {
-        tx_buffer.push_back(frame);
+        tx_buffer.push_back(std::move(entry));
+        UpdateQueueMetrics();
     } else {
-        WritePacket(frame);
+        WritePacket(entry);
     }
 
     return true;
 }
 
-void CommDriver::WritePacket(const CanFrame& frame)
+void CommDriver::Flush()
+{
+    // Attached driver flushes only its own frames in shared buffer.
+    auto& buffer = link_ ? link_->tx_buffer : tx_buffer;
+    auto it = std::remove_if(buffer.begin(), buffer.end(), [this](const TxEntry& e) { return e.owner == this; });
+
+    qCDebug(com) << "Flush" << std::distance(it, buffer.end()) << "buffered frames";
+    buffer.erase(it, buffer.end());
+    (link_ ? link_ : this)->UpdateQueueMetrics();
+}
+
+void CommDriver::WritePacket(const TxEntry& entry)
 {
     send_retry_ = kSendRetryNum;
-    last_can_frame_ = frame;
-    last_slip_frame_ = slip_.Encode(sky::SkySlip::Cmd::SendCan0, frame.ToStdVector());
+    last_can_frame_ = entry.frame;
+    last_can_frame_.timing.write = Trace::Now();
+    last_owner_ = entry.owner;
+    last_token_ = entry.token;
+    last_slip_frame_ = slip_.Encode(entry.cmd, entry.frame.ToStdVector());
+    SKY_PROBE4(write_packet, entry.frame.id, entry.frame.data.size(), static_cast<uint8_t>(entry.cmd), tx_buffer.size());
 
 #if DEVICE_SPACE_QUERY
     if (free_space_ < last_slip_frame_.size()) {
@@ -128,30 +209,41 @@ void CommDriver::WritePacket(const CanFrame& frame)
 void CommDriver::BytesRead()
 {
     QByteArray b = serial_port_.readAll();
-    qCDebug(com) << "Bytes received" << b.size() << b.toHex();
-    slip_.Decode(std::vector<uint8_t>(b.begin(), b.end()));
+    uint64_t now = Trace::Now();
+    SKY_PROBE1(bytes_read, b.size());
+    metrics_.bytes_read->Increment(static_cast<uint64_t>(b.size()));
+    SKY_TRACE(TraceEvent::kSerialRead, Trace::kNoBus, 0, static_cast<uint32_t>(b.size()),
+              reinterpret_cast<const uint8_t*>(b.constData()), static_cast<size_t>(b.size()));
+    slip_.Decode(std::vector<uint8_t>(b.begin(), b.end()), now);
 }
 
 void CommDriver::BytesWritten(qint64 bytes)
 {
     assert(TxState::Idle != state_);
+    metrics_.bytes_written->Increment(static_cast<uint64_t>(bytes));
 
     // Successfull transmission of last frame.
     if (TxState::WaitForWrite == state_ &&
         bytes == static_cast<qint64>(last_slip_frame_.size())) {
-        tmr.stop();
-        qCDebug(com) << "Bytes sent" << bytes << QByteArray(reinterpret_cast<const char*>(last_slip_frame_.data()),
-                                                              static_cast<int>(last_slip_frame_.size())).toHex();
-        emit CanFrameSent(last_can_frame_);
+        tmr->Stop();
+        last_can_frame_.timing.written = Trace::Now();
+        SKY_TRACE(TraceEvent::kSerialWrite, Trace::kNoBus, last_can_frame_.id, static_cast<uint32_t>(bytes),
+                  last_slip_frame_.data(), last_slip_frame_.size());
+        if (last_owner_) {
+            last_owner_->metrics_.frames_sent->Increment();
+            last_owner_->CountBusBits(last_can_frame_);
+            emit last_owner_->CanFrameSent(last_can_frame_, last_token_);
+        }
         state_ = TxState::Idle;
 
         // Send buffered packets.
         if (!tx_buffer.empty()) {
             WritePacket(tx_buffer.front());
             tx_buffer.erase(tx_buffer.begin());
+            UpdateQueueMetrics();
         }
     } else {
-        qCDebug(com) << "Bytes sent" << bytes;
+        SKY_TRACE(TraceEvent::kSerialWrite, Trace::kNoBus, 0, static_cast<uint32_t>(bytes), nullptr, 0);
     }
 
     // In case of an transmit error, WriteTimout shall be called
@@ -169,11 +261,48 @@ void CommDriver::SlipFrameReceived(SkySlip::Frame slip)
     if (slip.cmd == SkySlip::Cmd::SendCan0 ||
         slip.cmd == SkySlip::Cmd::SendCan1) {
 
-        emit RawFrameReceived(slip.payload);
+        // Without attached drivers, frames from both interfaces are delivered to this driver.
+        CommDriver* target = this;
+
+        if (!channels_.empty()) {
+            auto it = std::find_if(channels_.begin(), channels_.end(),
+                                   [&slip](const CommDriver* c) { return c->channel_ == slip.cmd; });
+
+            if (it != channels_.end()) {
+                target = *it;
+            } else if (slip.cmd != channel_) {
+                qCDebug(com) << "Dropped frame of unattached channel" << slip.cmd;
+                return;
+            }
+        }
+
+        // Foreign traffic is decoded before filtering only when unfiltered frames are observed (capture).
+        bool decoded = (slip.payload.size() > 4) && target->IsUnfilteredConnected();
+        CanFrame frame_rcv_;
+
+        if (decoded) {
+            frame_rcv_ = CanFrame::FromStdVector(slip.payload);
+            frame_rcv_.timing.read = slip.timestamp;
+            emit target->CanFrameReceivedUnfiltered(frame_rcv_);
+        }
+
+        // Foreign traffic is dropped before frame is decoded.
+        if (!target->Accepts(slip.payload)) {
+            target->metrics_.frames_filtered->Increment();
+            return;
+        }
+
+        target->metrics_.frames_received->Increment();
+        emit target->RawFrameReceived(slip.payload);
 
         if (slip.payload.size() > 4) {
-            CanFrame frame_rcv_ = CanFrame::FromStdVector(slip.payload);
-            emit CanFrameReceived(frame_rcv_);
+            if (!decoded) {
+                frame_rcv_ = CanFrame::FromStdVector(slip.payload);
+                frame_rcv_.timing.read = slip.timestamp;
+            }
+
+            target->CountBusBits(frame_rcv_);
+            emit target->CanFrameReceived(frame_rcv_);
         }
 
     }
@@ -198,16 +327,79 @@ void CommDriver::SlipFrameReceived(SkySlip::Frame slip)
             WriteBytes(slip_space_);
         } else {
             // After multiple retries still no available space on dongle. Signal DongleBusy and stop.
-            emit CanFrameError(last_can_frame_, CanSendError::DongleBusy);
+            if (last_owner_) {
+                last_owner_->metrics_.send_errors->Increment();
+                emit last_owner_->CanFrameError(last_can_frame_, CanSendError::DongleBusy, last_token_);
+            }
             state_ = TxState::Idle;
         }
     }
 #endif
 }
 
+void CommDriver::SetFilters(const std::vector<CanFilter>& filters)
+{
+    qCDebug(com) << "Set" << filters.size() << "acceptance filters";
+    filters_ = filters;
+}
+
+bool CommDriver::Accepts(const std::vector<uint8_t>& payload) const
+{
+    if (filters_.empty())
+        return true;
+
+    uint32_t id = 0;
+    bool extid = false;
+
+    if (!CanFrame::PeekId(payload, id, extid))
+        return false;
+
+    return std::any_of(filters_.begin(), filters_.end(),
+                       [id, extid](const CanFilter& f) { return f.Matches(id, extid); });
+}
+
+void CommDriver::BindMetrics()
+{
+    Metrics& metrics = Metrics::Instance();
+    Metrics::Labels port = {{"port", GetPortName()}};
+    Metrics::Labels channel = {{"port", GetPortName()}, {"channel", (channel_ == SkySlip::Cmd::SendCan1) ? "can1" : "can0"}};
+
+    metrics_.frames_sent = &metrics.GetCounter("cants_frames_sent_total", channel, "CAN frames written to dongle.");
+    metrics_.frames_received = &metrics.GetCounter("cants_frames_received_total", channel, "CAN frames received.");
+    metrics_.frames_filtered = &metrics.GetCounter("cants_frames_filtered_total", channel, "Received CAN frames dropped by acceptance filters.");
+    metrics_.send_errors = &metrics.GetCounter("cants_send_errors_total", channel, "CAN frames which could not be written to dongle.");
+    metrics_.bus_bits = &metrics.GetCounter("cants_bus_bits_total", channel, "Estimated CAN bus bits of sent and received frames (divide rate by bitrate for bus load).");
+    metrics_.bytes_read = &metrics.GetCounter("cants_serial_bytes_read_total", port, "Bytes read from serial port.");
+    metrics_.bytes_written = &metrics.GetCounter("cants_serial_bytes_written_total", port, "Bytes written to serial port.");
+    metrics_.tx_queue_depth = &metrics.GetGauge("cants_tx_queue_depth", port, "Frames waiting in transmit buffer.");
+    metrics_.tx_queue_max = &metrics.GetGauge("cants_tx_queue_depth_max", port, "Highest number of frames waiting in transmit buffer.");
+}
+
+void CommDriver::UpdateQueueMetrics()
+{
+    auto depth = static_cast<int64_t>(tx_buffer.size());
+    metrics_.tx_queue_depth->Set(depth);
+    metrics_.tx_queue_max->SetMax(depth);
+}
+
+void CommDriver::CountBusBits(const CanFrame& frame) const
+{
+    // Frame overhead including interframe space, bit stuffing is not counted.
+    uint64_t overhead = frame.extid ? 67 : 47;
+    metrics_.bus_bits->Increment(overhead + 8 * frame.data.size());
+}
+
 std::string CommDriver::GetPortName() const
 {
+    if (link_)
+        return link_->GetPortName();
+
     return serial_port_.portName().toStdString();
 }
 
+void CommDriver::SetClock(Clock& clock)
+{
+    tmr = clock.CreateTimer([this]() { WriteTimeout(); });
+}
+
 } // namespace sky
@@ -0,0 +1,141 @@
+/* See the file "LICENSE.txt" for the full license governing this code. */
+
+#include "loopbackbus.h"
+#include <QDebug>
+#include <QLoggingCategory>
+#include <QTimer>
+#include <algorithm>
+
+Q_LOGGING_CATEGORY(loopback, "sky::LoopbackBus")
+
+namespace sky {
+
+LoopbackBus::LoopbackBus(double loss_rate, uint32_t seed)
+    : random_(seed)
+{
+    SetLossRate(loss_rate);
+}
+
+void LoopbackBus::SetLossRate(double loss_rate)
+{
+    loss_ = std::bernoulli_distribution(std::min(std::max(loss_rate, 0.0), 1.0));
+}
+
+uint64_t LoopbackBus::GetFramesSent() const
+{
+    return frames_sent_;
+}
+
+uint64_t LoopbackBus::GetFramesLost() const
+{
+    return frames_lost_;
+}
+
+void LoopbackBus::Deliver(const LoopbackTransport* sender, const CanFrame& frame)
+{
+    frames_sent_++;
+
+    // Receiver may send (and close) from a direct connection, so iterate over a copy.
+    std::vector<LoopbackTransport*> endpoints = endpoints_;
+
+    for (auto endpoint : endpoints) {
+        if (endpoint == sender)
+            continue;
+
+        if (!endpoint->Accepts(frame)) {
+            emit endpoint->CanFrameReceivedUnfiltered(frame);
+            continue;
+        }
+
+        if (loss_(random_)) {
+            frames_lost_++;
+            continue;
+        }
+
+        emit endpoint->CanFrameReceivedUnfiltered(frame);
+        emit endpoint->CanFrameReceived(frame);
+    }
+}
+
+LoopbackTransport::LoopbackTransport(LoopbackBus& bus)
+    : bus_(bus)
+{
+    Open();
+}
+
+LoopbackTransport::~LoopbackTransport()
+{
+    Close();
+}
+
+void LoopbackTransport::Open()
+{
+    if (open_)
+        return;
+
+    bus_.endpoints_.push_back(this);
+    open_ = true;
+    qCDebug(loopback) << "Attached, endpoints =" << bus_.endpoints_.size();
+}
+
+void LoopbackTransport::Close()
+{
+    if (!open_)
+        return;
+
+    bus_.endpoints_.erase(std::remove(bus_.endpoints_.begin(), bus_.endpoints_.end(), this), bus_.endpoints_.end());
+    tx_buffer_.clear();
+    open_ = false;
+    qCDebug(loopback) << "Detached, endpoints =" << bus_.endpoints_.size();
+}
+
+bool LoopbackTransport::Send(const CanFrame& frame, uint64_t token)
+{
+    if (!open_)
+        return false;
+
+    tx_buffer_.push_back({frame, token});
+
+    if (!scheduled_) {
+        scheduled_ = true;
+        QTimer::singleShot(0, this, &LoopbackTransport::Transmit);
+    }
+
+    return true;
+}
+
+void LoopbackTransport::Flush()
+{
+    tx_buffer_.clear();
+}
+
+void LoopbackTransport::SetFilters(const std::vector<CanFilter>& filters)
+{
+    filters_ = filters;
+}
+
+bool LoopbackTransport::Accepts(const CanFrame& frame) const
+{
+    return filters_.empty() || std::any_of(filters_.begin(), filters_.end(), [&frame](const CanFilter& filter) {
+        return filter.Matches(frame.id, frame.extid);
+    });
+}
+
+void LoopbackTransport::Transmit()
+{
+    scheduled_ = false;
+
+    // Frames sent from signal handlers below are transmitted in the next round.
+    std::vector<TxEntry> entries;
+    entries.swap(tx_buffer_);
+
+    for (const auto& entry : entries) {
+        if (!open_)
+            break;
+
+        bus_.Deliver(this, entry.frame);
+        emit CanFrameSent(entry.frame, entry.token);
+    }
+}
+
+} // namespace sky
@@ -0,0 +1,329 @@
+/* See the file "LICENSE.txt" for the full license governing this code. */
+
+#include "replaytransport.h"
+#include <QDebug>
+#include <QLoggingCategory>
+#include <QTimer>
+#include <algorithm>
+#include <cmath>
+
+Q_LOGGING_CATEGORY(replay, "sky::ReplayTransport")
+
+namespace sky {
+
+ReplayTransport::ReplayTransport(const Settings& settings)
+    : settings_(settings)
+{
+    settings_.speed = std::max(settings_.speed, 0.0);
+    timer_ = clock_->CreateTimer([this]() { Deliver(); });
+}
+
+ReplayTransport::~ReplayTransport()
+{
+    Close();
+}
+
+void ReplayTransport::SetRecords(const std::vector<CaptureRecord>& records, uint8_t bus)
+{
+    Stop();
+
+    bus_ = bus;
+    stimulus_.clear();
+    expected_.clear();
+    transmitted_.clear();
+    next_ = 0;
+    frames_replayed_ = 0;
+    frames_filtered_ = 0;
+    frames_matched_ = 0;
+    frames_mismatched_ = 0;
+
+    for (const auto& record : records) {
+        // Failed transmissions never reached the bus.
+        if ((record.bus != bus) || (record.direction == static_cast<uint8_t>(CaptureDirection::kTxError)))
+            continue;
+
+        bool received = (record.direction == static_cast<uint8_t>(CaptureDirection::kRx)) != settings_.mirror;
+        (received ? stimulus_ : expected_).push_back(record);
+    }
+
+    // Records of one bus are appended in order, except driver time stamps taken before the append.
+    std::stable_sort(stimulus_.begin(), stimulus_.end(), [](const CaptureRecord& a, const CaptureRecord& b) {
+        return a.timestamp < b.timestamp;
+    });
+
+    position_ = stimulus_.empty() ? 0 : stimulus_.front().timestamp;
+    qCDebug(replay) << "Bus" << bus << "stimulus =" << stimulus_.size() << "expected =" << expected_.size();
+}
+
+bool ReplayTransport::Load(const QString& path, uint8_t bus)
+{
+    std::vector<QString> files = CaptureReader::SegmentFiles(path);
+    std::vector<std::vector<CaptureRecord>> segments;
+
+    if (files.empty())
+        return false;
+
+    // Trace clock time stamps of different runs are not comparable, records are stamped with epoch time.
+    for (const auto& file : files) {
+        CaptureReader reader;
+
+        if (!reader.Open(file)) {
+            qCWarning(replay) << "Skipped invalid segment" << file;
+            continue;
+        }
+
+        const CaptureRecord* begin = reader.GetRecords();
+        int64_t epoch_offset = reader.GetEpochOffset();
+        std::vector<CaptureRecord> segment;
+
+        for (const CaptureRecord* record = begin; record != begin + reader.GetCount(); record++) {
+            if (record->bus != bus)
+                continue;
+
+            segment.push_back(*record);
+            segment.back().timestamp = static_cast<uint64_t>(static_cast<int64_t>(record->timestamp) + epoch_offset);
+        }
+
+        if (!segment.empty())
+            segments.push_back(std::move(segment));
+    }
+
+    // Segments of each run are in order, runs are ordered by epoch time of their first record.
+    std::stable_sort(segments.begin(), segments.end(), [](const std::vector<CaptureRecord>& a, const std::vector<CaptureRecord>& b) {
+        return a.front().timestamp < b.front().timestamp;
+    });
+
+    std::vector<CaptureRecord> records;
+
+    for (const auto& segment : segments)
+        records.insert(records.end(), segment.begin(), segment.end());
+
+    SetRecords(records, bus);
+    return true;
+}
+
+void ReplayTransport::SetClock(Clock& clock)
+{
+    bool running = running_;
+
+    Stop();
+    clock_ = &clock;
+    timer_ = clock_->CreateTimer([this]() { Deliver(); });
+
+    if (running)
+        Start();
+}
+
+void ReplayTransport::Start()
+{
+    if (running_ || !open_)
+        return;
+
+    running_ = true;
+    start_ms_ = clock_->Elapsed();
+    origin_ = position_;
+    ScheduleNext();
+}
+
+void ReplayTransport::Stop()
+{
+    if (!running_)
+        return;
+
+    UpdatePosition();
+    running_ = false;
+    timer_->Stop();
+}
+
+bool ReplayTransport::IsFinished() const
+{
+    return next_ >= stimulus_.size();
+}
+
+uint64_t ReplayTransport::GetFramesReplayed() const
+{
+    return frames_replayed_;
+}
+
+uint64_t ReplayTransport::GetFramesFiltered() const
+{
+    return frames_filtered_;
+}
+
+uint64_t ReplayTransport::GetFramesMatched() const
+{
+    return frames_matched_;
+}
+
+uint64_t ReplayTransport::GetFramesMismatched() const
+{
+    return frames_mismatched_;
+}
+
+uint64_t ReplayTransport::GetFramesMissing() const
+{
+    return expected_.size() - std::min(transmitted_.size(), expected_.size());
+}
+
+uint64_t ReplayTransport::GetFramesUnexpected() const
+{
+    return transmitted_.size() - std::min(transmitted_.size(), expected_.size());
+}
+
+const std::vector<CaptureRecord>& ReplayTransport::GetTransmitted() const
+{
+    return transmitted_;
+}
+
+bool ReplayTransport::Send(const CanFrame& frame, uint64_t token)
+{
+    if (!open_)
+        return false;
+
+    UpdatePosition();
+
+    size_t index = transmitted_.size();
+    transmitted_.push_back(CaptureRecord::FromCanFrame(frame, bus_, CaptureDirection::kTx, position_));
+
+    if (index < expected_.size()) {
+        CanFrame expected = expected_[index].ToCanFrame();
+
+        if ((expected.id == frame.id) && (expected.extid == frame.extid) && (expected.rtr == frame.rtr) &&
+            (expected.data == frame.data)) {
+            frames_matched_++;
+        } else {
+            frames_mismatched_++;
+            emit TransmitMismatch(index, expected, frame);
+        }
+    }
+
+    tx_buffer_.push_back({frame, token});
+
+    if (!transmit_scheduled_) {
+        transmit_scheduled_ = true;
+        QTimer::singleShot(0, this, &ReplayTransport::Transmit);
+    }
+
+    return true;
+}
+
+void ReplayTransport::Flush()
+{
+    tx_buffer_.clear();
+}
+
+void ReplayTransport::SetFilters(const std::vector<CanFilter>& filters)
+{
+    filters_ = filters;
+}
+
+void ReplayTransport::Close()
+{
+    Stop();
+    tx_buffer_.clear();
+    open_ = false;
+}
+
+void ReplayTransport::Open()
+{
+    open_ = true;
+}
+
+void ReplayTransport::Deliver()
+{
+    deliver_scheduled_ = false;
+
+    if (!running_)
+        return;
+
+    if (settings_.speed > 0) {
+        UpdatePosition();
+
+        while ((next_ < stimulus_.size()) && (stimulus_[next_].timestamp <= position_))
+            DeliverRecord(stimulus_[next_++]);
+    } else {
+        // Reactions to a delivered frame are processed before the next one is delivered.
+        while (next_ < stimulus_.size()) {
+            position_ = stimulus_[next_].timestamp;
+
+            if (DeliverRecord(stimulus_[next_++]))
+                break;
+        }
+    }
+
+    ScheduleNext();
+}
+
+void ReplayTransport::Transmit()
+{
+    transmit_scheduled_ = false;
+
+    // Frames sent from signal handlers below are confirmed in the next round.
+    std::vector<TxEntry> entries;
+    entries.swap(tx_buffer_);
+
+    for (const auto& entry : entries) {
+        if (!open_)
+            break;
+
+        emit CanFrameSent(entry.frame, entry.token);
+    }
+}
+
+bool ReplayTransport::Accepts(const CanFrame& frame) const
+{
+    return filters_.empty() || std::any_of(filters_.begin(), filters_.end(), [&frame](const CanFilter& filter) {
+        return filter.Matches(frame.id, frame.extid);
+    });
+}
+
+void ReplayTransport::UpdatePosition()
+{
+    if (!running_ || (settings_.speed <= 0))
+        return;
+
+    auto elapsed = static_cast<double>(clock_->Elapsed() - start_ms_) * 1e6 * settings_.speed;
+    position_ = std::max(position_, origin_ + static_cast<uint64_t>(elapsed));
+}
+
+bool ReplayTransport::DeliverRecord(const CaptureRecord& record)
+{
+    CanFrame frame = record.ToCanFrame();
+    emit CanFrameReceivedUnfiltered(frame);
+
+    if (!Accepts(frame)) {
+        frames_filtered_++;
+        return false;
+    }
+
+    frames_replayed_++;
+    emit CanFrameReceived(frame);
+    return true;
+}
+
+void ReplayTransport::ScheduleNext()
+{
+    if (!running_)
+        return;
+
+    if (next_ >= stimulus_.size()) {
+        running_ = false;
+        qCDebug(replay) << "Finished, replayed =" << frames_replayed_ << "filtered =" << frames_filtered_;
+        emit Finished();
+        return;
+    }
+
+    if (settings_.speed <= 0) {
+        if (!deliver_scheduled_) {
+            deliver_scheduled_ = true;
+            QTimer::singleShot(0, this, &ReplayTransport::Deliver);
+        }
+        return;
+    }
+
+    uint64_t due = stimulus_[next_].timestamp;
+    double delay_ms = (due > position_) ? (static_cast<double>(due - position_) / 1e6 / settings_.speed) : 0.0;
+    timer_->Start(static_cast<uint32_t>(std::min(std::ceil(delay_ms), 4294967295.0)));
+}
+
+} // namespace sky
@@ -0,0 +1,424 @@
+/* See the file "LICENSE.txt" for the full license governing this code. */
+
+#include "simulatedbus.h"
+#include <QCoreApplication>
+#include <QDebug>
+#include <QLoggingCategory>
+#include <algorithm>
+#include <cmath>
+
+Q_LOGGING_CATEGORY(simbus, "sky::SimulatedBus")
+
+namespace
+{
+
+// Bits following CRC field: CRC delimiter, ACK slot, ACK delimiter and end of frame.
+constexpr uint32_t kTrailerBits = 10;
+
+// Bus idle time between frames.
+constexpr uint32_t kIntermissionBits = 3;
+
+// Error flag, echoed error flags of other nodes (worst case) and error delimiter.
+constexpr uint32_t kErrorFrameBits = 20;
+
+//! Appends \a count least significant bits of \a value to \a bits, MSB first.
+void AppendBits(std::vector<uint8_t>& bits, uint32_t value, uint32_t count)
+{
+    while (count--)
+        bits.push_back(static_cast<uint8_t>((value >> count) & 1));
+}
+
+//! Returns arbitration field of \a frame as a number, frame with lower value wins arbitration.
+uint64_t ArbitrationKey(const sky::CanFrame& frame)
+{
+    // Base identifier, SRR/RTR, IDE, identifier extension and RTR. Dominant bits (0) win.
+    if (frame.extid) {
+        return (static_cast<uint64_t>(frame.id >> 18) << 21) | (1ULL << 20) | (1ULL << 19) |
+               (static_cast<uint64_t>(frame.id & 0x3FFFF) << 1) | (frame.rtr ? 1 : 0);
+    }
+
+    return (static_cast<uint64_t>(frame.id & 0x7FF) << 21) | (static_cast<uint64_t>(frame.rtr ? 1 : 0) << 20);
+}
+
+} // namespace
+
+namespace sky {
+
+SimulatedBus::SimulatedBus(const Settings& settings)
+    : settings_(settings), random_(settings.seed),
+      error_(std::min(std::max(settings.error_rate, 0.0), 1.0)),
+      drop_(std::min(std::max(settings.drop_rate, 0.0), 1.0)),
+      corrupt_(std::min(std::max(settings.corrupt_rate, 0.0), 1.0))
+{
+    if (settings_.bitrate == 0)
+        settings_.bitrate = 1000000;
+}
+
+uint64_t SimulatedBus::Now() const
+{
+    return now_;
+}
+
+void SimulatedBus::SetClock(VirtualClock* clock)
+{
+    clock_ = clock;
+}
+
+void SimulatedBus::Schedule(uint64_t time_ns, std::function<void()> action)
+{
+    events_.push({std::max(time_ns, now_), sequence_++, std::move(action)});
+}
+
+bool SimulatedBus::Step()
+{
+    // Reactions to previous event are queued by Qt and must see its virtual time.
+    QCoreApplication::processEvents();
+
+    uint64_t deadline = 0;
+    bool timer = clock_ && clock_->NextDeadline(deadline);
+
+    // Timers expiring together with a bus event run first, as if they expired just before it.
+    if (timer && (events_.empty() || (deadline <= events_.top().time))) {
+        now_ = std::max(now_, deadline);
+        clock_->AdvanceTo(now_);
+        return true;
+    }
+
+    if (events_.empty())
+        return false;
+
+    Event event = events_.top();
+    events_.pop();
+    now_ = event.time;
+
+    if (clock_)
+        clock_->AdvanceTo(now_);
+
+    event.action();
+    return true;
+}
+
+void SimulatedBus::RunUntil(uint64_t time_ns)
+{
+    uint64_t next = 0;
+
+    for (;;) {
+        QCoreApplication::processEvents();
+
+        if (!NextEvent(next) || (next > time_ns))
+            break;
+
+        Step();
+    }
+
+    now_ = std::max(now_, time_ns);
+
+    if (clock_)
+        clock_->AdvanceTo(now_);
+}
+
+bool SimulatedBus::NextEvent(uint64_t& time_ns) const
+{
+    uint64_t deadline = 0;
+    bool timer = clock_ && clock_->NextDeadline(deadline);
+
+    if (events_.empty()) {
+        time_ns = deadline;
+        return timer;
+    }
+
+    time_ns = timer ? std::min(deadline, events_.top().time) : events_.top().time;
+    return true;
+}
+
+uint64_t SimulatedBus::GetFramesSent() const
+{
+    return frames_sent_;
+}
+
+uint64_t SimulatedBus::GetErrorFrames() const
+{
+    return error_frames_;
+}
+
+uint64_t SimulatedBus::GetFramesDropped() const
+{
+    return frames_dropped_;
+}
+
+uint64_t SimulatedBus::GetFramesCorrupted() const
+{
+    return frames_corrupted_;
+}
+
+uint64_t SimulatedBus::GetArbitrationLosses() const
+{
+    return arbitration_losses_;
+}
+
+uint64_t SimulatedBus::GetBusyTime() const
+{
+    return busy_ns_;
+}
+
+double SimulatedBus::GetLoad() const
+{
+    return now_ ? std::min(static_cast<double>(busy_ns_) / static_cast<double>(now_), 1.0) : 0.0;
+}
+
+uint32_t SimulatedBus::FrameBits(const CanFrame& frame)
+{
+    auto length = static_cast<uint32_t>(std::min<size_t>(frame.data.size(), 8));
+    std::vector<uint8_t> bits;
+    bits.reserve(128);
+
+    // Start of frame, arbitration and control fields.
+    AppendBits(bits, 0, 1);
+
+    if (frame.extid) {
+        AppendBits(bits, frame.id >> 18, 11);
+        AppendBits(bits, 1, 1); // SRR
+        AppendBits(bits, 1, 1); // IDE
+        AppendBits(bits, frame.id & 0x3FFFF, 18);
+        AppendBits(bits, frame.rtr ? 1 : 0, 1);
+        AppendBits(bits, 0, 2); // r1, r0
+    } else {
+        AppendBits(bits, frame.id & 0x7FF, 11);
+        AppendBits(bits, frame.rtr ? 1 : 0, 1);
+        AppendBits(bits, 0, 2); // IDE, r0
+    }
+
+    AppendBits(bits, length, 4);
+
+    if (!frame.rtr) {
+        for (uint32_t i = 0; i < length; i++)
+            AppendBits(bits, frame.data[i], 8);
+    }
+
+    // CRC-15 over all preceding bits.
+    uint32_t crc = 0;
+    for (uint8_t bit : bits) {
+        bool feedback = (bit ^ (crc >> 14)) & 1;
+        crc = (crc << 1) & 0x7FFF;
+        if (feedback)
+            crc ^= 0x4599;
+    }
+
+    AppendBits(bits, crc, 15);
+
+    // Stuff bit is inserted after five equal bits and starts the next run.
+    uint32_t stuff_bits = 0;
+    uint32_t run = 0;
+    uint8_t level = 2;
+
+    for (uint8_t bit : bits) {
+        if (bit == level) {
+            run++;
+        } else {
+            level = bit;
+            run = 1;
+        }
+
+        if (run == 5) {
+            stuff_bits++;
+            level = static_cast<uint8_t>(!level);
+            run = 1;
+        }
+    }
+
+    return static_cast<uint32_t>(bits.size()) + stuff_bits + kTrailerBits;
+}
+
+uint64_t SimulatedBus::BitsTime(uint32_t bits) const
+{
+    return static_cast<uint64_t>(std::llround(static_cast<double>(bits) * 1e9 / settings_.bitrate));
+}
+
+void SimulatedBus::RequestArbitration()
+{
+    if (transmitting_ || arbitration_scheduled_)
+        return;
+
+    bool pending = std::any_of(endpoints_.begin(), endpoints_.end(),
+                               [](const SimulatedTransport* endpoint) { return !endpoint->tx_queue_.empty(); });
+
+    if (pending) {
+        arbitration_scheduled_ = true;
+        Schedule(idle_at_, [this]() { Arbitrate(); });
+    }
+}
+
+void SimulatedBus::Arbitrate()
+{
+    arbitration_scheduled_ = false;
+
+    SimulatedTransport* winner = nullptr;
+    uint64_t winner_key = 0;
+    uint32_t contenders = 0;
+
+    for (auto endpoint : endpoints_) {
+        if (endpoint->tx_queue_.empty())
+            continue;
+
+        uint64_t key = ArbitrationKey(endpoint->tx_queue_.front().frame);
+        contenders++;
+
+        if (!winner || (key < winner_key)) {
+            winner = endpoint;
+            winner_key = key;
+        }
+    }
+
+    // Pending frames may have been flushed since arbitration was requested.
+    if (!winner)
+        return;
+
+    arbitration_losses_ += contenders - 1;
+    transmitting_ = true;
+
+    uint32_t bits = FrameBits(winner->tx_queue_.front().frame);
+
+    if (error_(random_)) {
+        // Frame stays in transmit queue and contends again after error frame.
+        uint32_t error_bit = std::uniform_int_distribution<uint32_t>(1, bits)(random_);
+        uint64_t end = now_ + BitsTime(error_bit + kErrorFrameBits);
+
+        error_frames_++;
+        busy_ns_ += BitsTime(error_bit + kErrorFrameBits + kIntermissionBits);
+        idle_at_ = end + BitsTime(kIntermissionBits);
+
+        Schedule(end, [this]() {
+            transmitting_ = false;
+            RequestArbitration();
+        });
+        return;
+    }
+
+    // Frame on the bus is not affected by Flush.
+    SimulatedTransport::TxEntry entry = winner->tx_queue_.front();
+    winner->tx_queue_.pop_front();
+
+    uint64_t end = now_ + BitsTime(bits);
+    busy_ns_ += BitsTime(bits + kIntermissionBits);
+    idle_at_ = end + BitsTime(kIntermissionBits);
+
+    Schedule(end, [this, winner, entry]() { Complete(winner, entry.frame, entry.token); });
+}
+
+void SimulatedBus::Complete(SimulatedTransport* sender, const CanFrame& frame, uint64_t token)
+{
+    transmitting_ = false;
+    frames_sent_++;
+
+    for (auto endpoint : endpoints_) {
+        if (endpoint == sender)
+            continue;
+
+        // Filtered frames are scheduled only when observed (capture).
+        if (!endpoint->Accepts(frame)) {
+            if (endpoint->IsUnfilteredConnected()) {
+                Schedule(now_ + endpoint->processing_delay_ns_, [this, endpoint, frame]() {
+                    if (IsAttached(endpoint))
+                        emit endpoint->CanFrameReceivedUnfiltered(frame);
+                });
+            }
+            continue;
+        }
+
+        if (drop_(random_)) {
+            frames_dropped_++;
+            continue;
+        }
+
+        CanFrame received = frame;
+
+        if (corrupt_(random_) && !received.data.empty()) {
+            size_t bit = std::uniform_int_distribution<size_t>(0, 8 * received.data.size() - 1)(random_);
+            received.data[bit / 8] ^= static_cast<uint8_t>(1U << (bit % 8));
+            frames_corrupted_++;
+        }
+
+        Schedule(now_ + endpoint->processing_delay_ns_, [this, endpoint, received]() {
+            if (IsAttached(endpoint)) {
+                emit endpoint->CanFrameReceivedUnfiltered(received);
+                emit endpoint->CanFrameReceived(received);
+            }
+        });
+    }
+
+    if (IsAttached(sender))
+        emit sender->CanFrameSent(frame, token);
+
+    RequestArbitration();
+}
+
+bool SimulatedBus::IsAttached(const SimulatedTransport* transport) const
+{
+    return std::find(endpoints_.begin(), endpoints_.end(), transport) != endpoints_.end();
+}
+
+SimulatedTransport::SimulatedTransport(SimulatedBus& bus, uint64_t processing_delay_ns)
+    : bus_(bus), processing_delay_ns_(processing_delay_ns)
+{
+    Open();
+}
+
+SimulatedTransport::~SimulatedTransport()
+{
+    Close();
+}
+
+void SimulatedTransport::Open()
+{
+    if (open_)
+        return;
+
+    bus_.endpoints_.push_back(this);
+    open_ = true;
+    qCDebug(simbus) << "Attached, endpoints =" << bus_.endpoints_.size();
+}
+
+void SimulatedTransport::Close()
+{
+    if (!open_)
+        return;
+
+    bus_.endpoints_.erase(std::remove(bus_.endpoints_.begin(), bus_.endpoints_.end(), this), bus_.endpoints_.end());
+    tx_queue_.clear();
+    open_ = false;
+    qCDebug(simbus) << "Detached, endpoints =" << bus_.endpoints_.size();
+}
+
+bool SimulatedTransport::Send(const CanFrame& frame, uint64_t token)
+{
+    if (!open_)
+        return false;
+
+    tx_queue_.push_back({frame, token});
+    bus_.RequestArbitration();
+    return true;
+}
+
+void SimulatedTransport::Flush()
+{
+    tx_queue_.clear();
+}
+
+void SimulatedTransport::SetFilters(const std::vector<CanFilter>& filters)
+{
+    filters_ = filters;
+}
+
+void SimulatedTransport::SetProcessingDelay(uint64_t processing_delay_ns)
+{
+    processing_delay_ns_ = processing_delay_ns;
+}
+
+bool SimulatedTransport::Accepts(const CanFrame& frame) const
+{
+    return filters_.empty() || std::any_of(filters_.begin(), filters_.end(), [&frame](const CanFilter& filter) {
+        return filter.Matches(frame.id, frame.extid);
+    });
+}
+
+} // namespace sky
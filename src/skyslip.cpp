@@ -1,6 +1,8 @@
 /* See the file "LICENSE.txt" for the full license governing this code. */
 
 #include "skyslip.h"
+#include "cantsmetrics.h"
+#include "cantsprobes.h"
 #include <QDebug>
 #include <QLoggingCategory>
 
@@ -8,6 +10,23 @@ Q_LOGGING_CATEGORY(slip, "sky::SkySlip")
 
 namespace sky {
 
+namespace {
+
+//! Decoder metrics, aggregated over all decoders.
+struct DecoderMetrics {
+    MetricCounter& frames = Metrics::Instance().GetCounter("cants_slip_frames_decoded_total", {}, "SLIP frames decoded.");
+    MetricCounter& invalid = Metrics::Instance().GetCounter("cants_slip_invalid_commands_total", {}, "SLIP frames ignored because of invalid command.");
+    MetricCounter& discarded = Metrics::Instance().GetCounter("cants_slip_discarded_bytes_total", {}, "Bytes received outside of SLIP frames.");
+};
+
+DecoderMetrics& GetDecoderMetrics()
+{
+    static DecoderMetrics metrics;
+    return metrics;
+}
+
+} // namespace
+
 const uint8_t SkySlip::SLIP_END = 0xC0;
 const uint8_t SkySlip::SLIP_ESC = 0xDB;
 const uint8_t SkySlip::SLIP_ESC_END = 0xDC;
@@ -37,8 +56,10 @@ std::vector<uint8_t> SkySlip::Encode(Cmd cmd, const std::vector<uint8_t>& data)
     return slip;
 }
 
-void SkySlip::Decode(const std::vector<uint8_t>& data)
+void SkySlip::Decode(const std::vector<uint8_t>& data, uint64_t timestamp)
 {
+    DecoderMetrics& metrics = GetDecoderMetrics();
+
     for (uint8_t ch : data) {
 
         switch (state_) {
@@ -46,6 +67,8 @@ void SkySlip::Decode(const std::vector<uint8_t>& data)
             if (SLIP_END == ch) {
                 state_ = Command;
                 frame_.payload.clear();
+            } else {
+                metrics.discarded.Increment();
             }
             break;
         case Command:
@@ -57,6 +80,7 @@ void SkySlip::Decode(const std::vector<uint8_t>& data)
                 state_ = Payload;
             } else {
                 qCDebug(slip) << "Ignoring frame with invalid command value" << ch;
+                metrics.invalid.Increment();
                 state_ = RxBegin;
             }
 
@@ -64,6 +88,9 @@ void SkySlip::Decode(const std::vector<uint8_t>& data)
         case Payload:
             if (SLIP_END == ch) {
                 // End of frame received
+                metrics.frames.Increment();
+                frame_.timestamp = timestamp;
+                SKY_PROBE2(slip_frame, static_cast<uint8_t>(frame_.cmd), frame_.payload.size());
                 emit FrameReceived(frame_);
                 state_ = RxBegin;
             } else if (SLIP_ESC == ch) {
@@ -0,0 +1,12 @@
+# See the file "LICENSE.txt" for the full license governing this code.
+#
+# CANdelaber emulator on Linux pseudo-terminal.
+
+TARGET = candelaber-emu
+TEMPLATE = app
+
+CONFIG += c++14 strict_c++ warn_on console
+CONFIG -= qt app_bundle
+
+SOURCES += \
+        main.cpp
@@ -0,0 +1,542 @@
+/* See the file "LICENSE.txt" for the full license governing this code. */
+
+// CANdelaber dongle emulator on Linux pseudo-terminal.
+//
+// Usage: candelaber-emu [--link PATH] [--baud N] [--buffer BYTES] [--bitrate N]
+//                       [--drop P] [--echo] [--respond] [--seed N] [--stats S]
+//
+// Opens pty pair and prints slave path (and creates symlink PATH to it), which
+// can be passed to CommDriver::Open as port name. Emulator speaks SKY-SLIP:
+//
+// - SendCan0/SendCan1 frames are stored in dongle buffer of --buffer bytes
+//   (SLIP encoded size, like CommDriver accounts it) and transmitted on the
+//   CAN interface at --bitrate. Frames not fitting in buffer are dropped.
+// - DongleReport request (empty payload) is answered with free buffer space.
+// - Serial line is limited to --baud (10 bits per byte) in both directions,
+//   0 disables the limit. Host sees it as slow writes and kernel buffer
+//   filling up, so CommDriver write path and flow control are exercised.
+// - Transmitted frames are lost with probability --drop. With --echo, every
+//   transmitted frame is received back on the same interface. With --respond,
+//   CAN TS telecommand and telemetry requests are answered with ACK (telemetry
+//   with 8 bytes of data) from the addressed node.
+//
+// SLIP is implemented here independently of SkySlip, so emulator does not
+// share defects with the code under test. Statistics are printed to stderr
+// every --stats seconds and on exit (SIGINT, SIGTERM).
+
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <termios.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cinttypes>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace
+{
+
+constexpr uint8_t kSlipEnd = 0xC0;
+constexpr uint8_t kSlipEsc = 0xDB;
+constexpr uint8_t kSlipEscEnd = 0xDC;
+constexpr uint8_t kSlipEscEsc = 0xDD;
+
+// SKY-SLIP commands (see SkySlip::Cmd).
+constexpr uint8_t kSendCan0 = 0x00;
+constexpr uint8_t kSendCan1 = 0x01;
+constexpr uint8_t kDongleReport = 0x02;
+
+volatile sig_atomic_t stop = 0;
+
+struct Options {
+    std::string link;
+    uint32_t baud = 115200;
+    size_t buffer = 1024;
+    uint32_t bitrate = 1000000;
+    double drop = 0.0;
+    bool echo = false;
+    bool respond = false;
+    uint32_t seed = 1;
+    uint32_t stats = 0;
+};
+
+struct Stats {
+    uint64_t bytes_in = 0; //!< Bytes read from host.
+    uint64_t bytes_out = 0; //!< Bytes written to host.
+    uint64_t frames_in = 0; //!< CAN frames received from host.
+    uint64_t frames_sent = 0; //!< CAN frames transmitted on bus.
+    uint64_t frames_out = 0; //!< CAN frames delivered to host.
+    uint64_t overflows = 0; //!< Frames dropped because buffer was full.
+    uint64_t dropped = 0; //!< Frames lost on bus.
+    uint64_t reports = 0; //!< Dongle space reports sent.
+    uint64_t invalid = 0; //!< Frames with invalid command or payload.
+    size_t max_used = 0; //!< Highest buffer usage in bytes.
+};
+
+using Clock = std::chrono::steady_clock;
+
+std::vector<uint8_t> SlipEncode(uint8_t cmd, const std::vector<uint8_t>& payload)
+{
+    std::vector<uint8_t> out = {kSlipEnd, cmd};
+
+    for (uint8_t b : payload) {
+        if (b == kSlipEnd) {
+            out.push_back(kSlipEsc);
+            out.push_back(kSlipEscEnd);
+        } else if (b == kSlipEsc) {
+            out.push_back(kSlipEsc);
+            out.push_back(kSlipEscEsc);
+        } else {
+            out.push_back(b);
+        }
+    }
+
+    out.push_back(kSlipEnd);
+    return out;
+}
+
+//! SLIP decoder, frames start and end with END byte, first byte is command.
+class SlipDecoder {
+public:
+    //! Adds \a b, returns true when frame is complete (available in cmd and payload).
+    bool Feed(uint8_t b) {
+        if (b == kSlipEnd) {
+            bool complete = in_frame_ && has_cmd_;
+            in_frame_ = true;
+            has_cmd_ = false;
+            esc_ = false;
+            if (!complete)
+                payload.clear();
+            return complete;
+        }
+
+        if (!in_frame_)
+            return false;
+
+        if (!has_cmd_) {
+            cmd = b;
+            has_cmd_ = true;
+            payload.clear();
+        } else if (b == kSlipEsc) {
+            esc_ = true;
+        } else {
+            if (esc_)
+                b = (b == kSlipEscEnd) ? kSlipEnd : ((b == kSlipEscEsc) ? kSlipEsc : b);
+            esc_ = false;
+            payload.push_back(b);
+        }
+
+        return false;
+    }
+
+    uint8_t cmd = 0;
+    std::vector<uint8_t> payload;
+
+private:
+    bool in_frame_ = false;
+    bool has_cmd_ = false;
+    bool esc_ = false;
+};
+
+//! Limits byte rate with token bucket.
+class RateLimit {
+public:
+    RateLimit(uint32_t baud, Clock::time_point now) : bytes_per_s_(baud / 10.0), last_(now) {}
+
+    //! Returns number of bytes which may be transferred now.
+    size_t Available(Clock::time_point now) {
+        if (bytes_per_s_ <= 0)
+            return SIZE_MAX;
+
+        // Burst is limited to roughly 1 ms of traffic (at least one byte).
+        double burst = std::max(1.0, bytes_per_s_ / 1000.0);
+        tokens_ = std::min(burst, tokens_ + std::chrono::duration<double>(now - last_).count() * bytes_per_s_);
+        last_ = now;
+        return static_cast<size_t>(tokens_);
+    }
+
+    void Consume(size_t bytes) {
+        if (bytes_per_s_ > 0)
+            tokens_ -= static_cast<double>(bytes);
+    }
+
+    //! Returns time until next byte may be transferred.
+    Clock::duration Wait() const {
+        if ((bytes_per_s_ <= 0) || (tokens_ >= 1.0))
+            return Clock::duration::zero();
+        return std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>((1.0 - tokens_) / bytes_per_s_));
+    }
+
+private:
+    double bytes_per_s_;
+    double tokens_ = 0.0;
+    Clock::time_point last_;
+};
+
+//! Emulated dongle with two CAN interfaces sharing one transmit buffer.
+class Dongle {
+public:
+    Dongle(const Options& options, Stats& stats) : options_(options), stats_(stats), random_(options.seed), drop_(options.drop) {}
+
+    //! Handles SKY-SLIP frame from host.
+    void Received(uint8_t cmd, const std::vector<uint8_t>& payload, Clock::time_point now) {
+        if (cmd == kDongleReport) {
+            size_t free = options_.buffer - used_;
+            free = std::min<size_t>(free, 0xFFFF);
+            ToHost(kDongleReport, {static_cast<uint8_t>(free & 0xFF), static_cast<uint8_t>(free >> 8)});
+            stats_.reports++;
+            return;
+        }
+
+        if (((cmd != kSendCan0) && (cmd != kSendCan1)) || !ValidFrame(payload)) {
+            stats_.invalid++;
+            return;
+        }
+
+        stats_.frames_in++;
+        size_t size = SlipEncode(cmd, payload).size();
+
+        if (used_ + size > options_.buffer) {
+            stats_.overflows++;
+            return;
+        }
+
+        used_ += size;
+        stats_.max_used = std::max(stats_.max_used, used_);
+        Enqueue(cmd, payload, size, now);
+    }
+
+    //! Completes transmissions finished by \a now.
+    void Poll(Clock::time_point now) {
+        for (auto& bus : buses_) {
+            while (!bus.queue.empty() && (bus.queue.front().done <= now)) {
+                TxFrame frame = bus.queue.front();
+                bus.queue.pop_front();
+                used_ -= frame.size;
+                Transmitted(frame, now);
+            }
+        }
+    }
+
+    //! Returns time of next transmission completion, or max if bus is idle.
+    Clock::time_point NextEvent() const {
+        Clock::time_point next = Clock::time_point::max();
+        for (const auto& bus : buses_) {
+            if (!bus.queue.empty())
+                next = std::min(next, bus.queue.front().done);
+        }
+        return next;
+    }
+
+    std::deque<uint8_t>& Output() { return to_host_; }
+    size_t Used() const { return used_; }
+
+private:
+    struct TxFrame {
+        uint8_t cmd;
+        std::vector<uint8_t> payload;
+        size_t size; //!< Buffer bytes taken, 0 for frames generated by emulator.
+        Clock::time_point done; //!< End of transmission on bus.
+    };
+
+    struct Bus {
+        std::deque<TxFrame> queue;
+        Clock::time_point free = Clock::time_point::min(); //!< Bus is free after this time.
+    };
+
+    const Options& options_;
+    Stats& stats_;
+    std::mt19937 random_;
+    std::bernoulli_distribution drop_;
+    Bus buses_[2];
+    size_t used_ = 0;
+    std::deque<uint8_t> to_host_;
+
+    static bool ValidFrame(const std::vector<uint8_t>& payload) {
+        if (payload.empty())
+            return false;
+
+        size_t header = (payload[0] & 0x80) ? 5 : 3;
+        size_t length = payload[0] & 0x0F;
+        return (length <= 8) && (payload.size() == header + length);
+    }
+
+    //! Starts transmission of frame after frames already queued on its bus.
+    void Enqueue(uint8_t cmd, const std::vector<uint8_t>& payload, size_t size, Clock::time_point now) {
+        Bus& bus = buses_[cmd];
+
+        // Frame bits without stuffing, like CommDriver bus load estimate.
+        size_t bits = ((payload[0] & 0x80) ? 67 : 47) + 8 * (payload[0] & 0x0F);
+        auto duration = std::chrono::duration_cast<Clock::duration>(
+            std::chrono::duration<double>(static_cast<double>(bits) / options_.bitrate));
+
+        bus.free = std::max(bus.free, now) + duration;
+        bus.queue.push_back({cmd, payload, size, bus.free});
+    }
+
+    void Transmitted(const TxFrame& frame, Clock::time_point now) {
+        // Responses generated by emulator are frames of remote node, received by host.
+        if (frame.size == 0) {
+            ToHost(frame.cmd, frame.payload);
+            stats_.frames_out++;
+            return;
+        }
+
+        stats_.frames_sent++;
+
+        if (drop_(random_)) {
+            stats_.dropped++;
+            return;
+        }
+
+        if (options_.echo) {
+            ToHost(frame.cmd, frame.payload);
+            stats_.frames_out++;
+        }
+
+        if (options_.respond)
+            Respond(frame, now);
+    }
+
+    //! Answers CAN TS telecommand or telemetry request in \a frame.
+    void Respond(const TxFrame& frame, Clock::time_point now) {
+        const std::vector<uint8_t>& p = frame.payload;
+        if (!(p[0] & 0x80))
+            return;
+
+        uint32_t id = static_cast<uint32_t>(p[1]) | (static_cast<uint32_t>(p[2]) << 8) |
+                      (static_cast<uint32_t>(p[3]) << 16) | (static_cast<uint32_t>(p[4]) << 24);
+
+        // CAN TS identifier: to address, type, from address, command.
+        uint32_t to = (id >> 21) & 0xFF;
+        uint32_t type = (id >> 18) & 0x07;
+        uint32_t from = (id >> 10) & 0xFF;
+        uint32_t command = id & 0x3FF;
+
+        if (((type != 2) && (type != 3)) || (((command >> 8) & 3) != 0))
+            return;
+
+        uint32_t ack = (from << 21) | (type << 18) | (to << 10) | (1U << 8) | (command & 0xFF);
+        uint8_t length = (type == 3) ? 8 : 0;
+        std::vector<uint8_t> response = {static_cast<uint8_t>(0x80 | length), static_cast<uint8_t>(ack),
+                                         static_cast<uint8_t>(ack >> 8), static_cast<uint8_t>(ack >> 16),
+                                         static_cast<uint8_t>(ack >> 24)};
+
+        for (uint8_t i = 0; i < length; i++)
+            response.push_back(static_cast<uint8_t>(to + i));
+
+        Enqueue(frame.cmd, response, 0, now);
+    }
+
+    void ToHost(uint8_t cmd, const std::vector<uint8_t>& payload) {
+        std::vector<uint8_t> slip = SlipEncode(cmd, payload);
+        to_host_.insert(to_host_.end(), slip.begin(), slip.end());
+    }
+};
+
+void PrintStats(const Stats& s, size_t used)
+{
+    std::fprintf(stderr, "in %" PRIu64 " B %" PRIu64 " frames, sent %" PRIu64 ", out %" PRIu64 " B %" PRIu64
+                 " frames, overflow %" PRIu64 ", dropped %" PRIu64 ", reports %" PRIu64 ", invalid %" PRIu64
+                 ", buffer %zu (max %zu)\n",
+                 s.bytes_in, s.frames_in, s.frames_sent, s.bytes_out, s.frames_out, s.overflows, s.dropped,
+                 s.reports, s.invalid, used, s.max_used);
+}
+
+bool ParseOptions(int argc, char* argv[], Options& options)
+{
+    for (int i = 1; i < argc; i++) {
+        const char* name = argv[i];
+
+        if (!std::strcmp(name, "--echo")) {
+            options.echo = true;
+            continue;
+        } else if (!std::strcmp(name, "--respond")) {
+            options.respond = true;
+            continue;
+        }
+
+        if (i + 1 >= argc)
+            return false;
+
+        const char* value = argv[++i];
+
+        if (!std::strcmp(name, "--link"))
+            options.link = value;
+        else if (!std::strcmp(name, "--baud"))
+            options.baud = static_cast<uint32_t>(std::strtoul(value, nullptr, 0));
+        else if (!std::strcmp(name, "--buffer"))
+            options.buffer = std::strtoul(value, nullptr, 0);
+        else if (!std::strcmp(name, "--bitrate"))
+            options.bitrate = static_cast<uint32_t>(std::strtoul(value, nullptr, 0));
+        else if (!std::strcmp(name, "--drop"))
+            options.drop = std::atof(value);
+        else if (!std::strcmp(name, "--seed"))
+            options.seed = static_cast<uint32_t>(std::strtoul(value, nullptr, 0));
+        else if (!std::strcmp(name, "--stats"))
+            options.stats = static_cast<uint32_t>(std::strtoul(value, nullptr, 0));
+        else
+            return false;
+    }
+
+    return (options.bitrate > 0) && (options.drop >= 0.0) && (options.drop <= 1.0);
+}
+
+//! Opens pty pair, returns master descriptor and sets \a slave descriptor and \a slave_name.
+int OpenPty(int& slave, std::string& slave_name)
+{
+    int master = posix_openpt(O_RDWR | O_NOCTTY);
+    if ((master < 0) || grantpt(master) || unlockpt(master)) {
+        std::perror("posix_openpt");
+        return -1;
+    }
+
+    slave_name = ptsname(master);
+
+    // Emulator keeps slave open, so master does not report hang up while host is not connected.
+    slave = open(slave_name.c_str(), O_RDWR | O_NOCTTY);
+    if (slave < 0) {
+        std::perror(slave_name.c_str());
+        close(master);
+        return -1;
+    }
+
+    termios tio;
+    if (tcgetattr(slave, &tio) == 0) {
+        cfmakeraw(&tio);
+        tcsetattr(slave, TCSANOW, &tio);
+    }
+
+    fcntl(master, F_SETFL, fcntl(master, F_GETFL) | O_NONBLOCK);
+    return master;
+}
+
+void HandleSignal(int)
+{
+    stop = 1;
+}
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+    Options options;
+
+    if (!ParseOptions(argc, argv, options)) {
+        std::fprintf(stderr, "Usage: %s [--link PATH] [--baud N] [--buffer BYTES] [--bitrate N]\n"
+                             "       [--drop P] [--echo] [--respond] [--seed N] [--stats S]\n", argv[0]);
+        return 2;
+    }
+
+    int slave = -1;
+    std::string slave_name;
+    int master = OpenPty(slave, slave_name);
+    if (master < 0)
+        return 1;
+
+    if (!options.link.empty()) {
+        unlink(options.link.c_str());
+        if (symlink(slave_name.c_str(), options.link.c_str())) {
+            std::perror(options.link.c_str());
+            return 1;
+        }
+    }
+
+    std::printf("%s\n", slave_name.c_str());
+    std::fflush(stdout);
+
+    signal(SIGINT, HandleSignal);
+    signal(SIGTERM, HandleSignal);
+
+    Stats stats;
+    Dongle dongle(options, stats);
+    SlipDecoder decoder;
+    Clock::time_point now = Clock::now();
+    RateLimit rx_limit(options.baud, now);
+    RateLimit tx_limit(options.baud, now);
+    Clock::time_point next_stats = now + std::chrono::seconds(options.stats);
+    std::vector<uint8_t> buffer(4096);
+
+    while (!stop) {
+        now = Clock::now();
+        dongle.Poll(now);
+
+        size_t rx_budget = rx_limit.Available(now);
+        size_t tx_budget = tx_limit.Available(now);
+        std::deque<uint8_t>& output = dongle.Output();
+
+        // Wake up for next bus event, rate limit refill or statistics.
+        Clock::time_point wake = std::min(dongle.NextEvent(), now + std::chrono::milliseconds(100));
+        if (rx_budget == 0)
+            wake = std::min(wake, now + rx_limit.Wait());
+        if (!output.empty() && (tx_budget == 0))
+            wake = std::min(wake, now + tx_limit.Wait());
+        if (options.stats)
+            wake = std::min(wake, next_stats);
+
+        pollfd fd = {master, 0, 0};
+        if (rx_budget > 0)
+            fd.events |= POLLIN;
+        if (!output.empty() && (tx_budget > 0))
+            fd.events |= POLLOUT;
+
+        auto timeout = std::chrono::duration_cast<std::chrono::microseconds>(wake - now).count();
+        int ret = poll(&fd, 1, static_cast<int>(std::max<int64_t>(0, (timeout + 999) / 1000)));
+
+        if ((ret < 0) && (errno != EINTR)) {
+            std::perror("poll");
+            break;
+        }
+
+        now = Clock::now();
+
+        if ((ret > 0) && (fd.revents & POLLIN)) {
+            ssize_t n = read(master, buffer.data(), std::min(buffer.size(), rx_budget));
+
+            if (n > 0) {
+                rx_limit.Consume(static_cast<size_t>(n));
+                stats.bytes_in += static_cast<uint64_t>(n);
+
+                for (ssize_t i = 0; i < n; i++) {
+                    if (decoder.Feed(buffer[static_cast<size_t>(i)]))
+                        dongle.Received(decoder.cmd, decoder.payload, now);
+                }
+            }
+        }
+
+        if ((ret > 0) && (fd.revents & POLLOUT)) {
+            size_t count = std::min({output.size(), tx_budget, buffer.size()});
+            std::copy(output.begin(), output.begin() + static_cast<std::ptrdiff_t>(count), buffer.begin());
+            ssize_t n = write(master, buffer.data(), count);
+
+            if (n > 0) {
+                tx_limit.Consume(static_cast<size_t>(n));
+                stats.bytes_out += static_cast<uint64_t>(n);
+                output.erase(output.begin(), output.begin() + n);
+            }
+        }
+
+        if (options.stats && (now >= next_stats)) {
+            PrintStats(stats, dongle.Used());
+            next_stats = now + std::chrono::seconds(options.stats);
+        }
+    }
+
+    PrintStats(stats, dongle.Used());
+
+    if (!options.link.empty())
+        unlink(options.link.c_str());
+
+    close(slave);
+    close(master);
+    return 0;
+}
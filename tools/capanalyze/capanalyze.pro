@@ -0,0 +1,20 @@
+# See the file "LICENSE.txt" for the full license governing this code.
+#
+# Parallel analysis of binary CAN capture.
+
+QT += core
+QT -= gui
+
+TARGET = capanalyze
+TEMPLATE = app
+
+DEFINES += QT_DEPRECATED_WARNINGS
+DEFINES += QT_USE_QSTRINGBUILDER
+
+CONFIG += c++14 strict_c++ warn_on console thread cants_capture
+CONFIG -= app_bundle
+
+include(../../cants.pri)
+
+SOURCES += \
+        main.cpp
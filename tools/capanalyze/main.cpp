@@ -0,0 +1,785 @@
+/* See the file "LICENSE.txt" for the full license governing this code. */
+
+// Parallel analysis of binary CAN capture (see sky::CaptureWriter).
+//
+// Usage: capanalyze <capture> [--threads N] [--shards N] [--timeout S] [--overlap S]
+//                   [--interval S] [--bitrate B] [--json FILE] [--csv PREFIX]
+//                   [--sessions FILE] [--verify]
+//
+// All segments of the capture are memory-mapped and split into time shards
+// of equal record count (time stamps are converted to Unix epoch time with
+// the offset of each segment, so segments appended by later runs, whose
+// trace clock started anew, continue the timeline), which worker threads (--threads, all cores by
+// default) analyze with sky::BusAnalyzer per bus. Each shard is fed from
+// --overlap seconds before its start, so transfers in progress at the
+// boundary are known, and past its end until transfers started in it have
+// ended; every transfer is counted by the shard it started in. Results equal
+// sequential analysis, except for transfers crossing a shard boundary which
+// last longer than --overlap. --verify also analyzes the capture sequentially
+// (one shard) and exits with 1 if any result differs, e.g. on a synthetic
+// capture of tools/capgen.
+//
+// Prints summary tables of transfers per node pair, latency per node,
+// failure causes per transfer type and bus utilization per --interval
+// (frame bits without stuff bits at --bitrate). --json writes all results,
+// --csv writes PREFIX-pairs.csv, PREFIX-nodes.csv and PREFIX-utilization.csv
+// and --sessions every transfer as CSV.
+
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QString>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <vector>
+#include "cantsanalyzer.h"
+#include "cantscapture.h"
+
+namespace
+{
+
+using sky::BusAnalyzer;
+using sky::CaptureRecord;
+
+struct Options {
+    std::string capture;
+    unsigned threads = 0;
+    unsigned shards = 0;
+    double timeout_s = 1.0;
+    double overlap_s = 10.0;
+    double interval_s = 1.0;
+    double bitrate = 1000000.0;
+    std::string json;
+    std::string csv;
+    std::string sessions;
+    bool verify = false;
+};
+
+bool ParseOptions(int argc, char* argv[], Options& options)
+{
+    for (int i = 1; i < argc; i++) {
+        const char* name = argv[i];
+
+        if (name[0] != '-') {
+            options.capture = name;
+            continue;
+        }
+
+        if (!std::strcmp(name, "--verify")) {
+            options.verify = true;
+            continue;
+        }
+
+        if (i + 1 >= argc)
+            return false;
+
+        const char* value = argv[++i];
+
+        if (!std::strcmp(name, "--threads"))
+            options.threads = static_cast<unsigned>(std::strtoul(value, nullptr, 0));
+        else if (!std::strcmp(name, "--shards"))
+            options.shards = static_cast<unsigned>(std::strtoul(value, nullptr, 0));
+        else if (!std::strcmp(name, "--timeout"))
+            options.timeout_s = std::atof(value);
+        else if (!std::strcmp(name, "--overlap"))
+            options.overlap_s = std::atof(value);
+        else if (!std::strcmp(name, "--interval"))
+            options.interval_s = std::atof(value);
+        else if (!std::strcmp(name, "--bitrate"))
+            options.bitrate = std::atof(value);
+        else if (!std::strcmp(name, "--json"))
+            options.json = value;
+        else if (!std::strcmp(name, "--csv"))
+            options.csv = value;
+        else if (!std::strcmp(name, "--sessions"))
+            options.sessions = value;
+        else
+            return false;
+    }
+
+    return !options.capture.empty() && (options.timeout_s > 0) && (options.overlap_s >= 0) &&
+           (options.interval_s > 0) && (options.bitrate > 0);
+}
+
+uint64_t Nanoseconds(double seconds)
+{
+    return static_cast<uint64_t>(seconds * 1e9);
+}
+
+double Seconds(uint64_t nanoseconds)
+{
+    return static_cast<double>(nanoseconds) / 1e9;
+}
+
+//! Returns bits of \a record on the bus (without stuff bits).
+uint64_t FrameBits(const CaptureRecord& record)
+{
+    uint64_t length = std::min<uint64_t>(record.length, sizeof(record.data));
+    uint64_t data = (record.flags & CaptureRecord::kRtr) ? 0 : 8 * length;
+
+    // SOF, arbitration, control, CRC, ACK, EOF and intermission.
+    return ((record.flags & CaptureRecord::kExtId) ? 67 : 47) + data;
+}
+
+//! All segments of a capture mapped as one sequence of records stamped with epoch time.
+class Capture {
+public:
+    //! Maps segments of capture \a path. Returns false if there are none or one is invalid.
+    bool Open(const QString& path)
+    {
+        for (const auto& file : sky::CaptureReader::SegmentFiles(path)) {
+            std::unique_ptr<sky::CaptureReader> reader(new sky::CaptureReader);
+
+            if (!reader->Open(file)) {
+                std::fprintf(stderr, "Invalid segment %s\n", file.toLocal8Bit().constData());
+                return false;
+            }
+
+            if (reader->GetCount())
+                readers_.push_back(std::move(reader));
+        }
+
+        // Segments of each run are in order, runs are ordered by epoch time of their first record.
+        std::stable_sort(readers_.begin(), readers_.end(), [](const std::unique_ptr<sky::CaptureReader>& a,
+                                                              const std::unique_ptr<sky::CaptureReader>& b) {
+            return Epoch(a->GetRecords()[0], a->GetEpochOffset()) < Epoch(b->GetRecords()[0], b->GetEpochOffset());
+        });
+
+        for (const auto& reader : readers_)
+            offsets_.push_back(offsets_.back() + reader->GetCount());
+
+        return !readers_.empty();
+    }
+
+    uint64_t GetCount() const
+    {
+        return offsets_.back();
+    }
+
+    size_t GetSegmentCount() const
+    {
+        return readers_.size();
+    }
+
+    //! Returns record at \a index stamped with epoch time.
+    CaptureRecord At(uint64_t index) const
+    {
+        size_t segment = static_cast<size_t>(std::upper_bound(offsets_.begin(), offsets_.end(), index) - offsets_.begin()) - 1;
+        CaptureRecord record = readers_[segment]->GetRecords()[index - offsets_[segment]];
+        record.timestamp = Epoch(record, readers_[segment]->GetEpochOffset());
+        return record;
+    }
+
+    //! Returns index of first record stamped at or after \a timestamp (records are in time order).
+    uint64_t LowerBound(uint64_t timestamp) const
+    {
+        uint64_t first = 0;
+        uint64_t count = GetCount();
+
+        while (count > 0) {
+            uint64_t step = count / 2;
+
+            if (At(first + step).timestamp < timestamp) {
+                first += step + 1;
+                count -= step + 1;
+            } else {
+                count = step;
+            }
+        }
+
+        return first;
+    }
+
+    //! Calls \a visitor with records (stamped with epoch time) from \a index on while it returns true. Returns true if all were visited.
+    template <typename Visitor>
+    bool Scan(uint64_t index, Visitor visitor) const
+    {
+        for (size_t segment = 0; segment < readers_.size(); segment++) {
+            if (index >= offsets_[segment + 1])
+                continue;
+
+            const CaptureRecord* records = readers_[segment]->GetRecords();
+            uint64_t count = offsets_[segment + 1] - offsets_[segment];
+            int64_t epoch_offset = readers_[segment]->GetEpochOffset();
+
+            for (uint64_t i = std::max(index, offsets_[segment]) - offsets_[segment]; i < count; i++) {
+                CaptureRecord record = records[i];
+                record.timestamp = Epoch(record, epoch_offset);
+
+                if (!visitor(record))
+                    return false;
+            }
+        }
+
+        return true;
+    }
+
+private:
+    //! Returns time stamp of \a record in nanoseconds since Unix epoch.
+    static uint64_t Epoch(const CaptureRecord& record, int64_t epoch_offset)
+    {
+        return static_cast<uint64_t>(static_cast<int64_t>(record.timestamp) + epoch_offset);
+    }
+
+    std::vector<std::unique_ptr<sky::CaptureReader>> readers_; //!< Mapped segments.
+    std::vector<uint64_t> offsets_ {0}; //!< Index of first record of each segment, then record count.
+};
+
+//! Frames on a bus in one utilization interval.
+struct Traffic {
+    uint64_t frames = 0;
+    uint64_t bits = 0;
+};
+
+//! Analysis of one bus.
+struct BusResult {
+    explicit BusResult(uint64_t timeout) : analyzer(timeout) {}
+
+    BusAnalyzer analyzer;
+    std::map<uint64_t, Traffic> timeline; //!< Traffic by interval index.
+};
+
+//! Analysis of one time shard.
+struct ShardResult {
+    uint64_t begin = 0; //!< Start of shard window.
+    uint64_t end = 0; //!< End of shard window.
+    std::array<std::unique_ptr<BusResult>, 256> buses; //!< Analysis by bus.
+    std::string sessions; //!< CSV lines of sessions started in shard.
+};
+
+//! Returns CSV line of \a session on \a bus, times relative to \a t0.
+std::string SessionLine(uint8_t bus, const BusAnalyzer::Session& session, uint64_t t0)
+{
+    char line[256];
+    std::snprintf(line, sizeof(line), "%u,%s,%u,%u,%u,%s,%.9f,%" PRIu64 ",%" PRIu64 ",%u,%u,%u,%u\n",
+                  bus, BusAnalyzer::TypeName(session.type), session.client, session.node, session.channel,
+                  BusAnalyzer::OutcomeName(session.outcome), Seconds(session.start - std::min(session.start, t0)),
+                  (session.end - std::min(session.end, session.start)) / 1000, session.latency / 1000,
+                  session.frames, session.retransmissions, session.nacks, session.blocks);
+    return line;
+}
+
+void AnalyzeShard(const Capture& capture, const Options& options, uint64_t t0, ShardResult& result)
+{
+    uint64_t timeout = Nanoseconds(options.timeout_s);
+    uint64_t interval = std::max<uint64_t>(Nanoseconds(options.interval_s), 1);
+    uint64_t overlap = Nanoseconds(options.overlap_s);
+    uint64_t from = capture.LowerBound(result.begin - std::min(result.begin, overlap));
+
+    // Past the window only transfers started in it are followed.
+    auto settled = [&result]() {
+        return std::all_of(result.buses.begin(), result.buses.end(), [](const std::unique_ptr<BusResult>& bus) {
+            return !bus || !bus->analyzer.GetOpenSessions();
+        });
+    };
+
+    bool finished = capture.Scan(from, [&](const CaptureRecord& record) {
+        if ((record.timestamp >= result.end) && settled())
+            return false;
+
+        std::unique_ptr<BusResult>& bus = result.buses[record.bus];
+
+        if (!bus) {
+            bus.reset(new BusResult(timeout));
+            bus->analyzer.SetWindow(result.begin, result.end);
+
+            if (!options.sessions.empty()) {
+                uint8_t number = record.bus;
+                bus->analyzer.SetSessionHandler([&result, number, t0](const BusAnalyzer::Session& session) {
+                    result.sessions += SessionLine(number, session, t0);
+                });
+            }
+        }
+
+        bus->analyzer.Process(record);
+
+        if ((record.timestamp >= result.begin) && (record.timestamp < result.end) &&
+            (record.direction != static_cast<uint8_t>(sky::CaptureDirection::kTxError))) {
+            Traffic& traffic = bus->timeline[(record.timestamp - std::min(record.timestamp, t0)) / interval];
+            traffic.frames++;
+            traffic.bits += FrameBits(record);
+        }
+
+        return true;
+    });
+
+    // Transfers still open at the end of the capture are unfinished.
+    if (finished) {
+        for (auto& bus : result.buses) {
+            if (bus)
+                bus->analyzer.Finish();
+        }
+    }
+}
+
+//! Merged results of all shards.
+struct Totals {
+    std::map<uint8_t, std::unique_ptr<BusResult>> buses; //!< Analysis by bus.
+    std::map<std::tuple<uint8_t, uint8_t, uint8_t>, BusAnalyzer::PairStats> nodes; //!< Statistics by bus, node and type.
+    std::map<std::tuple<uint8_t, uint8_t>, BusAnalyzer::PairStats> types; //!< Statistics by bus and type.
+};
+
+Totals Merge(const std::vector<ShardResult>& shards, uint64_t timeout)
+{
+    Totals totals;
+
+    for (const auto& shard : shards) {
+        for (size_t number = 0; number < shard.buses.size(); number++) {
+            const std::unique_ptr<BusResult>& bus = shard.buses[number];
+
+            if (!bus)
+                continue;
+
+            std::unique_ptr<BusResult>& total = totals.buses[static_cast<uint8_t>(number)];
+
+            if (!total)
+                total.reset(new BusResult(timeout));
+
+            total->analyzer.Merge(bus->analyzer);
+
+            for (const auto& traffic : bus->timeline) {
+                total->timeline[traffic.first].frames += traffic.second.frames;
+                total->timeline[traffic.first].bits += traffic.second.bits;
+            }
+        }
+    }
+
+    for (const auto& bus : totals.buses) {
+        for (const auto& pair : bus.second->analyzer.GetStats()) {
+            auto type = static_cast<uint8_t>(pair.first >> 16);
+            auto node = static_cast<uint8_t>(pair.first);
+            totals.nodes[std::make_tuple(bus.first, node, type)].Merge(pair.second);
+            totals.types[std::make_tuple(bus.first, type)].Merge(pair.second);
+        }
+    }
+
+    return totals;
+}
+
+//! Returns true if histograms \a a and \a b are equal.
+bool Equal(const sky::MetricHistogram::Snapshot& a, const sky::MetricHistogram::Snapshot& b)
+{
+    return (a.count == b.count) && (a.sum == b.sum) && (a.max == b.max) && (a.buckets == b.buckets);
+}
+
+//! Returns true if statistics \a a and \a b are equal.
+bool Equal(const BusAnalyzer::PairStats& a, const BusAnalyzer::PairStats& b)
+{
+    return (a.sessions == b.sessions) && (a.outcomes == b.outcomes) && (a.frames == b.frames) &&
+           (a.retransmissions == b.retransmissions) && (a.nacks == b.nacks) && Equal(a.latency, b.latency) &&
+           Equal(a.duration, b.duration);
+}
+
+//! Compares \a totals with \a reference, prints differences. Returns number of differences.
+uint64_t Compare(const Totals& totals, const Totals& reference)
+{
+    uint64_t differences = 0;
+
+    // Only the first differences are printed.
+    auto differ = [&differences](unsigned bus, const char* what, uint32_t pair) {
+        if (differences++ >= 10)
+            return;
+
+        if (what)
+            std::fprintf(stderr, "Bus %u: %s differ\n", bus, what);
+        else
+            std::fprintf(stderr, "Bus %u: %s 0x%02X-0x%02X differs\n", bus,
+                         BusAnalyzer::TypeName(static_cast<uint8_t>(pair >> 16)), (pair >> 8) & 0xFF, pair & 0xFF);
+    };
+
+    if (totals.buses.size() != reference.buses.size())
+        differ(0, "buses", 0);
+
+    for (const auto& bus : reference.buses) {
+        auto it = totals.buses.find(bus.first);
+
+        if (it == totals.buses.end()) {
+            differ(bus.first, "frames", 0);
+            continue;
+        }
+
+        const BusAnalyzer& analyzer = it->second->analyzer;
+        const BusAnalyzer::Counters& a = analyzer.GetCounters();
+        const BusAnalyzer::Counters& b = bus.second->analyzer.GetCounters();
+
+        if ((a.frames != b.frames) || (a.time_sync != b.time_sync) || (a.keep_alive != b.keep_alive) ||
+            (a.unsolicited != b.unsolicited) || (a.unmatched != b.unmatched) || (a.invalid != b.invalid))
+            differ(bus.first, "counters", 0);
+
+        if (analyzer.GetStats().size() != bus.second->analyzer.GetStats().size())
+            differ(bus.first, "node pairs", 0);
+
+        for (const auto& pair : bus.second->analyzer.GetStats()) {
+            auto stats = analyzer.GetStats().find(pair.first);
+
+            if ((stats == analyzer.GetStats().end()) || !Equal(stats->second, pair.second))
+                differ(bus.first, nullptr, pair.first);
+        }
+
+        const std::map<uint64_t, Traffic>& timeline = it->second->timeline;
+
+        if ((timeline.size() != bus.second->timeline.size()) ||
+            !std::equal(timeline.begin(), timeline.end(), bus.second->timeline.begin(),
+                        [](const std::pair<const uint64_t, Traffic>& x, const std::pair<const uint64_t, Traffic>& y) {
+                return (x.first == y.first) && (x.second.frames == y.second.frames) && (x.second.bits == y.second.bits);
+            }))
+            differ(bus.first, "utilization intervals", 0);
+    }
+
+    return differences;
+}
+
+//! Returns number of failed sessions (all but completed).
+uint64_t Failed(const BusAnalyzer::PairStats& stats)
+{
+    return stats.sessions - stats.outcomes[static_cast<size_t>(BusAnalyzer::Outcome::kCompleted)];
+}
+
+uint64_t Outcome(const BusAnalyzer::PairStats& stats, BusAnalyzer::Outcome outcome)
+{
+    return stats.outcomes[static_cast<size_t>(outcome)];
+}
+
+//! Utilization summary of a bus.
+struct Utilization {
+    double mean = 0.0;
+    double peak = 0.0;
+    uint64_t first = 0; //!< First interval index.
+    uint64_t last = 0; //!< Last interval index.
+};
+
+Utilization GetUtilization(const BusResult& bus, const Options& options)
+{
+    Utilization utilization;
+
+    if (bus.timeline.empty())
+        return utilization;
+
+    double capacity = options.bitrate * options.interval_s;
+    uint64_t bits = 0;
+
+    for (const auto& traffic : bus.timeline) {
+        bits += traffic.second.bits;
+        utilization.peak = std::max(utilization.peak, static_cast<double>(traffic.second.bits) / capacity);
+    }
+
+    utilization.first = bus.timeline.begin()->first;
+    utilization.last = bus.timeline.rbegin()->first;
+    utilization.mean = static_cast<double>(bits) / (capacity * static_cast<double>(utilization.last - utilization.first + 1));
+    return utilization;
+}
+
+void PrintSummary(const Totals& totals, const Options& options)
+{
+    for (const auto& bus : totals.buses) {
+        const BusAnalyzer::Counters& counters = bus.second->analyzer.GetCounters();
+        Utilization utilization = GetUtilization(*bus.second, options);
+
+        std::printf("Bus %u: %" PRIu64 " frames (time sync %" PRIu64 ", keep alive %" PRIu64 ", unsolicited %" PRIu64
+                    ", unmatched %" PRIu64 ", invalid %" PRIu64 "), utilization mean %.1f %% peak %.1f %% per %g s\n",
+                    bus.first, counters.frames, counters.time_sync, counters.keep_alive, counters.unsolicited,
+                    counters.unmatched, counters.invalid, 100.0 * utilization.mean, 100.0 * utilization.peak,
+                    options.interval_s);
+    }
+
+    std::printf("\nTransfers per node pair (latency in usec)\n");
+    std::printf("%3s %4s %6s %6s %9s %9s %7s %7s %7s %7s %7s %7s %9s %9s %9s\n", "bus", "type", "client", "node",
+                "sessions", "completed", "nacked", "aborted", "superse", "timeout", "unfin", "retx", "lat p50",
+                "lat p99", "lat max");
+
+    for (const auto& bus : totals.buses) {
+        for (const auto& pair : bus.second->analyzer.GetStats()) {
+            const BusAnalyzer::PairStats& stats = pair.second;
+            std::printf("%3u %4s   0x%02X   0x%02X %9" PRIu64 " %9" PRIu64 " %7" PRIu64 " %7" PRIu64 " %7" PRIu64
+                        " %7" PRIu64 " %7" PRIu64 " %7" PRIu64 " %9" PRIu64 " %9" PRIu64 " %9" PRIu64 "\n",
+                        bus.first, BusAnalyzer::TypeName(static_cast<uint8_t>(pair.first >> 16)),
+                        (pair.first >> 8) & 0xFF, pair.first & 0xFF, stats.sessions,
+                        Outcome(stats, BusAnalyzer::Outcome::kCompleted), Outcome(stats, BusAnalyzer::Outcome::kNacked),
+                        Outcome(stats, BusAnalyzer::Outcome::kAborted), Outcome(stats, BusAnalyzer::Outcome::kSuperseded),
+                        Outcome(stats, BusAnalyzer::Outcome::kTimedOut), Outcome(stats, BusAnalyzer::Outcome::kUnfinished),
+                        stats.retransmissions, stats.latency.ValueAtQuantile(0.5), stats.latency.ValueAtQuantile(0.99),
+                        stats.latency.max);
+        }
+    }
+
+    std::printf("\nLatency per node (usec)\n");
+    std::printf("%3s %6s %4s %9s %9s %9s %9s %9s %9s\n", "bus", "node", "type", "sessions", "failed", "mean", "p50",
+                "p99", "max");
+
+    for (const auto& node : totals.nodes) {
+        const BusAnalyzer::PairStats& stats = node.second;
+        double mean = stats.latency.count ? static_cast<double>(stats.latency.sum) / static_cast<double>(stats.latency.count) : 0.0;
+        std::printf("%3u   0x%02X %4s %9" PRIu64 " %9" PRIu64 " %9.0f %9" PRIu64 " %9" PRIu64 " %9" PRIu64 "\n",
+                    std::get<0>(node.first), std::get<1>(node.first), BusAnalyzer::TypeName(std::get<2>(node.first)),
+                    stats.sessions, Failed(stats), mean, stats.latency.ValueAtQuantile(0.5),
+                    stats.latency.ValueAtQuantile(0.99), stats.latency.max);
+    }
+
+    std::printf("\nFailure causes per transfer type\n");
+    std::printf("%3s %4s %9s %9s %9s %9s %9s %9s %9s %9s %9s\n", "bus", "type", "sessions", "failed", "nacked",
+                "aborted", "supersede", "timed out", "unfinish", "nacks", "retx");
+
+    for (const auto& type : totals.types) {
+        const BusAnalyzer::PairStats& stats = type.second;
+        std::printf("%3u %4s %9" PRIu64 " %9" PRIu64 " %9" PRIu64 " %9" PRIu64 " %9" PRIu64 " %9" PRIu64 " %9" PRIu64
+                    " %9" PRIu64 " %9" PRIu64 "\n",
+                    std::get<0>(type.first), BusAnalyzer::TypeName(std::get<1>(type.first)), stats.sessions,
+                    Failed(stats), Outcome(stats, BusAnalyzer::Outcome::kNacked),
+                    Outcome(stats, BusAnalyzer::Outcome::kAborted), Outcome(stats, BusAnalyzer::Outcome::kSuperseded),
+                    Outcome(stats, BusAnalyzer::Outcome::kTimedOut), Outcome(stats, BusAnalyzer::Outcome::kUnfinished),
+                    stats.nacks, stats.retransmissions);
+    }
+}
+
+bool WriteCsv(const Totals& totals, const Options& options)
+{
+    std::string prefix = options.csv;
+    FILE* pairs = std::fopen((prefix + "-pairs.csv").c_str(), "w");
+    FILE* nodes = std::fopen((prefix + "-nodes.csv").c_str(), "w");
+    FILE* utilization = std::fopen((prefix + "-utilization.csv").c_str(), "w");
+    bool ok = pairs && nodes && utilization;
+
+    if (ok) {
+        std::fprintf(pairs, "bus,type,client,node,sessions,completed,nacked,aborted,superseded,timed_out,unfinished,"
+                            "frames,retransmissions,nacks,latency_count,latency_p50_us,latency_p99_us,latency_max_us,"
+                            "duration_p50_us,duration_p99_us,duration_max_us\n");
+
+        for (const auto& bus : totals.buses) {
+            for (const auto& pair : bus.second->analyzer.GetStats()) {
+                const BusAnalyzer::PairStats& stats = pair.second;
+                std::fprintf(pairs, "%u,%s,%u,%u", bus.first, BusAnalyzer::TypeName(static_cast<uint8_t>(pair.first >> 16)),
+                             (pair.first >> 8) & 0xFF, pair.first & 0xFF);
+
+                for (uint64_t value : {stats.sessions, stats.outcomes[0], stats.outcomes[1], stats.outcomes[2],
+                                       stats.outcomes[3], stats.outcomes[4], stats.outcomes[5], stats.frames,
+                                       stats.retransmissions, stats.nacks, stats.latency.count,
+                                       stats.latency.ValueAtQuantile(0.5), stats.latency.ValueAtQuantile(0.99),
+                                       stats.latency.max, stats.duration.ValueAtQuantile(0.5),
+                                       stats.duration.ValueAtQuantile(0.99), stats.duration.max})
+                    std::fprintf(pairs, ",%" PRIu64, value);
+
+                std::fprintf(pairs, "\n");
+            }
+        }
+
+        std::fprintf(nodes, "bus,node,type,sessions,failed,latency_count,latency_p50_us,latency_p99_us,latency_max_us\n");
+
+        for (const auto& node : totals.nodes) {
+            const BusAnalyzer::PairStats& stats = node.second;
+            std::fprintf(nodes, "%u,%u,%s,%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 "\n",
+                         std::get<0>(node.first), std::get<1>(node.first), BusAnalyzer::TypeName(std::get<2>(node.first)),
+                         stats.sessions, Failed(stats), stats.latency.count, stats.latency.ValueAtQuantile(0.5),
+                         stats.latency.ValueAtQuantile(0.99), stats.latency.max);
+        }
+
+        // Intervals without frames are written as idle.
+        std::fprintf(utilization, "bus,time_s,frames,bits,utilization\n");
+        double capacity = options.bitrate * options.interval_s;
+
+        for (const auto& bus : totals.buses) {
+            Utilization summary = GetUtilization(*bus.second, options);
+
+            for (uint64_t index = summary.first; !bus.second->timeline.empty() && (index <= summary.last); index++) {
+                auto it = bus.second->timeline.find(index);
+                Traffic traffic = (it != bus.second->timeline.end()) ? it->second : Traffic();
+                std::fprintf(utilization, "%u,%.6f,%" PRIu64 ",%" PRIu64 ",%.6f\n", bus.first,
+                             static_cast<double>(index) * options.interval_s, traffic.frames, traffic.bits,
+                             static_cast<double>(traffic.bits) / capacity);
+            }
+        }
+    }
+
+    for (FILE* file : {pairs, nodes, utilization}) {
+        if (file)
+            ok = (std::fclose(file) == 0) && ok;
+    }
+
+    return ok;
+}
+
+QJsonObject ToJson(const Totals& totals, const Options& options, const QJsonObject& capture, const QJsonObject& analysis)
+{
+    QJsonArray buses;
+    double capacity = options.bitrate * options.interval_s;
+
+    for (const auto& bus : totals.buses) {
+        Utilization summary = GetUtilization(*bus.second, options);
+        QJsonArray timeline;
+
+        for (const auto& traffic : bus.second->timeline) {
+            QJsonObject interval;
+            interval["time_s"] = static_cast<double>(traffic.first) * options.interval_s;
+            interval["frames"] = static_cast<double>(traffic.second.frames);
+            interval["utilization"] = static_cast<double>(traffic.second.bits) / capacity;
+            timeline.append(interval);
+        }
+
+        QJsonObject utilization;
+        utilization["interval_s"] = options.interval_s;
+        utilization["bitrate"] = options.bitrate;
+        utilization["mean"] = summary.mean;
+        utilization["peak"] = summary.peak;
+        utilization["timeline"] = timeline;
+
+        QJsonObject json = bus.second->analyzer.ToJson();
+        json["bus"] = static_cast<int>(bus.first);
+        json["utilization"] = utilization;
+        buses.append(json);
+    }
+
+    QJsonArray nodes;
+
+    for (const auto& node : totals.nodes) {
+        QJsonObject json = BusAnalyzer::ToJson(BusAnalyzer::PairKey(std::get<2>(node.first), 0, std::get<1>(node.first)), node.second);
+        json.remove("client");
+        json["bus"] = static_cast<int>(std::get<0>(node.first));
+        nodes.append(json);
+    }
+
+    QJsonObject result;
+    result["capture"] = capture;
+    result["analysis"] = analysis;
+    result["buses"] = buses;
+    result["nodes"] = nodes;
+    return result;
+}
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+    Options options;
+
+    if (!ParseOptions(argc, argv, options)) {
+        std::fprintf(stderr, "Usage: %s <capture> [--threads N] [--shards N] [--timeout S] [--overlap S]\n"
+                             "       [--interval S] [--bitrate B] [--json FILE] [--csv PREFIX] [--sessions FILE]\n"
+                             "       [--verify]\n",
+                     argv[0]);
+        return 2;
+    }
+
+    Capture capture;
+
+    if (!capture.Open(QString::fromLocal8Bit(options.capture.c_str()))) {
+        std::fprintf(stderr, "No capture %s\n", options.capture.c_str());
+        return 1;
+    }
+
+    unsigned threads = options.threads ? options.threads : std::max(std::thread::hardware_concurrency(), 1U);
+
+    // Several shards per thread balance load, shards are not made smaller than overlap is worth (unless given).
+    constexpr uint64_t kMinShardRecords = 1 << 16;
+    uint64_t count = capture.GetCount();
+    uint64_t shard_count = options.shards ? std::min<uint64_t>(options.shards, count)
+                                          : std::min<uint64_t>(4ULL * threads, count / kMinShardRecords);
+    shard_count = std::max<uint64_t>(shard_count, 1);
+
+    uint64_t t0 = capture.At(0).timestamp;
+    std::vector<ShardResult> shards(static_cast<size_t>(shard_count));
+
+    // Shard windows adjoin, first and last are open ended.
+    for (size_t i = 1; i < shards.size(); i++) {
+        shards[i].begin = std::max(capture.At(i * count / shard_count).timestamp, shards[i - 1].begin);
+        shards[i - 1].end = shards[i].begin;
+    }
+
+    shards.back().end = UINT64_MAX;
+
+    auto start = std::chrono::steady_clock::now();
+    std::atomic<size_t> next{0};
+    std::vector<std::thread> workers;
+
+    for (unsigned i = 0; i < std::min<uint64_t>(threads, shard_count); i++) {
+        workers.emplace_back([&]() {
+            for (size_t shard; (shard = next.fetch_add(1)) < shards.size();)
+                AnalyzeShard(capture, options, t0, shards[shard]);
+        });
+    }
+
+    for (auto& worker : workers)
+        worker.join();
+
+    double wall_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    Totals totals = Merge(shards, Nanoseconds(options.timeout_s));
+
+    uint64_t t1 = capture.At(count - 1).timestamp;
+    std::printf("Capture %s: %zu segments, %" PRIu64 " records, %.3f s\n", options.capture.c_str(),
+                capture.GetSegmentCount(), count, Seconds(t1 - std::min(t1, t0)));
+    std::printf("Analyzed in %zu shards on %zu threads: %.3f s (%.1f M records/s)\n\n", shards.size(), workers.size(),
+                wall_s, static_cast<double>(count) / std::max(wall_s, 1e-9) / 1e6);
+    PrintSummary(totals, options);
+
+    bool ok = true;
+
+    if (options.verify) {
+        Options sequential_options = options;
+        sequential_options.sessions.clear();
+
+        std::vector<ShardResult> sequential(1);
+        sequential.front().end = UINT64_MAX;
+        AnalyzeShard(capture, sequential_options, t0, sequential.front());
+
+        uint64_t differences = Compare(totals, Merge(sequential, Nanoseconds(options.timeout_s)));
+        std::printf("\nVerified against sequential analysis: %s (%" PRIu64 " differences)\n",
+                    differences ? "DIFFERENT" : "equal", differences);
+        ok = !differences;
+    }
+
+    if (!options.csv.empty() && !WriteCsv(totals, options)) {
+        std::fprintf(stderr, "Failed writing %s-*.csv\n", options.csv.c_str());
+        ok = false;
+    }
+
+    if (!options.sessions.empty()) {
+        FILE* file = std::fopen(options.sessions.c_str(), "w");
+        bool written = file && (std::fputs("bus,type,client,node,channel,outcome,start_s,duration_us,latency_us,"
+                                           "frames,retransmissions,nacks,blocks\n", file) >= 0);
+
+        for (const auto& shard : shards)
+            written = written && (std::fwrite(shard.sessions.data(), 1, shard.sessions.size(), file) == shard.sessions.size());
+
+        if (!file || (std::fclose(file) != 0) || !written) {
+            std::fprintf(stderr, "Failed writing %s\n", options.sessions.c_str());
+            ok = false;
+        }
+    }
+
+    if (!options.json.empty()) {
+        QJsonObject capture_json;
+        capture_json["path"] = QString::fromLocal8Bit(options.capture.c_str());
+        capture_json["segments"] = static_cast<double>(capture.GetSegmentCount());
+        capture_json["records"] = static_cast<double>(count);
+        capture_json["start_epoch_s"] = Seconds(t0);
+        capture_json["duration_s"] = Seconds(t1 - std::min(t1, t0));
+
+        QJsonObject analysis;
+        analysis["shards"] = static_cast<double>(shards.size());
+        analysis["threads"] = static_cast<double>(workers.size());
+        analysis["wall_s"] = wall_s;
+        analysis["records_per_s"] = static_cast<double>(count) / std::max(wall_s, 1e-9);
+        analysis["timeout_s"] = options.timeout_s;
+        analysis["overlap_s"] = options.overlap_s;
+
+        QFile file(QString::fromLocal8Bit(options.json.c_str()));
+        QByteArray json = QJsonDocument(ToJson(totals, options, capture_json, analysis)).toJson(QJsonDocument::Indented);
+
+        if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate) || (file.write(json) != json.size())) {
+            std::fprintf(stderr, "Failed writing %s\n", options.json.c_str());
+            ok = false;
+        }
+    }
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,20 @@
+# See the file "LICENSE.txt" for the full license governing this code.
+#
+# Export of binary CAN capture to pcapng, candump log and transfer timeline.
+
+QT += core
+QT -= gui
+
+TARGET = capexport
+TEMPLATE = app
+
+DEFINES += QT_DEPRECATED_WARNINGS
+DEFINES += QT_USE_QSTRINGBUILDER
+
+CONFIG += c++14 strict_c++ warn_on console cants_capture
+CONFIG -= app_bundle
+
+include(../../cants.pri)
+
+SOURCES += \
+        main.cpp
@@ -0,0 +1,45 @@
+/* See the file "LICENSE.txt" for the full license governing this code. */
+
+// Converts binary CAN capture (see sky::CaptureWriter) for standard CAN tools.
+//
+// Usage: capexport [--candump | --chrome] <capture> <output>
+//
+// <capture> is the capture path (segments are listed in its index) or a
+// single segment file. Output is pcapng for Wireshark, candump log for
+// can-utils with --candump, or transfer timeline (Chrome trace event JSON)
+// for Perfetto UI with --chrome.
+
+#include <cstdio>
+#include <cstring>
+#include <QString>
+#include "cantscaptureexport.h"
+
+int main(int argc, char* argv[])
+{
+    bool candump = (argc > 1) && !std::strcmp(argv[1], "--candump");
+    bool chrome = (argc > 1) && !std::strcmp(argv[1], "--chrome");
+    int arg = (candump || chrome) ? 2 : 1;
+
+    if (argc != arg + 2) {
+        std::fprintf(stderr, "Usage: %s [--candump | --chrome] <capture> <output>\n", argv[0]);
+        return 2;
+    }
+
+    QString path = QString::fromLocal8Bit(argv[arg]);
+    QString output = QString::fromLocal8Bit(argv[arg + 1]);
+
+    if (sky::CaptureReader::SegmentFiles(path).empty()) {
+        std::fprintf(stderr, "No capture %s\n", argv[arg]);
+        return 1;
+    }
+
+    auto format = candump ? sky::CaptureExport::Format::kCandump
+                  : chrome ? sky::CaptureExport::Format::kChrome : sky::CaptureExport::Format::kPcapng;
+
+    if (!sky::CaptureExport::Export(path, output, format)) {
+        std::fprintf(stderr, "Failed exporting %s to %s\n", argv[arg], argv[arg + 1]);
+        return 1;
+    }
+
+    return 0;
+}
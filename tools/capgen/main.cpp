@@ -0,0 +1,217 @@
+/* See the file "LICENSE.txt" for the full license governing this code. */
+
+// Writes synthetic binary CAN capture (see sky::CaptureWriter) of CAN TS traffic.
+//
+// Usage: capgen <capture> [--sessions N] [--nodes N] [--buses N] [--seed N]
+//               [--segment N]
+//
+// Client 0x01 runs --sessions transfers with --nodes nodes (from 0x20) on
+// --buses buses in turn, one at a time: telecommands answered with ACK or
+// NACK, telemetry requests answered, NACKed or left unanswered for 2 s,
+// set block and get block transfers, some of them aborted, and time
+// synchronization. Frames are 100 to 150 us apart and time stamps start
+// at the current trace clock. Segments hold --segment records.
+//
+// Transfers are deterministic for --seed (an existing capture is appended
+// to, so use a new path), e.g. to check that sharded analysis of
+// tools/capanalyze equals sequential analysis:
+//
+//     capgen synth --sessions 1000000
+//     capanalyze synth --shards 37 --verify
+
+#include <QString>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+#include "cantscapture.h"
+#include "cantsframe.h"
+#include "cantstrace.h"
+
+namespace
+{
+
+constexpr uint8_t kClientAddress = 0x01;
+constexpr uint8_t kFirstNodeAddress = 0x20;
+constexpr uint64_t kUnansweredGap = 2000000000ULL; //!< Gap after unanswered telemetry request (ns).
+
+struct Options {
+    std::string capture;
+    uint64_t sessions = 100000;
+    uint32_t nodes = 8;
+    uint32_t buses = 2;
+    uint32_t seed = 1;
+    uint64_t segment_records = 1 << 20;
+};
+
+bool ParseOptions(int argc, char* argv[], Options& options)
+{
+    for (int i = 1; i < argc; i++) {
+        const char* name = argv[i];
+
+        if (name[0] != '-') {
+            options.capture = name;
+            continue;
+        }
+
+        if (i + 1 >= argc)
+            return false;
+
+        const char* value = argv[++i];
+
+        if (!std::strcmp(name, "--sessions"))
+            options.sessions = std::strtoull(value, nullptr, 0);
+        else if (!std::strcmp(name, "--nodes"))
+            options.nodes = static_cast<uint32_t>(std::strtoul(value, nullptr, 0));
+        else if (!std::strcmp(name, "--buses"))
+            options.buses = static_cast<uint32_t>(std::strtoul(value, nullptr, 0));
+        else if (!std::strcmp(name, "--seed"))
+            options.seed = static_cast<uint32_t>(std::strtoul(value, nullptr, 0));
+        else if (!std::strcmp(name, "--segment"))
+            options.segment_records = std::strtoull(value, nullptr, 0);
+        else
+            return false;
+    }
+
+    return !options.capture.empty() && (options.nodes >= 1) && (options.nodes <= 200) && (options.buses >= 1) &&
+           (options.buses <= 255) && (options.segment_records >= 1);
+}
+
+//! Synthetic traffic, records are written in time order.
+class Generator {
+public:
+    Generator(sky::CaptureWriter& writer, uint64_t start, uint32_t seed)
+        : writer_(writer), time_(start), random_(seed) {}
+
+    //! Writes one transfer with \a node on \a bus. Returns false if capture cannot be written.
+    bool Session(uint8_t bus, uint8_t node) {
+        bus_ = bus;
+        const std::vector<uint8_t> data(8, 0x55);
+        const std::vector<uint8_t> address = {0x00, 0x10};
+        uint8_t channel = static_cast<uint8_t>(random_() % 3);
+
+        switch (random_() % 5) {
+        case 0:
+            Request(sky::CanTsFrame::CreateTelecommandRequest(node, kClientAddress, channel, data));
+            if (random_() % 4)
+                Response(sky::CanTsFrame::CreateTelecommandAck(kClientAddress, node, channel));
+            else
+                Response(sky::CanTsFrame::CreateTelecommandNack(kClientAddress, node, channel));
+            break;
+        case 1:
+            Request(sky::CanTsFrame::CreateTelemetryRequest(node, kClientAddress, channel));
+            switch (random_() % 5) {
+            case 0:
+                time_ += kUnansweredGap;
+                break;
+            case 1:
+                Response(sky::CanTsFrame::CreateTelemetryNack(kClientAddress, node, channel));
+                break;
+            default:
+                Response(sky::CanTsFrame::CreateTelemetryAck(kClientAddress, node, channel, data));
+                break;
+            }
+            break;
+        case 2:
+            Request(sky::CanTsFrame::CreateSetBlockRequest(node, kClientAddress, 3, address));
+            Response(sky::CanTsFrame::CreateSetBlockAck(kClientAddress, node, 3, address));
+            Request(sky::CanTsFrame::CreateSetBlockTransfer(node, kClientAddress, 0, data));
+            if (random_() % 3) {
+                for (uint8_t sequence = 1; sequence < 4; sequence++)
+                    Request(sky::CanTsFrame::CreateSetBlockTransfer(node, kClientAddress, sequence, data));
+                Request(sky::CanTsFrame::CreateSetBlockStatus(node, kClientAddress));
+                Response(sky::CanTsFrame::CreateSetBlockReport(kClientAddress, node, true, {0x0f}));
+            }
+            // Client ends the transfer with abort also when all blocks were received.
+            Request(sky::CanTsFrame::CreateSetBlockAbort(node, kClientAddress));
+            Response(sky::CanTsFrame::CreateSetBlockAck(kClientAddress, node, 0, {}));
+            break;
+        case 3:
+            Request(sky::CanTsFrame::CreateGetBlockRequest(node, kClientAddress, 1, address));
+            Response(sky::CanTsFrame::CreateGetBlockAck(kClientAddress, node, 1, address));
+            Request(sky::CanTsFrame::CreateGetBlockStart(node, kClientAddress, {0x03}));
+            Response(sky::CanTsFrame::CreateGetBlockTransfer(kClientAddress, node, 0, data));
+            if (random_() % 3)
+                Response(sky::CanTsFrame::CreateGetBlockTransfer(kClientAddress, node, 1, data));
+            Request(sky::CanTsFrame::CreateGetBlockAbort(node, kClientAddress));
+            Response(sky::CanTsFrame::CreateGetBlockAck(kClientAddress, node, 0, {}));
+            break;
+        default:
+            Request(sky::CanTsFrame::CreateTimeSync(kClientAddress, {0x00, 0x00, 0x00, 0x00, 0x00, 0x00}));
+            break;
+        }
+
+        return ok_;
+    }
+
+private:
+    sky::CaptureWriter& writer_;
+    uint8_t bus_ = 0;
+    uint64_t time_;
+    std::mt19937 random_;
+    bool ok_ = true;
+
+    void Request(const sky::CanTsFrame& frame) {
+        Append(frame, sky::CaptureDirection::kTx);
+    }
+
+    void Response(const sky::CanTsFrame& frame) {
+        Append(frame, sky::CaptureDirection::kRx);
+    }
+
+    void Append(const sky::CanTsFrame& frame, sky::CaptureDirection direction) {
+        // See CAN_TS::ToCanFrame for CAN TS identifier layout.
+        sky::CanFrame can_frame;
+        can_frame.id = static_cast<uint32_t>(frame.command_) | static_cast<uint32_t>(frame.fromAddress_ << 10) |
+                       static_cast<uint32_t>(frame.type_ << 18) | static_cast<uint32_t>(frame.toAddress_ << 21);
+        can_frame.data = frame.data_;
+        can_frame.extid = true;
+        can_frame.rtr = false;
+
+        ok_ = writer_.Append(can_frame, bus_, direction, time_) && ok_;
+        time_ += 100000 + random_() % 50000;
+    }
+};
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+    Options options;
+
+    if (!ParseOptions(argc, argv, options)) {
+        std::fprintf(stderr, "Usage: %s <capture> [--sessions N] [--nodes N] [--buses N] [--seed N]\n"
+                             "       [--segment N]\n", argv[0]);
+        return 2;
+    }
+
+    sky::CaptureWriter writer;
+    sky::CaptureWriter::Settings settings;
+    settings.segment_records = options.segment_records;
+
+    if (!writer.Open(QString::fromLocal8Bit(options.capture.c_str()), settings)) {
+        std::fprintf(stderr, "Cannot open capture %s\n", options.capture.c_str());
+        return 1;
+    }
+
+    Generator generator(writer, sky::Trace::Now(), options.seed);
+    std::mt19937 random(options.seed + 1);
+
+    for (uint64_t i = 0; i < options.sessions; i++) {
+        auto bus = static_cast<uint8_t>(i % options.buses);
+        auto node = static_cast<uint8_t>(kFirstNodeAddress + random() % options.nodes);
+
+        if (!generator.Session(bus, node)) {
+            std::fprintf(stderr, "Cannot write capture %s\n", options.capture.c_str());
+            return 1;
+        }
+    }
+
+    uint64_t records = writer.GetRecordCount();
+    writer.Close();
+    std::printf("%llu records of %llu sessions written to %s\n", static_cast<unsigned long long>(records),
+                static_cast<unsigned long long>(options.sessions), options.capture.c_str());
+    return 0;
+}
@@ -0,0 +1,128 @@
+/* See the file "LICENSE.txt" for the full license governing this code. */
+
+// Converts binary trace dump (see sky::Trace::Dump) to text.
+//
+// Usage: tracedecode [--chrome] <dump> [output]
+//
+// Records of all threads are merged by timestamp. Times are printed
+// relative to the first record in the dump. With --chrome, output is
+// Chrome trace event JSON for Perfetto UI or chrome://tracing.
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <vector>
+#include "cantstrace.h"
+#include "cantstraceexport.h"
+
+namespace
+{
+
+struct Entry {
+    uint32_t thread;
+    const sky::TraceRecord* record;
+};
+
+bool IsFrameEvent(uint16_t event)
+{
+    switch (static_cast<sky::TraceEvent>(event)) {
+    case sky::TraceEvent::kFrameSend:
+    case sky::TraceEvent::kFrameSent:
+    case sky::TraceEvent::kFrameSendError:
+    case sky::TraceEvent::kFrameReceived:
+    case sky::TraceEvent::kTransferStart:
+    case sky::TraceEvent::kTransferComplete:
+    case sky::TraceEvent::kTransferFail:
+        return true;
+    default:
+        return false;
+    }
+}
+
+void PrintRecord(FILE* out, const Entry& entry, uint64_t t0)
+{
+    const sky::TraceRecord& r = *entry.record;
+    uint64_t dt = r.timestamp - t0;
+
+    std::fprintf(out, "%10" PRIu64 ".%06" PRIu64 " ms  T%-2u #%-6u %-16s",
+                 dt / 1000000, dt % 1000000, entry.thread, r.sequence, sky::Trace::EventName(r.event));
+
+    if (r.bus != sky::Trace::kNoBus)
+        std::fprintf(out, " bus=%u", r.bus);
+
+    if (IsFrameEvent(r.event)) {
+        // CAN TS identifier layout: to address, type, from address, command.
+        std::fprintf(out, " to=%02x type=%u from=%02x cmd=%03x",
+                     (r.id >> 21) & 0xFF, (r.id >> 18) & 0x07, (r.id >> 10) & 0xFF, r.id & 0x3FF);
+    } else if (r.id) {
+        std::fprintf(out, " id=%08x", r.id);
+    }
+
+    std::fprintf(out, " arg=%u", r.arg);
+
+    if (r.length) {
+        std::fprintf(out, " data=");
+        for (uint8_t i = 0; i < r.length && i < sizeof(r.data); i++)
+            std::fprintf(out, "%02x", r.data[i]);
+    }
+
+    std::fprintf(out, "\n");
+}
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+    bool chrome = (argc > 1) && !std::strcmp(argv[1], "--chrome");
+    int arg = chrome ? 2 : 1;
+
+    if ((argc < arg + 1) || (argc > arg + 2)) {
+        std::fprintf(stderr, "Usage: %s [--chrome] <dump> [output]\n", argv[0]);
+        return 2;
+    }
+
+    std::ifstream in(argv[arg], std::ios::binary);
+    std::vector<sky::TraceThread> threads;
+
+    if (!in || !sky::Trace::Load(in, threads)) {
+        std::fprintf(stderr, "Invalid trace dump %s\n", argv[arg]);
+        return 1;
+    }
+
+    if (chrome) {
+        bool ok = (argc == arg + 2) ? sky::ChromeTraceExport::Write(threads, std::string(argv[arg + 1]))
+                                    : sky::ChromeTraceExport::Write(threads, std::cout);
+        if (!ok)
+            std::fprintf(stderr, "Failed writing Chrome trace\n");
+
+        return ok ? 0 : 1;
+    }
+
+    FILE* out = (argc == arg + 2) ? std::fopen(argv[arg + 1], "w") : stdout;
+    if (!out) {
+        std::fprintf(stderr, "Cannot open %s\n", argv[arg + 1]);
+        return 1;
+    }
+
+    std::vector<Entry> entries;
+    for (const auto& thread : threads) {
+        for (const auto& record : thread.records)
+            entries.push_back({thread.index, &record});
+    }
+
+    std::stable_sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) {
+        return a.record->timestamp < b.record->timestamp;
+    });
+
+    uint64_t t0 = entries.empty() ? 0 : entries.front().record->timestamp;
+    for (const auto& entry : entries)
+        PrintRecord(out, entry, t0);
+
+    if (out != stdout)
+        std::fclose(out);
+
+    return 0;
+}
@@ -0,0 +1,19 @@
+# See the file "LICENSE.txt" for the full license governing this code.
+
+TARGET = tracedecode
+TEMPLATE = app
+
+CONFIG += c++14 strict_c++ warn_on console
+CONFIG -= qt app_bundle
+
+INCLUDEPATH += \
+        ../../include
+
+SOURCES += \
+        main.cpp \
+        ../../src/cantstrace.cpp \
+        ../../src/cantstraceexport.cpp
+
+HEADERS += \
+        ../../include/cantstrace.h \
+        ../../include/cantstraceexport.h